@@ -7,6 +7,7 @@
 //#include "Utility.h"
 #include "DataFormats.h"
 #include "Histogrammer.h"
+#include "ZScanAccumulator.h"
 
 class TH1;
 class AlignmentAnalysis : public BeamAnaBase {
@@ -15,7 +16,8 @@ class AlignmentAnalysis : public BeamAnaBase {
   ~AlignmentAnalysis();
   void beginJob();
   void eventLoop(); 
-  std::pair<float, float>  GetOffsetVsZ(const char*, float **, float**);
+  //straight line fit of the residual peak vs z; sigma and offset_err per z step
+  std::pair<float, float>  GetOffsetVsZ(const char* det, ZScanAccumulator& zScan, std::vector<float>& sigma, std::vector<float>& offset_err);
   void bookHistograms();
   void clearEvent();
   void endJob();
@@ -41,5 +43,7 @@ class AlignmentAnalysis : public BeamAnaBase {
   float zMin;
   float zStep;
   int zNsteps;
+  ZScanAccumulator zScanD0_;
+  ZScanAccumulator zScanD1_;
 };
 #endif
@@ -0,0 +1,70 @@
+#ifndef AlignmentChi2_h
+#define AlignmentChi2_h
+
+#include <vector>
+#include "DataFormats.h"
+
+// Chi2 of the DUT alignment computed on flat copies of the selected tracks and
+// DUT positions. Same residual definition and 3 sigma window as the
+// histogram+fit path of AlignmentMultiDimAnalysis, but the residual peak is
+// estimated with a coarse mode search refined by median/MAD, so nothing is
+// booked or fitted per call.
+class AlignmentChi2 {
+  public:
+    struct Peak {
+      double center;
+      double sigma;
+      unsigned int nCore;
+      bool valid;
+    };
+    //parameters: kOnePlane (offset, zDUT, theta), kTwoPlanes (offset_d0, zDUT_d0, offset_d1, zDUT_d1, theta),
+    //kTwoPlanesDeltaZ (offset_d0, zDUT_d0, deltaZ, theta)
+    enum Model { kOnePlane = 0, kTwoPlanes, kTwoPlanesDeltaZ };
+    struct FitResult {
+      double chi2;
+      unsigned int nIter;
+      unsigned int nCalls;
+      bool converged;
+    };
+    static unsigned int nPar(Model m) { return m == kOnePlane ? 3 : (m == kTwoPlanes ? 5 : 4); }
+    AlignmentChi2();
+    //one DUT plane, or two planes seen by the same tracks
+    void setData(double fei4Z, const std::vector<tbeam::Track>& tk, const std::vector<float>& xDUT0);
+    void setData(double fei4Z, const std::vector<tbeam::Track>& tk, const std::vector<float>& xDUT0,
+                 const std::vector<float>& xDUT1);
+    unsigned int size() const { return xTk_.size(); }
+    //residuals xDUT - xTkAtDUT of plane 0 or 1, same formula as Utility::extrapolateTrackAtDUTwithAngles
+    void residuals(unsigned int plane, double offset, double zDUT, double theta, std::vector<double>& res) const;
+    //both planes in one pass over the tracks
+    void residuals(double offset0, double zDUT0, double offset1, double zDUT1, double theta,
+                   std::vector<double>& res0, std::vector<double>& res1) const;
+    //chi2 per track in the 3 sigma window, 9999. if the peak is not found
+    double chi2(double offset, double zDUT, double theta) const;
+    //both planes, 99999. if one of the peaks is not found
+    double chi2(double offset0, double zDUT0, double offset1, double zDUT1, double theta) const;
+    Peak findPeak(const std::vector<double>& res) const;
+    //normalised residuals r/resTelescope of the tracks in the 3 sigma window(s) and, if jac is given,
+    //their derivatives wrt the nPar(m) parameters (row major). False if a peak is not found
+    bool windowedResiduals(Model m, const double* x, std::vector<double>& f, std::vector<double>* jac) const;
+    //chi2 of the model and its analytic gradient, the window being kept fixed at x
+    double chi2Gradient(Model m, const double* x, double* grad) const;
+    //Levenberg-Marquardt on the windowed residuals within the box [lo,hi], x is updated
+    FitResult fitLM(Model m, double* x, const double* lo, const double* hi, unsigned int maxIter = 200) const;
+    const Peak& lastPeak(unsigned int plane) const { return peak_[plane]; }
+    //tracks in the window(s) of the last chi2 call, 0 if a peak was not found
+    unsigned int lastWindowCount() const { return nWindow_; }
+
+  private:
+    double fei4Z_;
+    std::vector<double> xTk_;
+    std::vector<double> dxdz_;
+    std::vector<double> xDUT_[2];
+    mutable std::vector<double> res_[2];
+    mutable std::vector<double> scratch_;
+    mutable std::vector<unsigned int> bins_;
+    mutable std::vector<double> f_;
+    mutable std::vector<double> jac_;
+    mutable Peak peak_[2];
+    mutable unsigned int nWindow_;
+};
+#endif
@@ -0,0 +1,59 @@
+#ifndef AlignmentDB_h
+#define AlignmentDB_h
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "DataFormats.h"
+
+// Binary store of the alignment parameters, keyed by run and version. Every
+// fit of a run adds a version(1, 2, ...), so a reprocessing can ask for a
+// given alignment iteration or for the latest one. The file holds fixed size
+// records sorted by run and version: lookup() finds a run by a binary search
+// on the file without reading it all. importText() converts the text alignment
+// file, the lines of a run becoming its versions in the order of the file.
+class AlignmentDB {
+  public:
+    static const int kLatest = -1;
+    struct Entry {
+      int32_t run;
+      int32_t version;
+      int64_t time;//unix time of the entry
+      double offsetFEI4X;
+      double offsetFEI4Y;
+      double residualSigmaFEI4X;
+      double residualSigmaFEI4Y;
+      double zD0;
+      double offsetD0;
+      double deltaZ;
+      double angle;//deg
+      bool operator<(const Entry& o) const { return run != o.run ? run < o.run : version < o.version; }
+    };
+    AlignmentDB() {}
+    bool read(const std::string& file);
+    //sorted, through a temporary file renamed over file
+    bool write(const std::string& file) const;
+    //adds the parameters of a run as version(kLatest: one after the last version of the run), returns the version
+    int add(int run, const tbeam::alignmentPars& al, int version = kLatest);
+    //sets the alignment parameters of the run(not FEI4z), false if the run or the version is not there
+    bool find(int run, int version, tbeam::alignmentPars& al) const;
+    int latestVersion(int run) const;
+    //lines of the text alignment file, returns the number of entries added
+    int importText(const std::string& textFile);
+    const std::vector<Entry>& entries() const { return entries_; }
+    size_t size() const { return entries_.size(); }
+
+    static void toPars(const Entry& e, tbeam::alignmentPars& al);
+    //lookup on the file, O(log n) reads
+    static bool lookup(const std::string& file, int run, int version, tbeam::alignmentPars& al, int* foundVersion = nullptr);
+    //add() of runs to the file under the lock of the alignment file(a new file if it is not there),
+    //false if the file could not be updated. The versions given to the runs go to versions
+    static bool append(const std::string& file, const std::map<int, tbeam::alignmentPars>& pars, std::map<int, int>* versions = nullptr);
+    //as above for one run, returns the version or -1
+    static int append(const std::string& file, int run, const tbeam::alignmentPars& al);
+
+  private:
+    std::vector<Entry> entries_;//sorted
+};
+#endif
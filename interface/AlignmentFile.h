@@ -0,0 +1,28 @@
+#ifndef AlignmentFile_h
+#define AlignmentFile_h
+
+#include <map>
+#include <string>
+#include "DataFormats.h"
+
+// Updates of the text alignment file(one Run=...:key=value line per run, see
+// README). The file is rewritten as a whole: the new lines replace the lines of
+// the same runs, the result goes to a temporary file which is renamed over the
+// alignment file, all under an exclusive lock on <file>.lock. Jobs writing the
+// same file in parallel therefore never leave mixed or partial lines.
+namespace AlignmentFile {
+  //Run=:offsetFEI4X=:offsetFEI4Y=:residualSigmaFEI4X=:residualSigmaFEI4Y=:zD0=:offsetD0=:deltaZ=:angle= line
+  std::string line(int run, const tbeam::alignmentPars& al);
+  //run number of a line, -1 if the line has no Run=
+  int runOfLine(const std::string& line);
+  //sets the parameters found in a line, the others are left as they are
+  void parse(const std::string& line, tbeam::alignmentPars& al);
+  //parameters of the run closest to run(the lower one on a tie, the last line of a run), false if the file has no run
+  bool nearest(const std::string& file, int run, int& foundRun, tbeam::alignmentPars& al);
+  //exclusive lock on <file>.lock, -1 if it could not be taken
+  int lock(const std::string& file);
+  void unlock(int fd);
+  //lines by run; with keepOthers=false the file holds only the given lines afterwards
+  bool update(const std::string& file, const std::map<int, std::string>& lines, bool keepOthers = true);
+}
+#endif
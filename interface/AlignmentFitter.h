@@ -0,0 +1,38 @@
+#ifndef AlignmentFitter_h
+#define AlignmentFitter_h
+
+#include "AlignmentChi2.h"
+#include "AlignmentSample.h"
+#include "Minuit2/Minuit2Minimizer.h"
+
+// Alignment fit of one run from its AlignmentSample: both DUT planes with the
+// deltaZ constraint, minimised by Migrad on the fast chi2 with the start values
+// and limits of AlignmentMultiDimAnalysis(or from AlignmentGridScan). Every
+// fitter owns its Minuit2 minimizer and chi2 engine, so different runs can be
+// fitted on different threads.
+class AlignmentFitter {
+  public:
+    struct Result {
+      int run;
+      double offsetD0;
+      double zD0;
+      double deltaZ;
+      double theta;//rad
+      double chi2;
+      int status;
+      unsigned long nCalls;
+      double time;
+    };
+    explicit AlignmentFitter(bool gridSeed = false);
+    Result fit(const AlignmentSample& s);
+    //alignment parameters of the run for the alignment file
+    static tbeam::alignmentPars parameters(const AlignmentSample& s, const Result& r);
+
+  private:
+    double chi2(const double* x) const;
+    bool gridSeed_;
+    AlignmentChi2 both_;
+    mutable unsigned long nCalls_;
+    ROOT::Minuit2::Minuit2Minimizer minimizer_;
+};
+#endif
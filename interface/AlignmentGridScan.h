@@ -0,0 +1,60 @@
+#ifndef AlignmentGridScan_h
+#define AlignmentGridScan_h
+
+#include <vector>
+#include "AlignmentChi2.h"
+
+// Coarse grid of the fast alignment chi2, to seed the Minuit fits of
+// AlignmentMultiDimAnalysis with the global minimum. The grid runs over
+// zDUT x theta(x deltaZ for kTwoPlanesDeltaZ) x offset; for every (zDUT,theta)
+// cell the offset is centred on the residual peak of plane 0 at zero offset and
+// nOffset points around it are tried. The cells are shared by nThreads threads,
+// each with its own copy of the chi2 engine; the result does not depend on
+// the number of threads.
+class AlignmentGridScan {
+  public:
+    struct Axis {
+      double lo;
+      double step;
+      unsigned int n;
+      double at(unsigned int i) const { return lo + i*step; }
+    };
+    //parameters in the order of the model(AlignmentChi2::nPar)
+    struct Point {
+      double x[4];
+      double chi2;
+    };
+    //kOnePlane or kTwoPlanesDeltaZ
+    AlignmentGridScan(const AlignmentChi2& fc, AlignmentChi2::Model m);
+    //zDUT and deltaZ in mm, theta in rad; deltaZ is ignored for kOnePlane
+    void setAxes(const Axis& z, const Axis& theta, const Axis& deltaZ, unsigned int nOffset, double offsetStep);
+    //false if no grid point has a valid chi2
+    bool run(unsigned int nThreads);
+    const Point& best() const { return best_; }
+    unsigned int nPoints() const { return chi2_.size(); }
+    //minimum chi2 over the other parameters for each theta/deltaZ value of the axis, -1 if none
+    std::vector<double> profileTheta() const;
+    std::vector<double> profileDeltaZ() const;
+    const Axis& thetaAxis() const { return theta_; }
+    const Axis& deltaZAxis() const { return deltaZ_; }
+    double time() const { return time_; }
+
+  private:
+    void scanCell(const AlignmentChi2& fc, unsigned int cell, std::vector<double>& res);
+    unsigned int index(unsigned int iz, unsigned int it, unsigned int id, unsigned int io) const {
+      return ((iz*theta_.n + it)*deltaZ_.n + id)*nOffset_ + io;
+    }
+    const AlignmentChi2& fc_;
+    AlignmentChi2::Model model_;
+    Axis z_;
+    Axis theta_;
+    Axis deltaZ_;
+    unsigned int nOffset_;
+    double offsetStep_;
+    //per grid point, offsets of the cells
+    std::vector<double> chi2_;
+    std::vector<double> offset0_;
+    Point best_;
+    double time_;
+};
+#endif
@@ -9,6 +9,8 @@
 #include "Histogrammer.h"
 #include "Math/Functor.h"
 #include "Minuit2/Minuit2Minimizer.h"
+#include "AlignmentChi2.h"
+#include <memory>
 
 class TH1;
 class AlignmentMultiDimAnalysis : public BeamAnaBase {
@@ -16,12 +18,20 @@ class AlignmentMultiDimAnalysis : public BeamAnaBase {
   AlignmentMultiDimAnalysis();
   ~AlignmentMultiDimAnalysis();
   void beginJob();
+  std::vector<std::string> requiredBranches() const;
+  void beginRun();
   void eventLoop(); 
   void bookHistograms();
   void clearEvent();
   void endJob();
   double ComputeChi2(const double* x) const;
   double ComputeChi2BothPlanes(const double* x) const;
+  //histogram+fit evaluation, kept for alignmentChi2Mode=root|validate
+  double ComputeChi2Root(const double* x) const;
+  double ComputeChi2BothPlanesRoot(const double* x) const;
+  //analytic derivatives of the fast chi2, for ROOT::Math::GradFunctor
+  double ComputeChi2Derivative(const double* x, unsigned int icoord) const;
+  double ComputeChi2BothPlanesDerivative(const double* x, unsigned int icoord) const;
 
   static double FuncStepGaus(Double_t * x, Double_t * par){
     double xx = x[0];
@@ -37,11 +47,45 @@ class AlignmentMultiDimAnalysis : public BeamAnaBase {
   }
   void doTelescopeAnalysis(tbeam::alignmentPars& aLp);
  private:
+  struct FitVar {
+    std::string name;
+    double init;
+    double step;
+    double lo;
+    double hi;
+  };
+  //runs one alignment fit with the minimizer chosen by alignmentMinimizer, the result goes to x
+  void minimize(const std::string& fitName, ROOT::Minuit2::Minuit2Minimizer* m,
+                const ROOT::Math::Functor& f, const ROOT::Math::GradFunctor& fGrad,
+                AlignmentChi2::Model model, const std::vector<FitVar>& vars, double* x);
+  //start values of the fits from the grid scans of the fast chi2(alignmentGridScan=1)
+  void gridSeeds(double* d0, double* d1, double* bothPlanes, double* constraint);
+  //start values from the alignment of the nearest run in the alignment file(alignmentWarmStart=1),
+  //false if there is none. skipSinglePlane if the residual sigmas there are within warmStartSigmaTolerance
+  bool warmSeeds(double* d0, double* d1, double* bothPlanes, double* constraint, bool& skipSinglePlane);
+  const AlignmentChi2& fastChi2(AlignmentChi2::Model m) const;
+  double chi2Derivative(AlignmentChi2::Model m, const double* x, unsigned int icoord) const;
+  struct TrackFitHistos {
+    Hist1DHandle d0_1tk1ClusterBothPlanesConstraint_diffX_aligned;
+    Hist1DHandle d0_1tk1ClusterBothPlanes_diffX_aligned;
+    Hist1DHandle d0_1tk1Hit_diffX;
+    Hist1DHandle d0_1tk1Hit_diffX_aligned;
+    Hist1DHandle d0_1tk1Hit_diffX_bis;
+    Hist1DHandle d0_1tk1Hit_diffX_ter;
+    Hist1DHandle d1_1tk1ClusterBothPlanesConstraint_diffX_aligned;
+    Hist1DHandle d1_1tk1ClusterBothPlanes_diffX_aligned;
+    Hist1DHandle d1_1tk1Hit_diffX;
+    Hist1DHandle d1_1tk1Hit_diffX_aligned;
+    Hist1DHandle d1_1tk1Hit_diffX_bis;
+    Hist1DHandle d1_1tk1Hit_diffX_ter;
+  };
   std::string runNumber_;
   std::string outFile_;
   Histogrammer* hist_;
   unsigned long int nEntries_;
   bool isProduction_;
+  //runs of a runList after the first
+  bool keepOtherRuns_;
   std::string alignparFile_; 
   float zMin;
   float zStep;
@@ -56,15 +100,48 @@ class AlignmentMultiDimAnalysis : public BeamAnaBase {
   std::vector<float> bothPlanes_DutXposD0;
   std::vector<float> bothPlanes_DutXposD1;
  
-  ROOT::Math::Functor* toMinimize;
-  ROOT::Math::Functor* toMinimizeBothPlanes;
-  ROOT::Math::Functor* toMinimizeBothPlanesConstraint;
-  ROOT::Minuit2::Minuit2Minimizer* minimizer;
-  ROOT::Minuit2::Minuit2Minimizer* minimizerBothPlanes;
-  ROOT::Minuit2::Minuit2Minimizer* minimizerBothPlanesConstraint;
+  //created once in beginJob, cleared by minimize() before every fit of every run
+  std::unique_ptr<ROOT::Math::Functor> toMinimize;
+  std::unique_ptr<ROOT::Math::Functor> toMinimizeBothPlanes;
+  std::unique_ptr<ROOT::Math::Functor> toMinimizeBothPlanesConstraint;
+  std::unique_ptr<ROOT::Math::GradFunctor> toMinimizeGrad;
+  std::unique_ptr<ROOT::Math::GradFunctor> toMinimizeBothPlanesGrad;
+  std::unique_ptr<ROOT::Math::GradFunctor> toMinimizeBothPlanesConstraintGrad;
+  std::unique_ptr<ROOT::Minuit2::Minuit2Minimizer> minimizer;
+  std::unique_ptr<ROOT::Minuit2::Minuit2Minimizer> minimizerBothPlanes;
+  std::unique_ptr<ROOT::Minuit2::Minuit2Minimizer> minimizerBothPlanesConstraint;
 
   bool doConstrainDeltaOffset;
+  //alignmentChi2Mode=fast(default)|root|validate
+  enum Chi2Mode { kChi2Fast = 0, kChi2Root, kChi2Validate };
+  int chi2Mode_;
+  AlignmentChi2 fastD0_;
+  AlignmentChi2 fastD1_;
+  AlignmentChi2 fastBoth_;
+  //alignmentMinimizer=migrad(default)|gradient|lm|compare
+  enum MinimizerMode { kMigrad = 0, kMigradGradient, kLevenbergMarquardt, kCompareMinimizers };
+  int minimizerMode_;
+  mutable unsigned long nChi2Calls_;
+  mutable unsigned long nGradCalls_;
+  mutable std::vector<double> gradX_;
+  mutable std::vector<double> grad_;
+  bool gridScan_;
+  int gridThreads_;
+  //alignmentSampleFile=, alignmentSampleOnly=1 skips the fits
+  std::string sampleFileName() const;
+  std::string sampleFile_;
+  bool sampleOnly_;
+  //alignmentDB=, the result is added to it as a new version
+  std::string alignDB_;
+  bool warmStart_;
+  double warmSigmaTol_;
+  //offset step(mm) whose EDM is the Migrad stopping point of warm started runs
+  double warmTol_;
+  bool earlyStop_;
   tbeam::alignmentPars al;
+  Histogrammer::EventHistos evH_;
+  Histogrammer::TelescopeHistos tH_;
+  TrackFitHistos fitH_;
 };
 
 #endif
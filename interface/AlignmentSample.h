@@ -0,0 +1,37 @@
+#ifndef AlignmentSample_h
+#define AlignmentSample_h
+
+#include <string>
+#include <vector>
+#include "DataFormats.h"
+
+// Selected tracks and DUT hit positions of one run, the input of the DUT
+// alignment fits. alignmentReco writes it with alignmentSampleFile= so that the
+// fits of many runs can be redone by alignmentFitRuns without reading the
+// tuples again. Binary file: header, then for each sample the tracks(xPos, yPos,
+// dxdz, dydz) followed by the DUT positions of its plane(s).
+class AlignmentSample {
+  public:
+    AlignmentSample();
+    int run;
+    //FEI4 z and telescope-FEI4 alignment of the run, copied to the alignment file
+    double fei4Z;
+    double offsetFEI4X;
+    double offsetFEI4Y;
+    double residualSigmaFEI4X;
+    double residualSigmaFEI4Y;
+    //peak of the DUT residuals at the nominal z, start value of the offsets
+    double offsetInitD0;
+    double offsetInitD1;
+    //one track and one hit in d0/d1, one track and one cluster in both planes
+    std::vector<tbeam::Track> tkD0;
+    std::vector<float> xD0;
+    std::vector<tbeam::Track> tkD1;
+    std::vector<float> xD1;
+    std::vector<tbeam::Track> tkBoth;
+    std::vector<float> xBothD0;
+    std::vector<float> xBothD1;
+    bool write(const std::string& file) const;
+    bool read(const std::string& file);
+};
+#endif
@@ -14,7 +14,12 @@ class BaselineAnalysis : public BeamAnaBase {
   BaselineAnalysis();
   ~BaselineAnalysis();
   void beginJob();
+  std::vector<std::string> requiredBranches() const;
+  void beginRun();
   void eventLoop(); 
+  void processEntries(Long64_t first, Long64_t last);
+  BeamAnaBase* makeWorker() const;
+  void mergeWorker(BeamAnaBase& w);
   void bookHistograms();
   void printEfficiency();
   void clearEvent();
@@ -24,5 +29,49 @@ class BaselineAnalysis : public BeamAnaBase {
   //std::string outFile_;
   Histogrammer* hist_;
   unsigned long int nEntries_; 
+  //handles of the histograms filled per event
+  struct TrackMatchHistos {
+    Hist1DHandle nTrackParams;
+    Hist1DHandle nTrackParamsNodupl;
+    Hist1DHandle trkcluseff;
+    Hist1DHandle hposxTkDUT0;
+    Hist1DHandle hposxTkDUT1;
+    Hist1DHandle hminposClsDUT0;
+    Hist1DHandle hminposClsDUT1;
+    Hist1DHandle hminposStub;
+    Hist1DHandle minresidualDUT0_1trkfid;
+    Hist1DHandle minresidualDUT1_1trkfid;
+    Hist1DHandle clswidthDUT0_1trkfid;
+    Hist1DHandle clswidthDUT1_1trkfid;
+    Hist1DHandle sminresidualC0_1trkfid;
+    Hist2DHandle minclsTrkPoscorrD0;
+    Hist2DHandle minclsTrkPoscorrD1;
+    Hist2DHandle minstubTrkPoscorrD1_all;
+    Hist2DHandle minstubTrkPoscorrD1_matched;
+    Hist1DHandle effVtdc_num;
+    Hist1DHandle effVtdc_den;
+  };
+  Histogrammer::EventHistos evH_;
+  TrackMatchHistos tmH_;
+  //efficiency counters, summed over the workers of the event loop
+  struct EventCounters {
+    long int trkFid = 0;
+    long int det0clsMatch = 0;
+    long int det1clsMatch = 0;
+    long int clsMatchboth = 0;
+    long int clsMatchany = 0;
+    long int recostubMatchD1 = 0;
+  };
+  EventCounters cnt_;
+  //indices of the perf() cut-flow counters
+  struct CutFlow {
+    unsigned int good;
+    unsigned int onePixHit;
+    unsigned int clsMatchD0;
+    unsigned int clsMatchD1;
+    unsigned int clsMatchBoth;
+    unsigned int stubMatch;
+  };
+  CutFlow cf_;
 };
 #endif
@@ -17,6 +17,13 @@
 
 #include "DataFormats.h"
 #include "Histogrammer.h"
+#include "EventCache.h"
+#include "TrackDuplicateFilter.h"
+#include "Fei4HitIndex.h"
+#include "Utility.h"
+#include "TreeIOStats.h"
+#include "EventReadAhead.h"
+#include "PerfCounters.h"
 using std::cout;
 using std::endl;
 using std::string;
@@ -29,11 +36,26 @@ class BeamAnaBase {
     BeamAnaBase();
     virtual ~BeamAnaBase();
     bool setInputFile(const std::string& fname);
+    void setFileNames(const std::string& iFile, const std::string& oFile);
     bool branchFound(const string& b);
     void setAddresses();
+    //branches read by the analysis, "B" for a whole branch or "B.s" for a sub-branch of B;
+    //the others are disabled. Empty(default) reads everything
+    virtual std::vector<std::string> requiredBranches() const { return std::vector<std::string>(); }
+    //reads an entry of the enabled branches, to be used in the event loops. With
+    //readAheadSlots>0 the entries are read ahead on another thread and the event
+    //pointers(dutEv() etc.) change from entry to entry
+    Long64_t readEntry(Long64_t jentry);
+    //stops the read-ahead, the event pointers are the own objects again
+    void stopReadAhead();
+    //to be called before setAddresses, e.g. by analyses sharing the branch addresses
+    void setReadAheadSlots(unsigned int n) { readAheadSlots_ = n; }
     void setDetChannelVectors();
     TTree* analysisTree() const{ return analysisTree_; } 
     tbeam::dutEvent* dutEv() const { return dutEv_; }
+    //set instead of dutEv() for trees written by flatConverter
+    tbeam::dutFlatEvent* dutFlatEv() const { return dutFlatEv_; }
+    bool hasFlatDUT() const { return hasDUTFlat_; }
     tbeam::condEvent* condEv() const {return condEv_;}
     tbeam::TelescopeEvent* telEv() const { return telEv_; }
     tbeam::FeIFourEvent* fei4Ev() const { return fei4Ev_; }
@@ -70,7 +92,11 @@ class BeamAnaBase {
     virtual void clearEvent();
     virtual bool readJob(const std::string jfile);
     void getCbcConfig(uint32_t cwdWord, uint32_t windowWord);
+    //tracks left by the duplicate removal and the FEI4 residual cut
+    void getFei4MatchedTracks(std::vector<tbeam::Track>& selectedTk);
+    //same, extrapolated to the DUT planes and within the fiducial region
     void getExtrapolatedTracks(std::vector<tbeam::Track>& fidTkColl);
+    unsigned int nFei4MatchedTracks() const { return tkSelected_.size(); }
     void readChannelMaskData(const std::string cmaskF);
     void setTelMatching(const bool mtel);
     void setChannelMasking(const std::string cFile);
@@ -81,16 +107,61 @@ class BeamAnaBase {
     tbeam::alignmentPars aLparameteres() const { return alPars_; }
     bool isTrkfiducial(const double xtrk0Pos, const double xtrk1Pos, const double ytrk0Pos, const double ytrk1Pos);
     Histogrammer* outFile() { return hout_; }
+    //closeFile of outFile(), timed with the other stages
+    void closeOutput();
+    //stage timing and cut flow(perfStats=1), written to the Perf directory at endJob
+    PerfCounters& perf() { return perf_; }
     void fillCommonHistograms();
     std::map<std::string,std::string> jobCardmap() const { return jobCardmap_;}
+
+    //Parallel event loop. runEventLoop splits [0,nEntries) in contiguous ranges over
+    //nThreads() workers made by makeWorker(); each worker owns its input file, event
+    //buffers and an in-memory histogram replica which is added to outFile() after the pass.
+    void runEventLoop(Long64_t nEntries);
+    //the default is a serial loop filling the common histograms
+    virtual void processEntries(Long64_t first, Long64_t last);
+    virtual BeamAnaBase* makeWorker() const { return nullptr; }
+    //copy the per-pass state to a worker before the pass
+    virtual void syncWorker(BeamAnaBase& w) {}
+    //collect the counters of a worker after the pass
+    virtual void mergeWorker(BeamAnaBase& w) {}
+    void setNumberOfThreads(int n) { nThreads_ = n; }
+    int nThreads() const { return nThreads_;}
+    bool isWorker() const { return isWorker_;}
+
+    //in-memory copy of the events read, so that later passes need no ROOT I/O;
+    //beyond eventCacheMaxMB the later passes read the tree again
+    EventCache& eventCache() { return evCache_; }
+    bool useEventCache() const { return useEventCache_;}
+    void cacheEvent(bool withDUT);
+
+    //Multi-run jobs (runList= in the job card). Each run is read through its own
+    //TChain; nextRun() writes the histograms of the current run to its output
+    //file, resets them and moves to the next run, then calls beginRun().
+    bool nextRun();
+    virtual void beginRun() {}
+    int nRuns() const { return runList_.size(); }
+    int runNumber() const { return runList_.empty() ? -1 : runList_[currentRun_].run; }
+    bool isFirstRun() const { return currentRun_ == 0; }
     
   private :
+    static void enableRootThreads();
+    void createWorkers();
+    void setDetChannelVectorsFlat();
+    tbeam::stub& nextRecoStub(std::vector<tbeam::stub>& stubs);
+    bool readAlignmentForRun(const std::string& alignParfile, int run, tbeam::alignmentPars& al);
+    //version AlignmentDB::kLatest(-1) is the last one of the run
+    bool readAlignmentFromDB(const std::string& dbFile, int run, int version, tbeam::alignmentPars& al);
+    void initWorker(const BeamAnaBase& master, int id);
     std::string iFilename_;
     std::string outFilename_;
     std::string chmaskFilename_;
     TFile* fin_;
+    TChain* chain_;
     TTree *analysisTree_; 
     tbeam::dutEvent* dutEv_;
+    tbeam::dutFlatEvent* dutFlatEv_;
+    bool hasDUTFlat_;
     tbeam::condEvent* condEv_;
     tbeam::TelescopeEvent* telEv_;
     tbeam::FeIFourEvent* fei4Ev_;
@@ -109,15 +180,35 @@ class BeamAnaBase {
     vector<int>* dut1_chtempC1_;
     std::map<std::string,std::vector<tbeam::cluster> >* dutRecoClmap_;
     std::map<std::string,std::vector<tbeam::stub> >* dutRecoStubmap_;
+    //stubs of the previous events kept with their clusters, reused by nextRecoStub
+    std::vector<tbeam::stub> stubPool_;
     std::map<std::string,std::vector<unsigned int>>* recostubChipids_;
     std::map<std::string,std::vector<unsigned int>>* cbcstubChipids_;
     std::map<int,std::vector<int>>  cbcMaskedChannelsMap_;
     std::map<std::string,std::vector<int> >* dut_maskedChannels_;
+    Utility::ChannelMask dutChannelMask_[2];//det0, det1
     int nStubsrecoSword_;
     int nStubscbcSword_;
     tbeam::alignmentPars  alPars_;
     std::map<std::string,std::string> jobCardmap_;
     Histogrammer* hout_;
+    //handles for fillCommonHistograms, resolved in bookHistograms
+    struct CommonHistos {
+      Histogrammer::DUTHistos det0;
+      Histogrammer::DUTHistos det1;
+      Hist1DHandle corHitC0;
+      Hist1DHandle nclusterdiffC0;
+      Hist1DHandle nstubRecoC0;
+      Hist1DHandle nstubsFromReco;
+      Hist1DHandle nstubsFromCBCSword;
+      Hist1DHandle nstubsFromRecoSword;
+      Hist1DHandle recoStubWord;
+      Hist1DHandle cbcStubWord;
+      Hist1DHandle stubMatch;
+      Hist1DHandle nstubsdiffSword;
+      Hist1DHandle nstubsdiff;
+    };
+    CommonHistos ch_;
     double residualSigmaDUT_;
     double residualSigmaFEI4x_;
     double residualSigmaFEI4y_;
@@ -126,5 +217,46 @@ class BeamAnaBase {
 
     int nStrips_;
     double pitchDUT_;
+
+    int nThreads_;
+    bool isWorker_;
+    int workerId_;
+    std::vector<BeamAnaBase*> workers_;
+    bool useEventCache_;
+    int eventCacheMaxMB_;
+    EventCache evCache_;
+    //branch pruning, TTreeCache and I/O accounting of analysisTree
+    bool pruneBranches_;
+    double treeCacheMB_;
+    bool ioStats_;
+    TreeIOStats io_;
+    unsigned int readAheadSlots_;
+    EventReadAhead* readAhead_;
+    PerfCounters perf_;
+    //counters of the runs of a runList already written
+    PerfCounters jobPerf_;
+    unsigned int cfTracks_;
+    unsigned int cfFei4Matched_;
+    unsigned int cfFiducial_;
+    void collectWorkerStats();
+    //histograms and perf counters of the current run to its output file
+    void writeRunOutput();
+    struct RunInput {
+      int run;
+      std::string files;
+      std::string outFile;
+      tbeam::alignmentPars alPars;
+    };
+    std::vector<RunInput> runList_;
+    int currentRun_;
+    //flat track buffers of getExtrapolatedTracks
+    TrackDuplicateFilter tkFilter_;
+    TrackDuplicateFilter::Tracks tkNoOv_;
+    Fei4HitIndex fei4Hits_;
+    std::vector<unsigned int> tkSelected_;
+    std::vector<double> tkXBuf_;
+    std::vector<double> tkDxdzBuf_;
+    std::vector<double> xTkDut0Buf_;
+    std::vector<double> xTkDut1Buf_;
 };
 #endif
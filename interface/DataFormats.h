@@ -84,6 +84,12 @@ namespace tbeam {
    public:
      stub();
      stub(const tbeam::stub& t);
+     //noexcept, so that std::vector growth moves stubs instead of copying their clusters
+     stub(tbeam::stub&& t) noexcept;//takes over the clusters of t
+     ~stub();
+     //copies the content into the clusters already owned, no allocation
+     tbeam::stub& operator=(const tbeam::stub& t);
+     tbeam::stub& operator=(tbeam::stub&& t) noexcept;
      tbeam::cluster * seeding;  // Bottom sensor cluster
      tbeam::cluster * matched;  // Top sensor cluster
      uint16_t x;        // Position of the stub (bottom sensor)
@@ -115,6 +121,41 @@ namespace tbeam {
      //bool isGood;
      ClassDef(dutEvent,1)
   };
+  //Flat replacement of dutEvent. Hits, clusters and stubs are kept in contiguous
+  //columns ordered by plane (det0C0, det0C1, det1C0, det1C1); xxxOff[p] is the first
+  //element of plane p and xxxOff[p+1] one past its last. As in the analysis maps,
+  //hit and cluster positions of column 1 are shifted by -1016 while stubs keep the
+  //raw position and are split in C0/C1 only.
+  class dutFlatEvent : public TObject {
+   public:
+     enum { kC0 = 0, kC1 = 1, kNPlanes = 4 };
+     static unsigned int plane(unsigned int det, unsigned int col) { return 2*det + col; }
+     dutFlatEvent();
+     virtual ~dutFlatEvent(){}
+     void clear();
+     void fill(const tbeam::dutEvent& ev);
+     unsigned int nHits(unsigned int p) const { return hitOff[p+1] - hitOff[p]; }
+     const int* hits(unsigned int p) const { return hitCh.data() + hitOff[p]; }
+     unsigned int nClusters(unsigned int p) const { return clsOff[p+1] - clsOff[p]; }
+     unsigned int clusterBegin(unsigned int p) const { return clsOff[p]; }
+     unsigned int nStubs(unsigned int col) const { return stubOff[col+1] - stubOff[col]; }
+     unsigned int stubBegin(unsigned int col) const { return stubOff[col]; }
+     UInt_t hitOff[5];
+     UInt_t clsOff[5];
+     UInt_t stubOff[3];
+     std::vector<int> hitCh;
+     std::vector<uint16_t> clsX;
+     std::vector<float> clsFx;
+     std::vector<uint16_t> clsSize;
+     std::vector<uint16_t> stubX;
+     std::vector<float> stubFx;
+     std::vector<int16_t> stubDir;
+     std::vector<uint16_t> stubSeedX;
+     std::vector<uint16_t> stubMatchedX;
+     uint32_t stubWord;
+     uint32_t stubWordReco;
+     ClassDef(dutFlatEvent,1)
+  };
   class condEvent : public TObject {
    public:
     unsigned int run;
@@ -14,14 +14,24 @@ class DeltaClusterAnalysis : public BeamAnaBase {
   DeltaClusterAnalysis(const string inFilename,const string outFilename);
   ~DeltaClusterAnalysis();
   void beginJob();
+  std::vector<std::string> requiredBranches() const;
   void eventLoop(); 
+  void processEntries(Long64_t first, Long64_t last);
+  BeamAnaBase* makeWorker() const;
   void bookHistograms();
   void clearEvent();
   void endJob();
 
  private:
+  DeltaClusterAnalysis();
   std::string outFile_;
   Histogrammer* hist_;
   unsigned long int nEntries_; 
+  Histogrammer::EventHistos evH_;
+  Histogrammer::DUTHistos det0H_;
+  Histogrammer::DUTHistos det1H_;
+  Hist2DHandle nclsCorrelation_;
+  Hist1DHandle evtsW1cls_;
+  Hist1DHandle nclusterdiffC0_;
 };
 #endif
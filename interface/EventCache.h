@@ -0,0 +1,119 @@
+#ifndef EventCache_h
+#define EventCache_h
+
+#include <vector>
+#include <stdint.h>
+#include "DataFormats.h"
+#include "TrackDuplicateFilter.h"
+
+// Flat in-memory copy of the event content used by the multi-pass analyses.
+// Every entry read is added, the last one stays readable until the next
+// addEvent; it is kept for the later passes only if addEvent was asked to keep
+// it, so cached event i is entry event(i).entry. Variable length content is
+// kept in flat columns indexed through per-event offsets. Beyond maxMemory()
+// the cache is emptied, stops keeping events and no longer covers its range:
+// the later passes read the tree again.
+class EventCache {
+  public:
+    // View of one cached event. The pointers refer to the cache columns and
+    // stay valid until the next addEvent/addDUT/clear.
+    struct Event {
+      Long64_t entry;
+      bool isGood;
+      bool isPeriodic;
+      int condData;
+      unsigned int tdcPhase;
+      int nPixHits;
+      int nTrackParams;
+      unsigned int nRawTracks;//before duplicate removal
+      //FEI4 hits
+      unsigned int nFei4;
+      const int* row;
+      const int* col;
+      //telescope tracks after duplicate removal, none for events without FEI4 hits
+      unsigned int nTk;
+      const double* tkX;
+      const double* tkY;
+      const float* tkDxdz;
+      const float* tkDydz;
+      //DUT hits and clusters of column 0, only if cached with DUT content
+      bool hasDUT;
+      unsigned int nHitD0;
+      unsigned int nHitD1;
+      const int* hitD0;
+      const int* hitD1;
+      unsigned int nClsD0;
+      unsigned int nClsD1;
+      const uint16_t* clsXD0;
+      const uint16_t* clsXD1;
+      const uint16_t* clsSizeD0;
+      const uint16_t* clsSizeD1;
+      //index i in the event, chi2 and ndof are not cached(0)
+      tbeam::Track track(unsigned int i) const;
+    };
+
+    EventCache();
+    void clear(Long64_t firstEntry);
+    //adds the next entry; the previous one is dropped if it was not to be kept
+    void addEvent(bool keep, bool isGood, bool isPeriodic, const tbeam::condEvent& cond,
+                  const tbeam::FeIFourEvent& fei4, const tbeam::TelescopeEvent& tel);
+    //adds the DUT content to the last event added
+    void addDUT(const std::vector<int>& hitD0, const std::vector<int>& hitD1,
+                const std::vector<tbeam::cluster>& clsD0, const std::vector<tbeam::cluster>& clsD1);
+    Long64_t firstEntry() const { return first_; }
+    //events kept
+    Long64_t size() const { return isGood_.size() - (keepLast_ ? 0 : 1); }
+    bool covers(Long64_t first, Long64_t last) const { return !full_ && first == first_ && last == next_; }
+    //i-th cached event
+    Event event(Long64_t i) const;
+    //last event added, also if it is not kept
+    Event last() const { return event(isGood_.size() - 1); }
+    const tbeam::condEvent& firstCondition() const { return firstCond_; }
+    void setMaxMemory(std::size_t bytes) { maxMemory_ = bytes; }
+    std::size_t maxMemory() const { return maxMemory_; }
+    bool full() const { return full_; }
+    std::size_t memoryUsage() const;
+
+  private:
+    void dropLast();
+    void release();
+    Long64_t first_;
+    Long64_t next_;
+    bool keepLast_;
+    bool full_;
+    std::size_t maxMemory_;
+    tbeam::condEvent firstCond_;
+    TrackDuplicateFilter tkFilter_;
+    TrackDuplicateFilter::Tracks tkBuf_;
+    //per event
+    std::vector<unsigned int> entry_;//entry - firstEntry()
+    std::vector<char> isGood_;
+    std::vector<char> isPeriodic_;
+    std::vector<char> hasDUT_;
+    std::vector<int> condData_;
+    std::vector<unsigned int> tdcPhase_;
+    std::vector<int> nPixHits_;
+    std::vector<int> nTrackParams_;
+    std::vector<unsigned int> nRawTracks_;
+    //offsets into the columns, one more than the number of events
+    std::vector<unsigned int> fei4Off_;
+    std::vector<unsigned int> tkOff_;
+    std::vector<unsigned int> hitD0Off_;
+    std::vector<unsigned int> hitD1Off_;
+    std::vector<unsigned int> clsD0Off_;
+    std::vector<unsigned int> clsD1Off_;
+    //columns
+    std::vector<int> row_;
+    std::vector<int> col_;
+    std::vector<double> tkX_;
+    std::vector<double> tkY_;
+    std::vector<float> tkDxdz_;
+    std::vector<float> tkDydz_;
+    std::vector<int> hitD0_;
+    std::vector<int> hitD1_;
+    std::vector<uint16_t> clsXD0_;
+    std::vector<uint16_t> clsXD1_;
+    std::vector<uint16_t> clsSizeD0_;
+    std::vector<uint16_t> clsSizeD1_;
+};
+#endif
@@ -0,0 +1,74 @@
+#ifndef EventReadAhead_h
+#define EventReadAhead_h
+
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "DataFormats.h"
+
+// Read-ahead of analysisTree on a thread of its own. The reader fills a bounded
+// ring of event slots, each with its own pre-allocated event objects, in entry
+// order while the analysis thread consumes them; a slot goes back to the reader
+// when the analysis asks for the next entry. The branch addresses are bound once
+// to the pointers of branchBuffers(), which the reader points to the slot being
+// filled (ROOT follows a changed object pointer on the next GetEntry).
+class EventReadAhead {
+  public:
+    struct Event {
+      tbeam::dutEvent* dut;
+      tbeam::dutFlatEvent* dutFlat;
+      tbeam::condEvent* cond;
+      tbeam::TelescopeEvent* tel;
+      tbeam::FeIFourEvent* fei4;
+      bool periodic;
+      bool good;
+    };
+    //reads entry i into the bound buffers, returns the bytes read or <0
+    typedef std::function<Long64_t(Long64_t)> ReadFunction;
+    //own are the event objects used outside the read-ahead(e.g. GetEntry(0) in beginJob)
+    EventReadAhead(unsigned int nSlots, const Event& own);
+    ~EventReadAhead();
+    Event* branchBuffers() { return &bound_; }
+    const Event& ownBuffers() const { return own_; }
+    //reads [first,last) ahead of the consumer
+    void start(ReadFunction read, Long64_t first, Long64_t last);
+    //stops the reader, the bound buffers point to the own objects again
+    void stop();
+    bool running() const { return running_; }
+    Long64_t nextEntry() const { return next_; }
+    //event of entry jentry, which must be nextEntry(); nullptr at the end or on a read error
+    const Event* next(Long64_t jentry, Long64_t& nbytes);
+    void add(const EventReadAhead& o);
+    void print(std::ostream& out) const;
+
+  private:
+    struct Slot {
+      Event ev;
+      Long64_t entry;
+      Long64_t nbytes;
+    };
+    void run(ReadFunction read, Long64_t first, Long64_t last);
+    std::vector<Slot> slots_;
+    Event own_;
+    Event bound_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool running_;
+    bool stop_;
+    bool done_;
+    bool holding_;
+    unsigned int nFilled_;
+    unsigned int writeIdx_;
+    unsigned int readIdx_;
+    Long64_t next_;
+    //time spent waiting, by the reader for a free slot and by the analysis for an event
+    double readerStall_;
+    double consumerStall_;
+    double readerBusy_;
+    Long64_t nRead_;
+};
+#endif
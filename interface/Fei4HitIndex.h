@@ -0,0 +1,37 @@
+#ifndef Fei4HitIndex_h
+#define Fei4HitIndex_h
+
+#include <vector>
+
+// Per-event index of the FEI4 pixel hits for the track to hit matching. The
+// hits are bucketed by column and sorted by row, so the nearest hit to a track
+// is found by walking outwards from the track position on the fixed
+// 0.05 x 0.25 mm pitch grid, with squared distances only. Ties go to the lowest
+// hit index, the choice of the plain loop over the hits.
+class Fei4HitIndex {
+  public:
+    struct Match {
+      int hit;//-1 if there are no hits
+      double xres;
+      double yres;
+      double dist2;
+    };
+    //default pitch and dimensions of the fei4 plane
+    static double xPos(int row) { return 8.375 - (row-1)*0.05; }
+    static double yPos(int col) { return 9.875 - (col-1)*0.250; }
+
+    void build(const int* row, const int* col, unsigned int nHits);
+    void build(const std::vector<int>& row, const std::vector<int>& col);
+    unsigned int size() const { return row_.size(); }
+    //hit with the smallest residual xPos-tkX-xResMean, yPos-tkY-yResMean
+    Match nearest(double tkX, double tkY, double xResMean = 0., double yResMean = 0.) const;
+
+  private:
+    //hits sorted by (col,row,index), colBegin_ indexes the first hit of each distinct column
+    std::vector<int> row_;
+    std::vector<int> index_;
+    std::vector<int> colVal_;
+    std::vector<unsigned int> colBegin_;
+    std::vector<unsigned int> order_;
+};
+#endif
@@ -0,0 +1,38 @@
+#ifndef Fei4PairBuffer_h
+#define Fei4PairBuffer_h
+
+#include <vector>
+#include "EventCache.h"
+
+// Track to FEI4 hit residual candidates of the events read, for the residual
+// fits of TelescopeAnalysis that follow the first pass. For every entry the
+// residuals xPos-tkX, yPos-tkY of all (track, hit) pairs are kept in flat
+// columns, so the closest pair for new mean residuals is found without going
+// back to the tree. Entries the analysis does not use keep a flag and no pairs.
+class Fei4PairBuffer {
+  public:
+    enum Flag { Skipped = 0, Matched = 1, Fitted = 2 };
+    Fei4PairBuffer();
+    void clear(Long64_t firstEntry);
+    //all the pairs of the event with the given flag
+    void addEvent(const EventCache::Event& ev, Flag f);
+    void skipEvent() { addEvent(Flag(Skipped)); }
+    Long64_t firstEntry() const { return first_; }
+    Long64_t size() const { return flag_.size(); }
+    bool covers(Long64_t first, Long64_t last) const { return size() > 0 && first == first_ && last - first == size(); }
+    Flag flag(Long64_t jentry) const { return Flag(flag_[jentry - first_]); }
+    //residuals of the pair closest to (xResMean, yResMean), same pair as Fei4HitIndex::nearest
+    //over the tracks in order; false, with xres/yres left as they are, if no pair is within 999.9
+    bool closest(Long64_t jentry, double xResMean, double yResMean, double& xres, double& yres) const;
+    std::size_t memoryUsage() const;
+
+  private:
+    void addEvent(Flag f);
+    Long64_t first_;
+    std::vector<char> flag_;
+    //offsets into the columns, one more than the number of entries
+    std::vector<unsigned int> pairOff_;
+    std::vector<double> xres_;
+    std::vector<double> yres_;
+};
+#endif
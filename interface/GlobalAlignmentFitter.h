@@ -0,0 +1,65 @@
+#ifndef GlobalAlignmentFitter_h
+#define GlobalAlignmentFitter_h
+
+#include <vector>
+#include "AlignmentChi2.h"
+#include "AlignmentSample.h"
+#include "AlignmentFitter.h"
+
+// Alignment fit of a set of runs taken with the same mechanics: the distance
+// of DUT plane d0 from the FEI4(zD0 - fei4Z) and deltaZ are shared by all the
+// runs, offset_d0 and theta are fitted per run. One Migrad fit of the 2 + 2N
+// parameters minimises the chi2 per track in the residual windows of all the
+// runs, 99999. if a peak of one run is not found. The chi2 of a run is
+// only recomputed when one of its parameters changed since the last call, and
+// the runs to recompute are spread over the threads, each on the flat chi2
+// buffers kept by addRun(). The start geometry is the fit of the run with the
+// most tracks, the start offset_d0 and theta of every run their fit at that
+// geometry.
+class GlobalAlignmentFitter {
+  public:
+    struct Result {
+      double zFromFEI4;//zD0 - fei4Z
+      double deltaZ;
+      double chi2;//per track in the windows, all the runs
+      int status;
+      unsigned long nCalls;//chi2 calls of the global fit
+      unsigned long nRunEvals;//chi2 evaluations of single runs
+      double time;
+      //zD0, deltaZ, offset_d0, theta of every run, in the order of addRun()
+      std::vector<AlignmentFitter::Result> runs;
+    };
+    explicit GlobalAlignmentFitter(unsigned int nThreads, bool gridSeed = false);
+    //the tracks of the sample are copied to the flat buffers of the run
+    void addRun(const AlignmentSample& s);
+    unsigned int nRuns() const { return runs_.size(); }
+    Result fit();
+    //alignment parameters of run i(order of addRun()) for the alignment file
+    tbeam::alignmentPars parameters(unsigned int i, const Result& r) const;
+
+  private:
+    struct RunData {
+      AlignmentSample header;//without the tracks
+      AlignmentChi2 both;
+      double offset;//start values
+      double theta;
+      //parameters of the last chi2 evaluation, the chi2 is kept until one of them changes
+      bool evaluated;
+      double lastPars[4];//zD0, deltaZ, offset_d0, theta
+      double chi2;
+      unsigned int nWindow;//tracks in the windows at lastPars
+    };
+    double totalChi2(const double* x);
+    //fits of(offset_d0, theta) of every run at the given geometry, for the start values
+    void fitRuns(double zFromFEI4, double deltaZ);
+    //runs the jobs 0..n-1 on the threads
+    template<class F> void parallel(unsigned int n, F job) const;
+    unsigned int nThreads_;
+    bool gridSeed_;
+    std::vector<RunData> runs_;
+    AlignmentSample bestSample_;//run with the most tracks, for the start values
+    unsigned long nCalls_;
+    unsigned long nRunEvals_;
+    std::vector<unsigned int> changed_;
+};
+#endif
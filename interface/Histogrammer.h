@@ -8,9 +8,77 @@
 #include "DataFormats.h"
 #include<string>
 #include<vector>
+#include<map>
+
+// Typed handle to a booked histogram. Handles are resolved once from the
+// registry after booking; filling through a handle needs no directory switch,
+// name lookup or cast, so it is the one to use inside the event loop.
+template <class H>
+class HistHandle {
+  public:
+    HistHandle() : h_(nullptr) {}
+    explicit HistHandle(H* h) : h_(h) {}
+    H* get() const { return h_; }
+    bool isValid() const { return h_ != nullptr; }
+  private:
+    H* h_;
+};
+typedef HistHandle<TH1> Hist1DHandle;
+typedef HistHandle<TH2> Hist2DHandle;
+typedef HistHandle<TProfile> HistProfileHandle;
+
 class Histogrammer {
   public:
+    //handles of the per-column cluster histograms booked by bookDUTHistoForColumn
+    struct ClusterHistos {
+      Hist1DHandle ncluster;
+      Hist1DHandle clusterWidth;
+      Hist1DHandle clusterPos;
+      HistProfileHandle clusterWidthVsPosProf;
+      Hist2DHandle clusterWidthVsPos2D;
+    };
+    //handles of the per-detector histograms booked by bookDUTHistograms
+    struct DUTHistos {
+      Hist1DHandle chsize;
+      Hist1DHandle hitmap;
+      Hist2DHandle hitmapfull;
+      Hist2DHandle nhitvsnclus;
+      Hist2DHandle nhitvsHitClusPosDiff;
+      Hist2DHandle propertyVsTDC2D;
+      ClusterHistos clusters;
+    };
+    //handles of the per-event histograms booked by bookEventHistograms
+    struct EventHistos {
+      Hist1DHandle isPeriodic;
+      Hist1DHandle isGoodFlag;
+      Hist1DHandle condData;
+      Hist1DHandle tdcPhase;
+    };
+    //handles of the track and FEI4 histograms booked by bookTelescopeAnalysisHistograms
+    struct TelescopeHistos {
+      Hist1DHandle HtColumn;
+      Hist1DHandle HtRow;
+      Hist1DHandle HtXPos;
+      Hist1DHandle HtYPos;
+      Hist1DHandle TkXPos;
+      Hist1DHandle TkYPos;
+      Hist1DHandle deltaXPos;
+      Hist1DHandle deltaXPos_fit;
+      Hist1DHandle deltaXPos_trkfei4;
+      Hist1DHandle deltaXPos_trkfei4M;
+      Hist1DHandle deltaYPos;
+      Hist1DHandle deltaYPos_fit;
+      Hist1DHandle deltaYPos_trkfei4;
+      Hist1DHandle deltaYPos_trkfei4M;
+      Hist1DHandle nTrack;
+      Hist1DHandle nhitsFei4;
+      Hist2DHandle tkXPosVsHtXPos;
+      Hist2DHandle tkYPosVsHtYPos;
+    };
+
     Histogrammer(std::string& outFile);
+    //in-memory Histogrammer, used as per-thread replica by the parallel event loop
+    Histogrammer(const std::string& name, bool inMemory);
     virtual ~Histogrammer();
     void bookEventHistograms();
     void bookDUTHistograms(std::string det);
@@ -26,6 +94,21 @@ class Histogrammer {
     TH1* GetHistoByName(const std::string& dir, const std::string& hname);
     void FillAlignmentOffsetVsZ(const char*, const char*, int, float, float, float);
 
+    //registry access, resolve once after booking and keep the handle
+    void registerHistograms(const std::string& dir);
+    Hist1DHandle hist1D(const std::string& dir, const std::string& hname) const;
+    Hist2DHandle hist2D(const std::string& dir, const std::string& hname) const;
+    HistProfileHandle histProfile(const std::string& dir, const std::string& hname) const;
+    ClusterHistos clusterHistos(const std::string& det, const std::string& col) const;
+    DUTHistos dutHistos(const std::string& det, const std::string& col) const;
+    EventHistos eventHistos() const;
+    TelescopeHistos telescopeHistos() const;
+    //add the registered histograms of a replica booked identically
+    void addHistograms(const Histogrammer& replica);
+    void resetHistograms();
+    //write the registered histograms, in their directories, to a new file
+    void writeHistograms(const std::string& fname);
+
 
     template <class T>
     void fillHist1D(const char* dir, const char* histo, T val) {
@@ -46,6 +129,19 @@ class Histogrammer {
       fillHist2D(dir.c_str(), histo.c_str(), xval, yval);
     } 
  
+    template <class T>
+    void fillHist1D(const Hist1DHandle& h, T val, double w=1.0) {
+      if(h.isValid())  h.get()->Fill(val, w);
+    }
+    template <class T1, class T2>
+    void fillHist2D(const Hist2DHandle& h, T1 xval, T2 yval, double w=1.0) {
+      if(h.isValid())  h.get()->Fill(xval, yval, w);
+    }
+    template <class T1, class T2>
+    void fillHistProfile(const HistProfileHandle& h, T1 xvalue, T2 yvalue) {
+      if(h.isValid())  h.get()->Fill(xvalue, yvalue);
+    }
+
     template <class T>
     void fillHistofromVec( const std::vector<T>& vec, const char* dir, const char* h) {
       fout_->cd(dir);
@@ -57,6 +153,13 @@ class Histogrammer {
       fout_->cd(dir);
       Utility::fill2DHistofromVec( vecC0, vecC1,h);
     }
+    template <class T>
+    void fillHistofromVec( const std::vector<T>& vec, const Hist1DHandle& h) {
+      if(!h.isValid())  return;
+      for( unsigned int i = 0; i<vec.size(); i++ )
+        h.get()->Fill(vec[i], 1.0);
+    }
+    void fill2DHistofromVec( const std::vector<int>& vecC0, const std::vector<int>& vecC1, const Hist2DHandle& h);
      
     template <class T1, class T2>
     bool fillHistProfile(const char* dir, const char* hname, T1 xvalue, T2 yvalue) {
@@ -69,11 +172,15 @@ class Histogrammer {
     }
 
     void fillClusterHistograms( const char* det, std::vector<tbeam::cluster>& cvec, const char* col);
+    void fillClusterHistograms( const ClusterHistos& ch, const std::vector<tbeam::cluster>& cvec);
     void closeFile();
     
     TFile* hfile() const { return fout_;}
   private:
     TFile* fout_;
     bool isFileopen_;  
+    bool inMemory_;
+    //booked histograms keyed by "dir/name"
+    std::map<std::string,TH1*> registry_;
 };
 #endif
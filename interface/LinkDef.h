@@ -26,6 +26,9 @@
 #pragma link C++ class std::vector<tbeam::stub>+;
 #pragma link C++ class std::vector<tbeam::stub* >+;
 #pragma link C++ class tbeam::dutEvent+;
+#pragma link C++ class tbeam::dutFlatEvent+;
+#pragma link C++ class std::vector<short>+;
+#pragma link C++ class std::vector<float>+;
 #pragma link C++ class tbeam::condEvent+;
 #pragma link C++ class tbeam::FeIFourEvent+;
 
@@ -0,0 +1,61 @@
+#ifndef PerfCounters_h
+#define PerfCounters_h
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+class TDirectory;
+
+// Time spent in the main stages of the event processing and cut-flow counts.
+// A Timer adds the wall time of its scope to a stage; when the counters are
+// disabled(default) a Timer and count() only test a flag. Counters are made
+// once by name with counter() and then filled through their index.
+class PerfCounters {
+  public:
+    enum Stage { ReadEntry, DetChannelVectors, ChannelMasking, ExtrapolatedTracks,
+                 ClusterMatching, HistogramFill, CloseFile, NStages };
+    class Timer {
+      public:
+        Timer(PerfCounters& p, Stage s) : p_(p.enabled_ ? &p : nullptr), s_(s) {
+          if(p_)  t0_ = std::chrono::steady_clock::now();
+        }
+        ~Timer() {
+          if(!p_)  return;
+          p_->ns_[s_] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0_).count();
+          p_->calls_[s_]++;
+        }
+      private:
+        PerfCounters* p_;
+        Stage s_;
+        std::chrono::steady_clock::time_point t0_;
+    };
+    PerfCounters();
+    void enable(bool on) { enabled_ = on; }
+    bool enabled() const { return enabled_; }
+    //index of the cut-flow counter name, made on the first call
+    unsigned int counter(const std::string& name);
+    void count(unsigned int id, unsigned long n = 1) { if(enabled_)  counts_[id] += n; }
+    static const char* stageName(Stage s);
+    //events are the calls of ReadEntry
+    unsigned long nEvents() const { return calls_[ReadEntry]; }
+    double nsPerEvent(Stage s) const;
+    unsigned long calls(Stage s) const { return calls_[s]; }
+    double milliseconds(Stage s) const { return ns_[s]*1e-6; }
+    //counters are matched by name
+    void add(const PerfCounters& o);
+    //zero the times and counts, the counter indices stay valid
+    void reset();
+    void print(std::ostream& out) const;
+    //histograms of ns/event, calls and cut flow in d
+    void write(TDirectory* d) const;
+
+  private:
+    bool enabled_;
+    long long ns_[NStages];
+    unsigned long calls_[NStages];
+    std::vector<std::string> names_;
+    std::vector<unsigned long> counts_;
+};
+#endif
@@ -0,0 +1,41 @@
+#ifndef SkimAnalysis_h
+#define SkimAnalysis_h
+
+#include "BeamAnaBase.h"
+
+#include "DataFormats.h"
+#include "Histogrammer.h"
+
+// Writes the events passing the common selection of the analyses (good event,
+// one FEI4 hit, at least one track left by the duplicate removal, the FEI4
+// residual cut and, with skimFiducial=1, the DUT fiducial region) to a slim
+// analysisTree. Only the selected telescope tracks are kept and the DUT content
+// is written in the flat format, so the output is read back by the other
+// analyses like any input tree.
+class SkimAnalysis : public BeamAnaBase {
+ public:
+  SkimAnalysis();
+  ~SkimAnalysis();
+  void beginJob();
+  void eventLoop();
+  void bookHistograms();
+  void endJob();
+
+ private:
+  //fills skimTk_, false if the event is not kept
+  bool selectEvent();
+  //keeps the telescope tracks of skimTk_ only
+  template<typename T>
+  void keepTracks(std::vector<T>* v);
+
+  Histogrammer* hist_;
+  unsigned long int nEntries_;
+  bool fiducialCut_;
+  TTree* skimTree_;
+  bool fillFlat_;
+  tbeam::dutFlatEvent* flatEv_;
+  std::vector<tbeam::Track> skimTk_;
+  std::vector<unsigned int> keep_;
+  Hist1DHandle cutFlow_;
+};
+#endif
@@ -7,6 +7,8 @@
 //#include "Utility.h"
 #include "DataFormats.h"
 #include "Histogrammer.h"
+#include "Fei4HitIndex.h"
+#include "Fei4PairBuffer.h"
 
 class TH1;
 class TelescopeAnalysis : public BeamAnaBase {
@@ -14,7 +16,12 @@ class TelescopeAnalysis : public BeamAnaBase {
   TelescopeAnalysis();
   ~TelescopeAnalysis();
   void beginJob();
+  std::vector<std::string> requiredBranches() const;
+  void beginRun();
   void eventLoop(); 
+  void processEntries(Long64_t first, Long64_t last);
+  BeamAnaBase* makeWorker() const;
+  void syncWorker(BeamAnaBase& w);
   void bookHistograms();
   void clearEvent();
   void endJob();
@@ -47,5 +54,27 @@ class TelescopeAnalysis : public BeamAnaBase {
  private:
   Histogrammer* hist_;
   unsigned long int nEntries_; 
+  Histogrammer::TelescopeHistos tH_;
+  //residual pass of the event loop and the offsets found by the previous passes
+  struct PassState {
+    int pass = 0;
+    double offsetXtmp = 0.;
+    double offsetYtmp = 0.;
+    double offsetXtotal = 0.;
+    double offsetYtotal = 0.;
+    double resXtotal = 0.;
+    double resYtotal = 0.;
+  };
+  PassState ps_;
+  void fillResiduals(const EventCache::Event& ev);
+  void fillResidualsWithOffset(const EventCache::Event& ev);
+  void fillMatchedResiduals(const EventCache::Event& ev);
+  //residuals of the closest track-FEI4 hit pair of the event
+  void closestTrackHit(const EventCache::Event& ev, double xResMean, double yResMean, double& xres, double& yres);
+  //passes 1 and 2 on the residual candidates kept by pass 0(telescopeSinglePass=1)
+  void replayResiduals(Long64_t first, Long64_t last);
+  Fei4HitIndex fei4Hits_;
+  bool singlePass_;
+  Fei4PairBuffer pairs_;
 };
 #endif
@@ -0,0 +1,40 @@
+#ifndef TrackDuplicateFilter_h
+#define TrackDuplicateFilter_h
+
+#include <vector>
+#include <stdint.h>
+#include "DataFormats.h"
+
+// Removal of the duplicated telescope tracks with the definition of
+// Utility::removeTrackDuplicates: a track is dropped when a later track is
+// within 0.001 mm of it in both x and y. The tracks are sorted on an x key
+// quantized to the tolerance, so only the tracks of the neighbouring cells are
+// compared.
+// The survivors are written in their original order to flat columns which
+// are reused from event to event.
+class TrackDuplicateFilter {
+  public:
+    struct Tracks {
+      std::vector<int> index;
+      std::vector<double> x;
+      std::vector<double> y;
+      std::vector<double> dxdz;
+      std::vector<double> dydz;
+      std::vector<double> chi2;
+      std::vector<double> ndof;
+      unsigned int size() const { return index.size(); }
+      void clear();
+      tbeam::Track track(unsigned int i) const;
+    };
+    //survivors of the telescope event, out is cleared first
+    void run(const tbeam::TelescopeEvent& tel, Tracks& out);
+    //indices of the survivors among n positions, in increasing order
+    void run(const double* x, const double* y, unsigned int n, std::vector<unsigned int>& survivors);
+
+  private:
+    std::vector<uint64_t> keys_;
+    std::vector<unsigned int> outliers_;
+    std::vector<char> isDuplicate_;
+    std::vector<unsigned int> survivors_;
+};
+#endif
@@ -0,0 +1,57 @@
+#ifndef TreeIOStats_h
+#define TreeIOStats_h
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "TTree.h"
+
+class TBranch;
+class TTreePerfStats;
+
+// Reading of analysisTree restricted to a list of top-level branches, with the
+// TTreeCache set up for them and the I/O accounted per branch. With timing on,
+// every entry is read branch by branch and the bytes unpacked and the time spent
+// (decompression and streaming) are summed per branch; the bytes read from disk
+// and the total decompression time come from TTreePerfStats.
+class TreeIOStats {
+  public:
+    struct BranchIO {
+      std::string name;
+      Long64_t nEntries;
+      Long64_t bytes;//unpacked
+      Long64_t zipBytes;//size on disk, from the compression factor of the branch
+      double seconds;
+    };
+    TreeIOStats();
+    ~TreeIOStats();
+    //enables only the listed branches; "B" is a whole branch, "B.s" a sub-branch of B.
+    //An empty list enables all. Names not in the tree are skipped.
+    //Returns the top-level branches left enabled.
+    static std::vector<std::string> enableBranches(TTree* t, const std::vector<std::string>& branches);
+    //TTreeCache on the given branches; cacheMB <= 0 sizes it for ~1000 entries
+    static Long64_t setTreeCache(TTree* t, const std::vector<std::string>& branches, double cacheMB);
+    //start the accounting on a new tree, the numbers of the previous one are kept
+    void setTree(TTree* t, const std::vector<std::string>& branches, bool timing);
+    Long64_t readEntry(Long64_t jentry);
+    void add(const TreeIOStats& o);
+    void print(std::ostream& out) const;
+
+  private:
+    BranchIO& branchIO(const std::string& name);
+    void collectPerfStats();
+    TTree* tree_;
+    bool timing_;
+    int treeNumber_;
+    std::vector<std::string> names_;
+    std::vector<TBranch*> branches_;
+    std::vector<unsigned int> slots_;
+    std::vector<double> zipRatio_;
+    std::vector<BranchIO> io_;
+    TTreePerfStats* perf_;
+    Long64_t diskBytes_;
+    Long64_t readCalls_;
+    double diskSeconds_;
+    double unzipSeconds_;
+};
+#endif
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <bitset>
 #include <iostream>
 
 #include "TMath.h"
@@ -15,15 +16,21 @@
 #include "TProfile.h"
 #include "stdint.h"
 #include "DataFormats.h"
+#include "Fei4HitIndex.h"
+#include "TrackDuplicateFilter.h"
 class TFile;
 using std::string;
 
 namespace Utility {
   
   void tokenize(const std::string& str, std::vector<std::string>& tokens, const std::string& delimiter);
-  void getChannelMaskedHits( std::vector<int>& vec, const std::vector<int>& mch );
-  void getChannelMaskedClusters( std::vector<tbeam::cluster*>& vec, const std::vector<int>& mch );
-  void getChannelMaskedStubs( std::vector<tbeam::stub*>& vec, const std::vector<int>& mch );
+  //DUT channel mask, one bit per strip of the 2032 strip layout; channels outside it are never masked
+  typedef std::bitset<2032> ChannelMask;
+  inline bool isMasked(const ChannelMask& mch, int ch) { return ch >= 0 && ch < static_cast<int>(mch.size()) && mch.test(ch); }
+  //the masked channels are removed in place, masked clusters and stubs are deleted
+  void getChannelMaskedHits( std::vector<int>& vec, const ChannelMask& mch );
+  void getChannelMaskedClusters( std::vector<tbeam::cluster*>& vec, const ChannelMask& mch );
+  void getChannelMaskedStubs( std::vector<tbeam::stub*>& vec, const ChannelMask& mch );
  
   int readStubWord( std::map<std::string,std::vector<unsigned int> >& stubids, const uint32_t sWord );
   TH1* getHist1D(const char* hname);
@@ -135,9 +142,17 @@ namespace Utility {
   void cutTrackFei4Residuals(std::vector<double> *xTk, std::vector<double> *yTk, std::vector<double> *slopeTk, std::vector<int> *colFei4, std::vector<int> *rowFei4, std::vector<double> *xSelectedTk, std::vector<double> *ySelectedTk, std::vector<double> *slopeSelectedTk, double xResMean, double yResMean, double xResPitch, double yResPitch);
   
   void cutTrackFei4Residuals(const tbeam::FeIFourEvent* fei4ev ,const std::vector<tbeam::Track>& tkNoOverlap, std::vector<tbeam::Track>& selectedTk, double xResMean, double yResMean, double xResPitch, double yResPitch, bool doClosestTrack);
+  //same selection on flat arrays, returns the indices of the selected tracks
+  void cutTrackFei4Residuals(const int* rowFei4, const int* colFei4, unsigned int nFei4Hits, const double* xTk, const double* yTk, unsigned int nTk, std::vector<unsigned int>& selectedTk, double xResMean, double yResMean, double xResPitch, double yResPitch, bool doClosestTrack);
+  //same selection with the nearest hit search on an index already built for the event
+  void cutTrackFei4Residuals(const Fei4HitIndex& fei4Hits, const double* xTk, const double* yTk, unsigned int nTk, std::vector<unsigned int>& selectedTk, double xResMean, double yResMean, double xResPitch, double yResPitch, bool doClosestTrack);
 
   double extrapolateTrackAtDUTwithAngles(const tbeam::Track& track, double FEI4_z, double offset, double zPlane, double theta);
   std::pair<double, double> extrapolateTrackAtDUTwithAngles(const tbeam::Track& track, double FEI4_z, double offset_d0, double zDUT_d0, double deltaZ, double theta);
+  //batch versions on flat arrays of track positions/slopes (structure of arrays), trig computed once;
+  //the two-plane one writes the impact on both planes in one pass, each plane with its own offset and z
+  void extrapolateTracksAtDUTwithAngles(const double* xPos, const double* dxdz, unsigned int nTk, double FEI4_z, double offset, double zDUT, double theta, double* xTkAtDUT);
+  void extrapolateTracksAtDUTwithAngles(const double* xPos, const double* dxdz, unsigned int nTk, double FEI4_z, double offset_d0, double zDUT_d0, double offset_d1, double zDUT_d1, double theta, double* xTkAtDUT_d0, double* xTkAtDUT_d1);
 
 }
 #endif
@@ -0,0 +1,48 @@
+#ifndef ZScanAccumulator_h
+#define ZScanAccumulator_h
+
+#include <vector>
+#include "AlignmentChi2.h"
+
+// z scan of the DUT residuals for AlignmentAnalysis. Each selected event is
+// stored once as its residual xDUT - xTkAtDUT at the first z of the scan and
+// its track slope, so the residual at any z is one multiply-add over flat
+// columns. The residual peak of every z step is the mode of a coarse histogram
+// refined with the mean and rms in a window around it, instead of a booked
+// 10000 bin histogram and a fit per step.
+class ZScanAccumulator {
+  public:
+    struct Step {
+      double z;
+      AlignmentChi2::Peak peak;
+      double offsetErr;//sigma/sqrt(nCore)
+    };
+    ZScanAccumulator();
+    //z of step iz is zMin + iz*zStep
+    void setScan(double fei4Z, double zMin, double zStep, int nSteps);
+    void clear();
+    void add(double xDUT, double xTk, double dxdz);
+    unsigned int size() const { return res0_.size(); }
+    int nSteps() const { return nSteps_; }
+    double z(int iz) const { return zMin_ + iz*zStep_; }
+    //residual peak at all z steps, in one sweep per step
+    const std::vector<Step>& scan();
+    const std::vector<Step>& steps() const { return steps_; }
+    //residuals xDUT - xTkAtDUT - offset at z
+    void residuals(double z, double offset, std::vector<double>& res) const;
+    //sum of ((offset - res)/resolution)^2 over the events with |offset - res| < window at z
+    double chi2(double z, double offset, double window, double resolution, unsigned int& nWindow) const;
+
+  private:
+    double fei4Z_;
+    double zMin_;
+    double zStep_;
+    int nSteps_;
+    std::vector<double> res0_;
+    std::vector<double> dxdz_;
+    std::vector<Step> steps_;
+    AlignmentChi2::Peak findPeak(const std::vector<double>& res) const;
+    mutable std::vector<double> res_;
+    mutable std::vector<unsigned int> bins_;
+};
+#endif
@@ -43,6 +43,14 @@ void AlignmentAnalysis::beginJob() {
   zMin = 200;
   zStep = 20.;
   zNsteps = 50;
+  //same z range with a finer step
+  if(jobCardmap().find("zScanSteps") != jobCardmap().end()) {
+    int n = atoi(jobCardmap().at("zScanSteps").c_str());
+    if(n > 1) {
+      zStep = zStep*zNsteps/n;
+      zNsteps = n;
+    }
+  }
 
   bookHistograms();
   analysisTree()->GetEntry(0);
@@ -83,11 +91,13 @@ void AlignmentAnalysis::eventLoop()
              << "\tOffset1="<< cbcOffset1() 
 	    << "\tOffset2" << cbcOffset2()
 	    << std::endl;
-  //First Loop over events-inject z and compute residual
-  //evaluate the best z alignment
+  //Single loop over events: the selected events go to the z scan accumulators,
+  //the offset, chi2 and aligned residuals at every z are computed from them
+  zScanD0_.setScan(aLparameteres().FEI4z(), zMin, zStep, zNsteps);
+  zScanD1_.setScan(aLparameteres().FEI4z(), zMin, zStep, zNsteps);
   for (Long64_t jentry=0; jentry<nEntries_;jentry++) {
     clearEvent();
-    Long64_t ientry = analysisTree()->GetEntry(jentry);
+    Long64_t ientry = readEntry(jentry);
     if (ientry < 0) break;
     if (jentry%1000 == 0) {
        cout << " Events processed. " << std::setw(8) << jentry 
@@ -112,185 +122,71 @@ void AlignmentAnalysis::eventLoop()
     hist_->fillHist1D("EventInfo","condData", condEv()->condData);
     hist_->fillHist1D("EventInfo","tdcPhase", static_cast<unsigned int>(condEv()->tdcPhase));
     
-    setDetChannelVectors();
-    const auto& d0c0 = *det0C0();
-    const auto& d0c1 = *det0C1();
-    const auto& d1c0 = *det1C0();
-    const auto& d1c1 = *det1C1();
- 
     //Remove track duplicates 
-    //std::vector<double> xTkNoOverlap, yTkNoOverlap, slopeTkNoOverlap;
-    //Utility::removeTrackDuplicates(telEv()->xPos, telEv()->yPos, telEv()->dydz, &xTkNoOverlap, &yTkNoOverlap, &slopeTkNoOverlap);
     std::vector<tbeam::Track>  tkNoOv;
     Utility::removeTrackDuplicates(telEv(), tkNoOv);
 	
     //Match with FEI4
-    //std::vector<double> xSelectedTk, ySelectedTk, slopeSelectedTk;
-    //Utility::cutTrackFei4Residuals(&xTkNoOverlap, &yTkNoOverlap, &slopeTkNoOverlap, fei4Ev()->col, fei4Ev()->row, &xSelectedTk, &ySelectedTk, &slopeSelectedTk, offsetfei4x(), offsetfei4y(), resfei4x(), resfei4y());
     std::vector<tbeam::Track>  selectedTk;
     Utility::cutTrackFei4Residuals(fei4Ev(), tkNoOv, selectedTk, offsetfei4x(), offsetfei4y(), resfei4x(), resfei4y(), true); 
-    //cout << "NselectedTk="<<selectedTk.size()<<endl;    
 
     //Find mean of residuals, scanning zDUT      
     if (selectedTk.size()!=1) continue;
-    //cout << "NHits: d0, "<<d0c0.size()<<" ; d1, "<<d1c0.size()<<endl;
+    setDetChannelVectors();
+    const auto& d0c0 = *det0C0();
+    const auto& d1c0 = *det1C0();
+    const tbeam::Track& tk = selectedTk[0];
     if (d0c0.size()==1) {
-      for (unsigned int ih=0; ih<d0c0.size(); ih++){
-	//float xTkAtDUT = selectedTk[0].yPos + (DUT_z-aLparameteres().FEI4_z)*selectedTk[0].dydz;
-	float xTkAtDUT = selectedTk[0].xPos + (DUT_z-aLparameteres().FEI4_z)*selectedTk[0].dxdz;
-	float xDUT = (d0c0.at(ih) - nstrips()/2) * dutpitch();
-        //xTkAtDUT = -1.*xTkAtDUT;
-	hist_->fillHist1D("TrackFit","d0_1tk1Hit_diffX", xDUT-xTkAtDUT);
-	DUT_z_try = zMin; //300
-	for (int iz=0; iz<zNsteps; iz++){
-	  DUT_z_try += zStep;
-	  //xTkAtDUT = selectedTk[0].yPos + (DUT_z_try-aLparameteres().FEI4_z)*selectedTk[0].dydz;
-	  xTkAtDUT = selectedTk[0].xPos + (DUT_z_try-aLparameteres().FEI4_z)*selectedTk[0].dxdz;
-          //xTkAtDUT = -1.*xTkAtDUT;
-	  hist_->fillHist1D("TrackFit",Form("d0_1tk1Hit_diffX_iz%i", iz), xDUT-xTkAtDUT);
-	}
-      }
+      float xTkAtDUT = tk.xPos + (DUT_z-aLparameteres().FEI4z())*tk.dxdz;
+      float xDUT = (d0c0.at(0) - nstrips()/2) * dutpitch();
+      hist_->fillHist1D("TrackFit","d0_1tk1Hit_diffX", xDUT-xTkAtDUT);
+      zScanD0_.add(xDUT, tk.xPos, tk.dxdz);
     }
     if (d1c0.size()==1){
-      for (unsigned int ih=0; ih<d1c0.size(); ih++){
-	//float xTkAtDUT = selectedTk[0].yPos + (DUT_z-aLparameteres().FEI4_z)*selectedTk[0].dydz;
-	float xTkAtDUT = selectedTk[0].xPos + (DUT_z-aLparameteres().FEI4_z)*selectedTk[0].dxdz;
-        //xTkAtDUT = -1.*xTkAtDUT;
-	float xDUT = (d1c0.at(ih) - nstrips()/2) * dutpitch();
-	hist_->fillHist1D("TrackFit","d1_1tk1Hit_diffX", xDUT-xTkAtDUT);
-	DUT_z_try = zMin;//300;
-	for (int iz=0; iz<zNsteps; iz++){
-	  DUT_z_try += zStep;
-	  //xTkAtDUT = selectedTk[0].yPos + (DUT_z_try-aLparameteres().FEI4_z)*selectedTk[0].dydz;
-	  xTkAtDUT = selectedTk[0].xPos + (DUT_z_try-aLparameteres().FEI4_z)*selectedTk[0].dxdz;
-          //xTkAtDUT = -1.*xTkAtDUT;
-	  hist_->fillHist1D("TrackFit",Form("d1_1tk1Hit_diffX_iz%i", iz), xDUT-xTkAtDUT);
-	}
-      }
+      float xTkAtDUT = tk.xPos + (DUT_z-aLparameteres().FEI4z())*tk.dxdz;
+      float xDUT = (d1c0.at(0) - nstrips()/2) * dutpitch();
+      hist_->fillHist1D("TrackFit","d1_1tk1Hit_diffX", xDUT-xTkAtDUT);
+      zScanD1_.add(xDUT, tk.xPos, tk.dxdz);
     } 
-
-  }//End of First Loop
+  }//End of the loop over events
+  cout << "z scan: " << zNsteps << " steps, " << zScanD0_.size() << " events d0, "
+       << zScanD1_.size() << " events d1" << endl;
   
   cout << "Computing chi2" << endl;
-  float* sigma_d0 = new float[zNsteps];
-  float* sigma_d1 = new float[zNsteps];
-  float* offset_err_d0 = new float[zNsteps];
-  float* offset_err_d1 = new float[zNsteps];
-  
-  std::pair<float, float> line_d0 = GetOffsetVsZ("d0", &sigma_d0, &offset_err_d0);
-  std::pair<float, float> line_d1 = GetOffsetVsZ("d1", &sigma_d1, &offset_err_d1);
+  std::vector<float> sigma_d0, sigma_d1, offset_err_d0, offset_err_d1;
+  std::pair<float, float> line_d0 = GetOffsetVsZ("d0", zScanD0_, sigma_d0, offset_err_d0);
+  std::pair<float, float> line_d1 = GetOffsetVsZ("d1", zScanD1_, sigma_d1, offset_err_d1);
   
   cout << "d0, offset="<<line_d0.first <<" * z_DUT + " << line_d0.second << endl;
   cout << "d1, offset="<<line_d1.first <<" * z_DUT + " << line_d1.second << endl;
   
-  float resTelescopeSquared = (90*90/12. + 3.5*3.5) / 1000. /1000.;
   float resTelescope = sqrt(0.090*0.090/12. + 0.0035*0.0035);
-  float* chi2_d0 = new float[zNsteps];
-  float* chi2_d1 = new float[zNsteps];
-  float* Nevent_d0_window = new float[zNsteps];
-  float* Nevent_d1_window = new float[zNsteps];
-  for (int iz=0; iz<zNsteps; iz++) {
-    chi2_d0[iz]=0;
-    chi2_d1[iz]=0;
-    Nevent_d0_window[iz]=0;
-    Nevent_d1_window[iz]=0;
-  }
-  
-  int nEv1tk1hit_d0=0;
-  int nEv1tk1hit_d1=0;
-   
-  //2nd loop over events- computing chi2
-  for (Long64_t jentry=0; jentry<nEntries_;jentry++) {
-    clearEvent();
-    Long64_t ientry = analysisTree()->GetEntry(jentry);
-    if (ientry < 0) break;
-    if (jentry%1000 == 0) {
-      cout << " Events processed. " << std::setw(8) << jentry
-	   << endl;
-    }
-    if(!isGoodEvent())   continue;
-    if(fei4Ev()->nPixHits != 1)    continue;
-
-    //Tk overlap removal
-    //std::vector<double> xTkNoOverlap, yTkNoOverlap, slopeTkNoOverlap;
-    //Utility::removeTrackDuplicates(telEv()->xPos, telEv()->yPos, telEv()->dydz, &xTkNoOverlap, &yTkNoOverlap, &slopeTkNoOverlap);
-    std::vector<tbeam::Track>  tkNoOv;
-    Utility::removeTrackDuplicates(telEv(), tkNoOv);
-
-    //Match with FEI4
-    //std::vector<double> xSelectedTk, ySelectedTk, slopeSelectedTk;
-    //Utility::cutTrackFei4Residuals(&xTkNoOverlap, &yTkNoOverlap, &slopeTkNoOverlap, fei4Ev()->col, fei4Ev()->row, &xSelectedTk, &ySelectedTk, &slopeSelectedTk, offsetfei4x(), offsetfei4y(), resfei4x(), resfei4y());
-
-    std::vector<tbeam::Track>  selectedTk;
-    Utility::cutTrackFei4Residuals(fei4Ev(), tkNoOv, selectedTk, offsetfei4x(), offsetfei4y(), resfei4x(), resfei4y(), true); 
-
-    //Select events with one track to compute chi2(z)
-    if (selectedTk.size() != 1) continue;
-    setDetChannelVectors();
-    const auto& d0c0 = *det0C0();
-    const auto& d0c1 = *det0C1();
-    const auto& d1c0 = *det1C0();
-    const auto& d1c1 = *det1C1();
-    if (d0c0.size()==1){
-      nEv1tk1hit_d0++;
-      float xDUT = (d0c0.at(0) - nstrips()/2) * dutpitch();
-      for (int iz=0; iz<zNsteps; iz++){
-	DUT_z_try = zMin + (float)(iz*zStep);
-	float offset = line_d0.first * DUT_z_try + line_d0.second;
-	//float xTkAtDUT = selectedTk[0].yPos + (DUT_z_try-aLparameteres().FEI4_z)*selectedTk[0].dydz;// + offset;
-	float xTkAtDUT = selectedTk[0].xPos + (DUT_z_try-aLparameteres().FEI4_z)*selectedTk[0].dxdz;
-        //xTkAtDUT = -1.*xTkAtDUT + offset;
-        xTkAtDUT = xTkAtDUT + offset;
-	if (fabs(xTkAtDUT-xDUT) < 3*sigma_d0[iz]) {
-	  chi2_d0[iz] += (xTkAtDUT-xDUT)/resTelescope * (xTkAtDUT-xDUT)/resTelescope;
-	  Nevent_d0_window[iz] ++;
-	}
-      }
-    }
-    if (d1c0.size()==1){
-      nEv1tk1hit_d1++;
-      float xDUT = (d1c0.at(0) - nstrips()/2) * dutpitch();
-      for (int iz=0; iz<zNsteps; iz++){
-	DUT_z_try = zMin + (float)(iz*zStep);
-	float offset = line_d1.first * DUT_z_try + line_d1.second;
-	//float xTkAtDUT = selectedTk[0].yPos + (DUT_z_try-aLparameteres().FEI4_z)*selectedTk[0].dydz;// + offset;
-	float xTkAtDUT = selectedTk[0].xPos + (DUT_z_try-aLparameteres().FEI4_z)*selectedTk[0].dxdz;
-        //xTkAtDUT = -1.*xTkAtDUT + offset;
-        xTkAtDUT = xTkAtDUT + offset;
-	if (fabs(xTkAtDUT-xDUT) < 3*sigma_d1[iz]) {
-	  chi2_d1[iz] += (xTkAtDUT-xDUT)/resTelescope * (xTkAtDUT-xDUT)/resTelescope;
-	  Nevent_d1_window[iz]++;
-	}
-      }
-    }
-  }//end of 2nd loop over events
-  
-  
   for (int iz=0; iz<zNsteps; iz++){ 
     DUT_z_try = zMin + (float)(iz*zStep);
-    chi2_d0[iz] /= Nevent_d0_window[iz];//nEv1tk1hit_d0;
-    chi2_d1[iz] /= Nevent_d1_window[iz];//nEv1tk1hit_d1;
-    cout << "z="<<DUT_z_try<<" chi2_d0="<<chi2_d0[iz]<<" chi2_d1="<<chi2_d1[iz]<<endl;
-    if (chi2_d0[iz]>0) hist_->FillAlignmentOffsetVsZ("d0", "_chi2VsZ", iz, DUT_z_try, chi2_d0[iz], offset_err_d0[iz]/resTelescope);
-    if (chi2_d1[iz]>0) hist_->FillAlignmentOffsetVsZ("d1", "_chi2VsZ", iz, DUT_z_try, chi2_d1[iz], offset_err_d1[iz]/resTelescope);
+    unsigned int Nevent_d0_window = 0;
+    unsigned int Nevent_d1_window = 0;
+    float chi2_d0 = zScanD0_.chi2(DUT_z_try, line_d0.first * DUT_z_try + line_d0.second, 3*sigma_d0[iz], resTelescope, Nevent_d0_window);
+    float chi2_d1 = zScanD1_.chi2(DUT_z_try, line_d1.first * DUT_z_try + line_d1.second, 3*sigma_d1[iz], resTelescope, Nevent_d1_window);
+    chi2_d0 /= Nevent_d0_window;
+    chi2_d1 /= Nevent_d1_window;
+    cout << "z="<<DUT_z_try<<" chi2_d0="<<chi2_d0<<" chi2_d1="<<chi2_d1<<endl;
+    if (chi2_d0>0) hist_->FillAlignmentOffsetVsZ("d0", "_chi2VsZ", iz, DUT_z_try, chi2_d0, offset_err_d0[iz]/resTelescope);
+    if (chi2_d1>0) hist_->FillAlignmentOffsetVsZ("d1", "_chi2VsZ", iz, DUT_z_try, chi2_d1, offset_err_d1[iz]/resTelescope);
   }
   
   TF1* fParabolaChi2VsZ = new TF1("fParabolaChi2VsZ", "[0]*x*x+[1]*x+[2]", zMin, 690);
   TH1* htmp = dynamic_cast<TH1F*>(hist_->GetHistoByName("TrackFit","d0_chi2VsZ"));
-  //TH1* htmp = (TH1F*) hist_->GetHistoByName("d0", "_chi2VsZ");
   htmp->Fit("fParabolaChi2VsZ");
   float d0_chi2_min = fParabolaChi2VsZ->GetMinimum();
   float d0_chi2_min_z = fParabolaChi2VsZ->GetMinimumX(); 
   cout << "d0 chi2 z="<<d0_chi2_min_z<<" chi2="<<d0_chi2_min<<endl;
   
   htmp = dynamic_cast<TH1F*>(hist_->GetHistoByName("TrackFit","d1_chi2VsZ"));
-  //htmp = (TH1F*) hist_->GetHistoByName("d1", "_chi2VsZ");
   htmp->Fit("fParabolaChi2VsZ");
   float d1_chi2_min = fParabolaChi2VsZ->GetMinimum();
   float d1_chi2_min_z = fParabolaChi2VsZ->GetMinimumX();
   cout << "d1 chi2 z="<<d1_chi2_min_z<<" chi2="<<d1_chi2_min<<endl;
   
-  float DUT_z_aligned = DUT_z;
   float d0_Offset_aligned = line_d0.first * d0_chi2_min_z + line_d0.second;
   float d1_Offset_aligned = line_d1.first * d1_chi2_min_z + line_d1.second;
  
@@ -309,56 +205,14 @@ void AlignmentAnalysis::eventLoop()
     fileAlignment.close();
   } else std::cout << "Dump File could not be opened!!" << std::endl;
 
-  //3rd loop over number of entries-get residual after alignment correction
-  for (Long64_t jentry=0; jentry<nEntries_;jentry++) {
-    clearEvent();
-    Long64_t ientry = analysisTree()->GetEntry(jentry);
-    if (ientry < 0) break;
-    if (jentry%1000 == 0) {
-      cout << " Events processed. " << std::setw(8) << jentry
-	   << endl;
-    }
-    if(!isGoodEvent())   continue;
-    if(fei4Ev()->nPixHits != 1)    continue;
-
-    //Tk overlap removal
-    //std::vector<double> xTkNoOverlap, yTkNoOverlap, slopeTkNoOverlap;
-    //Utility::removeTrackDuplicates(telEv()->xPos, telEv()->yPos, telEv()->dydz, &xTkNoOverlap, &yTkNoOverlap, &slopeTkNoOverlap);
-
-    std::vector<tbeam::Track>  tkNoOv;
-    Utility::removeTrackDuplicates(telEv(), tkNoOv);
-
-    //Match with FEI4
-    //std::vector<double> xSelectedTk, ySelectedTk, slopeSelectedTk;
-    //Utility::cutTrackFei4Residuals(&xTkNoOverlap, &yTkNoOverlap, &slopeTkNoOverlap, fei4Ev()->col, fei4Ev()->row, &xSelectedTk, &ySelectedTk, &slopeSelectedTk, offsetfei4x(), offsetfei4y(), resfei4x(), resfei4y());
-    
-    std::vector<tbeam::Track>  selectedTk;
-    Utility::cutTrackFei4Residuals(fei4Ev(), tkNoOv, selectedTk, offsetfei4x(), offsetfei4y(), resfei4x(), resfei4y(), true); 
-
-    if (selectedTk.size()!=1) continue;
-    setDetChannelVectors();
-    const auto& d0c0 = *det0C0();
-    const auto& d0c1 = *det0C1();
-    const auto& d1c0 = *det1C0();
-    const auto& d1c1 = *det1C1();
-    
-    if (d0c0.size()==1){
-      float xDUT = (d0c0.at(0) - nstrips()/2) * dutpitch();
-      //float xTkAtDUT = selectedTk[0].yPos + (d0_chi2_min_z-aLparameteres().FEI4_z)*selectedTk[0].dydz;// + d0_Offset_aligned;
-      float xTkAtDUT = selectedTk[0].xPos + (d0_chi2_min_z-aLparameteres().FEI4_z)*selectedTk[0].dxdz;
-      //xTkAtDUT = -1.*xTkAtDUT + d0_Offset_aligned;
-      xTkAtDUT = xTkAtDUT + d0_Offset_aligned;
-      hist_->fillHist1D("TrackFit","d0_1tk1Hit_diffX_aligned", xDUT-xTkAtDUT);
-    }
-    if (d1c0.size()==1){
-      float xDUT = (d1c0.at(0) - nstrips()/2) * dutpitch();
-      //float xTkAtDUT = selectedTk[0].yPos + (d1_chi2_min_z-aLparameteres().FEI4_z)*selectedTk[0].dydz;// + d1_Offset_aligned;
-      float xTkAtDUT = selectedTk[0].xPos + (d1_chi2_min_z-aLparameteres().FEI4_z)*selectedTk[0].dxdz;
-      //xTkAtDUT = -1.*xTkAtDUT + d1_Offset_aligned;
-      xTkAtDUT = xTkAtDUT + d1_Offset_aligned;
-      hist_->fillHist1D("TrackFit","d1_1tk1Hit_diffX_aligned", xDUT-xTkAtDUT);
-    }
-  }//end of 3rd loop over events
+  //residuals after alignment correction
+  std::vector<double> res;
+  zScanD0_.residuals(d0_chi2_min_z, d0_Offset_aligned, res);
+  for (auto r : res)
+    hist_->fillHist1D("TrackFit","d0_1tk1Hit_diffX_aligned", r);
+  zScanD1_.residuals(d1_chi2_min_z, d1_Offset_aligned, res);
+  for (auto r : res)
+    hist_->fillHist1D("TrackFit","d1_1tk1Hit_diffX_aligned", r);
 
   //Fit Residuals Gaussian convulated with Step Function
   TF1* fGausResiduals = new TF1("fGausResiduals", "gaus", -10, 10);
@@ -412,74 +266,25 @@ void AlignmentAnalysis::eventLoop()
   htmp->Fit(fStepGaus);
 }
 
-std::pair<float, float> AlignmentAnalysis::GetOffsetVsZ(const char* det, float** sigma, float** offset_err){
-  
-  //TF1* fGausExtractedX = new TF1("fGausExtractedX", "gaus", -10, 10);
-  TF1* fGausExtractedX = new TF1("fGausExtractedX", Utility::FuncPol1Gaus, -10, 10, 5);
-  TH1* htmp;
-  float* offset = new float[zNsteps];
-  //float offset_err[zNsteps];
-  float* injectedZ = new float[zNsteps];
-  float center, rms, cte;
-  bool failedFit = false;
-  
-  for (int iz=0; iz<zNsteps; iz++){
-    std::string hn = det + std::string("_1tk1Hit_diffX_iz") + std::to_string((iz));
-    htmp = dynamic_cast<TH1I*>(hist_->GetHistoByName("TrackFit", hn));   
-    //htmp = (TH1I*) hist_->GetHistoByName(det, Form("_1tk1Hit_diffX_iz%i",iz));
-
-    center = ((float)htmp->GetMaximumBin())*(htmp->GetXaxis()->GetXmax()-htmp->GetXaxis()->GetXmin())/((float)htmp->GetNbinsX()) + htmp->GetXaxis()->GetXmin();//htmp->GetMean();
-    htmp->SetAxisRange(center-0.2, center+0.2, "X");
-    cte = (htmp->GetBinContent(htmp->FindBin(center-0.2))+htmp->GetBinContent(htmp->FindBin(center+0.2)))/2.;
-    fGausExtractedX->SetParameter(0, htmp->GetMaximum());
-    fGausExtractedX->SetParameter(1, center);
-    fGausExtractedX->SetParLimits(2, 0, 0.1);
-    fGausExtractedX->SetParameter(2, 0.026);
-    fGausExtractedX->SetParameter(3, cte);
-    fGausExtractedX->SetParameter(4, 0);
-    htmp->Fit("fGausExtractedX", "WW");
-
-    center = fGausExtractedX->GetParameter(1);
-    rms = 5*fGausExtractedX->GetParameter(2);
-    (*sigma)[iz] = rms;
-    htmp->SetAxisRange(center-rms, center+rms, "X");
-    fGausExtractedX->SetRange(center-rms, center+rms);
-    htmp->Fit("fGausExtractedX", "WW");
- 
-/*
-    center = ((float)htmp->GetMaximumBin())*(htmp->GetXaxis()->GetXmax()-htmp->GetXaxis()->GetXmin())/((float)htmp->GetNbinsX()) + htmp->GetXaxis()->GetXmin();//htmp->GetMean();
-    htmp->SetAxisRange(center-0.2, center+0.2, "X");
-    fGausExtractedX->SetRange(center-0.2, center+0.2);
-    fGausExtractedX->SetParameter(1, center);
-    fGausExtractedX->SetParameter(2, 0.026);
-    htmp->Fit("fGausExtractedX");
-    
-    center = fGausExtractedX->GetParameter(1);
-    rms = 5*fGausExtractedX->GetParameter(2);
-    (*sigma)[iz] = rms;
-    htmp->SetAxisRange(center-rms, center+rms, "X");
-    fGausExtractedX->SetRange(center-rms, center+rms);
-    htmp->Fit("fGausExtractedX");
-*/  
-    offset[iz] = fGausExtractedX->GetParameter(1);
-    (*offset_err)[iz] = fGausExtractedX->GetParError(1);
-    injectedZ[iz] = zMin + (float)(iz*zStep);
-    //failedFit = false;
-    //if ((*offset_err)[iz]/offset[iz] > 1 || !((*offset_err)[iz]>0)) failedFit = true;
-    //if (!failedFit) hist_->FillAlignmentOffsetVsZ(det, "_offsetVsZ", iz, injectedZ[iz], offset[iz], (*offset_err)[iz]);
-  }
-  
+std::pair<float, float> AlignmentAnalysis::GetOffsetVsZ(const char* det, ZScanAccumulator& zScan,
+                                                         std::vector<float>& sigma, std::vector<float>& offset_err){
+  //residual peak at every z, sigma is the 5 sigma window of the old Pol1+Gaus fit
+  const std::vector<ZScanAccumulator::Step>& steps = zScan.scan();
+  sigma.assign(zNsteps, 0.);
+  offset_err.assign(zNsteps, 0.);
   for (int iz=0; iz<zNsteps; iz++){
-    cout << "iz="<< iz<<" z="<<injectedZ[iz]<<" offset = "<<offset[iz]<< " +/- " <<(*offset_err)[iz] << endl;
-    failedFit = false;
-    if ((*offset_err)[iz]/offset[iz] > 1 || !((*offset_err)[iz]>0)) failedFit = true;
-    if (!failedFit) hist_->FillAlignmentOffsetVsZ(det, "_offsetVsZ", iz, injectedZ[iz], offset[iz], (*offset_err)[iz]);
+    const ZScanAccumulator::Step& st = steps[iz];
+    float offset = st.peak.center;
+    sigma[iz] = 5*st.peak.sigma;
+    offset_err[iz] = st.offsetErr;
+    cout << "iz="<< iz<<" z="<<st.z<<" offset = "<<offset<< " +/- " <<offset_err[iz] << endl;
+    bool failedFit = !st.peak.valid || offset_err[iz]/offset > 1 || !(offset_err[iz]>0);
+    if (!failedFit) hist_->FillAlignmentOffsetVsZ(det, "_offsetVsZ", iz, st.z, offset, offset_err[iz]);
   }
   
-  TF1* fOffsetVsZ = new TF1("fOffsetVsZ","[0]*x+[1]", injectedZ[0], injectedZ[zNsteps-1]);
+  TF1* fOffsetVsZ = new TF1("fOffsetVsZ","[0]*x+[1]", zScan.z(0), zScan.z(zNsteps-1));
   std::string hn = det + std::string("_offsetVsZ");
-  htmp = dynamic_cast<TH1F*>(hist_->GetHistoByName("TrackFit", hn));  
-  //htmp = (TH1I*) hist_->GetHistoByName(det, "_offsetVsZ");
+  TH1* htmp = dynamic_cast<TH1F*>(hist_->GetHistoByName("TrackFit", hn));  
   htmp->Fit(fOffsetVsZ);
   htmp->SetAxisRange(htmp->GetMinimum(), htmp->GetMaximum(),"Y");
   
@@ -495,7 +300,7 @@ void AlignmentAnalysis::clearEvent() {
 }
 void AlignmentAnalysis::endJob() {
   BeamAnaBase::endJob();
-  hist_->closeFile();
+  closeOutput();
 }
 
 AlignmentAnalysis::~AlignmentAnalysis(){
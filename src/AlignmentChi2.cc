@@ -0,0 +1,331 @@
+/*!
+        \file                AlignmentChi2.cc
+        \brief               Flat chi2 engine for the DUT alignment minimisation
+*/
+#include "AlignmentChi2.h"
+#include "Utility.h"
+#include <cmath>
+#include <algorithm>
+
+namespace {
+  //same resolution as AlignmentMultiDimAnalysis::ComputeChi2
+  const double resTelescope = std::sqrt(0.090*0.090/12. + 0.0035*0.0035);
+  //coarse binning of the mode search and the window/limits of the original fit
+  const double histMin = -10.;
+  const double histMax = 10.;
+  const double binWidth = 0.02;
+  const double peakWindow = 2.;
+  const double maxSigma = 0.3;
+  const double minCore = 5.;
+  //Levenberg-Marquardt damping range and stopping tolerance on the relative chi2 change
+  const double lambdaMin = 1e-12;
+  const double lambdaMax = 1e12;
+  const double lmTolerance = 1e-8;
+
+  //A x = b by Gaussian elimination with partial pivoting, A is n*n row major; b is replaced by x
+  bool solveLinear(std::vector<double>& A, std::vector<double>& b, unsigned int n) {
+    for(unsigned int k = 0; k < n; k++) {
+      unsigned int piv = k;
+      for(unsigned int i = k+1; i < n; i++)
+        if(std::fabs(A[i*n+k]) > std::fabs(A[piv*n+k]))  piv = i;
+      if(A[piv*n+k] == 0.)  return false;
+      if(piv != k) {
+        for(unsigned int j = 0; j < n; j++)  std::swap(A[k*n+j], A[piv*n+j]);
+        std::swap(b[k], b[piv]);
+      }
+      for(unsigned int i = k+1; i < n; i++) {
+        double fac = A[i*n+k]/A[k*n+k];
+        for(unsigned int j = k; j < n; j++)  A[i*n+j] -= fac*A[k*n+j];
+        b[i] -= fac*b[k];
+      }
+    }
+    for(int i = n-1; i >= 0; i--) {
+      for(unsigned int j = i+1; j < n; j++)  b[i] -= A[i*n+j]*b[j];
+      b[i] /= A[i*n+i];
+    }
+    return true;
+  }
+
+  double sumSquares(const std::vector<double>& f) {
+    double s = 0.;
+    for(auto v : f)  s += v*v;
+    return s;
+  }
+}
+
+AlignmentChi2::AlignmentChi2() :
+  fei4Z_(0.),
+  nWindow_(0)
+{
+  for(auto& p : peak_)
+    p = Peak{0., 0., 0, false};
+}
+
+void AlignmentChi2::setData(double fei4Z, const std::vector<tbeam::Track>& tk, const std::vector<float>& xDUT0) {
+  fei4Z_ = fei4Z;
+  xTk_.resize(tk.size());
+  dxdz_.resize(tk.size());
+  for(unsigned int i = 0; i < tk.size(); i++) {
+    xTk_[i] = tk[i].xPos;
+    dxdz_[i] = tk[i].dxdz;
+  }
+  xDUT_[0].assign(xDUT0.begin(), xDUT0.end());
+  xDUT_[1].clear();
+}
+
+void AlignmentChi2::setData(double fei4Z, const std::vector<tbeam::Track>& tk, const std::vector<float>& xDUT0,
+                            const std::vector<float>& xDUT1) {
+  setData(fei4Z, tk, xDUT0);
+  xDUT_[1].assign(xDUT1.begin(), xDUT1.end());
+}
+
+void AlignmentChi2::residuals(unsigned int plane, double offset, double zDUT, double theta, std::vector<double>& res) const {
+  const unsigned int n = xTk_.size();
+  res.resize(n);
+  Utility::extrapolateTracksAtDUTwithAngles(xTk_.data(), dxdz_.data(), n, fei4Z_, offset, zDUT, theta, res.data());
+  const double* xd = xDUT_[plane].data();
+  double* r = res.data();
+  for(unsigned int i = 0; i < n; i++)
+    r[i] = xd[i] - r[i];
+}
+
+void AlignmentChi2::residuals(double offset0, double zDUT0, double offset1, double zDUT1, double theta,
+                              std::vector<double>& res0, std::vector<double>& res1) const {
+  const unsigned int n = xTk_.size();
+  res0.resize(n);
+  res1.resize(n);
+  Utility::extrapolateTracksAtDUTwithAngles(xTk_.data(), dxdz_.data(), n, fei4Z_, offset0, zDUT0, offset1, zDUT1, theta,
+                                            res0.data(), res1.data());
+  const double* xd0 = xDUT_[0].data();
+  const double* xd1 = xDUT_[1].data();
+  double* r0 = res0.data();
+  double* r1 = res1.data();
+  for(unsigned int i = 0; i < n; i++) {
+    r0[i] = xd0[i] - r0[i];
+    r1[i] = xd1[i] - r1[i];
+  }
+}
+
+AlignmentChi2::Peak AlignmentChi2::findPeak(const std::vector<double>& res) const {
+  Peak p{0., 0., 0, false};
+  //coarse mode, as the maximum bin of the residual histogram
+  const unsigned int nbins = static_cast<unsigned int>((histMax - histMin)/binWidth);
+  bins_.assign(nbins, 0);
+  for(auto r : res) {
+    if(r < histMin || r >= histMax)  continue;
+    bins_[static_cast<unsigned int>((r - histMin)/binWidth)]++;
+  }
+  unsigned int imax = std::max_element(bins_.begin(), bins_.end()) - bins_.begin();
+  if(bins_[imax] == 0)  return p;
+  double center = histMin + (imax + 0.5)*binWidth;
+  double window = peakWindow;
+  double sigma = maxSigma;
+  //refine with the median and the MAD of the residuals in the window
+  for(int iter = 0; iter < 5; iter++) {
+    scratch_.clear();
+    for(auto r : res)
+      if(std::fabs(r - center) < window)  scratch_.push_back(r);
+    if(scratch_.size() < minCore)  return p;
+    auto mid = scratch_.begin() + scratch_.size()/2;
+    std::nth_element(scratch_.begin(), mid, scratch_.end());
+    double median = *mid;
+    for(auto& r : scratch_)  r = std::fabs(r - median);
+    std::nth_element(scratch_.begin(), mid, scratch_.end());
+    double newSigma = std::min(1.4826*(*mid), maxSigma);
+    bool converged = std::fabs(median - center) < 1e-6 && std::fabs(newSigma - sigma) < 1e-6;
+    center = median;
+    sigma = newSigma;
+    if(converged || !(sigma > 0.))  break;
+    window = std::min(5.*sigma, peakWindow);
+  }
+  if(!(sigma > 0.))  return p;
+  for(auto r : res)
+    if(std::fabs(r - center) < 3.*sigma)  p.nCore++;
+  p.center = center;
+  p.sigma = sigma;
+  p.valid = p.nCore > minCore;
+  return p;
+}
+
+double AlignmentChi2::chi2(double offset, double zDUT, double theta) const {
+  residuals(0, offset, zDUT, theta, res_[0]);
+  nWindow_ = 0;
+  peak_[0] = findPeak(res_[0]);
+  if(!peak_[0].valid)  return 9999.;
+  double chi2 = 0.;
+  unsigned int nEvWindow = 0;
+  const double center = peak_[0].center;
+  const double win = 3.*peak_[0].sigma;
+  for(auto r : res_[0]) {
+    if(std::fabs(r - center) < win) {
+      chi2 += (r/resTelescope)*(r/resTelescope);
+      nEvWindow++;
+    }
+  }
+  if(nEvWindow == 0 || chi2 == 0.)  return 9999.;
+  nWindow_ = nEvWindow;
+  return chi2/nEvWindow;
+}
+
+double AlignmentChi2::chi2(double offset0, double zDUT0, double offset1, double zDUT1, double theta) const {
+  residuals(offset0, zDUT0, offset1, zDUT1, theta, res_[0], res_[1]);
+  nWindow_ = 0;
+  peak_[0] = findPeak(res_[0]);
+  if(!peak_[0].valid)  return 99999.;
+  peak_[1] = findPeak(res_[1]);
+  if(!peak_[1].valid)  return 99999.;
+  double chi2 = 0.;
+  unsigned int nEvWindow = 0;
+  const unsigned int n = res_[0].size();
+  for(unsigned int i = 0; i < n; i++) {
+    double r0 = res_[0][i];
+    double r1 = res_[1][i];
+    if(std::fabs(r0 - peak_[0].center) < 3.*peak_[0].sigma && std::fabs(r1 - peak_[1].center) < 3.*peak_[1].sigma) {
+      chi2 += (r0/resTelescope)*(r0/resTelescope) + (r1/resTelescope)*(r1/resTelescope);
+      nEvWindow++;
+    }
+  }
+  if(nEvWindow == 0)  return 99999.;
+  nWindow_ = nEvWindow;
+  return chi2/nEvWindow;
+}
+
+bool AlignmentChi2::windowedResiduals(Model m, const double* x, std::vector<double>& f, std::vector<double>* jac) const {
+  f.clear();
+  if(jac)  jac->clear();
+  const unsigned int np = nPar(m);
+  const double offset0 = x[0];
+  const double zDUT0 = x[1];
+  double offset1 = 0., zDUT1 = 0., deltaZ = 0., theta = 0.;
+  if(m == kOnePlane) {
+    theta = x[2];
+  } else if(m == kTwoPlanes) {
+    offset1 = x[2];
+    zDUT1 = x[3];
+    theta = x[4];
+  } else {
+    //same d1 position as the two-plane Utility::extrapolateTrackAtDUTwithAngles
+    deltaZ = x[2];
+    theta = x[3];
+    offset1 = offset0 + std::sin(theta)*deltaZ;
+    zDUT1 = zDUT0 + deltaZ*std::cos(theta);
+  }
+  if(m == kOnePlane) {
+    residuals(0, offset0, zDUT0, theta, res_[0]);
+    peak_[0] = findPeak(res_[0]);
+    if(!peak_[0].valid)  return false;
+  } else {
+    residuals(offset0, zDUT0, offset1, zDUT1, theta, res_[0], res_[1]);
+    peak_[0] = findPeak(res_[0]);
+    if(!peak_[0].valid)  return false;
+    peak_[1] = findPeak(res_[1]);
+    if(!peak_[1].valid)  return false;
+  }
+  //xTkAtDUT = (xTk + (zDUT - zFEI4)*dxdz + offset)/D with D = cos(theta) - dxdz*sin(theta), so
+  //d/doffset = 1/D, d/dzDUT = dxdz/D and d/dtheta = xTkAtDUT*dD/D with dD = sin(theta) + dxdz*cos(theta);
+  //the residual is xDUT - xTkAtDUT
+  const double c = std::cos(theta);
+  const double sn = std::sin(theta);
+  const double inv = 1./resTelescope;
+  const unsigned int n = res_[0].size();
+  const bool twoPlanes = (m != kOnePlane);
+  for(unsigned int i = 0; i < n; i++) {
+    double r0 = res_[0][i];
+    if(std::fabs(r0 - peak_[0].center) >= 3.*peak_[0].sigma)  continue;
+    double r1 = 0.;
+    if(twoPlanes) {
+      r1 = res_[1][i];
+      if(std::fabs(r1 - peak_[1].center) >= 3.*peak_[1].sigma)  continue;
+    }
+    f.push_back(r0*inv);
+    if(twoPlanes)  f.push_back(r1*inv);
+    if(!jac)  continue;
+    const double s = dxdz_[i];
+    const double D = c - s*sn;
+    const double dD = sn + s*c;
+    const double dOff = -inv/D;
+    const double dZ = -inv*s/D;
+    const double dTheta0 = -inv*(xDUT_[0][i] - r0)*dD/D;
+    if(m == kOnePlane) {
+      jac->insert(jac->end(), {dOff, dZ, dTheta0});
+      continue;
+    }
+    const double dTheta1 = -inv*(xDUT_[1][i] - r1)*dD/D;
+    if(m == kTwoPlanes) {
+      jac->insert(jac->end(), {dOff, dZ, 0., 0., dTheta0});
+      jac->insert(jac->end(), {0., 0., dOff, dZ, dTheta1});
+    } else {
+      //offset_d1 and zDUT_d1 move with deltaZ and theta
+      jac->insert(jac->end(), {dOff, dZ, 0., dTheta0});
+      jac->insert(jac->end(), {dOff, dZ, -inv*dD/D, dTheta1 - inv*deltaZ});
+    }
+  }
+  if(jac && jac->size() != f.size()*np)  return false;
+  return !f.empty();
+}
+
+double AlignmentChi2::chi2Gradient(Model m, const double* x, double* grad) const {
+  const unsigned int np = nPar(m);
+  for(unsigned int j = 0; j < np; j++)  grad[j] = 0.;
+  if(!windowedResiduals(m, x, f_, &jac_))  return m == kOnePlane ? 9999. : 99999.;
+  const double nTk = (m == kOnePlane) ? f_.size() : f_.size()/2;
+  for(unsigned int i = 0; i < f_.size(); i++)
+    for(unsigned int j = 0; j < np; j++)
+      grad[j] += f_[i]*jac_[i*np+j];
+  for(unsigned int j = 0; j < np; j++)  grad[j] *= 2./nTk;
+  return sumSquares(f_)/nTk;
+}
+
+AlignmentChi2::FitResult AlignmentChi2::fitLM(Model m, double* x, const double* lo, const double* hi, unsigned int maxIter) const {
+  FitResult res{m == kOnePlane ? 9999. : 99999., 0, 0, false};
+  const unsigned int np = nPar(m);
+  const unsigned int perTk = (m == kOnePlane) ? 1 : 2;
+  res.nCalls++;
+  if(!windowedResiduals(m, x, f_, &jac_))  return res;
+  double chi2 = sumSquares(f_)/(f_.size()/perTk);
+  std::vector<double> fTrial, jacTrial;
+  std::vector<double> A(np*np), g(np), Ad(np*np), step(np), xTrial(np);
+  double lambda = 1e-3;
+  for(res.nIter = 0; res.nIter < maxIter && !res.converged; res.nIter++) {
+    //normal equations of the windowed residuals
+    std::fill(A.begin(), A.end(), 0.);
+    std::fill(g.begin(), g.end(), 0.);
+    for(unsigned int i = 0; i < f_.size(); i++) {
+      const double* row = &jac_[i*np];
+      for(unsigned int j = 0; j < np; j++) {
+        g[j] -= row[j]*f_[i];
+        for(unsigned int k = 0; k < np; k++)  A[j*np+k] += row[j]*row[k];
+      }
+    }
+    bool accepted = false;
+    while(!accepted && lambda < lambdaMax) {
+      Ad = A;
+      step = g;
+      for(unsigned int j = 0; j < np; j++)  Ad[j*np+j] += lambda*(A[j*np+j] > 0. ? A[j*np+j] : 1.);
+      if(!solveLinear(Ad, step, np)) {
+        lambda *= 10.;
+        continue;
+      }
+      for(unsigned int j = 0; j < np; j++)  xTrial[j] = std::min(std::max(x[j] + step[j], lo[j]), hi[j]);
+      res.nCalls++;
+      if(windowedResiduals(m, xTrial.data(), fTrial, &jacTrial)) {
+        double chi2Trial = sumSquares(fTrial)/(fTrial.size()/perTk);
+        if(chi2Trial <= chi2) {
+          accepted = true;
+          res.converged = (chi2 - chi2Trial) < lmTolerance*(1. + chi2);
+          chi2 = chi2Trial;
+          std::copy(xTrial.begin(), xTrial.end(), x);
+          f_.swap(fTrial);
+          jac_.swap(jacTrial);
+          lambda = std::max(lambda/10., lambdaMin);
+          continue;
+        }
+      }
+      lambda *= 10.;
+    }
+    //no step lowers the chi2 any more
+    if(!accepted)  res.converged = true;
+  }
+  res.chi2 = chi2;
+  return res;
+}
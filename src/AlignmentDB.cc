@@ -0,0 +1,243 @@
+/*!
+        \file                AlignmentDB.cc
+        \brief               Binary alignment parameter store with lookup by run and version
+*/
+#include "AlignmentDB.h"
+#include "AlignmentFile.h"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+namespace {
+  const char magic[4] = {'T', 'B', 'A', 'D'};
+  const uint32_t formatVersion = 1;
+  //magic, format version, number of entries
+  const std::streamoff headerSize = 16;
+  //run, version, time and 8 doubles
+  const std::streamoff recordSize = 4 + 4 + 8 + 8*8;
+
+  template<class T> void put(std::ostream& out, const T& v) {
+    out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+  }
+  template<class T> void get(std::istream& in, T& v) {
+    in.read(reinterpret_cast<char*>(&v), sizeof(T));
+  }
+
+  void putEntry(std::ostream& out, const AlignmentDB::Entry& e) {
+    put(out, e.run);
+    put(out, e.version);
+    put(out, e.time);
+    put(out, e.offsetFEI4X);
+    put(out, e.offsetFEI4Y);
+    put(out, e.residualSigmaFEI4X);
+    put(out, e.residualSigmaFEI4Y);
+    put(out, e.zD0);
+    put(out, e.offsetD0);
+    put(out, e.deltaZ);
+    put(out, e.angle);
+  }
+
+  bool getEntry(std::istream& in, AlignmentDB::Entry& e) {
+    get(in, e.run);
+    get(in, e.version);
+    get(in, e.time);
+    get(in, e.offsetFEI4X);
+    get(in, e.offsetFEI4Y);
+    get(in, e.residualSigmaFEI4X);
+    get(in, e.residualSigmaFEI4Y);
+    get(in, e.zD0);
+    get(in, e.offsetD0);
+    get(in, e.deltaZ);
+    get(in, e.angle);
+    return static_cast<bool>(in);
+  }
+
+  //number of entries; false and an error message if the file is not an alignment DB
+  bool readHeader(std::istream& in, const std::string& file, uint64_t& n) {
+    char m[4];
+    uint32_t v = 0;
+    n = 0;
+    in.read(m, sizeof(m));
+    get(in, v);
+    get(in, n);
+    if(!in || !std::equal(m, m + 4, magic) || v != formatVersion) {
+      std::cerr << "Alignment DB " << file << " is not a version " << formatVersion << " alignment DB!" << std::endl;
+      return false;
+    }
+    return true;
+  }
+}
+
+bool AlignmentDB::read(const std::string& file) {
+  entries_.clear();
+  std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+  if(!in) {
+    std::cerr << "Alignment DB " << file << " could not be opened!" << std::endl;
+    return false;
+  }
+  uint64_t n = 0;
+  if(!readHeader(in, file, n))  return false;
+  entries_.resize(n);
+  for(auto& e : entries_) {
+    if(!getEntry(in, e)) {
+      std::cerr << "Alignment DB " << file << " is truncated!" << std::endl;
+      entries_.clear();
+      return false;
+    }
+  }
+  std::sort(entries_.begin(), entries_.end());
+  return true;
+}
+
+bool AlignmentDB::write(const std::string& file) const {
+  const std::string tmpName = file + ".tmp." + std::to_string(getpid());
+  bool ok = false;
+  {
+    std::ofstream out(tmpName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write(magic, sizeof(magic));
+    put(out, formatVersion);
+    put(out, static_cast<uint64_t>(entries_.size()));
+    for(const auto& e : entries_)
+      putEntry(out, e);
+    out.close();
+    ok = static_cast<bool>(out);
+  }
+  if(ok)  ok = (std::rename(tmpName.c_str(), file.c_str()) == 0);
+  if(!ok) {
+    std::cerr << "Alignment DB " << file << " could not be written!" << std::endl;
+    std::remove(tmpName.c_str());
+  }
+  return ok;
+}
+
+int AlignmentDB::latestVersion(int run) const {
+  Entry key;
+  key.run = run + 1;
+  key.version = 0;
+  auto it = std::lower_bound(entries_.begin(), entries_.end(), key);
+  if(it == entries_.begin() || (it - 1)->run != run)  return 0;
+  return (it - 1)->version;
+}
+
+int AlignmentDB::add(int run, const tbeam::alignmentPars& al, int version) {
+  Entry e;
+  e.run = run;
+  e.version = (version == kLatest) ? latestVersion(run) + 1 : version;
+  e.time = static_cast<int64_t>(std::time(nullptr));
+  e.offsetFEI4X = al.offsetFEI4x();
+  e.offsetFEI4Y = al.offsetFEI4y();
+  e.residualSigmaFEI4X = al.residualSigmaFEI4x();
+  e.residualSigmaFEI4Y = al.residualSigmaFEI4y();
+  e.zD0 = al.d0Z();
+  e.offsetD0 = al.d0Offset();
+  e.deltaZ = al.deltaZ();
+  e.angle = al.theta()*180./TMath::Pi();
+  //an existing version is replaced
+  auto it = std::lower_bound(entries_.begin(), entries_.end(), e);
+  if(it != entries_.end() && it->run == e.run && it->version == e.version)  *it = e;
+  else entries_.insert(it, e);
+  return e.version;
+}
+
+void AlignmentDB::toPars(const Entry& e, tbeam::alignmentPars& al) {
+  al.offsetFEI4x(e.offsetFEI4X);
+  al.offsetFEI4y(e.offsetFEI4Y);
+  al.residualSigmaFEI4x(e.residualSigmaFEI4X);
+  al.residualSigmaFEI4y(e.residualSigmaFEI4Y);
+  al.d0Z(e.zD0);
+  al.d0Offset(e.offsetD0);
+  al.deltaZ(e.deltaZ);
+  al.theta(e.angle);
+}
+
+bool AlignmentDB::find(int run, int version, tbeam::alignmentPars& al) const {
+  if(version == kLatest)  version = latestVersion(run);
+  Entry key;
+  key.run = run;
+  key.version = version;
+  auto it = std::lower_bound(entries_.begin(), entries_.end(), key);
+  if(it == entries_.end() || it->run != run || it->version != version)  return false;
+  toPars(*it, al);
+  return true;
+}
+
+int AlignmentDB::importText(const std::string& textFile) {
+  std::ifstream in(textFile.c_str());
+  if(!in) {
+    std::cerr << "Alignment File: " << textFile << " could not be opened!" << std::endl;
+    return 0;
+  }
+  int n = 0;
+  std::string line;
+  while(std::getline(in, line)) {
+    int run = AlignmentFile::runOfLine(line);
+    if(run < 0)  continue;
+    tbeam::alignmentPars al;
+    AlignmentFile::parse(line, al);
+    add(run, al);
+    n++;
+  }
+  return n;
+}
+
+bool AlignmentDB::lookup(const std::string& file, int run, int version, tbeam::alignmentPars& al, int* foundVersion) {
+  std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+  if(!in) {
+    std::cerr << "Alignment DB " << file << " could not be opened!" << std::endl;
+    return false;
+  }
+  uint64_t n = 0;
+  if(!readHeader(in, file, n))  return false;
+  //first entry after (run, version), the latest version is the one before (run+1, 0)
+  Entry key;
+  key.run = (version == kLatest) ? run + 1 : run;
+  key.version = (version == kLatest) ? 0 : version;
+  Entry e;
+  uint64_t lo = 0, hi = n;
+  while(lo < hi) {
+    uint64_t mid = lo + (hi - lo)/2;
+    in.seekg(headerSize + static_cast<std::streamoff>(mid)*recordSize);
+    if(!getEntry(in, e))  return false;
+    if(e < key)  lo = mid + 1;
+    else hi = mid;
+  }
+  uint64_t i = lo;
+  if(version == kLatest) {
+    if(i == 0)  return false;
+    i--;
+  } else if(i == n) return false;
+  in.seekg(headerSize + static_cast<std::streamoff>(i)*recordSize);
+  if(!getEntry(in, e) || e.run != run || (version != kLatest && e.version != version))  return false;
+  toPars(e, al);
+  if(foundVersion)  *foundVersion = e.version;
+  return true;
+}
+
+bool AlignmentDB::append(const std::string& file, const std::map<int, tbeam::alignmentPars>& pars, std::map<int, int>* versions) {
+  int lockFd = AlignmentFile::lock(file);
+  if(lockFd < 0)  return false;
+  AlignmentDB db;
+  std::ifstream test(file.c_str());
+  bool ok = !test || db.read(file);
+  test.close();
+  if(ok) {
+    for(const auto& p : pars) {
+      int v = db.add(p.first, p.second);
+      if(versions)  (*versions)[p.first] = v;
+    }
+    ok = db.write(file);
+  }
+  AlignmentFile::unlock(lockFd);
+  return ok;
+}
+
+int AlignmentDB::append(const std::string& file, int run, const tbeam::alignmentPars& al) {
+  std::map<int, tbeam::alignmentPars> pars;
+  pars[run] = al;
+  std::map<int, int> versions;
+  if(!append(file, pars, &versions))  return -1;
+  return versions[run];
+}
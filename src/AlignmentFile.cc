@@ -0,0 +1,124 @@
+/*!
+        \file                AlignmentFile.cc
+        \brief               Locked, atomic updates of the alignment parameter file
+*/
+#include "AlignmentFile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+std::string AlignmentFile::line(int run, const tbeam::alignmentPars& al) {
+  std::ostringstream l;
+  l << "Run=" << run
+    << ":offsetFEI4X=" << al.offsetFEI4x()
+    << ":offsetFEI4Y=" << al.offsetFEI4y()
+    << ":residualSigmaFEI4X=" << al.residualSigmaFEI4x()
+    << ":residualSigmaFEI4Y=" << al.residualSigmaFEI4y()
+    << ":zD0=" << al.d0Z()
+    << ":offsetD0=" << al.d0Offset()
+    << ":deltaZ=" << al.deltaZ()
+    << ":angle=" << al.theta()*180./TMath::Pi();
+  return l.str();
+}
+
+int AlignmentFile::runOfLine(const std::string& line) {
+  if(line.compare(0, 4, "Run=") != 0)  return -1;
+  return atoi(line.c_str() + 4);
+}
+
+void AlignmentFile::parse(const std::string& line, tbeam::alignmentPars& al) {
+  std::stringstream ss(line);
+  std::string token;
+  while(std::getline(ss, token, ':')) {
+    std::string::size_type eq = token.find('=');
+    if(eq == std::string::npos)  continue;
+    std::string key = token.substr(0, eq);
+    double value = std::atof(token.c_str() + eq + 1);
+    if(key=="offsetFEI4X") al.offsetFEI4x(value);
+    else if(key=="offsetFEI4Y") al.offsetFEI4y(value);
+    else if(key=="residualSigmaFEI4X") al.residualSigmaFEI4x(value);
+    else if(key=="residualSigmaFEI4Y") al.residualSigmaFEI4y(value);
+    else if(key=="zD0")  al.d0Z(value);
+    else if(key=="offsetD0")  al.d0Offset(value);
+    else if(key=="deltaZ")  al.deltaZ(value);
+    else if(key=="angle")  al.theta(value);
+  }
+}
+
+bool AlignmentFile::nearest(const std::string& file, int run, int& foundRun, tbeam::alignmentPars& al) {
+  std::ifstream in(file.c_str());
+  if(!in)  return false;
+  std::string line, bestLine;
+  int best = -1;
+  while(std::getline(in, line)) {
+    int r = runOfLine(line);
+    if(r < 0)  continue;
+    long d = std::labs(long(r) - run), dBest = std::labs(long(best) - run);
+    if(best < 0 || d < dBest || (d == dBest && r <= best)) {
+      best = r;
+      bestLine = line;
+    }
+  }
+  if(best < 0)  return false;
+  foundRun = best;
+  parse(bestLine, al);
+  return true;
+}
+
+int AlignmentFile::lock(const std::string& file) {
+  const std::string lockName = file + ".lock";
+  int fd = open(lockName.c_str(), O_RDWR | O_CREAT, 0644);
+  if(fd < 0 || flock(fd, LOCK_EX) != 0) {
+    std::cerr << "Alignment file lock " << lockName << " could not be taken!" << std::endl;
+    if(fd >= 0)  close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void AlignmentFile::unlock(int fd) {
+  if(fd < 0)  return;
+  flock(fd, LOCK_UN);
+  close(fd);
+}
+
+bool AlignmentFile::update(const std::string& file, const std::map<int, std::string>& lines, bool keepOthers) {
+  int lockFd = lock(file);
+  if(lockFd < 0)  return false;
+  //lines of the other runs, in their order
+  std::vector<std::string> content;
+  if(keepOthers) {
+    std::ifstream in(file.c_str());
+    std::string line;
+    while(std::getline(in, line)) {
+      if(line.empty())  continue;
+      if(lines.count(runOfLine(line)))  continue;
+      content.push_back(line);
+    }
+  }
+  for(const auto& l : lines)
+    content.push_back(l.second);
+
+  const std::string tmpName = file + ".tmp." + std::to_string(getpid());
+  bool ok = false;
+  {
+    std::ofstream out(tmpName.c_str(), std::ios::out | std::ios::trunc);
+    for(const auto& l : content)
+      out << l << "\n";
+    out.close();
+    ok = static_cast<bool>(out);
+  }
+  if(ok)  ok = (std::rename(tmpName.c_str(), file.c_str()) == 0);
+  if(!ok) {
+    std::cerr << "Alignment file " << file << " could not be written!" << std::endl;
+    std::remove(tmpName.c_str());
+  }
+  unlock(lockFd);
+  return ok;
+}
@@ -0,0 +1,76 @@
+/*!
+        \file                AlignmentFitter.cc
+        \brief               Constrained two-plane alignment fit of one run on its own Minuit2 instance
+*/
+#include "AlignmentFitter.h"
+#include "AlignmentGridScan.h"
+#include "Math/Functor.h"
+#include "TMath.h"
+#include <chrono>
+
+AlignmentFitter::AlignmentFitter(bool gridSeed) :
+  gridSeed_(gridSeed),
+  nCalls_(0),
+  minimizer_(ROOT::Minuit2::kMigrad)
+{
+  minimizer_.SetPrintLevel(0);
+}
+
+double AlignmentFitter::chi2(const double* x) const {
+  nCalls_++;
+  //same d1 position as AlignmentMultiDimAnalysis::ComputeChi2BothPlanes with the deltaZ constraint
+  const double theta = x[3];
+  return both_.chi2(x[0], x[1], x[0] + sin(theta)*x[2], x[1] + x[2]*cos(theta), theta);
+}
+
+AlignmentFitter::Result AlignmentFitter::fit(const AlignmentSample& s) {
+  auto t0 = std::chrono::steady_clock::now();
+  Result r{s.run, 0., 0., 0., 0., 0., -1, 0, 0.};
+  both_.setData(s.fei4Z, s.tkBoth, s.xBothD0, s.xBothD1);
+  double seed[4] = {s.offsetInitD0, 435., 2.65, TMath::ATan((s.offsetInitD1 - s.offsetInitD0)/2.6)};
+  if(gridSeed_) {
+    //zDUT from the grid of plane d0, then the constrained grid around it as in alignmentReco
+    AlignmentChi2 d0;
+    d0.setData(s.fei4Z, s.tkD0, s.xD0);
+    AlignmentGridScan gridD0(d0, AlignmentChi2::kOnePlane);
+    double zD0 = gridD0.run(1) ? gridD0.best().x[1] : seed[1];
+    AlignmentGridScan grid(both_, AlignmentChi2::kTwoPlanesDeltaZ);
+    grid.setAxes(AlignmentGridScan::Axis{std::min(std::max(zD0 - 20., 200.), 760.), 10., 5},
+                 AlignmentGridScan::Axis{-20.*TMath::Pi()/180., 2.*TMath::Pi()/180., 21},
+                 AlignmentGridScan::Axis{0., 0.5, 17}, 1, 0.);
+    if(grid.run(1))  std::copy(grid.best().x, grid.best().x + 4, seed);
+  }
+  nCalls_ = 0;
+  ROOT::Math::Functor f(this, &AlignmentFitter::chi2, 4);
+  minimizer_.Clear();
+  minimizer_.SetFunction(f);
+  minimizer_.SetLimitedVariable(0, "offset_d0", seed[0], 0.0001, -5., 5.);
+  minimizer_.SetLimitedVariable(1, "zDUT_d0", seed[1], 0.01, 200., 800.);
+  minimizer_.SetLimitedVariable(2, "deltaZ", seed[2], 0.01, 0., 8.);
+  minimizer_.SetLimitedVariable(3, "theta", seed[3], 0.01, -20.*TMath::Pi()/180., 20.*TMath::Pi()/180.);
+  minimizer_.Minimize();
+  const double* x = minimizer_.X();
+  r.offsetD0 = x[0];
+  r.zD0 = x[1];
+  r.deltaZ = x[2];
+  r.theta = x[3];
+  r.chi2 = chi2(x);
+  r.status = minimizer_.Status();
+  r.nCalls = nCalls_;
+  r.time = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  return r;
+}
+
+tbeam::alignmentPars AlignmentFitter::parameters(const AlignmentSample& s, const Result& r) {
+  tbeam::alignmentPars al;
+  al.FEI4z(s.fei4Z);
+  al.offsetFEI4x(s.offsetFEI4X);
+  al.offsetFEI4y(s.offsetFEI4Y);
+  al.residualSigmaFEI4x(s.residualSigmaFEI4X);
+  al.residualSigmaFEI4y(s.residualSigmaFEI4Y);
+  al.d0Z(r.zD0);
+  al.d0Offset(r.offsetD0);
+  al.deltaZ(r.deltaZ);
+  al.theta(r.theta*180./TMath::Pi());
+  return al;
+}
@@ -0,0 +1,131 @@
+/*!
+        \file                AlignmentGridScan.cc
+        \brief               Multi-threaded coarse grid of the fast alignment chi2 used to seed
+                             the Minuit fits of the DUT alignment
+*/
+#include "AlignmentGridScan.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace {
+  //chi2 of the grid points where the peak is not found, the failure value of AlignmentChi2
+  const double badChi2 = 9999.;
+}
+
+AlignmentGridScan::AlignmentGridScan(const AlignmentChi2& fc, AlignmentChi2::Model m) :
+  fc_(fc),
+  model_(m),
+  z_{200., 25., 25},
+  theta_{-20.*M_PI/180., 2.*M_PI/180., 21},
+  deltaZ_{0., 0.5, 17},
+  nOffset_(3),
+  offsetStep_(0.05),
+  time_(0.)
+{
+  best_ = Point{{0., 0., 0., 0.}, badChi2};
+}
+
+void AlignmentGridScan::setAxes(const Axis& z, const Axis& theta, const Axis& deltaZ, unsigned int nOffset, double offsetStep) {
+  z_ = z;
+  theta_ = theta;
+  deltaZ_ = deltaZ;
+  nOffset_ = nOffset > 0 ? nOffset : 1;
+  offsetStep_ = offsetStep;
+}
+
+void AlignmentGridScan::scanCell(const AlignmentChi2& fc, unsigned int cell, std::vector<double>& res) {
+  const unsigned int iz = cell/theta_.n;
+  const unsigned int it = cell%theta_.n;
+  const double z = z_.at(iz);
+  const double theta = theta_.at(it);
+  //the residuals move by about -offset/cos(theta) with the offset
+  fc.residuals(0, 0., z, theta, res);
+  AlignmentChi2::Peak p = fc.findPeak(res);
+  const double off0 = p.valid ? p.center*std::cos(theta) : 0.;
+  offset0_[cell] = off0;
+  for(unsigned int id = 0; id < deltaZ_.n; id++) {
+    for(unsigned int io = 0; io < nOffset_; io++) {
+      double& c = chi2_[index(iz, it, id, io)];
+      if(!p.valid) {
+        c = badChi2;
+        continue;
+      }
+      double off = off0 + (double(io) - 0.5*(nOffset_ - 1))*offsetStep_;
+      if(model_ == AlignmentChi2::kOnePlane) {
+        c = fc.chi2(off, z, theta);
+      } else {
+        //d1 as in ComputeChi2BothPlanes with the deltaZ constraint
+        double dz = deltaZ_.at(id);
+        c = fc.chi2(off, z, off + std::sin(theta)*dz, z + dz*std::cos(theta), theta);
+      }
+    }
+  }
+}
+
+bool AlignmentGridScan::run(unsigned int nThreads) {
+  auto t0 = std::chrono::steady_clock::now();
+  if(model_ == AlignmentChi2::kOnePlane)  deltaZ_.n = 1;
+  const unsigned int nCells = z_.n*theta_.n;
+  chi2_.assign(nCells*deltaZ_.n*nOffset_, badChi2);
+  offset0_.assign(nCells, 0.);
+  if(nThreads < 1)  nThreads = 1;
+  if(nThreads > nCells)  nThreads = nCells;
+  //the chi2 engine keeps its work arrays in the object, every thread scans with a copy
+  std::atomic<unsigned int> next(0);
+  auto work = [this, &next, nCells]() {
+    AlignmentChi2 fc(fc_);
+    std::vector<double> res;
+    for(unsigned int cell = next++; cell < nCells; cell = next++)
+      scanCell(fc, cell, res);
+  };
+  std::vector<std::thread> threads;
+  for(unsigned int i = 1; i < nThreads; i++)
+    threads.emplace_back(work);
+  work();
+  for(auto& t : threads)  t.join();
+
+  //lowest chi2, the first grid point on ties
+  best_ = Point{{0., 0., 0., 0.}, badChi2};
+  unsigned int ibest = chi2_.size();
+  for(unsigned int i = 0; i < chi2_.size(); i++)
+    if(chi2_[i] < best_.chi2) {
+      best_.chi2 = chi2_[i];
+      ibest = i;
+    }
+  time_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  if(ibest == chi2_.size())  return false;
+  const unsigned int io = ibest%nOffset_;
+  const unsigned int id = (ibest/nOffset_)%deltaZ_.n;
+  const unsigned int cell = ibest/(nOffset_*deltaZ_.n);
+  const double theta = theta_.at(cell%theta_.n);
+  const double off = offset0_[cell] + (double(io) - 0.5*(nOffset_ - 1))*offsetStep_;
+  best_.x[0] = off;
+  best_.x[1] = z_.at(cell/theta_.n);
+  if(model_ == AlignmentChi2::kOnePlane) {
+    best_.x[2] = theta;
+  } else {
+    best_.x[2] = deltaZ_.at(id);
+    best_.x[3] = theta;
+  }
+  return true;
+}
+
+std::vector<double> AlignmentGridScan::profileTheta() const {
+  std::vector<double> p(theta_.n, -1.);
+  for(unsigned int i = 0; i < chi2_.size(); i++) {
+    unsigned int it = (i/(nOffset_*deltaZ_.n))%theta_.n;
+    if(chi2_[i] < badChi2 && (p[it] < 0. || chi2_[i] < p[it]))  p[it] = chi2_[i];
+  }
+  return p;
+}
+
+std::vector<double> AlignmentGridScan::profileDeltaZ() const {
+  std::vector<double> p(deltaZ_.n, -1.);
+  for(unsigned int i = 0; i < chi2_.size(); i++) {
+    unsigned int id = (i/nOffset_)%deltaZ_.n;
+    if(chi2_[i] < badChi2 && (p[id] < 0. || chi2_[i] < p[id]))  p[id] = chi2_[i];
+  }
+  return p;
+}
@@ -15,18 +15,25 @@
 #include "TClass.h"
 #include "TDirectory.h"
 #include "TCanvas.h"
+#include "TStopwatch.h"
 #include <map>
 #include <utility>
 #include <vector>
 #include <sstream>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <thread>
 
 #include "Math/Functor.h"
 #include "Minuit2/Minuit2Minimizer.h"
 
 
 #include "AlignmentMultiDimAnalysis.h"
+#include "AlignmentGridScan.h"
+#include "AlignmentSample.h"
+#include "AlignmentFile.h"
+#include "AlignmentDB.h"
 
 using std::vector;
 using std::map;
@@ -35,10 +42,31 @@ using namespace std;
 AlignmentMultiDimAnalysis::AlignmentMultiDimAnalysis() :
   BeamAnaBase::BeamAnaBase(),
   isProduction_(false),
-  alignparFile_("alignmentParameters.txt")
+  keepOtherRuns_(false),
+  alignparFile_("alignmentParameters.txt"),
+  chi2Mode_(kChi2Fast),
+  minimizerMode_(kMigrad),
+  nChi2Calls_(0),
+  nGradCalls_(0),
+  gridScan_(false),
+  gridThreads_(std::thread::hardware_concurrency()),
+  sampleOnly_(false),
+  warmStart_(false),
+  warmSigmaTol_(0.04),
+  warmTol_(0.001),
+  earlyStop_(false)
 {
 }
 
+//everything but the FEI4 hit details
+std::vector<std::string> AlignmentMultiDimAnalysis::requiredBranches() const {
+  static const char* b[] = {
+    "DUT", "DUTFlat", "Condition", "TelescopeEvent", "goodEventFlag", "periodicityFlag",
+    "Fei4Event.nPixHits", "Fei4Event.row", "Fei4Event.col"
+  };
+  return std::vector<std::string>(b, b + sizeof(b)/sizeof(b[0]));
+}
+
 void AlignmentMultiDimAnalysis::beginJob() {
   BeamAnaBase::beginJob();
   hist_ = outFile();
@@ -59,18 +87,112 @@ void AlignmentMultiDimAnalysis::beginJob() {
     alignparFile_ = jobCardmap().at("alignmentOutputFile");
   if(jobCardmap().find("Run") != jobCardmap().end())
     runNumber_ = jobCardmap().at("Run");
+  if(nRuns() > 0)  runNumber_ = std::to_string(runNumber());
+  if(jobCardmap().find("alignmentChi2Mode") != jobCardmap().end()) {
+    const std::string& m = jobCardmap().at("alignmentChi2Mode");
+    if(m == "root")  chi2Mode_ = kChi2Root;
+    else if(m == "validate")  chi2Mode_ = kChi2Validate;
+    else if(m == "fast")  chi2Mode_ = kChi2Fast;
+    else  std::cerr << "Unknown alignmentChi2Mode " << m << ", using fast" << std::endl;
+  }
+  if(jobCardmap().find("alignmentMinimizer") != jobCardmap().end()) {
+    const std::string& m = jobCardmap().at("alignmentMinimizer");
+    if(m == "gradient")  minimizerMode_ = kMigradGradient;
+    else if(m == "lm")  minimizerMode_ = kLevenbergMarquardt;
+    else if(m == "compare")  minimizerMode_ = kCompareMinimizers;
+    else if(m == "migrad")  minimizerMode_ = kMigrad;
+    else  std::cerr << "Unknown alignmentMinimizer " << m << ", using migrad" << std::endl;
+  }
+  if(jobCardmap().find("alignmentGridScan") != jobCardmap().end())
+    gridScan_ = (atoi(jobCardmap().at("alignmentGridScan").c_str()) > 0) ? true : false;
+  if(jobCardmap().find("alignmentGridThreads") != jobCardmap().end())
+    gridThreads_ = atoi(jobCardmap().at("alignmentGridThreads").c_str());
+  if(gridThreads_ < 1)  gridThreads_ = 1;
+  if(jobCardmap().find("alignmentSampleFile") != jobCardmap().end())
+    sampleFile_ = jobCardmap().at("alignmentSampleFile");
+  if(jobCardmap().find("alignmentDB") != jobCardmap().end())
+    alignDB_ = jobCardmap().at("alignmentDB");
+  if(jobCardmap().find("alignmentWarmStart") != jobCardmap().end())
+    warmStart_ = (atoi(jobCardmap().at("alignmentWarmStart").c_str()) > 0) ? true : false;
+  if(jobCardmap().find("warmStartSigmaTolerance") != jobCardmap().end())
+    warmSigmaTol_ = std::atof(jobCardmap().at("warmStartSigmaTolerance").c_str());
+  if(jobCardmap().find("warmStartTolerance") != jobCardmap().end())
+    warmTol_ = std::atof(jobCardmap().at("warmStartTolerance").c_str());
+  if(jobCardmap().find("alignmentSampleOnly") != jobCardmap().end())
+    sampleOnly_ = (atoi(jobCardmap().at("alignmentSampleOnly").c_str()) > 0) ? true : false;
+  if(sampleOnly_ && sampleFile_.empty()) {
+    std::cerr << "alignmentSampleOnly=1 needs alignmentSampleFile, the fits are done" << std::endl;
+    sampleOnly_ = false;
+  }
+  //the derivatives are those of the fast chi2
+  if(minimizerMode_ != kMigrad && chi2Mode_ != kChi2Fast) {
+    std::cerr << "alignmentMinimizer other than migrad needs alignmentChi2Mode=fast, using migrad" << std::endl;
+    minimizerMode_ = kMigrad;
+  }
+
+  //one set of minimizers for all the runs of the job
+  toMinimize.reset(new ROOT::Math::Functor(this, &AlignmentMultiDimAnalysis::ComputeChi2, 3));
+  minimizer.reset(new ROOT::Minuit2::Minuit2Minimizer( ROOT::Minuit2::kMigrad ));
+  minimizer->SetPrintLevel(0);
+  minimizer->SetFunction(*toMinimize);
+
+  toMinimizeBothPlanes.reset(new ROOT::Math::Functor(this, &AlignmentMultiDimAnalysis::ComputeChi2BothPlanes, 5));
+  minimizerBothPlanes.reset(new ROOT::Minuit2::Minuit2Minimizer( ROOT::Minuit2::kMigrad ));
+  minimizerBothPlanes->SetPrintLevel(0);
+  minimizerBothPlanes->SetFunction(*toMinimizeBothPlanes);
+
+  toMinimizeBothPlanesConstraint.reset(new ROOT::Math::Functor(this, &AlignmentMultiDimAnalysis::ComputeChi2BothPlanes, 4));
+  minimizerBothPlanesConstraint.reset(new ROOT::Minuit2::Minuit2Minimizer( ROOT::Minuit2::kMigrad ));
+  minimizerBothPlanesConstraint->SetPrintLevel(0);
+  minimizerBothPlanesConstraint->SetFunction(*toMinimizeBothPlanesConstraint);
+
+  //same chi2 with the analytic gradient of the fast evaluation, for alignmentMinimizer=gradient|compare
+  toMinimizeGrad.reset(new ROOT::Math::GradFunctor(this, &AlignmentMultiDimAnalysis::ComputeChi2,
+                                                    &AlignmentMultiDimAnalysis::ComputeChi2Derivative, 3));
+  toMinimizeBothPlanesGrad.reset(new ROOT::Math::GradFunctor(this, &AlignmentMultiDimAnalysis::ComputeChi2BothPlanes,
+                                                              &AlignmentMultiDimAnalysis::ComputeChi2BothPlanesDerivative, 5));
+  toMinimizeBothPlanesConstraintGrad.reset(new ROOT::Math::GradFunctor(this, &AlignmentMultiDimAnalysis::ComputeChi2BothPlanes,
+                                                                        &AlignmentMultiDimAnalysis::ComputeChi2BothPlanesDerivative, 4));
   
   std::cout << "Additional Parameter specific to AlignmentReco>>" 
             << "\nisProductionMode:" << isProduction_
             << "\nalignparameterOutputFile:" << alignparFile_
+            << "\nalignmentChi2Mode:" << chi2Mode_
+            << "\nalignmentMinimizer:" << minimizerMode_
+            << "\nalignmentGridScan:" << gridScan_
+            << "\nalignmentWarmStart:" << warmStart_
+            << "\nalignmentSampleFile:" << sampleFile_
+            << "\nalignmentDB:" << alignDB_
             << std::endl;
 
 } 
 
+void AlignmentMultiDimAnalysis::beginRun() {
+  nEntries_ = analysisTree()->GetEntries();
+  runNumber_ = std::to_string(runNumber());
+  //the following runs of the list keep the lines written by the first one
+  keepOtherRuns_ = !isFirstRun();
+}
+
 void AlignmentMultiDimAnalysis::bookHistograms() {
   hist_->bookEventHistograms();
   hist_->bookTelescopeAnalysisHistograms();
   hist_->bookTrackFitHistograms(zMin, zStep, zNsteps);
+  //resolve handles for the event loop
+  evH_ = hist_->eventHistos();
+  tH_ = hist_->telescopeHistos();
+  fitH_.d0_1tk1ClusterBothPlanesConstraint_diffX_aligned = hist_->hist1D("TrackFit","d0_1tk1ClusterBothPlanesConstraint_diffX_aligned");
+  fitH_.d0_1tk1ClusterBothPlanes_diffX_aligned = hist_->hist1D("TrackFit","d0_1tk1ClusterBothPlanes_diffX_aligned");
+  fitH_.d0_1tk1Hit_diffX = hist_->hist1D("TrackFit","d0_1tk1Hit_diffX");
+  fitH_.d0_1tk1Hit_diffX_aligned = hist_->hist1D("TrackFit","d0_1tk1Hit_diffX_aligned");
+  fitH_.d0_1tk1Hit_diffX_bis = hist_->hist1D("TrackFit","d0_1tk1Hit_diffX_bis");
+  fitH_.d0_1tk1Hit_diffX_ter = hist_->hist1D("TrackFit","d0_1tk1Hit_diffX_ter");
+  fitH_.d1_1tk1ClusterBothPlanesConstraint_diffX_aligned = hist_->hist1D("TrackFit","d1_1tk1ClusterBothPlanesConstraint_diffX_aligned");
+  fitH_.d1_1tk1ClusterBothPlanes_diffX_aligned = hist_->hist1D("TrackFit","d1_1tk1ClusterBothPlanes_diffX_aligned");
+  fitH_.d1_1tk1Hit_diffX = hist_->hist1D("TrackFit","d1_1tk1Hit_diffX");
+  fitH_.d1_1tk1Hit_diffX_aligned = hist_->hist1D("TrackFit","d1_1tk1Hit_diffX_aligned");
+  fitH_.d1_1tk1Hit_diffX_bis = hist_->hist1D("TrackFit","d1_1tk1Hit_diffX_bis");
+  fitH_.d1_1tk1Hit_diffX_ter = hist_->hist1D("TrackFit","d1_1tk1Hit_diffX_ter");
 }
 
 void AlignmentMultiDimAnalysis::eventLoop()
@@ -85,22 +207,6 @@ void AlignmentMultiDimAnalysis::eventLoop()
   bothPlanes_DutXposD0.clear();
   bothPlanes_DutXposD1.clear();
 
-  toMinimize = new ROOT::Math::Functor(this, &AlignmentMultiDimAnalysis::ComputeChi2, 3);
-  minimizer = new ROOT::Minuit2::Minuit2Minimizer( ROOT::Minuit2::kMigrad );
-  minimizer->SetPrintLevel(0);
-  minimizer->SetFunction(*toMinimize);
-
-  toMinimizeBothPlanes = new ROOT::Math::Functor(this, &AlignmentMultiDimAnalysis::ComputeChi2BothPlanes, 5);
-  minimizerBothPlanes = new ROOT::Minuit2::Minuit2Minimizer( ROOT::Minuit2::kMigrad );
-  minimizerBothPlanes->SetPrintLevel(0);
-  minimizerBothPlanes->SetFunction(*toMinimizeBothPlanes);
-
-  toMinimizeBothPlanesConstraint = new ROOT::Math::Functor(this, &AlignmentMultiDimAnalysis::ComputeChi2BothPlanes, 4);
-  minimizerBothPlanesConstraint = new ROOT::Minuit2::Minuit2Minimizer( ROOT::Minuit2::kMigrad );
-  minimizerBothPlanesConstraint->SetPrintLevel(0);
-  minimizerBothPlanesConstraint->SetFunction(*toMinimizeBothPlanesConstraint);
-
-
   if (!doTelMatching() || !hasTelescope()) return;
   //First do telescope-fei4 matching 
   al = aLparameteres();
@@ -120,88 +226,78 @@ void AlignmentMultiDimAnalysis::eventLoop()
 	    << std::endl;
   //First Loop over events-inject z and compute residual
   //evaluate the best z alignment
-  for (Long64_t jentry=0; jentry<nEntries_;jentry++) {
-    clearEvent();
-    Long64_t ientry = analysisTree()->GetEntry(jentry);
-    if (ientry < 0) break;
+  //the events were cached with their DUT content by doTelescopeAnalysis
+  bool fromCache = eventCache().covers(0, nEntries_);
+  const Long64_t nLoop = fromCache ? eventCache().size() : nEntries_;
+  for (Long64_t jentry=0; jentry<nLoop;jentry++) {
+    if(!fromCache) {
+      clearEvent();
+      Long64_t ientry = readEntry(jentry);
+      if (ientry < 0) break;
+      eventCache().clear(jentry);
+      cacheEvent(isGoodEvent() && fei4Ev()->nPixHits == 1);
+    }
+    const EventCache::Event ev = fromCache ? eventCache().event(jentry) : eventCache().last();
     if (jentry%1000 == 0) {
-       cout << " Events processed. " << std::setw(8) << jentry 
+       cout << " Events processed. " << std::setw(8) << ev.entry
 	    << endl;
     }
     if(jentry==0) {
-      hist_->fillHist1D("EventInfo","hvSettings", condEv()->HVsettings);
-      hist_->fillHist1D("EventInfo","dutAngle", condEv()->DUTangle);
-      hist_->fillHist1D("EventInfo","vcth", condEv()->vcth);
+      const tbeam::condEvent& cond = eventCache().firstCondition();
+      hist_->fillHist1D("EventInfo","hvSettings", cond.HVsettings);
+      hist_->fillHist1D("EventInfo","dutAngle", cond.DUTangle);
+      hist_->fillHist1D("EventInfo","vcth", cond.vcth);
       hist_->fillHist1D("EventInfo","offset", cbcOffset1());
       hist_->fillHist1D("EventInfo","offset", cbcOffset2());
       hist_->fillHist1D("EventInfo","window", stubWindow());
-      hist_->fillHist1D("EventInfo","tilt", static_cast<unsigned long int>(condEv()->tilt));
+      hist_->fillHist1D("EventInfo","tilt", static_cast<unsigned long int>(cond.tilt));
     }
-    hist_->fillHist1D("EventInfo","isPeriodic",isPeriodic());
-    hist_->fillHist1D("EventInfo","isGoodFlag",isGoodEvent());
-    
-    if(!isGoodEvent())   continue;
+    if(!ev.isGood)   continue;
    
-    if(fei4Ev()->nPixHits != 1)    continue;
+    if(ev.nPixHits != 1)    continue;
  
-    hist_->fillHist1D("EventInfo","condData", condEv()->condData);
-    hist_->fillHist1D("EventInfo","tdcPhase", static_cast<unsigned int>(condEv()->tdcPhase));
+    hist_->fillHist1D(evH_.condData, ev.condData);
+    hist_->fillHist1D(evH_.tdcPhase, ev.tdcPhase);
     
-    setDetChannelVectors();
-    const auto& d0c0 = *det0C0();
-    const auto& d0c1 = *det0C1();
-    const auto& d1c0 = *det1C0();
-    const auto& d1c1 = *det1C1();
- 
-    //Remove track duplicates 
-    std::vector<tbeam::Track>  tkNoOv;
-    Utility::removeTrackDuplicates(telEv(), tkNoOv);
-	
-    //Match with FEI4
-    std::vector<tbeam::Track>  selectedTk;
-    Utility::cutTrackFei4Residuals(fei4Ev(), tkNoOv, selectedTk, al.offsetFEI4x(), al.offsetFEI4y(), al.residualSigmaFEI4x(), al.residualSigmaFEI4y(), true); 
+    //Match with FEI4, tracks in the cache are already free of duplicates
+    std::vector<unsigned int>  selectedTk;
+    Utility::cutTrackFei4Residuals(ev.row, ev.col, ev.nFei4, ev.tkX, ev.tkY, ev.nTk, selectedTk, al.offsetFEI4x(), al.offsetFEI4y(), al.residualSigmaFEI4x(), al.residualSigmaFEI4y(), true); 
     //Find mean of residuals, scanning zDUT      
     if (selectedTk.size()!=1) continue;
-    //cout << "NHits: d0, "<<d0c0.size()<<" ; d1, "<<d1c0.size()<<endl;
-    if (d0c0.size()==1) {
-      for (unsigned int ih=0; ih<d0c0.size(); ih++){
-        float xDUT = (d0c0.at(ih) - nstrips()/2) * dutpitch();
-        selectedTk_d0_1Hit.push_back(selectedTk[0]);
-        d0_DutXpos.push_back(xDUT);
-	float xTkAtDUT = selectedTk[0].xPos + (DUT_z- al.FEI4z())*selectedTk[0].dxdz;
-        hist_->fillHist1D("TrackFit","d0_1tk1Hit_diffX_bis", xDUT-xTkAtDUT);
-	DUT_z_try = zMin; //300
-      }
+    const tbeam::Track tk = ev.track(selectedTk[0]);
+    if (ev.nHitD0==1) {
+      float xDUT = (ev.hitD0[0] - nstrips()/2) * dutpitch();
+      selectedTk_d0_1Hit.push_back(tk);
+      d0_DutXpos.push_back(xDUT);
+      float xTkAtDUT = tk.xPos + (DUT_z- al.FEI4z())*tk.dxdz;
+      hist_->fillHist1D(fitH_.d0_1tk1Hit_diffX_bis, xDUT-xTkAtDUT);
+      DUT_z_try = zMin; //300
     }
-    if (d1c0.size()==1){
-      for (unsigned int ih=0; ih<d1c0.size(); ih++){
-        float xDUT = (d1c0.at(ih) - nstrips()/2) * dutpitch();
-        selectedTk_d1_1Hit.push_back(selectedTk[0]);
-        d1_DutXpos.push_back(xDUT);
-	float xTkAtDUT = selectedTk[0].xPos + (DUT_z- al.FEI4z())*selectedTk[0].dxdz;
-        //xTkAtDUT = -1.*xTkAtDUT;
-        hist_->fillHist1D("TrackFit","d1_1tk1Hit_diffX_bis", xDUT-xTkAtDUT);
-	DUT_z_try = zMin;//300;
-      }
+    if (ev.nHitD1==1){
+      float xDUT = (ev.hitD1[0] - nstrips()/2) * dutpitch();
+      selectedTk_d1_1Hit.push_back(tk);
+      d1_DutXpos.push_back(xDUT);
+      float xTkAtDUT = tk.xPos + (DUT_z- al.FEI4z())*tk.dxdz;
+      hist_->fillHist1D(fitH_.d1_1tk1Hit_diffX_bis, xDUT-xTkAtDUT);
+      DUT_z_try = zMin;//300;
     }
-    if (dutRecoClmap()->at("det0C0").size()==1 && dutRecoClmap()->at("det1C0").size()==1){
-      double D0xDUT;
-      double D1xDUT;
-      for(auto& cl : dutRecoClmap()->at("det0C0") ) {
-        D0xDUT = (cl.x-nstrips()/2)*dutpitch();
-      }
-      for(auto& cl : dutRecoClmap()->at("det1C0") ) {
-        D1xDUT = (cl.x-nstrips()/2)*dutpitch();
-      }
-      float xTkAtDUT = selectedTk[0].xPos + (DUT_z-al.FEI4z())*selectedTk[0].dxdz;
-      selectedTk_bothPlanes_1Cls.push_back(selectedTk[0]);
+    if (ev.nClsD0==1 && ev.nClsD1==1){
+      double D0xDUT = (ev.clsXD0[0]-nstrips()/2)*dutpitch();
+      double D1xDUT = (ev.clsXD1[0]-nstrips()/2)*dutpitch();
+      float xTkAtDUT = tk.xPos + (DUT_z-al.FEI4z())*tk.dxdz;
+      selectedTk_bothPlanes_1Cls.push_back(tk);
       bothPlanes_DutXposD0.push_back(D0xDUT);
       bothPlanes_DutXposD1.push_back(D1xDUT);
-      hist_->fillHist1D("TrackFit","d0_1tk1Hit_diffX_ter", D0xDUT-xTkAtDUT);
-      hist_->fillHist1D("TrackFit","d1_1tk1Hit_diffX_ter", D1xDUT-xTkAtDUT);
+      hist_->fillHist1D(fitH_.d0_1tk1Hit_diffX_ter, D0xDUT-xTkAtDUT);
+      hist_->fillHist1D(fitH_.d1_1tk1Hit_diffX_ter, D1xDUT-xTkAtDUT);
     }
   }//End of First Loop
 
+  //flat copies for the fast chi2
+  fastD0_.setData(al.FEI4z(), selectedTk_d0_1Hit, d0_DutXpos);
+  fastD1_.setData(al.FEI4z(), selectedTk_d1_1Hit, d1_DutXpos);
+  fastBoth_.setData(al.FEI4z(), selectedTk_bothPlanes_1Cls, bothPlanes_DutXposD0, bothPlanes_DutXposD1);
+
   TH1* hTmp = dynamic_cast<TH1I*>(hist_->GetHistoByName("TrackFit", "d0_1tk1Hit_diffX_bis"));
   TF1* fGausExtractedX = new TF1("fGausExtractedX", Utility::FuncPol1Gaus, -10, 10, 5);
   double offset_init_d0 = ((float)hTmp->GetMaximumBin())*(hTmp->GetXaxis()->GetXmax()-hTmp->GetXaxis()->GetXmin())/((float)hTmp->GetNbinsX()) + hTmp->GetXaxis()->GetXmin();//hTmp->GetMean();
@@ -232,125 +328,139 @@ void AlignmentMultiDimAnalysis::eventLoop()
   offset_init_d1 = fGausExtractedX->GetParameter(1);
   cout << "offset_init_d1="<<offset_init_d1<<endl;
 
+  //selected tracks for alignmentFitRuns
+  if(!sampleFile_.empty()) {
+    AlignmentSample sample;
+    sample.run = atoi(runNumber_.c_str());
+    sample.fei4Z = al.FEI4z();
+    sample.offsetFEI4X = al.offsetFEI4x();
+    sample.offsetFEI4Y = al.offsetFEI4y();
+    sample.residualSigmaFEI4X = al.residualSigmaFEI4x();
+    sample.residualSigmaFEI4Y = al.residualSigmaFEI4y();
+    sample.offsetInitD0 = offset_init_d0;
+    sample.offsetInitD1 = offset_init_d1;
+    sample.tkD0 = selectedTk_d0_1Hit;
+    sample.xD0 = d0_DutXpos;
+    sample.tkD1 = selectedTk_d1_1Hit;
+    sample.xD1 = d1_DutXpos;
+    sample.tkBoth = selectedTk_bothPlanes_1Cls;
+    sample.xBothD0 = bothPlanes_DutXposD0;
+    sample.xBothD1 = bothPlanes_DutXposD1;
+    std::string fname = sampleFileName();
+    if(sample.write(fname))
+      cout << "Alignment sample of run " << sample.run << " written to " << fname << ": " << sample.tkD0.size() << " d0, "
+           << sample.tkD1.size() << " d1, " << sample.tkBoth.size() << " both planes" << endl;
+    if(sampleOnly_)  return;
+  }
+
+  //start values of the fits, from the grid of the fast chi2 with alignmentGridScan=1
+  double seedD0[3] = {offset_init_d0, 435., 0.};
+  double seedD1[3] = {offset_init_d1, 435., 0.};
+  double seedBothPlanes[5] = {offset_init_d0, 435., offset_init_d1, 435., 0.};
+  double seedConstraint[4] = {offset_init_d0, 435., 2.65, TMath::ATan((offset_init_d1-offset_init_d0)/2.6)};
+  //or from the alignment of the nearest run with alignmentWarmStart=1, the grid is then only used without one
+  bool skipSinglePlane = false;
+  earlyStop_ = warmStart_ && warmSeeds(seedD0, seedD1, seedBothPlanes, seedConstraint, skipSinglePlane);
+  if(gridScan_ && !earlyStop_)  gridSeeds(seedD0, seedD1, seedBothPlanes, seedConstraint);
+
   doD0 = true;
   doD1 = false;
   double chi2 = 0;
-  minimizer->SetLimitedVariable(0, "offset", offset_init_d0, 0.0001, -5., 5.);
-  minimizer->SetLimitedVariable(1, "zDUT", 435., 0.01, 200., 800.);
-  minimizer->SetLimitedVariable(2, "theta", 0.*TMath::Pi()/180., 0.01, -90.*TMath::Pi()/180., 90.*TMath::Pi()/180.);
-
-  cout << "DUT d0: Start chi2 minimization"<<endl;
-  minimizer->Minimize();
-  const double *resultMinimizerD0 = minimizer->X();
-  double *resultD0 = new double[3];
-  resultD0[0] = resultMinimizerD0[0];
-  resultD0[1] = resultMinimizerD0[1];
-  resultD0[2] = resultMinimizerD0[2];
+  std::vector<FitVar> vars = {{"offset", seedD0[0], 0.0001, -5., 5.},
+                              {"zDUT", seedD0[1], 0.01, 200., 800.},
+                              {"theta", seedD0[2], 0.01, -90.*TMath::Pi()/180., 90.*TMath::Pi()/180.}};
+
+  double resultD0[3];
+  if(skipSinglePlane) {
+    cout << "DUT d0: fit skipped, the residuals of the previous alignment are within tolerance"<<endl;
+    std::copy(seedD0, seedD0 + 3, resultD0);
+  } else {
+    cout << "DUT d0: Start chi2 minimization"<<endl;
+    minimize("D0", minimizer.get(), *toMinimize, *toMinimizeGrad, AlignmentChi2::kOnePlane, vars, resultD0);
+  }
   double chi2D0 = ComputeChi2(resultD0);
   cout << "D0 offset="<< resultD0[0]<<" zDUT="<<resultD0[1]<<" theta="<<resultD0[2]*180./TMath::Pi()<<" chi2="<<chi2D0<<endl;
 
-  for (unsigned int i=0; i<selectedTk_d0_1Hit.size(); i++){
-    double xDUT_d0 =   d0_DutXpos.at(i);
-    double xTkAtDUT_d0 = Utility::extrapolateTrackAtDUTwithAngles(selectedTk_d0_1Hit.at(i), al.FEI4z(), resultD0[0], resultD0[1], resultD0[2]);
-    double resDUT_d0 = xDUT_d0 - xTkAtDUT_d0;
-    hist_->fillHist1D("TrackFit","d0_1tk1Hit_diffX_aligned", resDUT_d0);
-  }  
+  //residuals at the result, from the flat track copies
+  std::vector<double> resD0, resD1;
+  fastD0_.residuals(0, resultD0[0], resultD0[1], resultD0[2], resD0);
+  for (auto resDUT_d0 : resD0)
+    hist_->fillHist1D(fitH_.d0_1tk1Hit_diffX_aligned, resDUT_d0);
 
 
   doD0 = false;
   doD1 = true;
-  minimizer->Clear();
-  minimizer->SetLimitedVariable(0, "offset", offset_init_d1, 0.0001, -5., 5.);
-  minimizer->SetLimitedVariable(1, "zDUT", 435., 0.01, 200., 800.);
-  minimizer->SetLimitedVariable(2, "theta", 0.*TMath::Pi()/180., 0.01, -90.*TMath::Pi()/180., 90.*TMath::Pi()/180.);
-
-  cout << "DUT d1: Start chi2 minimization"<<endl;
-  minimizer->Minimize();
-  const double *resultMinimizerD1 = minimizer->X();
-  double* resultD1 = new double[3];
-  resultD1[0] = resultMinimizerD1[0];
-  resultD1[1] = resultMinimizerD1[1];
-  resultD1[2] = resultMinimizerD1[2];
+  for(unsigned int i = 0; i < 3; i++)  vars[i].init = seedD1[i];
+
+  double resultD1[3];
+  if(skipSinglePlane) {
+    cout << "DUT d1: fit skipped, the residuals of the previous alignment are within tolerance"<<endl;
+    std::copy(seedD1, seedD1 + 3, resultD1);
+  } else {
+    cout << "DUT d1: Start chi2 minimization"<<endl;
+    minimize("D1", minimizer.get(), *toMinimize, *toMinimizeGrad, AlignmentChi2::kOnePlane, vars, resultD1);
+  }
   double chi2D1 = ComputeChi2(resultD1);
   cout << "D1 offset="<< resultD1[0]<<" zDUT="<<resultD1[1]<<" theta="<<resultD1[2]*180./TMath::Pi()<<" chi2="<<chi2D1<<endl;
 
-  for (unsigned int i=0; i<selectedTk_d1_1Hit.size(); i++){
-    double xDUT_d1 =   d1_DutXpos.at(i);
-    double xTkAtDUT_d1 = Utility::extrapolateTrackAtDUTwithAngles(selectedTk_d1_1Hit.at(i), al.FEI4z(), resultD1[0], resultD1[1], resultD1[2]);
-    double resDUT_d1 = xDUT_d1 - xTkAtDUT_d1;
-    hist_->fillHist1D("TrackFit","d1_1tk1Hit_diffX_aligned", resDUT_d1);
-  }
+  fastD1_.residuals(0, resultD1[0], resultD1[1], resultD1[2], resD1);
+  for (auto resDUT_d1 : resD1)
+    hist_->fillHist1D(fitH_.d1_1tk1Hit_diffX_aligned, resDUT_d1);
 
 
   doConstrainDeltaOffset = false;
   doD0 = true;
   doD1 = true;
-  minimizerBothPlanes->Clear();
-  minimizerBothPlanes->SetLimitedVariable(0, "offset_d0", offset_init_d0, 0.0001, -5., 5.);
-  minimizerBothPlanes->SetLimitedVariable(1, "zDUT_d0", 435., 0.01, 200., 800.);
-  minimizerBothPlanes->SetLimitedVariable(2, "offset_d1", offset_init_d1, 0.0001, -5., 5.);
-  minimizerBothPlanes->SetLimitedVariable(3, "zDUT_d1", 435., 0.01, 200., 800.);
-  minimizerBothPlanes->SetLimitedVariable(4, "theta", 0., 0.01, -20.*TMath::Pi()/180., 20.*TMath::Pi()/180.);
+  vars = {{"offset_d0", seedBothPlanes[0], 0.0001, -5., 5.},
+          {"zDUT_d0", seedBothPlanes[1], 0.01, 200., 800.},
+          {"offset_d1", seedBothPlanes[2], 0.0001, -5., 5.},
+          {"zDUT_d1", seedBothPlanes[3], 0.01, 200., 800.},
+          {"theta", seedBothPlanes[4], 0.01, -20.*TMath::Pi()/180., 20.*TMath::Pi()/180.}};
 
   cout << "DUT both planes: Start chi2 minimization"<<endl;
-  minimizerBothPlanes->Minimize();
-  const double *resultMinimizerBothPlanes = minimizerBothPlanes->X();
-  double* resultBothPlanes = new double[5];
-  resultBothPlanes[0] = resultMinimizerBothPlanes[0];
-  resultBothPlanes[1] = resultMinimizerBothPlanes[1];
-  resultBothPlanes[2] = resultMinimizerBothPlanes[2];
-  resultBothPlanes[3] = resultMinimizerBothPlanes[3];
-  resultBothPlanes[4] = resultMinimizerBothPlanes[4];
+  double resultBothPlanes[5];
+  minimize("BothPlanes", minimizerBothPlanes.get(), *toMinimizeBothPlanes, *toMinimizeBothPlanesGrad, AlignmentChi2::kTwoPlanes, vars, resultBothPlanes);
   double chi2BothPlanes = ComputeChi2BothPlanes(resultBothPlanes);
   cout << "BothPlanes offset_d0="<< resultBothPlanes[0]<<" zDUT_d0="<<resultBothPlanes[1]<<" offset_d1="<< resultBothPlanes[2]<<" zDUT_d1="<<resultBothPlanes[3] << " theta="<<resultBothPlanes[4]*180./TMath::Pi()<< " chi2="<<chi2BothPlanes<<endl;
   
-  for (unsigned int i=0; i<selectedTk_bothPlanes_1Cls.size(); i++){
-    double xDUT_d0 =   bothPlanes_DutXposD0.at(i);
-    double xTkAtDUT_d0 = Utility::extrapolateTrackAtDUTwithAngles(selectedTk_bothPlanes_1Cls.at(i), al.FEI4z(), resultBothPlanes[0], resultBothPlanes[1], resultBothPlanes[4]);
-    double resDUT_d0 = xDUT_d0 - xTkAtDUT_d0;
-    hist_->fillHist1D("TrackFit","d0_1tk1ClusterBothPlanes_diffX_aligned", resDUT_d0);
-
-    double xDUT_d1 =   bothPlanes_DutXposD1.at(i);
-    double xTkAtDUT_d1 = Utility::extrapolateTrackAtDUTwithAngles(selectedTk_bothPlanes_1Cls.at(i), al.FEI4z(), resultBothPlanes[2], resultBothPlanes[3], resultBothPlanes[4]);
-    double resDUT_d1 = xDUT_d1 - xTkAtDUT_d1;
-    hist_->fillHist1D("TrackFit","d1_1tk1ClusterBothPlanes_diffX_aligned", resDUT_d1);
+  fastBoth_.residuals(resultBothPlanes[0], resultBothPlanes[1], resultBothPlanes[2], resultBothPlanes[3], resultBothPlanes[4], resD0, resD1);
+  for (unsigned int i=0; i<resD0.size(); i++){
+    hist_->fillHist1D(fitH_.d0_1tk1ClusterBothPlanes_diffX_aligned, resD0[i]);
+    hist_->fillHist1D(fitH_.d1_1tk1ClusterBothPlanes_diffX_aligned, resD1[i]);
   }
 
 
   doConstrainDeltaOffset = true;
   doD0 = true;
   doD1 = true;
-  minimizerBothPlanesConstraint->Clear();
-  minimizerBothPlanesConstraint->SetLimitedVariable(0, "offset_d0", offset_init_d0, 0.0001, -5., 5.);
-  //minimizerBothPlanesConstraint->SetLimitedVariable(0, "offset_d0", resultBothPlanes[0], 0.0001, -5., 5.);
-  minimizerBothPlanesConstraint->SetLimitedVariable(1, "zDUT_d0", 435., 0.01, 200., 800.);
-  //minimizerBothPlanesConstraint->SetLimitedVariable(1, "zDUT_d0", resultBothPlanes[1], 0.01, 200., 800.);
-  minimizerBothPlanesConstraint->SetLimitedVariable(2, "deltaZ", 2.65, 0.01, 0., 8.);
-  //minimizerBothPlanesConstraint->SetFixedVariable(2, "deltaZ", 2.6);
-  minimizerBothPlanesConstraint->SetLimitedVariable(3, "theta", TMath::ATan((offset_init_d1-offset_init_d0)/2.6), 0.01, -20.*TMath::Pi()/180., 20.*TMath::Pi()/180.);
-  //minimizerBothPlanesConstraint->SetLimitedVariable(3, "theta", resultBothPlanes[4], 0.01, -20.*TMath::Pi()/180., 20.*TMath::Pi()/180.);
+  vars = {{"offset_d0", seedConstraint[0], 0.0001, -5., 5.},
+          {"zDUT_d0", seedConstraint[1], 0.01, 200., 800.},
+          {"deltaZ", seedConstraint[2], 0.01, 0., 8.},
+          {"theta", seedConstraint[3], 0.01, -20.*TMath::Pi()/180., 20.*TMath::Pi()/180.}};
 
   cout << "DUT both planes with deltaOffset constraint: Start chi2 minimization"<<endl;
-  minimizerBothPlanesConstraint->Minimize();
-  const double *resultMinimizerBothPlanesConstraint = minimizerBothPlanesConstraint->X();
-  double* resultBothPlanesConstraint = new double[4];
-  resultBothPlanesConstraint[0] = resultMinimizerBothPlanesConstraint[0];
-  resultBothPlanesConstraint[1] = resultMinimizerBothPlanesConstraint[1];
-  resultBothPlanesConstraint[2] = resultMinimizerBothPlanesConstraint[2];
-  resultBothPlanesConstraint[3] = resultMinimizerBothPlanesConstraint[3];
+  double resultBothPlanesConstraint[4];
+  minimize("BothPlanesConstraint", minimizerBothPlanesConstraint.get(), *toMinimizeBothPlanesConstraint, *toMinimizeBothPlanesConstraintGrad,
+           AlignmentChi2::kTwoPlanesDeltaZ, vars, resultBothPlanesConstraint);
   double chi2BothPlanesConstraint = ComputeChi2BothPlanes(resultBothPlanesConstraint);
   cout << "BothPlanesConstraint offset_d0="<< resultBothPlanesConstraint[0]<<" zDUT_d0="<<resultBothPlanesConstraint[1]<<" deltaZ="<< resultBothPlanesConstraint[2]<<" theta="<<resultBothPlanesConstraint[3]*180./TMath::Pi()<< " chi2="<<chi2BothPlanesConstraint<<endl;
 
-  for (unsigned int i=0; i<selectedTk_bothPlanes_1Cls.size(); i++){
-    double xDUT_d0 =   bothPlanes_DutXposD0.at(i);
-    double xDUT_d1 =   bothPlanes_DutXposD1.at(i);
-    std::pair<double, double> xTkAtDUT = Utility::extrapolateTrackAtDUTwithAngles(selectedTk_bothPlanes_1Cls.at(i), al.FEI4z(), resultBothPlanesConstraint[0], resultBothPlanesConstraint[1], resultBothPlanesConstraint[2], resultBothPlanesConstraint[3]);
-    double xTkAtDUT_d0 = xTkAtDUT.first;
-    double xTkAtDUT_d1 = xTkAtDUT.second;
-    double resDUT_d0 = xDUT_d0 - xTkAtDUT_d0;
-    double resDUT_d1 = xDUT_d1 - xTkAtDUT_d1;
-    hist_->fillHist1D("TrackFit","d0_1tk1ClusterBothPlanesConstraint_diffX_aligned", resDUT_d0);
-    hist_->fillHist1D("TrackFit","d1_1tk1ClusterBothPlanesConstraint_diffX_aligned", resDUT_d1);
+  //the histogram path leaves the residuals of its last call in d0/d1_1tk1Hit_diffX,
+  //the fast one fills them once here at the final result
+  bool fillFitResiduals = (chi2Mode_ == kChi2Fast);
+  double thetaC = resultBothPlanesConstraint[3];
+  fastBoth_.residuals(resultBothPlanesConstraint[0], resultBothPlanesConstraint[1],
+                      resultBothPlanesConstraint[0] + sin(thetaC)*resultBothPlanesConstraint[2],
+                      resultBothPlanesConstraint[1] + resultBothPlanesConstraint[2]*cos(thetaC), thetaC, resD0, resD1);
+  for (unsigned int i=0; i<resD0.size(); i++){
+    double resDUT_d0 = resD0[i];
+    double resDUT_d1 = resD1[i];
+    hist_->fillHist1D(fitH_.d0_1tk1ClusterBothPlanesConstraint_diffX_aligned, resDUT_d0);
+    hist_->fillHist1D(fitH_.d1_1tk1ClusterBothPlanesConstraint_diffX_aligned, resDUT_d1);
+    if(fillFitResiduals) {
+      hist_->fillHist1D(fitH_.d0_1tk1Hit_diffX, resDUT_d0);
+      hist_->fillHist1D(fitH_.d1_1tk1Hit_diffX, resDUT_d1);
+    }
   }
   //Fit Residuals Gaussian convulated with Step Function
   TF1* fGausResiduals = new TF1("fGausResiduals", "gaus", -10, 10);
@@ -523,28 +633,260 @@ void AlignmentMultiDimAnalysis::eventLoop()
   cout << "D1 offset="<< resultD1[0]<<" zDUT="<<resultD1[1]<<" theta="<<resultD1[2]*180./TMath::Pi()<<" chi2="<<chi2D1<<endl;
   cout << "BothPlanes offset_d0="<< resultBothPlanes[0]<<" zDUT_d0="<<resultBothPlanes[1]<<" offset_d1="<< resultBothPlanes[2]<<" zDUT_d1="<<resultBothPlanes[3] << " theta="<<resultBothPlanes[4]*180./TMath::Pi()<< " chi2="<<chi2BothPlanes<<endl;
   cout << "BothPlanesConstraint offset_d0="<< resultBothPlanesConstraint[0]<<" zDUT_d0="<<resultBothPlanesConstraint[1]<<" deltaZ="<< resultBothPlanesConstraint[2]<<" theta="<<resultBothPlanesConstraint[3]*180./TMath::Pi()<< " chi2="<<chi2BothPlanesConstraint<<endl;
-  //Dump Alignment output to alignment text file
-  std::ofstream fileAlignment;
-  if(isProduction_) {
-    fileAlignment.open(alignparFile_.c_str(), ios::out | ios::app);
-  } else {
-    fileAlignment.open(alignparFile_.c_str(), ios::out);
+  //Dump Alignment output to alignment text file, in production mode the line of the run is replaced
+  //and the lines of the other runs are kept; the file is rewritten under a lock
+  tbeam::alignmentPars alOut = al;
+  alOut.d0Z(resultBothPlanesConstraint[1]);
+  alOut.d0Offset(resultBothPlanesConstraint[0]);
+  alOut.deltaZ(resultBothPlanesConstraint[2]);
+  alOut.theta(resultBothPlanesConstraint[3]*180./TMath::Pi());
+  int run = atoi(runNumber_.c_str());
+  std::map<int, std::string> lines;
+  lines[run] = AlignmentFile::line(run, alOut);
+  if(!AlignmentFile::update(alignparFile_, lines, isProduction_ || keepOtherRuns_))
+    std::cout << "Dump File could not be opened!!" << std::endl;
+  //and as a new version of the run in the alignment DB
+  if(!alignDB_.empty()) {
+    int version = AlignmentDB::append(alignDB_, run, alOut);
+    if(version > 0)  cout << "Alignment of run " << run << " stored as version " << version << " in " << alignDB_ << endl;
+  }
+}
+
+std::string AlignmentMultiDimAnalysis::sampleFileName() const {
+  //one file per run with a runList, as the output files
+  if(nRuns() == 0)  return sampleFile_;
+  std::string base = sampleFile_;
+  std::string ext;
+  std::string::size_type dot = base.rfind('.');
+  if(dot != std::string::npos && base.find('/', dot) == std::string::npos) {
+    ext = base.substr(dot);
+    base.erase(dot);
+  }
+  return base + "_Run" + runNumber_ + ext;
+}
+
+bool AlignmentMultiDimAnalysis::warmSeeds(double* d0, double* d1, double* bothPlanes, double* constraint, bool& skipSinglePlane) {
+  skipSinglePlane = false;
+  int run = atoi(runNumber_.c_str());
+  int prevRun = -1;
+  tbeam::alignmentPars prev;
+  if(!AlignmentFile::nearest(alignparFile_, run, prevRun, prev)) {
+    cout << "Warm start: no run in " << alignparFile_ << ", the fits start from the default values" << endl;
+    return false;
+  }
+  //within the limits of the fits
+  const double z0 = std::min(std::max(prev.d0Z(), 200.), 800.);
+  const double deltaZ = std::min(std::max(prev.deltaZ(), 0.), 8.);
+  const double theta = std::min(std::max(prev.theta(), -20.*TMath::Pi()/180.), 20.*TMath::Pi()/180.);
+  double offset0 = prev.d0Offset();
+  double offset1 = offset0 + sin(theta)*deltaZ;
+  const double z1 = z0 + deltaZ*cos(theta);
+  //the geometry is kept, the offsets of this run are moved to the residual peaks
+  fastBoth_.chi2(offset0, z0, offset1, z1, theta);
+  const AlignmentChi2::Peak& p0 = fastBoth_.lastPeak(0);
+  const AlignmentChi2::Peak& p1 = fastBoth_.lastPeak(1);
+  if(!p0.valid || !p1.valid) {
+    cout << "Warm start: no residual peak at the alignment of run " << prevRun << ", the fits start from the default values" << endl;
+    return false;
+  }
+  offset0 += p0.center*cos(theta);
+  offset1 += p1.center*cos(theta);
+  skipSinglePlane = p0.sigma < warmSigmaTol_ && p1.sigma < warmSigmaTol_;
+  cout << "Warm start from run " << prevRun << ": zDUT_d0=" << z0 << " deltaZ=" << deltaZ << " theta=" << theta*180./TMath::Pi()
+       << " residual sigma d0=" << p0.sigma << " d1=" << p1.sigma << (skipSinglePlane ? ", single plane fits skipped" : "") << endl;
+
+  d0[0] = offset0;
+  d0[1] = z0;
+  d0[2] = theta;
+  d1[0] = offset1;
+  d1[1] = z1;
+  d1[2] = theta;
+  bothPlanes[0] = offset0;
+  bothPlanes[1] = z0;
+  bothPlanes[2] = offset1;
+  bothPlanes[3] = z1;
+  bothPlanes[4] = theta;
+  constraint[0] = offset0;
+  constraint[1] = z0;
+  constraint[2] = deltaZ;
+  constraint[3] = theta;
+  return true;
+}
+
+void AlignmentMultiDimAnalysis::gridSeeds(double* d0, double* d1, double* bothPlanes, double* constraint) {
+  auto print = [](const char* name, const AlignmentGridScan& g, unsigned int np) {
+    cout << "Grid " << name << ": " << g.nPoints() << " points in " << g.time() << " s, minimum chi2=" << g.best().chi2 << " at";
+    for(unsigned int i = 0; i < np; i++)  cout << " " << g.best().x[i];
+    cout << endl;
+  };
+  //zDUT 200-800 mm in 25 mm steps, theta +-20 deg in 2 deg steps, 3 offsets around the residual peak
+  AlignmentGridScan gridD0(fastD0_, AlignmentChi2::kOnePlane);
+  if(gridD0.run(gridThreads_))  std::copy(gridD0.best().x, gridD0.best().x + 3, d0);
+  print("D0", gridD0, 3);
+  AlignmentGridScan gridD1(fastD1_, AlignmentChi2::kOnePlane);
+  if(gridD1.run(gridThreads_))  std::copy(gridD1.best().x, gridD1.best().x + 3, d1);
+  print("D1", gridD1, 3);
+
+  //both planes with the deltaZ constraint: zDUT in 10 mm steps around the D0 minimum, deltaZ 0-8 mm in 0.5 mm steps,
+  //the offset from the residual peak only
+  double zLo = std::min(std::max(d0[1] - 20., 200.), 760.);
+  AlignmentGridScan gridConstraint(fastBoth_, AlignmentChi2::kTwoPlanesDeltaZ);
+  gridConstraint.setAxes(AlignmentGridScan::Axis{zLo, 10., 5},
+                         AlignmentGridScan::Axis{-20.*TMath::Pi()/180., 2.*TMath::Pi()/180., 21},
+                         AlignmentGridScan::Axis{0., 0.5, 17}, 1, 0.);
+  if(!gridConstraint.run(gridThreads_)) {
+    print("BothPlanesConstraint", gridConstraint, 4);
+    return;
   }
-  if(fileAlignment) {
-    fileAlignment << "Run="<< runNumber_
-                  << ":offsetFEI4X=" << al.offsetFEI4x()
-                  << ":offsetFEI4Y=" << al.offsetFEI4y()
-                  << ":residualSigmaFEI4X=" << al.residualSigmaFEI4x()
-                  << ":residualSigmaFEI4Y=" << al.residualSigmaFEI4y()
-                  << ":zD0="<< resultBothPlanesConstraint[1]
-                  << ":offsetD0=" << resultBothPlanesConstraint[0]
-                  << ":deltaZ=" << resultBothPlanesConstraint[2]
-                  << ":angle=" << resultBothPlanesConstraint[3]*180./TMath::Pi() << endl;
-    fileAlignment.close();
-  } else std::cout << "Dump File could not be opened!!" << std::endl;
+  const double* c = gridConstraint.best().x;
+  std::copy(c, c + 4, constraint);
+  print("BothPlanesConstraint", gridConstraint, 4);
+  bothPlanes[0] = c[0];
+  bothPlanes[1] = c[1];
+  bothPlanes[2] = c[0] + sin(c[3])*c[2];
+  bothPlanes[3] = c[1] + c[2]*cos(c[3]);
+  bothPlanes[4] = c[3];
+
+  //chi2 profiles, minimum over the other parameters of the grid
+  TH1* hChi2vsTheta = dynamic_cast<TH1F*>(hist_->GetHistoByName("TrackFit","bothPlanesConstraint_chi2VsTheta"));
+  std::vector<double> prof = gridConstraint.profileTheta();
+  for(unsigned int i = 0; i < prof.size(); i++)
+    if(prof[i] >= 0.)  hChi2vsTheta->Fill(gridConstraint.thetaAxis().at(i)*180./TMath::Pi(), prof[i]);
+  TH1* hChi2vsDeltaZ = dynamic_cast<TH1F*>(hist_->GetHistoByName("TrackFit","bothPlanesConstraint_chi2VsDeltaZ"));
+  prof = gridConstraint.profileDeltaZ();
+  for(unsigned int i = 0; i < prof.size(); i++)
+    if(prof[i] >= 0.)  hChi2vsDeltaZ->Fill(gridConstraint.deltaZAxis().at(i), prof[i]);
 }
 
 double AlignmentMultiDimAnalysis::ComputeChi2(const double* x) const{
+  nChi2Calls_++;
+  if(chi2Mode_ == kChi2Root)  return ComputeChi2Root(x);
+  const AlignmentChi2& fc = doD0 ? fastD0_ : fastD1_;
+  double chi2 = fc.chi2(x[0], x[1], x[2]);
+  cout << "offset="<< x[0]<<" zDUT="<<x[1]<<" theta="<<x[2]*180./TMath::Pi()<<" chi2="<<chi2
+       << " center="<< fc.lastPeak(0).center << " sigma=" << fc.lastPeak(0).sigma << endl;
+  if(chi2Mode_ == kChi2Validate) {
+    double chi2Root = ComputeChi2Root(x);
+    cout << "Chi2 validation: fast=" << chi2 << " root=" << chi2Root << " diff=" << chi2 - chi2Root << endl;
+    return chi2Root;
+  }
+  return chi2;
+}
+
+double AlignmentMultiDimAnalysis::ComputeChi2BothPlanes(const double* x) const{
+  nChi2Calls_++;
+  if(chi2Mode_ == kChi2Root)  return ComputeChi2BothPlanesRoot(x);
+  double chi2 = 0.;
+  if (!doConstrainDeltaOffset) {
+    chi2 = fastBoth_.chi2(x[0], x[1], x[2], x[3], x[4]);
+    cout << "offset_d0="<< x[0]<<" zDUT_d0="<<x[1]<<" offset_d1=" << x[2]<< " zDUT_d1="<< x[3]<<" theta="<<x[4]*180./TMath::Pi()<<" chi2="<<chi2<<endl;
+  } else {
+    //same d1 position as the two-plane Utility::extrapolateTrackAtDUTwithAngles
+    double theta = x[3];
+    chi2 = fastBoth_.chi2(x[0], x[1], x[0] + sin(theta)*x[2], x[1] + x[2]*cos(theta), theta);
+    cout << "offset_d0="<< x[0]<<" zDUT_d0="<<x[1]<<" deltaZ="<<x[2]<<" theta="<<theta*180./TMath::Pi()<<" chi2="<<chi2<<endl;
+  }
+  if(chi2Mode_ == kChi2Validate) {
+    double chi2Root = ComputeChi2BothPlanesRoot(x);
+    cout << "Chi2 validation: fast=" << chi2 << " root=" << chi2Root << " diff=" << chi2 - chi2Root << endl;
+    return chi2Root;
+  }
+  return chi2;
+}
+
+const AlignmentChi2& AlignmentMultiDimAnalysis::fastChi2(AlignmentChi2::Model m) const {
+  if(m != AlignmentChi2::kOnePlane)  return fastBoth_;
+  return doD0 ? fastD0_ : fastD1_;
+}
+
+double AlignmentMultiDimAnalysis::chi2Derivative(AlignmentChi2::Model m, const double* x, unsigned int icoord) const {
+  //Minuit asks one coordinate at a time, the full gradient is computed once per point
+  const unsigned int np = AlignmentChi2::nPar(m);
+  if(gradX_.size() != np || !std::equal(x, x + np, gradX_.begin())) {
+    gradX_.assign(x, x + np);
+    grad_.resize(np);
+    fastChi2(m).chi2Gradient(m, x, grad_.data());
+    nGradCalls_++;
+  }
+  return grad_[icoord];
+}
+
+double AlignmentMultiDimAnalysis::ComputeChi2Derivative(const double* x, unsigned int icoord) const {
+  return chi2Derivative(AlignmentChi2::kOnePlane, x, icoord);
+}
+
+double AlignmentMultiDimAnalysis::ComputeChi2BothPlanesDerivative(const double* x, unsigned int icoord) const {
+  return chi2Derivative(doConstrainDeltaOffset ? AlignmentChi2::kTwoPlanesDeltaZ : AlignmentChi2::kTwoPlanes, x, icoord);
+}
+
+void AlignmentMultiDimAnalysis::minimize(const std::string& fitName, ROOT::Minuit2::Minuit2Minimizer* m,
+                                         const ROOT::Math::Functor& f, const ROOT::Math::GradFunctor& fGrad,
+                                         AlignmentChi2::Model model, const std::vector<FitVar>& vars, double* x) {
+  const unsigned int np = vars.size();
+  std::vector<double> xFit(np);
+  TStopwatch timer;
+  //Migrad, with numerical or analytic derivatives
+  auto migrad = [&](bool useGradient) {
+    nChi2Calls_ = 0;
+    nGradCalls_ = 0;
+    gradX_.clear();
+    timer.Start();
+    m->Clear();
+    if(useGradient)  m->SetFunction(fGrad);
+    else  m->SetFunction(f);
+    for(unsigned int i = 0; i < np; i++)
+      m->SetLimitedVariable(i, vars[i].name, vars[i].init, vars[i].step, vars[i].lo, vars[i].hi);
+    //warm started: Migrad stops at EDM < 0.002*tolerance, set to the EDM of an offset step of
+    //warmStartTolerance in one plane, (dx/resTelescope)^2 for the chi2 per track; never below the default
+    const double tol0 = m->Tolerance();
+    const double resTelescope2 = 0.090*0.090/12. + 0.0035*0.0035;
+    const double tol = earlyStop_ ? std::max(tol0, warmTol_*warmTol_/resTelescope2/0.002) : tol0;
+    m->SetTolerance(tol);
+    m->Minimize();
+    m->SetTolerance(tol0);
+    timer.Stop();
+    std::copy(m->X(), m->X() + np, xFit.begin());
+    cout << "Fit " << fitName << (useGradient ? " Migrad(analytic gradient)" : " Migrad")
+         << ": chi2=" << m->MinValue() << " status=" << m->Status() << " edm=" << m->Edm();
+    if(earlyStop_)  cout << " tolerance=" << tol;
+    cout << " fcnCalls=" << nChi2Calls_ << " gradientCalls=" << nGradCalls_
+         << " time=" << timer.RealTime() << " s" << endl;
+  };
+  auto levenbergMarquardt = [&]() {
+    std::vector<double> lo(np), hi(np);
+    for(unsigned int i = 0; i < np; i++) {
+      xFit[i] = vars[i].init;
+      lo[i] = vars[i].lo;
+      hi[i] = vars[i].hi;
+    }
+    timer.Start();
+    AlignmentChi2::FitResult r = fastChi2(model).fitLM(model, xFit.data(), lo.data(), hi.data());
+    timer.Stop();
+    cout << "Fit " << fitName << " Levenberg-Marquardt: chi2=" << r.chi2 << " converged=" << r.converged
+         << " iterations=" << r.nIter << " calls=" << r.nCalls
+         << " time=" << timer.RealTime() << " s" << endl;
+  };
+
+  if(minimizerMode_ == kLevenbergMarquardt) {
+    levenbergMarquardt();
+  } else if(minimizerMode_ == kMigradGradient) {
+    migrad(true);
+  } else if(minimizerMode_ == kCompareMinimizers) {
+    //the Migrad result, run last, is the one kept
+    levenbergMarquardt();
+    for(unsigned int i = 0; i < np; i++)  cout << " " << vars[i].name << "=" << xFit[i];
+    cout << endl;
+    migrad(true);
+    for(unsigned int i = 0; i < np; i++)  cout << " " << vars[i].name << "=" << xFit[i];
+    cout << endl;
+    migrad(false);
+  } else {
+    migrad(false);
+  }
+  std::copy(xFit.begin(), xFit.end(), x);
+}
+
+double AlignmentMultiDimAnalysis::ComputeChi2Root(const double* x) const{
 
   double chi2 = 0;
   double offset = x[0];
@@ -577,8 +919,8 @@ double AlignmentMultiDimAnalysis::ComputeChi2(const double* x) const{
     }
 
     resDUT = xDUT - xTkAtDUT;
-    if (doD0) hist_->fillHist1D("TrackFit","d0_1tk1Hit_diffX", resDUT);
-    if (doD1) hist_->fillHist1D("TrackFit","d1_1tk1Hit_diffX", resDUT);
+    if (doD0) hist_->fillHist1D(fitH_.d0_1tk1Hit_diffX, resDUT);
+    if (doD1) hist_->fillHist1D(fitH_.d1_1tk1Hit_diffX, resDUT);
 
     chi2 += (resDUT/resTelescope)*(resDUT/resTelescope);
   }
@@ -648,7 +990,7 @@ double AlignmentMultiDimAnalysis::ComputeChi2(const double* x) const{
   return chi2;
 }
 
-double AlignmentMultiDimAnalysis::ComputeChi2BothPlanes(const double* x) const{
+double AlignmentMultiDimAnalysis::ComputeChi2BothPlanesRoot(const double* x) const{
 
   double chi2 = 0;
   double offset_d0 = 0;
@@ -707,8 +1049,8 @@ double AlignmentMultiDimAnalysis::ComputeChi2BothPlanes(const double* x) const{
       resDUT_d0 = xDUT_d0 - xTkAtDUT_d0;
       resDUT_d1 = xDUT_d1 - xTkAtDUT_d1;
 
-      hist_->fillHist1D("TrackFit","d0_1tk1Hit_diffX", resDUT_d0);
-      hist_->fillHist1D("TrackFit","d1_1tk1Hit_diffX", resDUT_d1);
+      hist_->fillHist1D(fitH_.d0_1tk1Hit_diffX, resDUT_d0);
+      hist_->fillHist1D(fitH_.d1_1tk1Hit_diffX, resDUT_d1);
 
      chi2 += ( (resDUT_d0/resTelescope)*(resDUT_d0/resTelescope) + (resDUT_d1/resTelescope)*(resDUT_d1/resTelescope) );
     }
@@ -824,42 +1166,44 @@ zDUT_d1, theta);
 //TelescopeAnalysis Part//
 //Compute track residuals at FeI4 plane and compute offset and mean
 void AlignmentMultiDimAnalysis::doTelescopeAnalysis(tbeam::alignmentPars& aLp) {
-    for (Long64_t jentry=0; jentry<nEntries_;jentry++) {
+  //first pass reads the tree and fills the event cache, with the DUT content
+  //of the events used later by the z scan
+  eventCache().clear(0);
+  for (Long64_t jentry=0; jentry<nEntries_;jentry++) {
     clearEvent();
-    Long64_t ientry = analysisTree()->GetEntry(jentry);
+    Long64_t ientry = readEntry(jentry);
     if (ientry < 0) break;
+    if(!useEventCache()) eventCache().clear(jentry);
+    cacheEvent(isGoodEvent() && fei4Ev()->nPixHits == 1);
     if (jentry%1000 == 0) 
       cout << " Events processed. " << std::setw(8) << jentry 
 	   << endl;
-    hist_->fillHist1D("TelescopeAnalysis","nhitsFei4", fei4Ev()->nPixHits);
-    hist_->fillHist1D("TelescopeAnalysis","nTrack", telEv()->nTrackParams);
+    const EventCache::Event ev = eventCache().last();
+    //filled here, the z scan only sees the events kept in the cache
+    hist_->fillHist1D(evH_.isPeriodic,ev.isPeriodic);
+    hist_->fillHist1D(evH_.isGoodFlag,ev.isGood);
+    hist_->fillHist1D(tH_.nhitsFei4, ev.nPixHits);
+    hist_->fillHist1D(tH_.nTrack, ev.nTrackParams);
     
-    if(fei4Ev()->nPixHits > 2)    continue;
-    if (fei4Ev()->nPixHits==0) continue;
-    if(telEv()->xPos->empty())    continue;
-
-    std::vector<tbeam::Track>  tkNoOv;
-    Utility::removeTrackDuplicates(telEv(), tkNoOv);
-    //if(tkNoOv.size() != 1)   continue;
-    //if(tkNoOv.size() > 20)   continue;
-
-    for(unsigned int i = 0; i<tkNoOv.size(); i++) {
-      //std::cout << i<< std::endl;
-      double tkX = tkNoOv[i].xPos;//-1.*tkNoOv[i].xPos;
-      double tkY = tkNoOv[i].yPos;
-      hist_->fillHist1D("TelescopeAnalysis","TkXPos", tkX);
-      hist_->fillHist1D("TelescopeAnalysis","TkYPos", tkY);
+    if(ev.nPixHits > 2)    continue;
+    if (ev.nPixHits==0) continue;
+    if(ev.nRawTracks == 0)    continue;
+
+    //tracks in the cache are already free of duplicates
+    for(unsigned int i = 0; i<ev.nTk; i++) {
+      double tkX = ev.tkX[i];
+      double tkY = ev.tkY[i];
+      hist_->fillHist1D(tH_.TkXPos, tkX);
+      hist_->fillHist1D(tH_.TkYPos, tkY);
     }
 
-    for (unsigned int i = 0; i < fei4Ev()->nPixHits; i++) {   
-      hist_->fillHist1D("TelescopeAnalysis","HtColumn", fei4Ev()->col->at(i));
-      hist_->fillHist1D("TelescopeAnalysis","HtRow", fei4Ev()->row->at(i));
-      //double xval = -9.875 + (fei4Ev()->col->at(i)-1)*0.250;
-      //double yval = -8.375 + (fei4Ev()->row->at(i)-1)*0.05;
-      double xval = 8.375 - (fei4Ev()->row->at(i)-1)*0.05;
-      double yval = 9.875 - (fei4Ev()->col->at(i)-1)*0.250;
-      hist_->fillHist1D("TelescopeAnalysis","HtXPos", xval);
-      hist_->fillHist1D("TelescopeAnalysis","HtYPos", yval);
+    for (unsigned int i = 0; i < ev.nFei4; i++) {   
+      hist_->fillHist1D(tH_.HtColumn, ev.col[i]);
+      hist_->fillHist1D(tH_.HtRow, ev.row[i]);
+      double xval = 8.375 - (ev.row[i]-1)*0.05;
+      double yval = 9.875 - (ev.col[i]-1)*0.250;
+      hist_->fillHist1D(tH_.HtXPos, xval);
+      hist_->fillHist1D(tH_.HtYPos, yval);
     }
 
     //get residuals
@@ -867,14 +1211,14 @@ void AlignmentMultiDimAnalysis::doTelescopeAnalysis(tbeam::alignmentPars& aLp) {
     double xmin = 999.9;
     double ymin = 999.9;
     double deltamin = 999.9;
-    for(unsigned int itk = 0; itk < tkNoOv.size(); itk++) {
-      double tkX = tkNoOv[itk].xPos;//-1.*tkNoOv[itk].xPos; 
-      double tkY = tkNoOv[itk].yPos; 
-      for (unsigned int i = 0; i < fei4Ev()->nPixHits; i++) {   
-        double xval = 8.375 - (fei4Ev()->row->at(i)-1)*0.05;
-        double yval = 9.875 - (fei4Ev()->col->at(i)-1)*0.250;
-        hist_->fillHist2D("TelescopeAnalysis","tkXPosVsHtXPos", xval, tkX);
-        hist_->fillHist2D("TelescopeAnalysis","tkYPosVsHtYPos", yval, tkY);
+    for(unsigned int itk = 0; itk < ev.nTk; itk++) {
+      double tkX = ev.tkX[itk];
+      double tkY = ev.tkY[itk];
+      for (unsigned int i = 0; i < ev.nFei4; i++) {   
+        double xval = 8.375 - (ev.row[i]-1)*0.05;
+        double yval = 9.875 - (ev.col[i]-1)*0.250;
+        hist_->fillHist2D(tH_.tkXPosVsHtXPos, xval, tkX);
+        hist_->fillHist2D(tH_.tkYPosVsHtYPos, yval, tkY);
         //if (std::fabs(xval - tkX) < std::fabs(xmin)) xmin = xval - tkX;
         //if (std::fabs(yval - tkY) < std::fabs(ymin)) ymin = yval - tkY;
         if (sqrt((xval - tkX)*(xval - tkX) + (yval - tkY)*(yval - tkY)) < deltamin){
@@ -884,9 +1228,12 @@ void AlignmentMultiDimAnalysis::doTelescopeAnalysis(tbeam::alignmentPars& aLp) {
 	}
       }
     }
-    hist_->fillHist1D("TelescopeAnalysis","deltaXPos", xmin);
-    hist_->fillHist1D("TelescopeAnalysis","deltaYPos", ymin);
+    hist_->fillHist1D(tH_.deltaXPos, xmin);
+    hist_->fillHist1D(tH_.deltaYPos, ymin);
   }//event loop
+  if(useEventCache() && eventCache().size())
+    std::cout << "Event cache: " << eventCache().size() << " events, "
+              << eventCache().memoryUsage()/1024 << " kB" << std::endl;
 
   //Fit residual in Y direction//Perpendicular to strips in DUT
    TH1F* htmp = dynamic_cast<TH1F*>(hist_->GetHistoByName("TelescopeAnalysis","deltaYPos"));
@@ -929,29 +1276,34 @@ void AlignmentMultiDimAnalysis::doTelescopeAnalysis(tbeam::alignmentPars& aLp) {
             << std::endl;
 
   //Recompute residuals, with offset from previous gaus+pol1 fit
-  for (Long64_t jentry=0; jentry<nEntries_;jentry++) {
-    clearEvent();
-    Long64_t ientry = analysisTree()->GetEntry(jentry);
-    if (ientry < 0) break;
+  bool fromCache = eventCache().covers(0, nEntries_);
+  Long64_t nLoop = fromCache ? eventCache().size() : nEntries_;
+  for (Long64_t jentry=0; jentry<nLoop;jentry++) {
+    if(!fromCache) {
+      clearEvent();
+      Long64_t ientry = readEntry(jentry);
+      if (ientry < 0) break;
+      eventCache().clear(jentry);
+      cacheEvent(false);
+    }
+    const EventCache::Event ev = fromCache ? eventCache().event(jentry) : eventCache().last();
     if (jentry%1000 == 0)
-      cout << " Events processed. " << std::setw(8) << jentry
+      cout << " Events processed. " << std::setw(8) << ev.entry
            << endl;
 
-    if(fei4Ev()->nPixHits > 2)    continue;
-    if (fei4Ev()->nPixHits==0) continue;
-    if(telEv()->xPos->empty())    continue;
+    if(ev.nPixHits > 2)    continue;
+    if (ev.nPixHits==0) continue;
+    if(ev.nRawTracks == 0)    continue;
 
-    std::vector<tbeam::Track>  tkNoOv;
-    Utility::removeTrackDuplicates(telEv(), tkNoOv);
     double xmin = 999.9;
     double ymin = 999.9;
     double deltamin = 999.9;
-    for(unsigned int itk = 0; itk < tkNoOv.size(); itk++) {
-      double tkX = tkNoOv[itk].xPos;//-1.*tkNoOv[itk].xPos;
-      double tkY = tkNoOv[itk].yPos;
-      for (unsigned int i = 0; i < fei4Ev()->nPixHits; i++) {
-        double xval = 8.375 - (fei4Ev()->row->at(i)-1)*0.05;
-        double yval = 9.875 - (fei4Ev()->col->at(i)-1)*0.250;
+    for(unsigned int itk = 0; itk < ev.nTk; itk++) {
+      double tkX = ev.tkX[itk];
+      double tkY = ev.tkY[itk];
+      for (unsigned int i = 0; i < ev.nFei4; i++) {
+        double xval = 8.375 - (ev.row[i]-1)*0.05;
+        double yval = 9.875 - (ev.col[i]-1)*0.250;
         if (sqrt((xval - tkX - offset_x_tmp)*(xval - tkX - offset_x_tmp) + (yval - tkY - offset_y_tmp)*(yval - tkY - offset_y_tmp)) < deltamin){
           xmin = xval - tkX - offset_x_tmp;
           ymin = yval - tkY - offset_y_tmp;
@@ -960,8 +1312,8 @@ void AlignmentMultiDimAnalysis::doTelescopeAnalysis(tbeam::alignmentPars& aLp) {
 
       }
     }
-    hist_->fillHist1D("TelescopeAnalysis","deltaXPos_fit", xmin);
-    hist_->fillHist1D("TelescopeAnalysis","deltaYPos_fit", ymin);
+    hist_->fillHist1D(tH_.deltaXPos_fit, xmin);
+    hist_->fillHist1D(tH_.deltaYPos_fit, ymin);
   }//event loop
 
   //Fit with Gaussian convoluted with StepFunc  To be Done
@@ -1024,29 +1376,33 @@ void AlignmentMultiDimAnalysis::doTelescopeAnalysis(tbeam::alignmentPars& aLp) {
 
   std::cout << "Total offset in x:" << offset_x_total << " ; in y :"<<offset_y_total<<endl;
  
-  for (Long64_t jentry=0; jentry<nEntries_;jentry++) {
-    clearEvent();
-    Long64_t ientry = analysisTree()->GetEntry(jentry);
-    if (ientry < 0) break;
+  fromCache = eventCache().covers(0, nEntries_);
+  nLoop = fromCache ? eventCache().size() : nEntries_;
+  for (Long64_t jentry=0; jentry<nLoop;jentry++) {
+    if(!fromCache) {
+      clearEvent();
+      Long64_t ientry = readEntry(jentry);
+      if (ientry < 0) break;
+      eventCache().clear(jentry);
+      cacheEvent(false);
+    }
+    const EventCache::Event ev = fromCache ? eventCache().event(jentry) : eventCache().last();
     if (jentry%1000 == 0) 
-      cout << " Events processed. " << std::setw(8) << jentry 
+      cout << " Events processed. " << std::setw(8) << ev.entry 
 	   << endl;
-    if(fei4Ev()->nPixHits > 2)    continue;
-    //Remove track duplicates
-    std::vector<tbeam::Track>  tkNoOv;
-    Utility::removeTrackDuplicates(telEv(), tkNoOv);
+    if(ev.nPixHits > 2)    continue;
 
     //get residuals
     double minresx = 999.;
     double minresy = 999.;
     double mindelta = 999.;
-    for(unsigned int itk = 0; itk < tkNoOv.size(); itk++) {
-      double tkX = tkNoOv[itk].xPos;//-1.*tkNoOv[itk].xPos;//-1.*telEv()->xPos->at(itk);
-      double tkY = tkNoOv[itk].yPos;//telEv()->yPos->at(itk);
-      for (unsigned int i = 0; i < fei4Ev()->nPixHits; i++) {   
+    for(unsigned int itk = 0; itk < ev.nTk; itk++) {
+      double tkX = ev.tkX[itk];
+      double tkY = ev.tkY[itk];
+      for (unsigned int i = 0; i < ev.nFei4; i++) {   
         //default pitch and dimensions of fei4 plane
-        double xval = 8.375 - (fei4Ev()->row->at(i)-1)*0.05;
-        double yval = 9.875 - (fei4Ev()->col->at(i)-1)*0.250;
+        double xval = 8.375 - (ev.row[i]-1)*0.05;
+        double yval = 9.875 - (ev.col[i]-1)*0.250;
         double xres = xval - tkX - offset_x_total;//fStepGaus_x->GetParameter(4);//fGausResiduals_x->GetParameter("Mean");
         double yres = yval - tkY - offset_y_total;//fStepGaus_y->GetParameter(4);//fGausResiduals_y->GetParameter("Mean");
         if (sqrt(xres*xres+yres*yres)<mindelta){
@@ -1056,12 +1412,12 @@ void AlignmentMultiDimAnalysis::doTelescopeAnalysis(tbeam::alignmentPars& aLp) {
         }
       }
     }
-    hist_->fillHist1D("TelescopeAnalysis","deltaXPos_trkfei4", minresx);
-    hist_->fillHist1D("TelescopeAnalysis","deltaYPos_trkfei4", minresy);
+    hist_->fillHist1D(tH_.deltaXPos_trkfei4, minresx);
+    hist_->fillHist1D(tH_.deltaYPos_trkfei4, minresy);
       if(std::fabs(minresx) < res_x_total &&
         std::fabs(minresy) < res_y_total) {
-        hist_->fillHist1D("TelescopeAnalysis","deltaXPos_trkfei4M", minresx);
-        hist_->fillHist1D("TelescopeAnalysis","deltaYPos_trkfei4M", minresy);
+        hist_->fillHist1D(tH_.deltaXPos_trkfei4M, minresx);
+        hist_->fillHist1D(tH_.deltaYPos_trkfei4M, minresy);
       }
   }//event loop
 
@@ -1081,7 +1437,7 @@ void AlignmentMultiDimAnalysis::clearEvent() {
 }
 void AlignmentMultiDimAnalysis::endJob() {
   BeamAnaBase::endJob();
-  hist_->closeFile();
+  closeOutput();
 }
 
 AlignmentMultiDimAnalysis::~AlignmentMultiDimAnalysis(){
@@ -0,0 +1,111 @@
+/*!
+        \file                AlignmentSample.cc
+        \brief               Binary file of the selected tracks and DUT positions of one run
+                             used by the alignment fits
+*/
+#include "AlignmentSample.h"
+#include <fstream>
+#include <iostream>
+#include <stdint.h>
+
+namespace {
+  const char magic[4] = {'T', 'B', 'A', 'S'};
+  const uint32_t version = 1;
+
+  template<class T> void put(std::ostream& out, const T& v) {
+    out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+  }
+  template<class T> bool get(std::istream& in, T& v) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&v), sizeof(T)));
+  }
+
+  void putSample(std::ostream& out, const std::vector<tbeam::Track>& tk, const std::vector<float>* x0, const std::vector<float>* x1) {
+    put(out, static_cast<uint64_t>(tk.size()));
+    for(const auto& t : tk) {
+      put(out, t.xPos);
+      put(out, t.yPos);
+      put(out, t.dxdz);
+      put(out, t.dydz);
+    }
+    out.write(reinterpret_cast<const char*>(x0->data()), x0->size()*sizeof(float));
+    if(x1)  out.write(reinterpret_cast<const char*>(x1->data()), x1->size()*sizeof(float));
+  }
+
+  bool getSample(std::istream& in, std::vector<tbeam::Track>& tk, std::vector<float>* x0, std::vector<float>* x1) {
+    uint64_t n = 0;
+    if(!get(in, n))  return false;
+    tk.clear();
+    tk.reserve(n);
+    for(uint64_t i = 0; i < n; i++) {
+      double v[4];
+      if(!in.read(reinterpret_cast<char*>(v), sizeof(v)))  return false;
+      tk.push_back(tbeam::Track(static_cast<int>(i), v[0], v[1], v[2], v[3], 0., 0.));
+    }
+    x0->resize(n);
+    if(!in.read(reinterpret_cast<char*>(x0->data()), n*sizeof(float)))  return false;
+    if(!x1)  return true;
+    x1->resize(n);
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(x1->data()), n*sizeof(float)));
+  }
+}
+
+AlignmentSample::AlignmentSample() :
+  run(-1),
+  fei4Z(0.),
+  offsetFEI4X(0.),
+  offsetFEI4Y(0.),
+  residualSigmaFEI4X(0.),
+  residualSigmaFEI4Y(0.),
+  offsetInitD0(0.),
+  offsetInitD1(0.)
+{
+}
+
+bool AlignmentSample::write(const std::string& file) const {
+  std::ofstream out(file.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if(!out) {
+    std::cerr << "Alignment sample file " << file << " could not be opened!" << std::endl;
+    return false;
+  }
+  out.write(magic, sizeof(magic));
+  put(out, version);
+  put(out, static_cast<int32_t>(run));
+  put(out, fei4Z);
+  put(out, offsetFEI4X);
+  put(out, offsetFEI4Y);
+  put(out, residualSigmaFEI4X);
+  put(out, residualSigmaFEI4Y);
+  put(out, offsetInitD0);
+  put(out, offsetInitD1);
+  putSample(out, tkD0, &xD0, nullptr);
+  putSample(out, tkD1, &xD1, nullptr);
+  putSample(out, tkBoth, &xBothD0, &xBothD1);
+  out.close();
+  if(!out) {
+    std::cerr << "Alignment sample file " << file << " could not be written!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool AlignmentSample::read(const std::string& file) {
+  std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+  if(!in) {
+    std::cerr << "Alignment sample file " << file << " could not be opened!" << std::endl;
+    return false;
+  }
+  char m[4];
+  uint32_t v = 0;
+  int32_t r = 0;
+  if(!in.read(m, sizeof(m)) || std::string(m, 4) != std::string(magic, 4) || !get(in, v) || v != version) {
+    std::cerr << file << " is not an alignment sample file(version " << version << ")!" << std::endl;
+    return false;
+  }
+  bool ok = get(in, r) && get(in, fei4Z) && get(in, offsetFEI4X) && get(in, offsetFEI4Y)
+         && get(in, residualSigmaFEI4X) && get(in, residualSigmaFEI4Y) && get(in, offsetInitD0) && get(in, offsetInitD1)
+         && getSample(in, tkD0, &xD0, nullptr) && getSample(in, tkD1, &xD1, nullptr)
+         && getSample(in, tkBoth, &xBothD0, &xBothD1);
+  run = r;
+  if(!ok)  std::cerr << "Alignment sample file " << file << " is truncated!" << std::endl;
+  return ok;
+}
@@ -25,10 +25,50 @@ using std::map;
 BaselineAnalysis::BaselineAnalysis() :
   BeamAnaBase::BeamAnaBase()
 {
+  //cut flow in the order of the selection
+  cf_.good = perf().counter("good event");
+  cf_.onePixHit = perf().counter("1 FEI4 hit");
+  perf().counter("telescope tracks");
+  perf().counter("FEI4 matched track");
+  perf().counter("fiducial track");
+  cf_.clsMatchD0 = perf().counter("cluster matched D0");
+  cf_.clsMatchD1 = perf().counter("cluster matched D1");
+  cf_.clsMatchBoth = perf().counter("cluster matched D0 and D1");
+  cf_.stubMatch = perf().counter("stub matched C0");
 }
 void BaselineAnalysis::bookHistograms() {
   BeamAnaBase::bookHistograms();
   hist_->bookTrackMatchHistograms();
+  //resolve handles for the event loop
+  evH_ = hist_->eventHistos();
+  tmH_.nTrackParams = hist_->hist1D("TrackMatch","nTrackParams");
+  tmH_.nTrackParamsNodupl = hist_->hist1D("TrackMatch","nTrackParamsNodupl");
+  tmH_.trkcluseff = hist_->hist1D("TrackMatch","trkcluseff");
+  tmH_.hposxTkDUT0 = hist_->hist1D("TrackMatch","hposxTkDUT0");
+  tmH_.hposxTkDUT1 = hist_->hist1D("TrackMatch","hposxTkDUT1");
+  tmH_.hminposClsDUT0 = hist_->hist1D("TrackMatch","hminposClsDUT0");
+  tmH_.hminposClsDUT1 = hist_->hist1D("TrackMatch","hminposClsDUT1");
+  tmH_.hminposStub = hist_->hist1D("TrackMatch","hminposStub");
+  tmH_.minresidualDUT0_1trkfid = hist_->hist1D("TrackMatch","minresidualDUT0_1trkfid");
+  tmH_.minresidualDUT1_1trkfid = hist_->hist1D("TrackMatch","minresidualDUT1_1trkfid");
+  tmH_.clswidthDUT0_1trkfid = hist_->hist1D("TrackMatch","clswidthDUT0_1trkfid");
+  tmH_.clswidthDUT1_1trkfid = hist_->hist1D("TrackMatch","clswidthDUT1_1trkfid");
+  tmH_.sminresidualC0_1trkfid = hist_->hist1D("TrackMatch","sminresidualC0_1trkfid");
+  tmH_.minclsTrkPoscorrD0 = hist_->hist2D("TrackMatch","minclsTrkPoscorrD0");
+  tmH_.minclsTrkPoscorrD1 = hist_->hist2D("TrackMatch","minclsTrkPoscorrD1");
+  tmH_.minstubTrkPoscorrD1_all = hist_->hist2D("TrackMatch","minstubTrkPoscorrD1_all");
+  tmH_.minstubTrkPoscorrD1_matched = hist_->hist2D("TrackMatch","minstubTrkPoscorrD1_matched");
+  tmH_.effVtdc_num = hist_->hist1D("TrackMatch","effVtdc_num");
+  tmH_.effVtdc_den = hist_->hist1D("TrackMatch","effVtdc_den");
+}
+
+//everything but the FEI4 hit details
+std::vector<std::string> BaselineAnalysis::requiredBranches() const {
+  static const char* b[] = {
+    "DUT", "DUTFlat", "Condition", "TelescopeEvent", "goodEventFlag", "periodicityFlag",
+    "Fei4Event.nPixHits", "Fei4Event.row", "Fei4Event.col"
+  };
+  return std::vector<std::string>(b, b + sizeof(b)/sizeof(b[0]));
 }
 
 void BaselineAnalysis::beginJob() {
@@ -40,6 +80,11 @@ void BaselineAnalysis::beginJob() {
   analysisTree()->GetEntry(0);
   getCbcConfig(condEv()->cwd, condEv()->window);
 }
+
+void BaselineAnalysis::beginRun() {
+  nEntries_ = analysisTree()->GetEntries();
+  cnt_ = EventCounters();
+}
  
 void BaselineAnalysis::eventLoop()
 {
@@ -52,18 +97,32 @@ void BaselineAnalysis::eventLoop()
              << "\tOffset1="<< cbcOffset1() 
              << "\tOffset2" << cbcOffset2()
    << std::endl;
-   long int trkFid = 0;
-   long int det0clsMatch = 0;
-   long int det1clsMatch = 0;
-   long int clsMatchboth = 0;
-   long int clsMatchany = 0;
-   long int recostubMatchD1 = 0;
+   runEventLoop(nEntries_);
+   long int trkFid = cnt_.trkFid;
+   long int det0clsMatch = cnt_.det0clsMatch;
+   long int det1clsMatch = cnt_.det1clsMatch;
+   long int clsMatchboth = cnt_.clsMatchboth;
+   long int clsMatchany = cnt_.clsMatchany;
+   long int recostubMatchD1 = cnt_.recostubMatchD1;
+   //error(1/N )sqrt( k(1 − k/N )).
+   std::cout << "\n#events with 1 fid trk(both)=" << trkFid
+             << "\n#events with atleast 1 matched cluster with 1 fid trk(D0)=" << det0clsMatch
+             << "\n#events with atleast 1 matched cluster with 1 fid trk(D1)=" << det1clsMatch
+             << "\n#events with atleast 1 matched cluster with 1 fid trk(any)=" << clsMatchany
+             << "\n#events with atleast 1 matched cluster with 1 fid trk(both)=" << clsMatchboth
+             << "\n#events with atleast 1 matched reco stub in D1=" << recostubMatchD1
+             << "\n#Abs Stub Efficiency=" << double(recostubMatchD1)/double(trkFid) << "\tError=" << TMath::Sqrt(recostubMatchD1*(1.- double(recostubMatchD1)/double(trkFid) ))/double(trkFid)
+             << std::endl;
+}
+
+void BaselineAnalysis::processEntries(Long64_t first, Long64_t last)
+{
    unsigned long int lastBadevent = 0; 
    int nMatchedCluster = 0;
    
-   for (Long64_t jentry=0; jentry<nEntries_;jentry++) {
+   for (Long64_t jentry=first; jentry<last;jentry++) {
      clearEvent();
-     Long64_t ientry = analysisTree()->GetEntry(jentry);
+     Long64_t ientry = readEntry(jentry);
      if (ientry < 0) break;
      if (jentry%1000 == 0) {
        cout << " Events processed. " << std::setw(8) << jentry 
@@ -79,18 +138,20 @@ void BaselineAnalysis::eventLoop()
        hist_->fillHist1D("EventInfo","tilt", static_cast<unsigned long int>(condEv()->tilt));
        cout << "Alignment Parameters" << aLparameteres();
      }
-     hist_->fillHist1D("EventInfo","isPeriodic",isPeriodic());
-     hist_->fillHist1D("EventInfo","isGoodFlag",isGoodEvent());
+     hist_->fillHist1D(evH_.isPeriodic,isPeriodic());
+     hist_->fillHist1D(evH_.isGoodFlag,isGoodEvent());
 
      if(!isGoodEvent())   {
       lastBadevent = jentry; 
       continue;
      }
+     perf().count(cf_.good);
 
      if(fei4Ev()->nPixHits != 1)    continue;
+     perf().count(cf_.onePixHit);
      
-     hist_->fillHist1D("EventInfo","condData", condEv()->condData);
-     hist_->fillHist1D("EventInfo","tdcPhase", static_cast<unsigned int>(condEv()->tdcPhase));
+     hist_->fillHist1D(evH_.condData, condEv()->condData);
+     hist_->fillHist1D(evH_.tdcPhase, static_cast<unsigned int>(condEv()->tdcPhase));
       
       setDetChannelVectors();
       const auto& d0c0 = *det0C0();
@@ -100,16 +161,16 @@ void BaselineAnalysis::eventLoop()
       fillCommonHistograms();
       //Telescope Matching
       if(doTelMatching() && hasTelescope()) {
-        hist_->fillHist1D("TrackMatch","nTrackParams",telEv()->nTrackParams);
+        hist_->fillHist1D(tmH_.nTrackParams,telEv()->nTrackParams);
         
-        hist_->fillHist1D("TrackMatch", "trkcluseff", 0);
+        hist_->fillHist1D(tmH_.trkcluseff, 0);
         //Residual Calculation Now moved to AlignmentAnalysis
         //std::vector<double>  xtkDet0, xtkDet1;
         //getExtrapolatedTracks(xtkDet0, xtkDet1);
         std::vector<tbeam::Track>  fidTrkcoll;
         getExtrapolatedTracks(fidTrkcoll);
-        //hist_->fillHist1D("TrackMatch", "nTrackParamsNodupl", xtkDet0.size());
-        hist_->fillHist1D("TrackMatch", "nTrackParamsNodupl", fidTrkcoll.size());
+        //hist_->fillHist1D(tmH_.nTrackParamsNodupl, xtkDet0.size());
+        hist_->fillHist1D(tmH_.nTrackParamsNodupl, fidTrkcoll.size());
         if(fidTrkcoll.empty())    continue;
         bool trkClsmatchD0 = false;
         bool trkClsmatchD1 = false;
@@ -131,9 +192,10 @@ void BaselineAnalysis::eventLoop()
         double minHitresStripD0 = 999.;
         double minHitresStripD1 = 999.;
 
+        PerfCounters::Timer tmatch(perf(), PerfCounters::ClusterMatching);
         for(auto &tk : fidTrkcoll) {
           double x0 = tk.xtkDut0; 
-          hist_->fillHist1D("TrackMatch","hposxTkDUT0",x0); 
+          hist_->fillHist1D(tmH_.hposxTkDUT0,x0); 
           //matching at det0
           for(auto& h : d0c0) {
             double res = x0 - (h-nstrips()/2)*dutpitch();
@@ -152,13 +214,13 @@ void BaselineAnalysis::eventLoop()
               minClusWD0 = cl.size;
             }
           }
-          hist_->fillHist1D("TrackMatch","hminposClsDUT0",minclsposD0);
-          hist_->fillHist1D("TrackMatch","minresidualDUT0_1trkfid", minclsresD0);
-          hist_->fillHist1D("TrackMatch","clswidthDUT0_1trkfid", minClusWD0);
-          hist_->fillHist2D("TrackMatch","minclsTrkPoscorrD0", x0/dutpitch() + nstrips()/2 , minClusStripD0);
+          hist_->fillHist1D(tmH_.hminposClsDUT0,minclsposD0);
+          hist_->fillHist1D(tmH_.minresidualDUT0_1trkfid, minclsresD0);
+          hist_->fillHist1D(tmH_.clswidthDUT0_1trkfid, minClusWD0);
+          hist_->fillHist2D(tmH_.minclsTrkPoscorrD0, x0/dutpitch() + nstrips()/2 , minClusStripD0);
           //matching at det1
           double x1 = tk.xtkDut1;
-          hist_->fillHist1D("TrackMatch","hposxTkDUT1",x1); 
+          hist_->fillHist1D(tmH_.hposxTkDUT1,x1); 
           for(auto& h : d1c0) {
             double res = x1 - (h-nstrips()/2)*dutpitch();
             if(std::fabs(res) < std::fabs(minHitresStripD1)) {
@@ -186,52 +248,62 @@ void BaselineAnalysis::eventLoop()
               minStubStripC0 = s.x;
             }
           }
-          hist_->fillHist1D("TrackMatch","hminposClsDUT1",minclsposD1);
-          hist_->fillHist1D("TrackMatch","minresidualDUT1_1trkfid", minclsresD1);
-          hist_->fillHist1D("TrackMatch","clswidthDUT1_1trkfid", minClusWD1);
-          hist_->fillHist2D("TrackMatch","minclsTrkPoscorrD1", x1/dutpitch() + nstrips()/2, minClusStripD1);
+          hist_->fillHist1D(tmH_.hminposClsDUT1,minclsposD1);
+          hist_->fillHist1D(tmH_.minresidualDUT1_1trkfid, minclsresD1);
+          hist_->fillHist1D(tmH_.clswidthDUT1_1trkfid, minClusWD1);
+          hist_->fillHist2D(tmH_.minclsTrkPoscorrD1, x1/dutpitch() + nstrips()/2, minClusStripD1);
           //for stub
-          hist_->fillHist1D("TrackMatch","sminresidualC0_1trkfid", minStubresC0);
-          hist_->fillHist1D("TrackMatch","hminposStub",minStubposC0);
-          hist_->fillHist2D("TrackMatch","minstubTrkPoscorrD1_all", x1/dutpitch() + nstrips()/2, minStubStripC0);
-          if(smatchD1)  hist_->fillHist2D("TrackMatch","minstubTrkPoscorrD1_matched", x1/dutpitch() + nstrips()/2, minStubStripC0);  
+          hist_->fillHist1D(tmH_.sminresidualC0_1trkfid, minStubresC0);
+          hist_->fillHist1D(tmH_.hminposStub,minStubposC0);
+          hist_->fillHist2D(tmH_.minstubTrkPoscorrD1_all, x1/dutpitch() + nstrips()/2, minStubStripC0);
+          if(smatchD1)  hist_->fillHist2D(tmH_.minstubTrkPoscorrD1_matched, x1/dutpitch() + nstrips()/2, minStubStripC0);  
        }
 
-        hist_->fillHist1D("TrackMatch", "trkcluseff", 3);
-        trkFid++;
-        hist_->fillHist1D("TrackMatch","effVtdc_den",static_cast<unsigned int>(condEv()->tdcPhase));
+        hist_->fillHist1D(tmH_.trkcluseff, 3);
+        cnt_.trkFid++;
+        hist_->fillHist1D(tmH_.effVtdc_den,static_cast<unsigned int>(condEv()->tdcPhase));
+        perf().count(cf_.clsMatchD0, trkClsmatchD0);
+        perf().count(cf_.clsMatchD1, trkClsmatchD1);
+        perf().count(cf_.clsMatchBoth, trkClsmatchD0 && trkClsmatchD1);
+        perf().count(cf_.stubMatch, smatchD1);
         if(trkClsmatchD0)   {
-          det0clsMatch++;
-          hist_->fillHist1D("TrackMatch", "trkcluseff", 4);
+          cnt_.det0clsMatch++;
+          hist_->fillHist1D(tmH_.trkcluseff, 4);
         }
         if(trkClsmatchD1)   {
-          det1clsMatch++;
-          hist_->fillHist1D("TrackMatch", "trkcluseff", 5);
+          cnt_.det1clsMatch++;
+          hist_->fillHist1D(tmH_.trkcluseff, 5);
         }
-        if(trkClsmatchD0 || trkClsmatchD1)   clsMatchany++;
+        if(trkClsmatchD0 || trkClsmatchD1)   cnt_.clsMatchany++;
         if(trkClsmatchD0 && trkClsmatchD1)   {
-          clsMatchboth++;
-          hist_->fillHist1D("TrackMatch", "trkcluseff", 6);
-          hist_->fillHist1D("TrackMatch","effVtdc_num",static_cast<unsigned int>(condEv()->tdcPhase));
+          cnt_.clsMatchboth++;
+          hist_->fillHist1D(tmH_.trkcluseff, 6);
+          hist_->fillHist1D(tmH_.effVtdc_num,static_cast<unsigned int>(condEv()->tdcPhase));
         }
         if(smatchD1) {
-          recostubMatchD1++;
-          hist_->fillHist1D("TrackMatch", "trkcluseff", 8);
+          cnt_.recostubMatchD1++;
+          hist_->fillHist1D(tmH_.trkcluseff, 8);
         }
         if(!trkClsmatchD0 && !trkClsmatchD1)  {
-          hist_->fillHist1D("TrackMatch", "trkcluseff", 7);
+          hist_->fillHist1D(tmH_.trkcluseff, 7);
         }
       }   
    }//event loop
-   //error(1/N )sqrt( k(1 − k/N )).
-   std::cout << "\n#events with 1 fid trk(both)=" << trkFid
-             << "\n#events with atleast 1 matched cluster with 1 fid trk(D0)=" << det0clsMatch
-             << "\n#events with atleast 1 matched cluster with 1 fid trk(D1)=" << det1clsMatch
-             << "\n#events with atleast 1 matched cluster with 1 fid trk(any)=" << clsMatchany
-             << "\n#events with atleast 1 matched cluster with 1 fid trk(both)=" << clsMatchboth
-             << "\n#events with atleast 1 matched reco stub in D1=" << recostubMatchD1
-             << "\n#Abs Stub Efficiency=" << double(recostubMatchD1)/double(trkFid) << "\tError=" << TMath::Sqrt(recostubMatchD1*(1.- double(recostubMatchD1)/double(trkFid) ))/double(trkFid)
-             << std::endl;
+}
+
+BeamAnaBase* BaselineAnalysis::makeWorker() const {
+  return new BaselineAnalysis();
+}
+
+void BaselineAnalysis::mergeWorker(BeamAnaBase& w) {
+  BaselineAnalysis& bw = dynamic_cast<BaselineAnalysis&>(w);
+  cnt_.trkFid += bw.cnt_.trkFid;
+  cnt_.det0clsMatch += bw.cnt_.det0clsMatch;
+  cnt_.det1clsMatch += bw.cnt_.det1clsMatch;
+  cnt_.clsMatchboth += bw.cnt_.clsMatchboth;
+  cnt_.clsMatchany += bw.cnt_.clsMatchany;
+  cnt_.recostubMatchD1 += bw.cnt_.recostubMatchD1;
+  bw.cnt_ = EventCounters();
 }
 
 void BaselineAnalysis::clearEvent() {
@@ -240,7 +312,7 @@ void BaselineAnalysis::clearEvent() {
 
 void BaselineAnalysis::endJob() {
   BeamAnaBase::endJob();
-  hist_->closeFile();
+  closeOutput();
 }
 
 BaselineAnalysis::~BaselineAnalysis(){
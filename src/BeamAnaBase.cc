@@ -10,15 +10,28 @@
 
 #include "BeamAnaBase.h"
 #include "Utility.h"
+#include "AlignmentFile.h"
+#include "AlignmentDB.h"
 #include "TSystem.h"
 #include "TChain.h"
+#include "RVersion.h"
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,6,0)
+#include "TThread.h"
+#endif
 #include<algorithm>
 #include <fstream>
+#include <iomanip>
+#include <thread>
+#include <cmath>
+#include <utility>
 
 BeamAnaBase::BeamAnaBase() :
   fin_(nullptr),
+  chain_(nullptr),
   analysisTree_(nullptr),
   dutEv_(new tbeam::dutEvent()),
+  dutFlatEv_(new tbeam::dutFlatEvent()),
+  hasDUTFlat_(false),
   condEv_(new tbeam::condEvent()),
   telEv_(new  tbeam::TelescopeEvent()),
   fei4Ev_(new tbeam::FeIFourEvent()),
@@ -41,7 +54,18 @@ BeamAnaBase::BeamAnaBase() :
   cbcstubChipids_(new std::map<std::string,std::vector<unsigned int>>()),
   dut_maskedChannels_(new std::map<std::string,std::vector<int>>()),
   nStubsrecoSword_(0),
-  nStubscbcSword_(0)
+  nStubscbcSword_(0),
+  nThreads_(1),
+  isWorker_(false),
+  workerId_(-1),
+  useEventCache_(true),
+  eventCacheMaxMB_(1024),
+  pruneBranches_(true),
+  treeCacheMB_(0.),
+  ioStats_(false),
+  readAheadSlots_(0),
+  readAhead_(nullptr),
+  currentRun_(0)
 {
   dutRecoClmap_->insert({("det0C0"),std::vector<tbeam::cluster>()});
   dutRecoClmap_->insert({("det0C1"),std::vector<tbeam::cluster>()});
@@ -63,8 +87,11 @@ bool BeamAnaBase::readJob(const std::string jfile) {
   }
   std::string line;
   std::string alignParfile;
+  std::string alignDB;
+  int alignVersion = AlignmentDB::kLatest;
   bool ralignmentFromfile;
   int run;
+  std::string runList;
   if(jobcardFile.is_open()) {
     while(std::getline(jobcardFile,line)) {
       // enable '#' and '//' style comments
@@ -81,56 +108,58 @@ bool BeamAnaBase::readJob(const std::string jfile) {
       else if(key=="fei4Z")  alPars_.FEI4z(std::atof(value.c_str()));
       else if(key=="readAlignmentFromfile")  ralignmentFromfile = (atoi(value.c_str()) > 0) ? true : false;
       else if(key=="alignmentOutputFile")  alignParfile = value;
+      else if(key=="alignmentDB")  alignDB = value;
+      else if(key=="alignmentVersion")  alignVersion = atoi(value.c_str());
       else if(key=="residualSigmaDUT")     residualSigmaDUT_ = std::atof(value.c_str());
       else if(key=="doTelescopeMatching") doTelMatching_ = (atoi(value.c_str()) > 0) ? true : false;
       else if(key=="doChannelMasking") doChannelMasking_ = (atoi(value.c_str()) > 0) ? true : false;
       else if(key=="channelMaskFile")  chmaskFilename_ = value;
       else if(key=="nStrips") nStrips_ = atoi(value.c_str());
       else if(key=="pitchDUT") pitchDUT_ = std::atof(value.c_str());
+      else if(key=="nThreads") nThreads_ = atoi(value.c_str());
+      else if(key=="useEventCache") useEventCache_ = (atoi(value.c_str()) > 0) ? true : false;
+      else if(key=="eventCacheMaxMB") eventCacheMaxMB_ = std::max(atoi(value.c_str()), 0);
+      else if(key=="pruneBranches") pruneBranches_ = (atoi(value.c_str()) > 0) ? true : false;
+      else if(key=="treeCacheSize") treeCacheMB_ = std::atof(value.c_str());
+      else if(key=="ioStats") ioStats_ = (atoi(value.c_str()) > 0) ? true : false;
+      else if(key=="readAheadSlots") readAheadSlots_ = std::max(atoi(value.c_str()), 0);
+      else if(key=="perfStats") perf_.enable(atoi(value.c_str()) > 0);
+      else if(key=="runList")  runList = value;
     }
   }
   jobcardFile.close();
-  std::cout << run << "::" << ralignmentFromfile << "::" << alignParfile << std::endl;
-  if(ralignmentFromfile) {
-    std::ifstream alf(alignParfile.c_str());
-    if (!alf) {
-      std::cerr << "Alignment File: " << alignParfile << " could not be opened!" << std::endl;
-    }
-    if(alf.is_open()) {
-      while(std::getline(alf,line)) {
-        // enable '#' and '//' style comments
-        //if (line.substr(0,1) == "#" || line.substr(0,2) == "//") continue;
-        std::cout << line << std::endl;
-        std::vector<std::string> tokens;
-        Utility::tokenize(line,tokens,":");
-        std::cout << "Tokens size>>" << tokens.size() << std::endl;
-        std::vector<std::string> rtemp;
-        Utility::tokenize(tokens[0],rtemp,"=");
-        std::cout << "Run number>>" << atoi(rtemp[1].c_str()) << std::endl;
-        if(atoi(rtemp[1].c_str()) != run)  continue;
-        for(unsigned int i = 1; i < tokens.size(); i++) {
-          std::vector<std::string> vtemp;
-          Utility::tokenize(tokens[i],vtemp,"=");
-          std::string key = vtemp[0];
-          std::string value = vtemp[1];
-          std::cout << key << ":::" << value << std::endl;
-          if(key=="offsetFEI4X") alPars_.offsetFEI4x(std::atof(value.c_str())); 
-          else if(key=="offsetFEI4Y") alPars_.offsetFEI4y(std::atof(value.c_str())); 
-          else if(key=="residualSigmaFEI4X") alPars_.residualSigmaFEI4x(std::atof(value.c_str())); 
-          else if(key=="residualSigmaFEI4Y") alPars_.residualSigmaFEI4y(std::atof(value.c_str())); 
-          else if(key=="zD0")  alPars_.d0Z(std::atof(value.c_str()));
-          else if(key=="offsetD0")  alPars_.d0Offset(std::atof(value.c_str()));
-          else if(key=="deltaZ")  alPars_.deltaZ(std::atof(value.c_str()));
-          else if(key=="angle")  alPars_.theta(std::atof(value.c_str()));
-        }        
-      }
-      alf.close();
-    } else {
-      std::cout << "Alignment File not found!!" << std::endl;
+  evCache_.setMaxMemory(static_cast<std::size_t>(eventCacheMaxMB_)*1024*1024);
+  std::cout << run << "::" << ralignmentFromfile << "::" << (alignDB.empty() ? alignParfile : alignDB) << std::endl;
+  //the alignment DB, if given, is used instead of the text file
+  auto readAlignment = [&](int r, tbeam::alignmentPars& al) {
+    return alignDB.empty() ? readAlignmentForRun(alignParfile, r, al) : readAlignmentFromDB(alignDB, r, alignVersion, al);
+  };
+  if(ralignmentFromfile)  readAlignment(run, alPars_);
+  alPars_.setD1parametersfromD0();
+  //runList=<Run>:<file or glob>,<Run>:<file or glob>,...
+  //every run gets its own alignment constants and its own output file
+  std::vector<std::string> rtokens;
+  Utility::tokenize(runList,rtokens,",");
+  for(auto& r : rtokens) {
+    std::vector<std::string> rtemp;
+    Utility::tokenize(r,rtemp,":");
+    if(rtemp.size() != 2) {
+      std::cerr << "runList entry <" << r << "> is not <Run>:<file>, skipped!" << std::endl;
+      continue;
     }
-    
+    RunInput ri;
+    ri.run = atoi(rtemp[0].c_str());
+    ri.files = rtemp[1];
+    std::string ext = ".root";
+    std::string base = outFilename_;
+    if(base.size() > ext.size() && base.compare(base.size() - ext.size(), ext.size(), ext) == 0)
+      base.erase(base.size() - ext.size());
+    ri.outFile = base + "_Run" + rtemp[0] + ext;
+    ri.alPars = alPars_;
+    if(ralignmentFromfile)  readAlignment(ri.run, ri.alPars);
+    ri.alPars.setD1parametersfromD0();
+    runList_.push_back(ri);
   }
-  alPars_.setD1parametersfromD0();
   std::cout << "Initialized with the following options::"
             << "Infile: " << iFilename_
             << "\nOutFile: " << outFilename_
@@ -139,19 +168,121 @@ bool BeamAnaBase::readJob(const std::string jfile) {
             << "\nchannelMaskFile:" << chmaskFilename_
             << "\nnStrips:" << nStrips_
             << "\npitchDUT:" << pitchDUT_
+            << "\nnThreads:" << nThreads_
+            << "\nuseEventCache:" << useEventCache_
+            << "\neventCacheMaxMB:" << eventCacheMaxMB_
+            << "\npruneBranches:" << pruneBranches_
+            << "\ntreeCacheSize(MB):" << treeCacheMB_
+            << "\nioStats:" << ioStats_
+            << "\nreadAheadSlots:" << readAheadSlots_
+            << "\nperfStats:" << perf_.enabled()
+            << "\nnRuns:" << runList_.size()
             << std::endl;
+  for(auto& r : runList_)
+    std::cout << "Run " << r.run << ": " << r.files << " -> " << r.outFile << std::endl;
   std::cout << alPars_ << std::endl;
   if(doChannelMasking_)  setChannelMasking(chmaskFilename_);
+  return true;
+}
+
+bool BeamAnaBase::readAlignmentForRun(const std::string& alignParfile, int run, tbeam::alignmentPars& al) {
+  std::ifstream alf(alignParfile.c_str());
+  if (!alf) {
+    std::cerr << "Alignment File: " << alignParfile << " could not be opened!" << std::endl;
+    std::cout << "Alignment File not found!!" << std::endl;
+    return false;
+  }
+  //only the Run= of each line is decoded, the last line of the run is parsed
+  std::string line;
+  std::string runLine;
+  while(std::getline(alf,line)) {
+    if(AlignmentFile::runOfLine(line) == run)  runLine = line;
+  }
+  bool found = !runLine.empty();
+  if(found) {
+    std::cout << runLine << std::endl;
+    AlignmentFile::parse(runLine, al);
+  }
+  alf.close();
+  if(!found)  std::cerr << "Run " << run << " not found in the alignment file " << alignParfile << std::endl;
+  return found;
+}
+
+bool BeamAnaBase::readAlignmentFromDB(const std::string& dbFile, int run, int version, tbeam::alignmentPars& al) {
+  int found = 0;
+  if(!AlignmentDB::lookup(dbFile, run, version, al, &found)) {
+    std::cerr << "Run " << run << (version == AlignmentDB::kLatest ? std::string("") : " version " + std::to_string(version))
+              << " not found in the alignment DB " << dbFile << std::endl;
+    return false;
+  }
+  std::cout << "Alignment of run " << run << " version " << found << " from " << dbFile << std::endl;
+  return true;
 }
 
 void BeamAnaBase::beginJob(){
+  //after the counters an analysis declares in its constructor, unless it lists these too
+  cfTracks_ = perf_.counter("telescope tracks");
+  cfFei4Matched_ = perf_.counter("FEI4 matched track");
+  cfFiducial_ = perf_.counter("fiducial track");
+  if(!runList_.empty()) {
+    iFilename_ = runList_[currentRun_].files;
+    alPars_ = runList_[currentRun_].alPars;
+  }
   if( setInputFile(iFilename_) == 0 ) {
     std::cout << "Empty Chain!!";
     exit(1);
   }
-  hout_ = new Histogrammer(outFilename_);
+  if(isWorker_)  hout_ = new Histogrammer("worker" + std::to_string(workerId_), true);
+  //with a runList the histograms are booked once in memory and written to the
+  //output file of each run by nextRun()/endJob()
+  else if(!runList_.empty())  hout_ = new Histogrammer("runList", true);
+  else  hout_ = new Histogrammer(outFilename_);
+}
+
+bool BeamAnaBase::nextRun() {
+  if(isWorker_ || currentRun_ + 1 >= static_cast<int>(runList_.size()))  return false;
+  //workers hold the chain of the run, they are made again for the next one
+  stopReadAhead();
+  collectWorkerStats();
+  for(auto& w : workers_)
+    delete w;
+  workers_.clear();
+  writeRunOutput();
+  hout_->resetHistograms();
+  jobPerf_.add(perf_);
+  perf_.reset();
+  evCache_.clear(0);
+  currentRun_++;
+  std::cout << "Switching to Run " << runList_[currentRun_].run << std::endl;
+  iFilename_ = runList_[currentRun_].files;
+  alPars_ = runList_[currentRun_].alPars;
+  if( setInputFile(iFilename_) == 0 ) {
+    std::cout << "Empty Chain!!";
+    exit(1);
+  }
+  setAddresses();
+  analysisTree_->GetEntry(0);
+  getCbcConfig(condEv_->cwd, condEv_->window);
+  beginRun();
+  return true;
+}
+void BeamAnaBase::setFileNames(const std::string& iFile, const std::string& oFile) {
+  iFilename_ = iFile;
+  outFilename_ = oFile;
 }
 bool BeamAnaBase::setInputFile(const std::string& fname) {
+  iFilename_ = fname;
+  //globs and the runs of a runList are read through a TChain
+  if(fname.find_first_of("*?") != std::string::npos || !runList_.empty()) {
+    delete chain_;
+    chain_ = new TChain("analysisTree");
+    if(chain_->Add(fname.c_str()) == 0) {
+      std::cout <<  "No file matches " << fname << "!!" << std::endl;
+      return false;
+    }
+    analysisTree_ = chain_;
+    return true;
+  }
   fin_ = TFile::Open(fname.c_str());
   if(!fin_)    {
     std::cout <<  "File " << fname << " could not be opened!!" << std::endl;
@@ -172,100 +303,107 @@ void BeamAnaBase::bookHistograms() {
   hout_->bookDUTHistograms("det1");
   hout_->bookStubHistograms();
   hout_->bookCorrelationHistograms();
+  //resolve the handles used in fillCommonHistograms once
+  ch_.det0 = hout_->dutHistos("det0","C0");
+  ch_.det1 = hout_->dutHistos("det1","C0");
+  ch_.corHitC0 = hout_->hist1D("Correlation","cor_hitC0");
+  ch_.nclusterdiffC0 = hout_->hist1D("Correlation","nclusterdiffC0");
+  ch_.nstubRecoC0 = hout_->hist1D("StubInfo","nstubRecoC0");
+  ch_.nstubsFromReco = hout_->hist1D("StubInfo","nstubsFromReco");
+  ch_.nstubsFromCBCSword = hout_->hist1D("StubInfo","nstubsFromCBCSword");
+  ch_.nstubsFromRecoSword = hout_->hist1D("StubInfo","nstubsFromRecoSword");
+  ch_.recoStubWord = hout_->hist1D("StubInfo","recoStubWord");
+  ch_.cbcStubWord = hout_->hist1D("StubInfo","cbcStubWord");
+  ch_.stubMatch = hout_->hist1D("StubInfo","stubMatch");
+  ch_.nstubsdiffSword = hout_->hist1D("StubInfo","nstubsdiffSword");
+  ch_.nstubsdiff = hout_->hist1D("StubInfo","nstubsdiff");
 }
 
 void BeamAnaBase::fillCommonHistograms() {
-      const auto& d0c1 = *det0C1();
-      const auto& d1c0 = *det1C0();
-      const auto& d1c1 = *det1C1();      
+      PerfCounters::Timer t(perf_, PerfCounters::HistogramFill);
       //Fill histo for det0
-      hout_->fillHist1D("det0","chsizeC0", dut0_chtempC0_->size());
-      //hout_->fillHist1D("det0","chsizeC1", dut0_chtempC1_->size());
-      hout_->fillHistofromVec(*dut0_chtempC0_,"det0","hitmapC0");
-      //hout_->fillHistofromVec(dut0_chtempC1_,"det0","hitmapC1");
-      hout_->fill2DHistofromVec(*dut0_chtempC0_,*dut0_chtempC1_,"det0","hitmapfull");
-      hout_->fillClusterHistograms("det0",dutRecoClmap_->at("det0C0"),"C0");
-      //hout_->fillClusterHistograms("det0",dutRecoClmap_->at("dut0_chtempC1_"),"C1");
-      hout_->fillHist2D("det0","nhitvsnclusC0", dut0_chtempC0_->size(), dutRecoClmap_->at("det0C0").size());
+      hout_->fillHist1D(ch_.det0.chsize, dut0_chtempC0_->size());
+      hout_->fillHistofromVec(*dut0_chtempC0_, ch_.det0.hitmap);
+      hout_->fill2DHistofromVec(*dut0_chtempC0_,*dut0_chtempC1_, ch_.det0.hitmapfull);
+      const auto& d0cls = dutRecoClmap_->at("det0C0");
+      hout_->fillClusterHistograms(ch_.det0.clusters, d0cls);
+      hout_->fillHist2D(ch_.det0.nhitvsnclus, dut0_chtempC0_->size(), d0cls.size());
       for(const auto& h: *dut0_chtempC0_) {
         int minposdiff = 255;
-        for(const auto& cl:dutRecoClmap_->at("det0C0")) {
+        for(const auto& cl:d0cls) {
           if(std::abs(cl.x-h) < minposdiff)   minposdiff = std::abs(cl.x-h);
         }
-        hout_->fillHist2D("det0","nhitvsHitClusPosDiffC0", dut0_chtempC0_->size(), minposdiff);
+        hout_->fillHist2D(ch_.det0.nhitvsHitClusPosDiff, dut0_chtempC0_->size(), minposdiff);
       }
 
 
       //Fill histo for det1
-      hout_->fillHist1D("det1","chsizeC0", dut1_chtempC0_->size());
-      //hout_->fillHist1D("det1","chsizeC1", dut1_chtempC1_->size());
-      hout_->fillHistofromVec(*dut1_chtempC0_,"det1","hitmapC0");
-      //hout_->fillHistofromVec(*dut1_chtempC1_,"det1","hitmapC1");
-      hout_->fill2DHistofromVec(*dut1_chtempC0_,*dut1_chtempC1_,"det1","hitmapfull");
-      hout_->fillClusterHistograms("det1",dutRecoClmap_->at("det1C0"),"C0");
-      //hout_->fillClusterHistograms("det1",dutRecoClmap_->at("det1C1"),"C1");
-      hout_->fillHist2D("det1","nhitvsnclusC0", dut1_chtempC0_->size(), dutRecoClmap_->at("det1C0").size());
+      hout_->fillHist1D(ch_.det1.chsize, dut1_chtempC0_->size());
+      hout_->fillHistofromVec(*dut1_chtempC0_, ch_.det1.hitmap);
+      hout_->fill2DHistofromVec(*dut1_chtempC0_,*dut1_chtempC1_, ch_.det1.hitmapfull);
+      const auto& d1cls = dutRecoClmap_->at("det1C0");
+      hout_->fillClusterHistograms(ch_.det1.clusters, d1cls);
+      hout_->fillHist2D(ch_.det1.nhitvsnclus, dut1_chtempC0_->size(), d1cls.size());
       for(const auto& h: *dut1_chtempC0_) {
         int minposdiff = 255;
-        for(const auto& cl:dutRecoClmap_->at("det1C0")) {
+        for(const auto& cl:d1cls) {
           if(std::abs(cl.x-h) < minposdiff)   minposdiff = std::abs(cl.x-h);
         }
-        hout_->fillHist2D("det1","nhitvsHitClusPosDiffC0", dut1_chtempC0_->size(), minposdiff);
+        hout_->fillHist2D(ch_.det1.nhitvsHitClusPosDiff, dut1_chtempC0_->size(), minposdiff);
       }
       
-      if(dut0_chtempC0_->size() && !dut1_chtempC0_->size()) hout_->fillHist1D("Correlation","cor_hitC0", 1);
-      if(!dut0_chtempC0_->size() && dut1_chtempC0_->size()) hout_->fillHist1D("Correlation","cor_hitC0", 2);
-      if(dut0_chtempC0_->size() && dut1_chtempC0_->size()) hout_->fillHist1D("Correlation","cor_hitC0", 3);
-      if(!dut0_chtempC0_->size() && !dut1_chtempC0_->size()) hout_->fillHist1D("Correlation","cor_hitC0", 4);
-      hout_->fillHist1D("Correlation","nclusterdiffC0", std::abs(dutRecoClmap_->at("det1C0").size() - 
-                                                        dutRecoClmap_->at("det1C0").size())); 
+      if(dut0_chtempC0_->size() && !dut1_chtempC0_->size()) hout_->fillHist1D(ch_.corHitC0, 1);
+      if(!dut0_chtempC0_->size() && dut1_chtempC0_->size()) hout_->fillHist1D(ch_.corHitC0, 2);
+      if(dut0_chtempC0_->size() && dut1_chtempC0_->size()) hout_->fillHist1D(ch_.corHitC0, 3);
+      if(!dut0_chtempC0_->size() && !dut1_chtempC0_->size()) hout_->fillHist1D(ch_.corHitC0, 4);
+      hout_->fillHist1D(ch_.nclusterdiffC0, std::abs(d1cls.size() - d1cls.size())); 
 
       unsigned int tdc_phase = static_cast<unsigned int>(condEv()->tdcPhase);
-      hout_->fillHist2D("det0", "propertyVsTDC2DC0",tdc_phase, 1.0);
-      hout_->fillHist2D("det0", "propertyVsTDC2DC0",0.0, 1.0);
-      hout_->fillHist2D("det1", "propertyVsTDC2DC0",tdc_phase, 1.0);
-      hout_->fillHist2D("det1", "propertyVsTDC2DC0",0.0, 1.0);
+      hout_->fillHist2D(ch_.det0.propertyVsTDC2D, tdc_phase, 1.0);
+      hout_->fillHist2D(ch_.det0.propertyVsTDC2D, 0.0, 1.0);
+      hout_->fillHist2D(ch_.det1.propertyVsTDC2D, tdc_phase, 1.0);
+      hout_->fillHist2D(ch_.det1.propertyVsTDC2D, 0.0, 1.0);
       if (dut0_chtempC0_->size()) {
-        hout_->fillHist2D("det0", "propertyVsTDC2DC0",tdc_phase, 3.0);
-        hout_->fillHist2D("det0", "propertyVsTDC2DC0",0.0, 3.0);
+        hout_->fillHist2D(ch_.det0.propertyVsTDC2D, tdc_phase, 3.0);
+        hout_->fillHist2D(ch_.det0.propertyVsTDC2D, 0.0, 3.0);
       }
       if (dut1_chtempC0_->size()) {
-        hout_->fillHist2D("det1", "propertyVsTDC2DC0",tdc_phase, 3.0);
-        hout_->fillHist2D("det1", "propertyVsTDC2DC0",0.0, 3.0);
+        hout_->fillHist2D(ch_.det1.propertyVsTDC2D, tdc_phase, 3.0);
+        hout_->fillHist2D(ch_.det1.propertyVsTDC2D, 0.0, 3.0);
       }
-      if (dutRecoClmap_->at("det0C0").size()) {
-        hout_->fillHist2D("det0", "propertyVsTDC2DC0",tdc_phase, 5.0);
-        hout_->fillHist2D("det0", "propertyVsTDC2DC0",0.0, 5.0);
+      if (d0cls.size()) {
+        hout_->fillHist2D(ch_.det0.propertyVsTDC2D, tdc_phase, 5.0);
+        hout_->fillHist2D(ch_.det0.propertyVsTDC2D, 0.0, 5.0);
       }
-      if (dutRecoClmap_->at("det1C0").size()) {
-        hout_->fillHist2D("det1", "propertyVsTDC2DC0",tdc_phase, 5.0);
-        hout_->fillHist2D("det1", "propertyVsTDC2DC0",0.0, 5.0);
+      if (d1cls.size()) {
+        hout_->fillHist2D(ch_.det1.propertyVsTDC2D, tdc_phase, 5.0);
+        hout_->fillHist2D(ch_.det1.propertyVsTDC2D, 0.0, 5.0);
       }
       if (dutRecoStubmap_->at("C0").size()) {
-        hout_->fillHist2D("det0", "propertyVsTDC2DC0",tdc_phase, 7.0);
-        hout_->fillHist2D("det0", "propertyVsTDC2DC0",0.0, 7.0);
-        hout_->fillHist2D("det1", "propertyVsTDC2DC0",tdc_phase, 7.0);
-        hout_->fillHist2D("det1", "propertyVsTDC2DC0",0.0, 7.0);
+        hout_->fillHist2D(ch_.det0.propertyVsTDC2D, tdc_phase, 7.0);
+        hout_->fillHist2D(ch_.det0.propertyVsTDC2D, 0.0, 7.0);
+        hout_->fillHist2D(ch_.det1.propertyVsTDC2D, tdc_phase, 7.0);
+        hout_->fillHist2D(ch_.det1.propertyVsTDC2D, 0.0, 7.0);
       }
 
-      int totStubReco = dutEv_->stubs.size();
+      int totStubReco = dutRecoStubmap_->at("C0").size() + dutRecoStubmap_->at("C1").size();
       int nstubrecoSword = nStubsrecoSword_;
       int nstubscbcSword = nStubscbcSword_;
-      hout_->fillHist1D("StubInfo","nstubRecoC0", dutRecoStubmap_->at("C0").size());      
-      hout_->fillHist1D("StubInfo","nstubsFromReco",totStubReco);
-      hout_->fillHist1D("StubInfo","nstubsFromCBCSword",nstubrecoSword);
-      hout_->fillHist1D("StubInfo","nstubsFromRecoSword",nstubscbcSword);
+      hout_->fillHist1D(ch_.nstubRecoC0, dutRecoStubmap_->at("C0").size());      
+      hout_->fillHist1D(ch_.nstubsFromReco, totStubReco);
+      hout_->fillHist1D(ch_.nstubsFromCBCSword, nstubrecoSword);
+      hout_->fillHist1D(ch_.nstubsFromRecoSword, nstubscbcSword);
       for(auto& c : *recostubChipids_)  
-        hout_->fillHistofromVec(c.second,"StubInfo","recoStubWord");
+        hout_->fillHistofromVec(c.second, ch_.recoStubWord);
       for(auto& c : *cbcstubChipids_)  
-        hout_->fillHistofromVec(c.second,"StubInfo","cbcStubWord");
+        hout_->fillHistofromVec(c.second, ch_.cbcStubWord);
 
-      if (!nstubrecoSword && !nstubscbcSword) hout_->fillHist1D("StubInfo","stubMatch", 1);
-      if (!nstubrecoSword && nstubscbcSword)  hout_->fillHist1D("StubInfo","stubMatch", 2);
-      if (nstubrecoSword && !nstubscbcSword)  hout_->fillHist1D("StubInfo","stubMatch", 3);
-      if (nstubrecoSword && nstubscbcSword)   hout_->fillHist1D("StubInfo","stubMatch", 4);
-      hout_->fillHist1D("StubInfo","nstubsdiffSword",nstubrecoSword - nstubscbcSword);      
-      hout_->fillHist1D("StubInfo","nstubsdiff",totStubReco - nstubscbcSword);  
+      if (!nstubrecoSword && !nstubscbcSword) hout_->fillHist1D(ch_.stubMatch, 1);
+      if (!nstubrecoSword && nstubscbcSword)  hout_->fillHist1D(ch_.stubMatch, 2);
+      if (nstubrecoSword && !nstubscbcSword)  hout_->fillHist1D(ch_.stubMatch, 3);
+      if (nstubrecoSword && nstubscbcSword)   hout_->fillHist1D(ch_.stubMatch, 4);
+      hout_->fillHist1D(ch_.nstubsdiffSword, nstubrecoSword - nstubscbcSword);      
+      hout_->fillHist1D(ch_.nstubsdiff, totStubReco - nstubscbcSword);  
 }
 
 void BeamAnaBase::setChannelMasking(const std::string cFile) {
@@ -285,28 +423,87 @@ bool BeamAnaBase::branchFound(const string& b)
 
 
 void BeamAnaBase::setAddresses() {
+  //with read-ahead the branches are bound to the buffers the reader thread moves over its slots
+  stopReadAhead();
+  if(readAheadSlots_ > 0 && !readAhead_) {
+    enableRootThreads();
+    EventReadAhead::Event own = {dutEv_, dutFlatEv_, condEv_, telEv_, fei4Ev_, false, false};
+    readAhead_ = new EventReadAhead(readAheadSlots_, own);
+  }
+  EventReadAhead::Event* rb = readAhead_ ? readAhead_->branchBuffers() : nullptr;
   //set the address of the DUT tree
-  if(branchFound("DUT"))    analysisTree_->SetBranchAddress("DUT", &dutEv_);
-  if(branchFound("Condition"))    analysisTree_->SetBranchAddress("Condition", &condEv_);
-  if(branchFound("TelescopeEvent"))    analysisTree_->SetBranchAddress("TelescopeEvent",&telEv_);
-  if(branchFound("Fei4Event"))     analysisTree_->SetBranchAddress("Fei4Event",&fei4Ev_);
-  if(branchFound("periodicityFlag"))    analysisTree_->SetBranchAddress("periodicityFlag",&periodcictyF_);
-  if(branchFound("goodEventFlag"))    analysisTree_->SetBranchAddress("goodEventFlag",&isGood_);
-  analysisTree_->SetBranchStatus("*",1);
+  if(branchFound("DUT"))    analysisTree_->SetBranchAddress("DUT", rb ? &rb->dut : &dutEv_);
+  hasDUTFlat_ = branchFound("DUTFlat");
+  if(hasDUTFlat_)    analysisTree_->SetBranchAddress("DUTFlat", rb ? &rb->dutFlat : &dutFlatEv_);
+  if(branchFound("Condition"))    analysisTree_->SetBranchAddress("Condition", rb ? &rb->cond : &condEv_);
+  if(branchFound("TelescopeEvent"))    analysisTree_->SetBranchAddress("TelescopeEvent", rb ? &rb->tel : &telEv_);
+  if(branchFound("Fei4Event"))     analysisTree_->SetBranchAddress("Fei4Event", rb ? &rb->fei4 : &fei4Ev_);
+  if(branchFound("periodicityFlag"))    analysisTree_->SetBranchAddress("periodicityFlag", rb ? &rb->periodic : &periodcictyF_);
+  if(branchFound("goodEventFlag"))    analysisTree_->SetBranchAddress("goodEventFlag", rb ? &rb->good : &isGood_);
+  //only the branches of requiredBranches() are read, through a TTreeCache sized for them
+  std::vector<std::string> readBranches = TreeIOStats::enableBranches(analysisTree_,
+                                            pruneBranches_ ? requiredBranches() : std::vector<std::string>());
+  Long64_t cacheSize = TreeIOStats::setTreeCache(analysisTree_, readBranches, treeCacheMB_);
+  io_.setTree(analysisTree_, readBranches, ioStats_);
+  if(isWorker_)  return;
+  std::cout << "Branches read:";
+  for(auto& b : readBranches)
+    std::cout << " " << b;
+  std::cout << "\nTTreeCache size: " << cacheSize/1024 << " kB" << std::endl;
+  if(readAhead_)  std::cout << "Read-ahead on " << readAheadSlots_ << " event slots" << std::endl;
+}
+
+Long64_t BeamAnaBase::readEntry(Long64_t jentry) {
+  PerfCounters::Timer t(perf_, PerfCounters::ReadEntry);
+  if(!readAhead_)  return io_.readEntry(jentry);
+  //the reader is (re)started on a jump, it reads up to the end of the tree
+  if(!readAhead_->running() || readAhead_->nextEntry() != jentry) {
+    stopReadAhead();
+    readAhead_->start([this](Long64_t i) { return io_.readEntry(i); }, jentry, analysisTree_->GetEntries());
+  }
+  Long64_t nb;
+  const EventReadAhead::Event* ev = readAhead_->next(jentry, nb);
+  if(!ev)  return -1;
+  dutEv_ = ev->dut;
+  dutFlatEv_ = ev->dutFlat;
+  condEv_ = ev->cond;
+  telEv_ = ev->tel;
+  fei4Ev_ = ev->fei4;
+  periodcictyF_ = ev->periodic;
+  isGood_ = ev->good;
+  return nb;
+}
+
+void BeamAnaBase::stopReadAhead() {
+  if(!readAhead_)  return;
+  readAhead_->stop();
+  const EventReadAhead::Event& own = readAhead_->ownBuffers();
+  dutEv_ = own.dut;
+  dutFlatEv_ = own.dutFlat;
+  condEv_ = own.cond;
+  telEv_ = own.tel;
+  fei4Ev_ = own.fei4;
 }
 
 void BeamAnaBase::setDetChannelVectors() {
+  PerfCounters::Timer t(perf_, PerfCounters::DetChannelVectors);
+  //the flat columns are masked while they are copied, not timed apart
+  if(hasDUTFlat_) {
+    setDetChannelVectorsFlat();
+    return;
+  }
   if(doChannelMasking_) {
+    PerfCounters::Timer tm(perf_, PerfCounters::ChannelMasking);
     if( dutEv_->dut_channel.find("det0") != dutEv_->dut_channel.end() )
-      Utility::getChannelMaskedHits(dutEv_->dut_channel.at("det0"), dut_maskedChannels_->at("det0")); 
+      Utility::getChannelMaskedHits(dutEv_->dut_channel.at("det0"), dutChannelMask_[0]); 
     if( dutEv_->dut_channel.find("det1") != dutEv_->dut_channel.end() )
-      Utility::getChannelMaskedHits(dutEv_->dut_channel.at("det1"), dut_maskedChannels_->at("det1")); 
-    if( dutEv_->clusters.find("det1") != dutEv_->clusters.end() )  
-      Utility::getChannelMaskedClusters(dutEv_->clusters.at("det0"), dut_maskedChannels_->at("det0"));
+      Utility::getChannelMaskedHits(dutEv_->dut_channel.at("det1"), dutChannelMask_[1]); 
+    if( dutEv_->clusters.find("det0") != dutEv_->clusters.end() )
+      Utility::getChannelMaskedClusters(dutEv_->clusters.at("det0"), dutChannelMask_[0]);
     if( dutEv_->clusters.find("det1") != dutEv_->clusters.end() )
-      Utility::getChannelMaskedClusters(dutEv_->clusters.at("det1"), dut_maskedChannels_->at("det1"));
+      Utility::getChannelMaskedClusters(dutEv_->clusters.at("det1"), dutChannelMask_[1]);
     //stub seeding layer os det1
-    Utility::getChannelMaskedStubs(dutEv_->stubs,dut_maskedChannels_->at("det1"));
+    Utility::getChannelMaskedStubs(dutEv_->stubs,dutChannelMask_[1]);
   }
   //std::cout << "setP1" << std::endl;
   if( dutEv_->dut_channel.find("det0") != dutEv_->dut_channel.end() ) {
@@ -325,22 +522,22 @@ void BeamAnaBase::setDetChannelVectors() {
   }
   //std::cout << "setP2" << std::endl;
   for(auto& cl : (dutEv_->clusters)){
-    std::string ckey = cl.first;//keys are det0 and det1
+    const std::string& ckey = cl.first;//keys are det0 and det1
+    auto& clsC0 = dutRecoClmap_->at(ckey + "C0");
+    auto& clsC1 = dutRecoClmap_->at(ckey + "C1");
     for(auto& c : cl.second)  {
-      if(c->x <= 1015)  dutRecoClmap_->at(ckey +"C0").push_back(*c);
+      if(c->x <= 1015)  clsC0.push_back(*c);
       else {
-        auto ctemp = *c;
-        ctemp.x -= 1016;//even for column 1 we fill histograms between 0 and 1015 
-        dutRecoClmap_->at( ckey + "C1").push_back(ctemp);
+        clsC1.push_back(*c);
+        clsC1.back().x -= 1016;//even for column 1 we fill histograms between 0 and 1015 
       }
     }    
   }
   //std::cout << "setP3" << std::endl;
-  for(auto& s : dutEv_->stubs) {
-    tbeam::stub st = *s;
-    if(st.x <= 1015)   dutRecoStubmap_->at("C0").push_back(st);
-    else dutRecoStubmap_->at("C1").push_back(st);
-  }
+  auto& stubsC0 = dutRecoStubmap_->at("C0");
+  auto& stubsC1 = dutRecoStubmap_->at("C1");
+  for(auto& s : dutEv_->stubs)
+    nextRecoStub(s->x <= 1015 ? stubsC0 : stubsC1) = *s;
   
   //for(auto& t:*recostubChipids_) std::cout << t.first << ",";
   //for(auto& t:*cbcstubChipids_) std::cout << t.first << ",";
@@ -350,6 +547,64 @@ void BeamAnaBase::setDetChannelVectors() {
 }
 
 
+//same content as setDetChannelVectors, read from the flat columns
+void BeamAnaBase::setDetChannelVectorsFlat() {
+  const tbeam::dutFlatEvent& f = *dutFlatEv_;
+  std::vector<int>* hitv[tbeam::dutFlatEvent::kNPlanes] = {dut0_chtempC0_, dut0_chtempC1_, dut1_chtempC0_, dut1_chtempC1_};
+  const char* pname[tbeam::dutFlatEvent::kNPlanes] = {"det0C0", "det0C1", "det1C0", "det1C1"};
+  for(unsigned int p = 0; p < tbeam::dutFlatEvent::kNPlanes; p++) {
+    //masks are given in raw channels, column 1 is stored shifted by -1016
+    const Utility::ChannelMask* mask = doChannelMasking_ ? &dutChannelMask_[p < 2 ? 0 : 1] : nullptr;
+    int shift = (p%2 == tbeam::dutFlatEvent::kC1) ? 1016 : 0;
+    const int* h = f.hits(p);
+    for(unsigned int i = 0; i < f.nHits(p); i++) {
+      if(mask && Utility::isMasked(*mask, h[i] + shift))  continue;
+      hitv[p]->push_back(h[i]);
+    }
+    auto& cls = dutRecoClmap_->at(pname[p]);
+    unsigned int cend = f.clusterBegin(p) + f.nClusters(p);
+    for(unsigned int i = f.clusterBegin(p); i < cend; i++) {
+      if(mask && Utility::isMasked(*mask, f.clsX[i] + shift))  continue;
+      tbeam::cluster c;
+      c.x = f.clsX[i];
+      c.fx = f.clsFx[i];
+      c.size = f.clsSize[i];
+      cls.push_back(c);
+    }
+  }
+  //stub seeding layer is det1
+  const Utility::ChannelMask* smask = doChannelMasking_ ? &dutChannelMask_[1] : nullptr;
+  const char* cname[2] = {"C0", "C1"};
+  for(unsigned int col = 0; col < 2; col++) {
+    auto& stubs = dutRecoStubmap_->at(cname[col]);
+    unsigned int send = f.stubBegin(col) + f.nStubs(col);
+    for(unsigned int i = f.stubBegin(col); i < send; i++) {
+      if(smask && Utility::isMasked(*smask, f.stubX[i]))  continue;
+      tbeam::stub& st = nextRecoStub(stubs);
+      st.x = f.stubX[i];
+      st.fx = f.stubFx[i];
+      st.direction = f.stubDir[i];
+      *st.seeding = tbeam::cluster();
+      *st.matched = tbeam::cluster();
+      st.seeding->x = f.stubSeedX[i];
+      st.matched->x = f.stubMatchedX[i];
+    }
+  }
+  nStubsrecoSword_ = Utility::readStubWord(*recostubChipids_,f.stubWordReco);
+  nStubscbcSword_ = Utility::readStubWord(*cbcstubChipids_,f.stubWord);
+}
+
+//appends a stub to the event, taking it from the pool if one is left so that
+//its clusters are not allocated again
+tbeam::stub& BeamAnaBase::nextRecoStub(std::vector<tbeam::stub>& stubs) {
+  if(stubPool_.empty())  stubs.emplace_back();
+  else {
+    stubs.push_back(std::move(stubPool_.back()));
+    stubPool_.pop_back();
+  }
+  return stubs.back();
+}
+
 void BeamAnaBase::getCbcConfig(uint32_t cwdWord, uint32_t windowWord){
   sw_ = windowWord >>4;
   offset1_ = (cwdWord)%4;
@@ -369,42 +624,62 @@ bool BeamAnaBase::isTrkfiducial(const double xtrk0Pos, const double xtrk1Pos, co
   if(doChannelMasking_) {
     int xtkdutStrip0 = xtrk0Pos/pitchDUT_ + nStrips_/2; 
     int xtkdutStrip1 = xtrk1Pos/pitchDUT_ + nStrips_/2; 
-    bool mtk = std::find(dut_maskedChannels_->at("det0").begin(), dut_maskedChannels_->at("det0").end(), xtkdutStrip0) == dut_maskedChannels_->at("det0").end();
-    mtk = mtk && std::find( dut_maskedChannels_->at("det1").begin(), dut_maskedChannels_->at("det1").end(), xtkdutStrip1) == dut_maskedChannels_->at("det1").end();
+    bool mtk = !Utility::isMasked(dutChannelMask_[0], xtkdutStrip0);
+    mtk = mtk && !Utility::isMasked(dutChannelMask_[1], xtkdutStrip1);
     mtk = mtk && xtkdutStrip0 > 127 && xtkdutStrip1 > 127;
     return mtk;
   }
   return true;
 }
 
-void BeamAnaBase::getExtrapolatedTracks(std::vector<tbeam::Track>&  fidTkColl) {
+void BeamAnaBase::getFei4MatchedTracks(std::vector<tbeam::Track>& selectedTk) {
   //Tk overlap removal
-  std::vector<tbeam::Track>  tkNoOv;
-  Utility::removeTrackDuplicates(telEv_, tkNoOv);
+  tkFilter_.run(*telEv_, tkNoOv_);
   //Match with FEI4
+  fei4Hits_.build(*fei4Ev()->row, *fei4Ev()->col);
+  tkSelected_.clear();
+  Utility::cutTrackFei4Residuals(fei4Hits_, tkNoOv_.x.data(), tkNoOv_.y.data(), tkNoOv_.size(), tkSelected_, alPars_.offsetFEI4x(), alPars_.offsetFEI4y(), alPars_.residualSigmaFEI4x(), alPars_.residualSigmaFEI4y(), true); 
+  for(auto itk : tkSelected_)
+    selectedTk.push_back(tkNoOv_.track(itk));
+  perf_.count(cfTracks_, tkNoOv_.size() > 0);
+  perf_.count(cfFei4Matched_, !tkSelected_.empty());
+}
+
+void BeamAnaBase::getExtrapolatedTracks(std::vector<tbeam::Track>&  fidTkColl) {
+  PerfCounters::Timer t(perf_, PerfCounters::ExtrapolatedTracks);
+  const unsigned int nFid = fidTkColl.size();
   std::vector<tbeam::Track>  selectedTk;
-  Utility::cutTrackFei4Residuals(fei4Ev(), tkNoOv, selectedTk, alPars_.offsetFEI4x(), alPars_.offsetFEI4y(), alPars_.residualSigmaFEI4x(), alPars_.residualSigmaFEI4y(), true); 
-  for(unsigned int itrk = 0; itrk<selectedTk.size();itrk++) {
-    //do track fei4 matching
-    //double XTkatDUT0_itrk = selectedTk[itrk].xPos + (alPars_.d0_chi2_min_z-alPars_.FEI4_z)*selectedTk[itrk].dxdz;
-    //XTkatDUT0_itrk = XTkatDUT0_itrk + alPars_.d0_Offset_aligned;
-    //double XTkatDUT1_itrk = selectedTk[itrk].xPos + (alPars_.d1_chi2_min_z-alPars_.FEI4_z)*selectedTk[itrk].dxdz;
-    //XTkatDUT1_itrk = XTkatDUT1_itrk + alPars_.d1_Offset_aligned;
+  getFei4MatchedTracks(selectedTk);
+  //impact on both DUT planes for all the selected tracks in one pass
+  const unsigned int nTk = selectedTk.size();
+  tkXBuf_.resize(nTk);
+  tkDxdzBuf_.resize(nTk);
+  xTkDut0Buf_.resize(nTk);
+  xTkDut1Buf_.resize(nTk);
+  for(unsigned int itrk = 0; itrk<nTk; itrk++) {
+    tkXBuf_[itrk] = selectedTk[itrk].xPos;
+    tkDxdzBuf_[itrk] = selectedTk[itrk].dxdz;
+  }
+  //same d1 position as the two-plane Utility::extrapolateTrackAtDUTwithAngles
+  const double theta = alPars_.theta();
+  Utility::extrapolateTracksAtDUTwithAngles(tkXBuf_.data(), tkDxdzBuf_.data(), nTk, alPars_.FEI4z(),
+                                            alPars_.d0Offset(), alPars_.d0Z(),
+                                            alPars_.d0Offset() + sin(theta)*alPars_.deltaZ(), alPars_.d0Z() + alPars_.deltaZ()*cos(theta),
+                                            theta, xTkDut0Buf_.data(), xTkDut1Buf_.data());
+  for(unsigned int itrk = 0; itrk<nTk;itrk++) {
     double YTkatDUT0_itrk = selectedTk[itrk].yPos + (alPars_.d0Z() - alPars_.FEI4z())*selectedTk[itrk].dydz;
     double YTkatDUT1_itrk = selectedTk[itrk].yPos + (alPars_.d1Z() - alPars_.FEI4z())*selectedTk[itrk].dydz;
-    std::pair<double,double>  xtkdut = Utility::extrapolateTrackAtDUTwithAngles(selectedTk[itrk], 
-                                       alPars_.FEI4z(), alPars_.d0Offset(), alPars_.d0Z(), 
-                                       alPars_.deltaZ(), alPars_.theta());
     //Selected tracks within DUT acceptance FEI4
-    if(isTrkfiducial(xtkdut.first, xtkdut.second, YTkatDUT0_itrk, YTkatDUT1_itrk)) {
-      selectedTk[itrk].xtkDut0 = xtkdut.first;
-      selectedTk[itrk].xtkDut1 = xtkdut.second;
+    if(isTrkfiducial(xTkDut0Buf_[itrk], xTkDut1Buf_[itrk], YTkatDUT0_itrk, YTkatDUT1_itrk)) {
+      selectedTk[itrk].xtkDut0 = xTkDut0Buf_[itrk];
+      selectedTk[itrk].xtkDut1 = xTkDut1Buf_[itrk];
       selectedTk[itrk].ytkDut0 = YTkatDUT0_itrk;
       selectedTk[itrk].ytkDut1 = YTkatDUT1_itrk;
       tbeam::Track temp(selectedTk[itrk]);
       fidTkColl.push_back(temp);
     } 
   }
+  perf_.count(cfFiducial_, fidTkColl.size() > nFid);
 }
 
 void BeamAnaBase::readChannelMaskData(const std::string cmaskF) {
@@ -465,6 +740,12 @@ void BeamAnaBase::readChannelMaskData(const std::string cmaskF) {
       std::cout << ch << ",";
     std::cout << std::endl;
   } 
+  //bit masks used by the event loop
+  for(int d = 0; d < 2; d++) {
+    dutChannelMask_[d].reset();
+    for(auto ch : dut_maskedChannels_->at(d == 0 ? "det0" : "det1"))
+      if(ch >= 0 && ch < static_cast<int>(dutChannelMask_[d].size()))  dutChannelMask_[d].set(ch);
+  }
 }
 
 void readAlignmentConstant(const std::string& aFname) {
@@ -476,8 +757,165 @@ void readAlignmentConstant(const std::string& aFname) {
   fin.close();
 }
 
+//serial loop filling the common DUT histograms of bookHistograms()
+void BeamAnaBase::processEntries(Long64_t first, Long64_t last) {
+  for(Long64_t jentry = first; jentry < last; jentry++) {
+    clearEvent();
+    if(readEntry(jentry) < 0)  break;
+    if(!isWorker_ && jentry%1000 == 0)
+      std::cout << " Events processed. " << std::setw(8) << jentry << std::endl;
+    if(!isGoodEvent())  continue;
+    setDetChannelVectors();
+    fillCommonHistograms();
+  }
+}
+
+void BeamAnaBase::runEventLoop(Long64_t nEntries) {
+  if(nThreads_ > 1 && workers_.empty())  createWorkers();
+  if(workers_.empty() || nEntries < static_cast<Long64_t>(workers_.size())) {
+    processEntries(0, nEntries);
+    stopReadAhead();
+    return;
+  }
+  Long64_t nw = workers_.size();
+  std::vector<std::thread> threads;
+  for(Long64_t i = 0; i < nw; i++) {
+    syncWorker(*workers_[i]);
+    threads.emplace_back(&BeamAnaBase::processEntries, workers_[i], i*nEntries/nw, (i+1)*nEntries/nw);
+  }
+  for(auto& t : threads)  t.join();
+  for(auto& w : workers_)
+    w->stopReadAhead();
+  //merge in worker order so that the result does not depend on the scheduling
+  for(auto& w : workers_) {
+    hout_->addHistograms(*w->outFile());
+    w->outFile()->resetHistograms();
+    mergeWorker(*w);
+  }
+  hout_->hfile()->cd();
+}
+
+void BeamAnaBase::enableRootThreads() {
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,6,0)
+  ROOT::EnableThreadSafety();
+#else
+  TThread::Initialize();
+#endif
+}
+
+void BeamAnaBase::createWorkers() {
+  enableRootThreads();
+  //workers are set up one by one here, booking and file opening are not thread safe
+  for(int i = 0; i < nThreads_; i++) {
+    BeamAnaBase* w = makeWorker();
+    if(!w) {
+      std::cout << "Analysis does not provide workers, running on one thread" << std::endl;
+      break;
+    }
+    w->initWorker(*this, i);
+    workers_.push_back(w);
+  }
+  std::cout << "Event loop will run on " << workers_.size() << " threads" << std::endl;
+}
+
+void BeamAnaBase::initWorker(const BeamAnaBase& master, int id) {
+  isWorker_ = true;
+  workerId_ = id;
+  iFilename_ = master.iFilename_;
+  chmaskFilename_ = master.chmaskFilename_;
+  doTelMatching_ = master.doTelMatching_;
+  doChannelMasking_ = master.doChannelMasking_;
+  sw_ = master.sw_;
+  offset1_ = master.offset1_;
+  offset2_ = master.offset2_;
+  cwd_ = master.cwd_;
+  cbcMaskedChannelsMap_ = master.cbcMaskedChannelsMap_;
+  *dut_maskedChannels_ = *master.dut_maskedChannels_;
+  dutChannelMask_[0] = master.dutChannelMask_[0];
+  dutChannelMask_[1] = master.dutChannelMask_[1];
+  alPars_ = master.alPars_;
+  jobCardmap_ = master.jobCardmap_;
+  residualSigmaDUT_ = master.residualSigmaDUT_;
+  nStrips_ = master.nStrips_;
+  pitchDUT_ = master.pitchDUT_;
+  useEventCache_ = master.useEventCache_;
+  eventCacheMaxMB_ = master.eventCacheMaxMB_;
+  //the memory limit is shared by the workers
+  evCache_.setMaxMemory(master.evCache_.maxMemory()/std::max(master.nThreads_, 1));
+  pruneBranches_ = master.pruneBranches_;
+  treeCacheMB_ = master.treeCacheMB_;
+  ioStats_ = master.ioStats_;
+  readAheadSlots_ = master.readAheadSlots_;
+  perf_.enable(master.perf_.enabled());
+  runList_ = master.runList_;
+  currentRun_ = master.currentRun_;
+  beginJob();
+}
+
+void BeamAnaBase::cacheEvent(bool withDUT) {
+  //the passes after the first skip the events with more than 2 FEI4 hits
+  evCache_.addEvent(fei4Ev_->nPixHits <= 2, isGood_, periodcictyF_, *condEv_, *fei4Ev_, *telEv_);
+  if(!withDUT)  return;
+  setDetChannelVectors();
+  evCache_.addDUT(*dut0_chtempC0_, *dut1_chtempC0_, dutRecoClmap_->at("det0C0"), dutRecoClmap_->at("det1C0"));
+}
+
 void BeamAnaBase::endJob() {
-  
+  stopReadAhead();
+  collectWorkerStats();
+  for(auto& w : workers_)
+    delete w;
+  workers_.clear();
+  if(isWorker_)  return;
+  if(!runList_.empty())  writeRunOutput();
+  io_.print(std::cout);
+  if(readAhead_)  readAhead_->print(std::cout);
+  if(!perf_.enabled())  return;
+  //with a runList each run has its counters in its output file, the totals are printed
+  if(!runList_.empty()) {
+    jobPerf_.add(perf_);
+    jobPerf_.print(std::cout);
+    return;
+  }
+  perf_.print(std::cout);
+  TDirectory* d = hout_->hfile()->mkdir("Perf");
+  perf_.write(d);
+  hout_->hfile()->cd();
+}
+
+void BeamAnaBase::writeRunOutput() {
+  const std::string& fname = runList_[currentRun_].outFile;
+  hout_->writeHistograms(fname);
+  if(!perf_.enabled())  return;
+  TFile f(fname.c_str(), "UPDATE");
+  if(f.IsZombie()) {
+    std::cerr << "**** writeRunOutput: file <" << fname << "> could not be opened!" << std::endl;
+  }
+  else {
+    perf_.write(f.mkdir("Perf"));
+    f.Write();
+    f.Close();
+  }
+  hout_->hfile()->cd();
+}
+
+void BeamAnaBase::closeOutput() {
+  {
+    PerfCounters::Timer t(perf_, PerfCounters::CloseFile);
+    hout_->closeFile();
+  }
+  if(perf_.enabled() && !isWorker_)
+    std::cout << "closeFile: " << std::fixed << std::setprecision(1) << perf_.milliseconds(PerfCounters::CloseFile)
+              << " ms, " << perf_.nsPerEvent(PerfCounters::CloseFile) << " ns/event" << std::endl;
+}
+
+void BeamAnaBase::collectWorkerStats() {
+  for(auto& w : workers_) {
+    w->stopReadAhead();
+    io_.add(w->io_);
+    if(readAhead_ && w->readAhead_)  readAhead_->add(*w->readAhead_);
+    perf_.add(w->perf_);
+  }
 }
 void BeamAnaBase::clearEvent() {
   dut0_chtempC0_->clear();
@@ -486,8 +924,12 @@ void BeamAnaBase::clearEvent() {
   dut1_chtempC1_->clear();
   for(auto& c: *dutRecoClmap_)
     c.second.clear();
-  for(auto& s: *dutRecoStubmap_)
+  //the stubs go back to the pool, the vectors keep their capacity
+  for(auto& s: *dutRecoStubmap_) {
+    for(auto& st : s.second)
+      stubPool_.push_back(std::move(st));
     s.second.clear();
+  }
   for(auto& rs : *recostubChipids_)
     rs.second.clear();
   for(auto& rs : *cbcstubChipids_)
@@ -497,4 +939,6 @@ void BeamAnaBase::clearEvent() {
 }
 
 BeamAnaBase::~BeamAnaBase() {
+  stopReadAhead();
+  delete readAhead_;
 }
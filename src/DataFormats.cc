@@ -1,8 +1,10 @@
 #include "DataFormats.h"
+#include <utility>
 ClassImp(tbeam::cbc)
 ClassImp(tbeam::cluster)
 ClassImp(tbeam::stub)
 ClassImp(tbeam::dutEvent)
+ClassImp(tbeam::dutFlatEvent)
 ClassImp(tbeam::condEvent)
 ClassImp(tbeam::TelescopeEvent)
 
@@ -87,15 +89,55 @@ tbeam::stub::stub():
    matched = new tbeam::cluster();
 }
 
-tbeam::stub::stub(const tbeam::stub& t) 
+tbeam::stub::stub(const tbeam::stub& t) :
+  TObject(t)
 {
-  seeding = new tbeam::cluster(*(t.seeding));
-  matched = new tbeam::cluster(*(t.matched));
+  seeding = t.seeding ? new tbeam::cluster(*(t.seeding)) : new tbeam::cluster();
+  matched = t.matched ? new tbeam::cluster(*(t.matched)) : new tbeam::cluster();
   x = t.x;
   fx = t.fx;
   direction = t.direction;
 }
 
+tbeam::stub::stub(tbeam::stub&& t) noexcept :
+  TObject(t),
+  seeding(t.seeding),
+  matched(t.matched),
+  x(t.x),
+  fx(t.fx),
+  direction(t.direction)
+{
+  t.seeding = nullptr;
+  t.matched = nullptr;
+}
+
+tbeam::stub::~stub() {
+  delete seeding;
+  delete matched;
+}
+
+tbeam::stub& tbeam::stub::operator=(const tbeam::stub& t) {
+  if(this == &t)  return *this;
+  if(!seeding)  seeding = new tbeam::cluster();
+  if(!matched)  matched = new tbeam::cluster();
+  if(t.seeding)  *seeding = *(t.seeding);
+  if(t.matched)  *matched = *(t.matched);
+  x = t.x;
+  fx = t.fx;
+  direction = t.direction;
+  return *this;
+}
+
+tbeam::stub& tbeam::stub::operator=(tbeam::stub&& t) noexcept {
+  if(this == &t)  return *this;
+  std::swap(seeding, t.seeding);
+  std::swap(matched, t.matched);
+  x = t.x;
+  fx = t.fx;
+  direction = t.direction;
+  return *this;
+}
+
 tbeam::dutEvent::dutEvent():
    stubWord(0),
    stubWordReco(0)
@@ -144,6 +186,75 @@ tbeam::dutEvent::~dutEvent(){
    //std::cout << "Leaving dutEvent destructor!" << std::endl;   
 }
 
+tbeam::dutFlatEvent::dutFlatEvent():
+   stubWord(0),
+   stubWordReco(0)
+{
+  clear();
+}
+
+void tbeam::dutFlatEvent::clear() {
+  for(unsigned int p = 0; p <= kNPlanes; p++) {
+    hitOff[p] = 0;
+    clsOff[p] = 0;
+  }
+  for(unsigned int c = 0; c <= 2; c++)  stubOff[c] = 0;
+  hitCh.clear();
+  clsX.clear();
+  clsFx.clear();
+  clsSize.clear();
+  stubX.clear();
+  stubFx.clear();
+  stubDir.clear();
+  stubSeedX.clear();
+  stubMatchedX.clear();
+  stubWord = 0;
+  stubWordReco = 0;
+}
+
+void tbeam::dutFlatEvent::fill(const tbeam::dutEvent& ev) {
+  clear();
+  const std::string dets[2] = {"det0", "det1"};
+  for(unsigned int d = 0; d < 2; d++) {
+    auto hit = ev.dut_channel.find(dets[d]);
+    auto cls = ev.clusters.find(dets[d]);
+    for(unsigned int col = 0; col < 2; col++) {
+      unsigned int p = plane(d, col);
+      hitOff[p] = hitCh.size();
+      clsOff[p] = clsX.size();
+      if(hit != ev.dut_channel.end()) {
+        for(auto ch : hit->second) {
+          if((ch <= 1015) == (col == kC0))  hitCh.push_back(col == kC0 ? ch : ch - 1016);
+        }
+      }
+      if(cls != ev.clusters.end()) {
+        for(auto c : cls->second) {
+          if((c->x <= 1015) != (col == kC0))  continue;
+          clsX.push_back(col == kC0 ? c->x : c->x - 1016);
+          clsFx.push_back(c->fx);
+          clsSize.push_back(c->size);
+        }
+      }
+    }
+  }
+  hitOff[kNPlanes] = hitCh.size();
+  clsOff[kNPlanes] = clsX.size();
+  for(unsigned int col = 0; col < 2; col++) {
+    stubOff[col] = stubX.size();
+    for(auto s : ev.stubs) {
+      if((s->x <= 1015) != (col == kC0))  continue;
+      stubX.push_back(s->x);
+      stubFx.push_back(s->fx);
+      stubDir.push_back(s->direction);
+      stubSeedX.push_back(s->seeding ? s->seeding->x : 0);
+      stubMatchedX.push_back(s->matched ? s->matched->x : 0);
+    }
+  }
+  stubOff[2] = stubX.size();
+  stubWord = ev.stubWord;
+  stubWordReco = ev.stubWordReco;
+}
+
 tbeam::condEvent::condEvent() :
    run(999999), 
    lumiSection(999999), 
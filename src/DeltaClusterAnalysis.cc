@@ -29,14 +29,16 @@ DeltaClusterAnalysis::DeltaClusterAnalysis(const std::string inFilename,const st
             << "Infile: " << inFilename
             << "\nOutFile: " << outFile_
             << std::endl; 
-  if( setInputFile(inFilename) == 0 ) {
-    std::cout << "Empty Chain!!";
-    exit(1);
-  }
-  nEntries_ = analysisTree()->GetEntries();
-  hist_ = new Histogrammer(outFile_);
+  setFileNames(inFilename, outFile_);
   beginJob();
 
+}
+//worker of the parallel event loop, set up by BeamAnaBase::initWorker
+DeltaClusterAnalysis::DeltaClusterAnalysis() :
+  BeamAnaBase::BeamAnaBase(),
+  hist_(nullptr),
+  nEntries_(0)
+{
 }
 void DeltaClusterAnalysis::bookHistograms() {
   hist_->bookEventHistograms();
@@ -47,9 +49,28 @@ void DeltaClusterAnalysis::bookHistograms() {
   new TH2D("nclsCorrelation","#cluster correlation between det0 and det1;#Cluster_{det0};#Cluster_{det1}", 50, -0.5, 49.5, 50, -0.5, 49.5);
   new TH1D("evtsW1cls","Events with 1 cluster", 2, -0.5, 1.5);
   new TH1I("nclusterdiffC0","Difference in #clusters between dut0 and dut1() for C0;#cluster_{det0} - #cluster_{det1};Events",20,-0.5,19.5);
+  hist_->registerHistograms("DeltaCluster");
+  //resolve handles for the event loop
+  evH_ = hist_->eventHistos();
+  det0H_ = hist_->dutHistos("det0","C0");
+  det1H_ = hist_->dutHistos("det1","C0");
+  nclsCorrelation_ = hist_->hist2D("DeltaCluster","nclsCorrelation");
+  evtsW1cls_ = hist_->hist1D("DeltaCluster","evtsW1cls");
+  nclusterdiffC0_ = hist_->hist1D("DeltaCluster","nclusterdiffC0");
+}
+
+//DUT content and conditions, no telescope
+std::vector<std::string> DeltaClusterAnalysis::requiredBranches() const {
+  static const char* b[] = {
+    "DUT", "DUTFlat", "Condition", "goodEventFlag", "periodicityFlag"
+  };
+  return std::vector<std::string>(b, b + sizeof(b)/sizeof(b[0]));
 }
 
 void DeltaClusterAnalysis::beginJob() {
+  BeamAnaBase::beginJob();
+  nEntries_ = analysisTree()->GetEntries();
+  hist_ = outFile();
   setAddresses();
   bookHistograms();
   analysisTree()->GetEntry(0);
@@ -69,9 +90,14 @@ void DeltaClusterAnalysis::eventLoop()
              << "\tOffset1="<< cbcOffset1() 
              << "\tOffset2" << cbcOffset2()
    << std::endl;
-   for (Long64_t jentry=0; jentry<nEntries_;jentry++) {
+   runEventLoop(nEntries_);
+}
+
+void DeltaClusterAnalysis::processEntries(Long64_t first, Long64_t last)
+{
+   for (Long64_t jentry=first; jentry<last;jentry++) {
      clearEvent();
-     Long64_t ientry = analysisTree()->GetEntry(jentry);
+     Long64_t ientry = readEntry(jentry);
      if (ientry < 0) break;
      if (jentry%1000 == 0) {
        cout << " Events processed. " << std::setw(8) << jentry 
@@ -87,21 +113,21 @@ void DeltaClusterAnalysis::eventLoop()
        hist_->fillHist1D("EventInfo","window", stubWindow());
        hist_->fillHist1D("EventInfo","tilt", static_cast<unsigned long int>(condEv()->tilt));
      }
-     hist_->fillHist1D("EventInfo","isPeriodic",isPeriodic());
-     hist_->fillHist1D("EventInfo","isGoodFlag",isGoodEvent());
+     hist_->fillHist1D(evH_.isPeriodic,isPeriodic());
+     hist_->fillHist1D(evH_.isGoodFlag,isGoodEvent());
 
      if(!isGoodEvent())   continue;
-     hist_->fillHist1D("EventInfo","condData", condEv()->condData);
-     hist_->fillHist1D("EventInfo","tdcPhase", static_cast<unsigned int>(condEv()->tdcPhase));
+     hist_->fillHist1D(evH_.condData, condEv()->condData);
+     hist_->fillHist1D(evH_.tdcPhase, static_cast<unsigned int>(condEv()->tdcPhase));
       
       //cout << "Point 2" << endl;
       //All input vectors are set here. You can use the hit,cluster, stub maps only after calling this method
       setDetChannelVectors();
 
       bool cls1 = dutRecoClmap()->at("det0C0").size() == 1 && dutRecoClmap()->at("det1C0").size() == 1;
-      hist_->fillHist2D("DeltaCluster", "nclsCorrelation", dutRecoClmap()->at("det0C0").size(), dutRecoClmap()->at("det1C0").size()); 
-      hist_->fillHist1D("DeltaCluster", "evtsW1cls",cls1);
-      hist_->fillHist1D("DeltaCluster","nclusterdiffC0", std::abs(dutRecoClmap()->at("det0C0").size() - 
+      hist_->fillHist2D(nclsCorrelation_, dutRecoClmap()->at("det0C0").size(), dutRecoClmap()->at("det1C0").size()); 
+      hist_->fillHist1D(evtsW1cls_,cls1);
+      hist_->fillHist1D(nclusterdiffC0_, std::abs(dutRecoClmap()->at("det0C0").size() - 
                                                          dutRecoClmap()->at("det1C0").size()));
 
       if(!cls1)  continue;//single cluster on both sensors
@@ -111,33 +137,38 @@ void DeltaClusterAnalysis::eventLoop()
       const auto& d1c0 = *det1C0();
       const auto& d1c1 = *det1C1();      
       //cout << "Point 3" << endl;
+      PerfCounters::Timer tfill(perf(), PerfCounters::HistogramFill);
       //Fill histo for det0
-      hist_->fillHist1D("det0","chsizeC0", d0c0.size());
+      hist_->fillHist1D(det0H_.chsize, d0c0.size());
       //hist_->fillHist1D("det0","chsizeC1", det0C1()->size());
-      hist_->fillHistofromVec(d0c0,"det0","hitmapC0");
+      hist_->fillHistofromVec(d0c0,det0H_.hitmap);
       //hist_->fillHistofromVec(d0c1,"det0","hitmapC1");
-      hist_->fill2DHistofromVec(d0c0,d0c1,"det0","hitmapfull");
-      hist_->fillClusterHistograms("det0",dutRecoClmap()->at("det0C0"),"C0");
+      hist_->fill2DHistofromVec(d0c0,d0c1,det0H_.hitmapfull);
+      hist_->fillClusterHistograms(det0H_.clusters,dutRecoClmap()->at("det0C0"));
       //hist_->fillClusterHistograms("det0",dutRecoClmap()->at("det0C1"),"C1");
 
       //Fill histo for det1
       //std::cout << "Hits det1c0=" << dut1Ch0()->size() << std::endl;
-      hist_->fillHist1D("det1","chsizeC0", d1c0.size());
+      hist_->fillHist1D(det1H_.chsize, d1c0.size());
       //hist_->fillHist1D("det1","chsizeC1", d1c1.size());
-      hist_->fillHistofromVec(d1c0,"det1","hitmapC0");
+      hist_->fillHistofromVec(d1c0,det1H_.hitmap);
       //hist_->fillHistofromVec(d1c1,"det1","hitmapC1");
-      hist_->fill2DHistofromVec(d1c0,d1c1,"det1","hitmapfull");
-      hist_->fillClusterHistograms("det1",dutRecoClmap()->at("det1C0"),"C0");
+      hist_->fill2DHistofromVec(d1c0,d1c1,det1H_.hitmapfull);
+      hist_->fillClusterHistograms(det1H_.clusters,dutRecoClmap()->at("det1C0"));
       //hist_->fillClusterHistograms("det1",dutRecoClmap()->at("det1C1"),"C1");
    }
 }
 
+BeamAnaBase* DeltaClusterAnalysis::makeWorker() const {
+  return new DeltaClusterAnalysis();
+}
+
 void DeltaClusterAnalysis::clearEvent() {
   BeamAnaBase::clearEvent();
 }
 void DeltaClusterAnalysis::endJob() {
   BeamAnaBase::endJob();
-  hist_->closeFile();
+  closeOutput();
 }
 
 DeltaClusterAnalysis::~DeltaClusterAnalysis(){
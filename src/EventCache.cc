@@ -0,0 +1,232 @@
+/*!
+        \file                EventCache.cc
+        \brief               Flat in-memory cache of the event content used by the multi-pass
+                             analyses, filled on the first pass over the tree
+*/
+#include "EventCache.h"
+#include "Utility.h"
+#include <iostream>
+
+EventCache::EventCache() :
+  first_(0),
+  next_(0),
+  keepLast_(true),
+  full_(false),
+  maxMemory_(1024*1024*1024)
+{
+  clear(0);
+}
+
+void EventCache::clear(Long64_t firstEntry) {
+  first_ = firstEntry;
+  next_ = firstEntry;
+  keepLast_ = true;
+  full_ = false;
+  entry_.clear();
+  isGood_.clear();
+  isPeriodic_.clear();
+  hasDUT_.clear();
+  condData_.clear();
+  tdcPhase_.clear();
+  nPixHits_.clear();
+  nTrackParams_.clear();
+  nRawTracks_.clear();
+  row_.clear();
+  col_.clear();
+  tkX_.clear();
+  tkY_.clear();
+  tkDxdz_.clear();
+  tkDydz_.clear();
+  hitD0_.clear();
+  hitD1_.clear();
+  clsXD0_.clear();
+  clsXD1_.clear();
+  clsSizeD0_.clear();
+  clsSizeD1_.clear();
+  fei4Off_.assign(1, 0);
+  tkOff_.assign(1, 0);
+  hitD0Off_.assign(1, 0);
+  hitD1Off_.assign(1, 0);
+  clsD0Off_.assign(1, 0);
+  clsD1Off_.assign(1, 0);
+}
+
+void EventCache::release() {
+  //swap with empty columns, clear() keeps the memory
+  EventCache empty;
+  std::swap(entry_, empty.entry_);
+  std::swap(isGood_, empty.isGood_);
+  std::swap(isPeriodic_, empty.isPeriodic_);
+  std::swap(hasDUT_, empty.hasDUT_);
+  std::swap(condData_, empty.condData_);
+  std::swap(tdcPhase_, empty.tdcPhase_);
+  std::swap(nPixHits_, empty.nPixHits_);
+  std::swap(nTrackParams_, empty.nTrackParams_);
+  std::swap(nRawTracks_, empty.nRawTracks_);
+  std::swap(fei4Off_, empty.fei4Off_);
+  std::swap(tkOff_, empty.tkOff_);
+  std::swap(hitD0Off_, empty.hitD0Off_);
+  std::swap(hitD1Off_, empty.hitD1Off_);
+  std::swap(clsD0Off_, empty.clsD0Off_);
+  std::swap(clsD1Off_, empty.clsD1Off_);
+  std::swap(row_, empty.row_);
+  std::swap(col_, empty.col_);
+  std::swap(tkX_, empty.tkX_);
+  std::swap(tkY_, empty.tkY_);
+  std::swap(tkDxdz_, empty.tkDxdz_);
+  std::swap(tkDydz_, empty.tkDydz_);
+  std::swap(hitD0_, empty.hitD0_);
+  std::swap(hitD1_, empty.hitD1_);
+  std::swap(clsXD0_, empty.clsXD0_);
+  std::swap(clsXD1_, empty.clsXD1_);
+  std::swap(clsSizeD0_, empty.clsSizeD0_);
+  std::swap(clsSizeD1_, empty.clsSizeD1_);
+  keepLast_ = true;
+}
+
+void EventCache::dropLast() {
+  entry_.pop_back();
+  isGood_.pop_back();
+  isPeriodic_.pop_back();
+  hasDUT_.pop_back();
+  condData_.pop_back();
+  tdcPhase_.pop_back();
+  nPixHits_.pop_back();
+  nTrackParams_.pop_back();
+  nRawTracks_.pop_back();
+  fei4Off_.pop_back();
+  tkOff_.pop_back();
+  hitD0Off_.pop_back();
+  hitD1Off_.pop_back();
+  clsD0Off_.pop_back();
+  clsD1Off_.pop_back();
+  row_.resize(fei4Off_.back());
+  col_.resize(fei4Off_.back());
+  tkX_.resize(tkOff_.back());
+  tkY_.resize(tkOff_.back());
+  tkDxdz_.resize(tkOff_.back());
+  tkDydz_.resize(tkOff_.back());
+  hitD0_.resize(hitD0Off_.back());
+  hitD1_.resize(hitD1Off_.back());
+  clsXD0_.resize(clsD0Off_.back());
+  clsSizeD0_.resize(clsD0Off_.back());
+  clsXD1_.resize(clsD1Off_.back());
+  clsSizeD1_.resize(clsD1Off_.back());
+  keepLast_ = true;
+}
+
+void EventCache::addEvent(bool keep, bool isGood, bool isPeriodic, const tbeam::condEvent& cond,
+                          const tbeam::FeIFourEvent& fei4, const tbeam::TelescopeEvent& tel) {
+  //the previous event is complete, with its DUT content
+  if(!full_ && memoryUsage() > maxMemory_) {
+    full_ = true;
+    std::cout << "Event cache: above " << maxMemory_/(1024*1024) << " MB after " << size()
+              << " events, the later passes read the tree" << std::endl;
+    release();
+  }
+  else if(!keepLast_)  dropLast();
+  if(next_ == first_)  firstCond_ = cond;
+  entry_.push_back(next_ - first_);
+  next_++;
+  isGood_.push_back(isGood);
+  isPeriodic_.push_back(isPeriodic);
+  hasDUT_.push_back(false);
+  condData_.push_back(cond.condData);
+  tdcPhase_.push_back(cond.tdcPhase);
+  nPixHits_.push_back(fei4.nPixHits);
+  nTrackParams_.push_back(tel.nTrackParams);
+  nRawTracks_.push_back(tel.xPos->size());
+
+  row_.insert(row_.end(), fei4.row->begin(), fei4.row->end());
+  col_.insert(col_.end(), fei4.col->begin(), fei4.col->end());
+  fei4Off_.push_back(col_.size());
+
+  //no analysis matches the tracks of an event without FEI4 hits
+  if(!fei4.row->empty()) {
+    tkFilter_.run(tel, tkBuf_);
+    tkX_.insert(tkX_.end(), tkBuf_.x.begin(), tkBuf_.x.end());
+    tkY_.insert(tkY_.end(), tkBuf_.y.begin(), tkBuf_.y.end());
+    tkDxdz_.insert(tkDxdz_.end(), tkBuf_.dxdz.begin(), tkBuf_.dxdz.end());
+    tkDydz_.insert(tkDydz_.end(), tkBuf_.dydz.begin(), tkBuf_.dydz.end());
+  }
+  tkOff_.push_back(tkX_.size());
+
+  hitD0Off_.push_back(hitD0_.size());
+  hitD1Off_.push_back(hitD1_.size());
+  clsD0Off_.push_back(clsXD0_.size());
+  clsD1Off_.push_back(clsXD1_.size());
+  keepLast_ = keep && !full_;
+}
+
+void EventCache::addDUT(const std::vector<int>& hitD0, const std::vector<int>& hitD1,
+                        const std::vector<tbeam::cluster>& clsD0, const std::vector<tbeam::cluster>& clsD1) {
+  if(isGood_.empty())  return;
+  hasDUT_.back() = true;
+  hitD0_.insert(hitD0_.end(), hitD0.begin(), hitD0.end());
+  hitD1_.insert(hitD1_.end(), hitD1.begin(), hitD1.end());
+  for(auto& cl : clsD0) {
+    clsXD0_.push_back(cl.x);
+    clsSizeD0_.push_back(cl.size);
+  }
+  for(auto& cl : clsD1) {
+    clsXD1_.push_back(cl.x);
+    clsSizeD1_.push_back(cl.size);
+  }
+  hitD0Off_.back() = hitD0_.size();
+  hitD1Off_.back() = hitD1_.size();
+  clsD0Off_.back() = clsXD0_.size();
+  clsD1Off_.back() = clsXD1_.size();
+}
+
+EventCache::Event EventCache::event(Long64_t i) const {
+  Event ev;
+  ev.entry = first_ + entry_[i];
+  ev.isGood = isGood_[i];
+  ev.isPeriodic = isPeriodic_[i];
+  ev.condData = condData_[i];
+  ev.tdcPhase = tdcPhase_[i];
+  ev.nPixHits = nPixHits_[i];
+  ev.nTrackParams = nTrackParams_[i];
+  ev.nRawTracks = nRawTracks_[i];
+
+  ev.nFei4 = fei4Off_[i+1] - fei4Off_[i];
+  ev.row = row_.data() + fei4Off_[i];
+  ev.col = col_.data() + fei4Off_[i];
+
+  unsigned int tk = tkOff_[i];
+  ev.nTk = tkOff_[i+1] - tk;
+  ev.tkX = tkX_.data() + tk;
+  ev.tkY = tkY_.data() + tk;
+  ev.tkDxdz = tkDxdz_.data() + tk;
+  ev.tkDydz = tkDydz_.data() + tk;
+
+  ev.hasDUT = hasDUT_[i];
+  ev.nHitD0 = hitD0Off_[i+1] - hitD0Off_[i];
+  ev.nHitD1 = hitD1Off_[i+1] - hitD1Off_[i];
+  ev.hitD0 = hitD0_.data() + hitD0Off_[i];
+  ev.hitD1 = hitD1_.data() + hitD1Off_[i];
+  ev.nClsD0 = clsD0Off_[i+1] - clsD0Off_[i];
+  ev.nClsD1 = clsD1Off_[i+1] - clsD1Off_[i];
+  ev.clsXD0 = clsXD0_.data() + clsD0Off_[i];
+  ev.clsXD1 = clsXD1_.data() + clsD1Off_[i];
+  ev.clsSizeD0 = clsSizeD0_.data() + clsD0Off_[i];
+  ev.clsSizeD1 = clsSizeD1_.data() + clsD1Off_[i];
+  return ev;
+}
+
+tbeam::Track EventCache::Event::track(unsigned int i) const {
+  return tbeam::Track(i, tkX[i], tkY[i], tkDxdz[i], tkDydz[i], 0., 0.);
+}
+
+std::size_t EventCache::memoryUsage() const {
+  std::size_t m = (isGood_.capacity() + isPeriodic_.capacity() + hasDUT_.capacity()) * sizeof(char);
+  m += (condData_.capacity() + nPixHits_.capacity() + nTrackParams_.capacity()) * sizeof(int);
+  m += (entry_.capacity() + tdcPhase_.capacity() + nRawTracks_.capacity()) * sizeof(unsigned int);
+  m += (fei4Off_.capacity() + tkOff_.capacity() + hitD0Off_.capacity() + hitD1Off_.capacity()
+        + clsD0Off_.capacity() + clsD1Off_.capacity()) * sizeof(unsigned int);
+  m += (row_.capacity() + col_.capacity() + hitD0_.capacity() + hitD1_.capacity()) * sizeof(int);
+  m += (tkX_.capacity() + tkY_.capacity()) * sizeof(double);
+  m += (tkDxdz_.capacity() + tkDydz_.capacity()) * sizeof(float);
+  m += (clsXD0_.capacity() + clsXD1_.capacity() + clsSizeD0_.capacity() + clsSizeD1_.capacity()) * sizeof(uint16_t);
+  return m;
+}
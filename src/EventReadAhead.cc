@@ -0,0 +1,163 @@
+/*!
+        \file                EventReadAhead.cc
+        \brief               Producer/consumer read-ahead of the analysis tree on a bounded ring
+                             of event slots
+*/
+#include "EventReadAhead.h"
+#include <chrono>
+#include <iomanip>
+
+namespace {
+  typedef std::chrono::steady_clock Clock;
+  double secondsSince(const Clock::time_point& t0) {
+    return std::chrono::duration<double>(Clock::now() - t0).count();
+  }
+}
+
+EventReadAhead::EventReadAhead(unsigned int nSlots, const Event& own) :
+  own_(own),
+  bound_(own),
+  running_(false),
+  stop_(false),
+  done_(false),
+  holding_(false),
+  nFilled_(0),
+  writeIdx_(0),
+  readIdx_(0),
+  next_(-1),
+  readerStall_(0.),
+  consumerStall_(0.),
+  readerBusy_(0.),
+  nRead_(0)
+{
+  slots_.resize(nSlots > 0 ? nSlots : 1);
+  for(auto& s : slots_) {
+    s.ev.dut = new tbeam::dutEvent();
+    s.ev.dutFlat = new tbeam::dutFlatEvent();
+    s.ev.cond = new tbeam::condEvent();
+    s.ev.tel = new tbeam::TelescopeEvent();
+    s.ev.fei4 = new tbeam::FeIFourEvent();
+    s.ev.periodic = false;
+    s.ev.good = false;
+    s.entry = -1;
+    s.nbytes = 0;
+  }
+}
+
+EventReadAhead::~EventReadAhead() {
+  stop();
+  for(auto& s : slots_) {
+    delete s.ev.dut;
+    delete s.ev.dutFlat;
+    delete s.ev.cond;
+    delete s.ev.tel;
+    delete s.ev.fei4;
+  }
+}
+
+void EventReadAhead::start(ReadFunction read, Long64_t first, Long64_t last) {
+  stop();
+  stop_ = false;
+  done_ = false;
+  holding_ = false;
+  nFilled_ = 0;
+  writeIdx_ = 0;
+  readIdx_ = 0;
+  next_ = first;
+  running_ = true;
+  thread_ = std::thread(&EventReadAhead::run, this, read, first, last);
+}
+
+void EventReadAhead::stop() {
+  if(!running_)  return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+  running_ = false;
+  next_ = -1;
+  bound_.dut = own_.dut;
+  bound_.dutFlat = own_.dutFlat;
+  bound_.cond = own_.cond;
+  bound_.tel = own_.tel;
+  bound_.fei4 = own_.fei4;
+}
+
+void EventReadAhead::run(ReadFunction read, Long64_t first, Long64_t last) {
+  const unsigned int n = slots_.size();
+  for(Long64_t e = first; e < last; e++) {
+    Clock::time_point t0 = Clock::now();
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this, n]{ return stop_ || nFilled_ < n; });
+      if(stop_)  break;
+    }
+    readerStall_ += secondsSince(t0);
+    //only this thread touches the slot until it is published
+    Slot& s = slots_[writeIdx_ % n];
+    bound_.dut = s.ev.dut;
+    bound_.dutFlat = s.ev.dutFlat;
+    bound_.cond = s.ev.cond;
+    bound_.tel = s.ev.tel;
+    bound_.fei4 = s.ev.fei4;
+    t0 = Clock::now();
+    s.nbytes = read(e);
+    readerBusy_ += secondsSince(t0);
+    s.ev.periodic = bound_.periodic;
+    s.ev.good = bound_.good;
+    s.entry = e;
+    nRead_++;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      writeIdx_++;
+      nFilled_++;
+    }
+    cv_.notify_all();
+    if(s.nbytes < 0)  break;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+  }
+  cv_.notify_all();
+}
+
+const EventReadAhead::Event* EventReadAhead::next(Long64_t jentry, Long64_t& nbytes) {
+  nbytes = -1;
+  const unsigned int n = slots_.size();
+  Clock::time_point t0 = Clock::now();
+  std::unique_lock<std::mutex> lock(mutex_);
+  //the slot of the previous entry is given back now
+  if(holding_) {
+    holding_ = false;
+    readIdx_++;
+    nFilled_--;
+    cv_.notify_all();
+  }
+  if(!running_ || jentry != next_)  return nullptr;
+  cv_.wait(lock, [this]{ return nFilled_ > 0 || done_; });
+  consumerStall_ += secondsSince(t0);
+  if(nFilled_ == 0)  return nullptr;
+  Slot& s = slots_[readIdx_ % n];
+  holding_ = true;
+  next_++;
+  nbytes = s.nbytes;
+  return nbytes < 0 ? nullptr : &s.ev;
+}
+
+void EventReadAhead::add(const EventReadAhead& o) {
+  readerStall_ += o.readerStall_;
+  consumerStall_ += o.consumerStall_;
+  readerBusy_ += o.readerBusy_;
+  nRead_ += o.nRead_;
+}
+
+void EventReadAhead::print(std::ostream& out) const {
+  out << "----Read-ahead(" << slots_.size() << " slots)----\n"
+      << std::fixed << std::setprecision(2)
+      << "Entries read: " << nRead_ << ", reading " << readerBusy_ << " s\n"
+      << "Reader stalled(ring full): " << readerStall_ << " s\n"
+      << "Analysis stalled(ring empty): " << consumerStall_ << " s" << std::endl;
+}
@@ -0,0 +1,80 @@
+/*!
+        \file                Fei4HitIndex.cc
+        \brief               Column/row index of the FEI4 hits of one event for the nearest
+                             hit search of the track matching
+*/
+#include "Fei4HitIndex.h"
+#include <algorithm>
+#include <limits>
+
+void Fei4HitIndex::build(const int* row, const int* col, unsigned int nHits) {
+  order_.resize(nHits);
+  for(unsigned int i = 0; i < nHits; i++)  order_[i] = i;
+  std::sort(order_.begin(), order_.end(), [row, col](unsigned int a, unsigned int b) {
+    if(col[a] != col[b])  return col[a] < col[b];
+    if(row[a] != row[b])  return row[a] < row[b];
+    return a < b;
+  });
+  row_.resize(nHits);
+  index_.resize(nHits);
+  colVal_.clear();
+  colBegin_.clear();
+  for(unsigned int i = 0; i < nHits; i++) {
+    unsigned int h = order_[i];
+    row_[i] = row[h];
+    index_[i] = h;
+    if(colVal_.empty() || colVal_.back() != col[h]) {
+      colVal_.push_back(col[h]);
+      colBegin_.push_back(i);
+    }
+  }
+  colBegin_.push_back(nHits);
+}
+
+void Fei4HitIndex::build(const std::vector<int>& row, const std::vector<int>& col) {
+  build(row.data(), col.data(), std::min(row.size(), col.size()));
+}
+
+Fei4HitIndex::Match Fei4HitIndex::nearest(double tkX, double tkY, double xResMean, double yResMean) const {
+  Match best{-1, 999., 999., std::numeric_limits<double>::max()};
+  //the residuals decrease with row and col: start from the first column/row with a residual <= 0
+  //and walk both ways, stopping as soon as the distance along that axis alone is larger than the best
+  auto better = [&best](double d2, int hit) {
+    return d2 < best.dist2 || (d2 == best.dist2 && hit < best.hit);
+  };
+  auto scanColumn = [&](unsigned int ic, double yres) {
+    const double dy2 = yres*yres;
+    const unsigned int b = colBegin_[ic];
+    const unsigned int e = colBegin_[ic+1];
+    unsigned int start = std::partition_point(row_.begin() + b, row_.begin() + e, [&](int r) {
+      return xPos(r) - tkX - xResMean > 0.;
+    }) - row_.begin();
+    for(unsigned int i = start; i < e; i++) {
+      double xres = xPos(row_[i]) - tkX - xResMean;
+      double d2 = xres*xres + dy2;
+      if(xres*xres > best.dist2)  break;
+      if(better(d2, index_[i]))  best = Match{index_[i], xres, yres, d2};
+    }
+    for(unsigned int i = start; i-- > b; ) {
+      double xres = xPos(row_[i]) - tkX - xResMean;
+      double d2 = xres*xres + dy2;
+      if(xres*xres > best.dist2)  break;
+      if(better(d2, index_[i]))  best = Match{index_[i], xres, yres, d2};
+    }
+  };
+  const unsigned int nCol = colVal_.size();
+  unsigned int start = std::partition_point(colVal_.begin(), colVal_.end(), [&](int c) {
+    return yPos(c) - tkY - yResMean > 0.;
+  }) - colVal_.begin();
+  for(unsigned int ic = start; ic < nCol; ic++) {
+    double yres = yPos(colVal_[ic]) - tkY - yResMean;
+    if(yres*yres > best.dist2)  break;
+    scanColumn(ic, yres);
+  }
+  for(unsigned int ic = start; ic-- > 0; ) {
+    double yres = yPos(colVal_[ic]) - tkY - yResMean;
+    if(yres*yres > best.dist2)  break;
+    scanColumn(ic, yres);
+  }
+  return best;
+}
@@ -0,0 +1,60 @@
+/*!
+        \file                Fei4PairBuffer.cc
+        \brief               Track-FEI4 hit residual candidates kept from the first pass of
+                             TelescopeAnalysis for the residual fits of the later passes
+*/
+#include "Fei4PairBuffer.h"
+#include "Fei4HitIndex.h"
+
+Fei4PairBuffer::Fei4PairBuffer() :
+  first_(0)
+{
+  clear(0);
+}
+
+void Fei4PairBuffer::clear(Long64_t firstEntry) {
+  first_ = firstEntry;
+  flag_.clear();
+  pairOff_.assign(1, 0);
+  xres_.clear();
+  yres_.clear();
+}
+
+void Fei4PairBuffer::addEvent(Flag f) {
+  flag_.push_back(f);
+  pairOff_.push_back(xres_.size());
+}
+
+void Fei4PairBuffer::addEvent(const EventCache::Event& ev, Flag f) {
+  //track major, hits in their index order: the order in which ties are resolved
+  for(unsigned int itk = 0; itk < ev.nTk; itk++) {
+    for(unsigned int i = 0; i < ev.nFei4; i++) {
+      xres_.push_back(Fei4HitIndex::xPos(ev.row[i]) - ev.tkX[itk]);
+      yres_.push_back(Fei4HitIndex::yPos(ev.col[i]) - ev.tkY[itk]);
+    }
+  }
+  addEvent(f);
+}
+
+bool Fei4PairBuffer::closest(Long64_t jentry, double xResMean, double yResMean, double& xres, double& yres) const {
+  const Long64_t i = jentry - first_;
+  double mindelta2 = 999.9*999.9;
+  bool found = false;
+  for(unsigned int p = pairOff_[i]; p < pairOff_[i+1]; p++) {
+    double dx = xres_[p] - xResMean;
+    double dy = yres_[p] - yResMean;
+    double d2 = dx*dx + dy*dy;
+    if(d2 < mindelta2) {
+      mindelta2 = d2;
+      xres = dx;
+      yres = dy;
+      found = true;
+    }
+  }
+  return found;
+}
+
+std::size_t Fei4PairBuffer::memoryUsage() const {
+  return flag_.capacity()*sizeof(char) + pairOff_.capacity()*sizeof(unsigned int)
+       + (xres_.capacity() + yres_.capacity())*sizeof(double);
+}
@@ -0,0 +1,181 @@
+/*!
+        \file                GlobalAlignmentFitter.cc
+        \brief               Alignment fit of many runs with the DUT geometry shared by the runs
+*/
+#include "GlobalAlignmentFitter.h"
+#include "Math/Functor.h"
+#include "Minuit2/Minuit2Minimizer.h"
+#include "TMath.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace {
+  //chi2 of one run, same parametrisation as the constrained fit of AlignmentFitter
+  double runChi2(const AlignmentChi2& fc, double offset, double zD0, double deltaZ, double theta) {
+    return fc.chi2(offset, zD0, offset + std::sin(theta)*deltaZ, zD0 + deltaZ*std::cos(theta), theta);
+  }
+
+  //chi2 of one run for offset_d0, theta with zD0 and deltaZ fixed
+  class RunChi2 {
+    public:
+      RunChi2() : fc(nullptr), zD0(0.), deltaZ(0.) {}
+      double value(const double* x) const {
+        return runChi2(*fc, x[0], zD0, deltaZ, x[1]);
+      }
+      const AlignmentChi2* fc;
+      double zD0;
+      double deltaZ;
+  };
+}
+
+GlobalAlignmentFitter::GlobalAlignmentFitter(unsigned int nThreads, bool gridSeed) :
+  nThreads_(std::max(nThreads, 1u)),
+  gridSeed_(gridSeed),
+  nCalls_(0),
+  nRunEvals_(0)
+{
+}
+
+void GlobalAlignmentFitter::addRun(const AlignmentSample& s) {
+  RunData r;
+  r.header.run = s.run;
+  r.header.fei4Z = s.fei4Z;
+  r.header.offsetFEI4X = s.offsetFEI4X;
+  r.header.offsetFEI4Y = s.offsetFEI4Y;
+  r.header.residualSigmaFEI4X = s.residualSigmaFEI4X;
+  r.header.residualSigmaFEI4Y = s.residualSigmaFEI4Y;
+  r.header.offsetInitD0 = s.offsetInitD0;
+  r.header.offsetInitD1 = s.offsetInitD1;
+  r.both.setData(s.fei4Z, s.tkBoth, s.xBothD0, s.xBothD1);
+  //same start values as AlignmentFitter
+  r.offset = s.offsetInitD0;
+  r.theta = TMath::ATan((s.offsetInitD1 - s.offsetInitD0)/2.6);
+  r.evaluated = false;
+  r.chi2 = 99999.;
+  r.nWindow = 0;
+  runs_.push_back(r);
+  if(s.tkBoth.size() > bestSample_.tkBoth.size())  bestSample_ = s;
+}
+
+template<class F>
+void GlobalAlignmentFitter::parallel(unsigned int n, F job) const {
+  unsigned int nThreads = std::min(nThreads_, n);
+  if(nThreads <= 1) {
+    for(unsigned int i = 0; i < n; i++)  job(i);
+    return;
+  }
+  std::atomic<unsigned int> next(0);
+  auto work = [&]() {
+    for(unsigned int i = next++; i < n; i = next++)  job(i);
+  };
+  std::vector<std::thread> threads;
+  for(unsigned int t = 0; t < nThreads; t++)  threads.push_back(std::thread(work));
+  for(auto& t : threads)  t.join();
+}
+
+void GlobalAlignmentFitter::fitRuns(double zFromFEI4, double deltaZ) {
+  parallel(runs_.size(), [&](unsigned int i) {
+    RunData& r = runs_[i];
+    RunChi2 rc;
+    rc.fc = &r.both;
+    rc.zD0 = r.header.fei4Z + zFromFEI4;
+    rc.deltaZ = deltaZ;
+    ROOT::Math::Functor f(&rc, &RunChi2::value, 2);
+    ROOT::Minuit2::Minuit2Minimizer minimizer(ROOT::Minuit2::kMigrad);
+    minimizer.SetPrintLevel(0);
+    minimizer.SetFunction(f);
+    minimizer.SetLimitedVariable(0, "offset_d0", r.offset, 0.0001, -5., 5.);
+    minimizer.SetLimitedVariable(1, "theta", r.theta, 0.01, -20.*TMath::Pi()/180., 20.*TMath::Pi()/180.);
+    minimizer.Minimize();
+    r.offset = minimizer.X()[0];
+    r.theta = minimizer.X()[1];
+  });
+}
+
+double GlobalAlignmentFitter::totalChi2(const double* x) {
+  nCalls_++;
+  //a derivative step of offset_d0 or theta changes a single run
+  changed_.clear();
+  for(unsigned int i = 0; i < runs_.size(); i++) {
+    RunData& r = runs_[i];
+    const double p[4] = {r.header.fei4Z + x[0], x[1], x[2 + 2*i], x[3 + 2*i]};
+    if(r.evaluated && std::equal(p, p + 4, r.lastPars))  continue;
+    std::copy(p, p + 4, r.lastPars);
+    changed_.push_back(i);
+  }
+  parallel(changed_.size(), [this](unsigned int k) {
+    RunData& r = runs_[changed_[k]];
+    r.chi2 = runChi2(r.both, r.lastPars[2], r.lastPars[0], r.lastPars[1], r.lastPars[3]);
+    r.nWindow = r.both.lastWindowCount();
+    r.evaluated = true;
+  });
+  nRunEvals_ += changed_.size();
+  //chi2 per track in the windows over all the runs, the chi2 of a run being per track in its window
+  double sum = 0.;
+  unsigned long n = 0;
+  for(const auto& r : runs_) {
+    if(r.nWindow == 0)  return 99999.;
+    sum += r.nWindow*r.chi2;
+    n += r.nWindow;
+  }
+  return sum/n;
+}
+
+GlobalAlignmentFitter::Result GlobalAlignmentFitter::fit() {
+  auto t0 = std::chrono::steady_clock::now();
+  Result res{0., 0., 99999., -1, 0, 0, 0., std::vector<AlignmentFitter::Result>()};
+  if(runs_.empty())  return res;
+  nCalls_ = 0;
+  nRunEvals_ = 0;
+  for(auto& r : runs_)  r.evaluated = false;
+
+  //start geometry from the run with the most tracks
+  AlignmentFitter seedFitter(gridSeed_);
+  AlignmentFitter::Result seed = seedFitter.fit(bestSample_);
+  //zD0 of every run within the limits of the single run fit
+  double fei4ZMin = runs_[0].header.fei4Z, fei4ZMax = runs_[0].header.fei4Z;
+  for(const auto& r : runs_) {
+    fei4ZMin = std::min(fei4ZMin, r.header.fei4Z);
+    fei4ZMax = std::max(fei4ZMax, r.header.fei4Z);
+  }
+  const double zLo = 200. - fei4ZMin, zHi = 800. - fei4ZMax;
+  const double zStart = std::min(std::max(seed.zD0 - bestSample_.fei4Z, zLo), zHi);
+  const double deltaZStart = std::min(std::max(seed.deltaZ, 0.), 8.);
+  fitRuns(zStart, deltaZStart);
+
+  const unsigned int np = 2 + 2*runs_.size();
+  ROOT::Math::Functor f(this, &GlobalAlignmentFitter::totalChi2, np);
+  ROOT::Minuit2::Minuit2Minimizer minimizer(ROOT::Minuit2::kMigrad);
+  minimizer.SetPrintLevel(0);
+  minimizer.SetFunction(f);
+  minimizer.SetLimitedVariable(0, "zD0-fei4Z", zStart, 0.01, zLo, zHi);
+  minimizer.SetLimitedVariable(1, "deltaZ", deltaZStart, 0.01, 0., 8.);
+  for(unsigned int i = 0; i < runs_.size(); i++) {
+    const std::string run = std::to_string(runs_[i].header.run);
+    minimizer.SetLimitedVariable(2 + 2*i, "offset_d0_" + run, runs_[i].offset, 0.0001, -5., 5.);
+    minimizer.SetLimitedVariable(3 + 2*i, "theta_" + run, runs_[i].theta, 0.01, -20.*TMath::Pi()/180., 20.*TMath::Pi()/180.);
+  }
+  minimizer.Minimize();
+  std::vector<double> x(minimizer.X(), minimizer.X() + np);
+  res.zFromFEI4 = x[0];
+  res.deltaZ = x[1];
+  //per-run chi2 at the minimum
+  res.chi2 = totalChi2(x.data());
+  res.status = minimizer.Status();
+  res.nCalls = nCalls_;
+  res.nRunEvals = nRunEvals_;
+  for(unsigned int i = 0; i < runs_.size(); i++) {
+    const RunData& r = runs_[i];
+    res.runs.push_back(AlignmentFitter::Result{r.header.run, x[2 + 2*i], r.header.fei4Z + res.zFromFEI4, res.deltaZ,
+                                               x[3 + 2*i], r.chi2, res.status, 0, 0.});
+  }
+  res.time = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  return res;
+}
+
+tbeam::alignmentPars GlobalAlignmentFitter::parameters(unsigned int i, const Result& r) const {
+  return AlignmentFitter::parameters(runs_[i].header, r.runs[i]);
+}
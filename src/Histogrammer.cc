@@ -15,6 +15,7 @@
 #include <iterator>
 #include "TLorentzVector.h"
 #include "TFile.h"
+#include "TMemFile.h"
 
 using std::cout;
 using std::cerr;
@@ -25,6 +26,14 @@ using std::setw;
 Histogrammer::Histogrammer(std::string& outFile) {
   fout_ = new TFile(TString(outFile),"RECREATE");
   isFileopen_ = true;
+  inMemory_ = false;
+}
+
+Histogrammer::Histogrammer(const std::string& name, bool inMemory) {
+  if(inMemory)  fout_ = new TMemFile(name.c_str(),"RECREATE");
+  else  fout_ = new TFile(name.c_str(),"RECREATE");
+  isFileopen_ = true;
+  inMemory_ = inMemory;
 }
 
 void Histogrammer::bookEventHistograms() {
@@ -42,6 +51,7 @@ void Histogrammer::bookEventHistograms() {
   new TH1I("tdcPhase",";tdc;#Events",17,-0.5,16.5);
   new TH1I("isPeriodic",";isPeriodic;#Events",2,-0.5,1.5);
   new TH1I("isGoodFlag",";isGood;#Events",2,-0.5,1.5);
+  registerHistograms("EventInfo");
 }
 
 void Histogrammer::bookDUTHistograms(std::string det) {
@@ -52,6 +62,7 @@ void Histogrammer::bookDUTHistograms(std::string det) {
   new TH2I("hitmapfull",d + " hitmap;strip no.;#Events",1016,-0.5,1015.5,2,-0.5,1.5);
   bookDUTHistoForColumn(d,"C0");
   //bookDUTHistoForColumn(d,"C1");
+  registerHistograms(det);
 }
 void Histogrammer::bookDUTHistoForColumn(TString& d, TString c) {
   fout_->cd(d);    
@@ -82,6 +93,7 @@ void Histogrammer::bookStubHistograms() {
   new TH1I("nstubsdiff","#StubsReco - #StubsfromStubWord",20,-0.5,19.5);
   bookStubHistoForColumn("C0");
   //bookStubHistoForColumn("C1");
+  registerHistograms("StubInfo");
 }
 
 void Histogrammer::bookStubHistoForColumn(TString c) {
@@ -94,6 +106,7 @@ void Histogrammer::bookCorrelationHistograms() {
   fout_->cd("Correlation");
   bookCorrelationHistoForColumn("C0");
   //bookCorrelationHistoForColumn("C1");
+  registerHistograms("Correlation");
 }
     
 void Histogrammer::bookCorrelationHistoForColumn(TString c) {
@@ -154,7 +167,7 @@ void Histogrammer::bookTrackMatchHistograms() {
 
   new TH1F("deltaXPos_trkfei4", "Difference in matched Track impact and Hit X Position", 40000, -20.0, 20.0);
   new TH1F("deltaYPos_trkfei4", "Difference in matched Track Impact and Hit Y Position", 40000, -20.0, 20.0);
-
+  registerHistograms("TrackMatch");
 }
 
 void Histogrammer::bookTelescopeAnalysisHistograms() {
@@ -185,7 +198,7 @@ void Histogrammer::bookTelescopeAnalysisHistograms() {
   new TH1F("deltaYPos_trkfei4", "Difference in Track Impact and Hit Y Position after alignment", 40000, -20.0, 20.0);
   new TH1F("deltaXPos_trkfei4M", "Difference in matched Track impact and Hit X Position", 40000, -20.0, 20.0);
   new TH1F("deltaYPos_trkfei4M", "Difference in matched Track Impact and Hit Y Position", 40000, -20.0, 20.0);
-
+  registerHistograms("TelescopeAnalysis");
 }
 
 void Histogrammer::bookTrackFitHistograms(float zMin, float zStep, int zNsteps){
@@ -202,11 +215,7 @@ void Histogrammer::bookTrackFitHistograms(float zMin, float zStep, int zNsteps){
   new TH1I("d0_1tk1Hit_diffX_ter","X_{TkAtDUT}-X_{DUT}, d0",10000,-10,10);
   new TH1I("d1_1tk1Hit_diffX_ter","X_{TkAtDUT}-X_{DUT}, d1",10000,-10,10);
 
-  for (int iz=0; iz<zNsteps; iz++){
-    new TH1I(Form("d0_1tk1Hit_diffX_iz%i", iz),"X_{TkAtDUT}-X_{DUT}, d0",10000,-10,10);
-    new TH1I(Form("d1_1tk1Hit_diffX_iz%i", iz),"X_{TkAtDUT}-X_{DUT}, d0",10000,-10,10);
-  }
-
+  //the residuals of the z scan are kept in ZScanAccumulator, only the offset and chi2 vs z are booked
   float zMax = zMin + ((float)zNsteps) * zStep;
   float shift = zStep/2.;
 
@@ -226,7 +235,7 @@ void Histogrammer::bookTrackFitHistograms(float zMin, float zStep, int zNsteps){
   new TH1F("bothPlanes_chi2VsTheta","chi2 vs injected #theta", 41, -20.-0.5, 21.-0.5);
   new TH1F("bothPlanesConstraint_chi2VsTheta","chi2 vs injected #theta", 41, -20.-0.5, 21.-0.5);
   new TH1F("bothPlanesConstraint_chi2VsDeltaZ","chi2 vs injected #deltaZ", 41, 0.-0.125, 10.25-0.125);
-
+  registerHistograms("TrackFit");
 }
 
 TH1* Histogrammer::GetHistoByName(const char* dir, const char* hname){
@@ -251,6 +260,159 @@ void Histogrammer::FillAlignmentOffsetVsZ(const char* det, const char* histo, in
   h->SetBinError(iz+1, x_err);
 }
 
+// ------------------------------------------------------------------------
+// Histogram registry. Every book method registers the histograms of its
+// directory here, keyed by "dir/name". Analyses resolve typed handles once
+// (typically right after booking) and fill through them in the event loop,
+// which avoids the cd() + FindObject() + InheritsFrom() chain of the
+// name based fill methods.
+// -------------------------------------------------------------------------
+void Histogrammer::registerHistograms(const std::string& dir) {
+  TDirectory* d = fout_->GetDirectory(dir.c_str());
+  if(!d)  {
+    std::cerr << "**** registerHistograms: directory <" << dir << "> not found!" << std::endl;
+    return;
+  }
+  TIter next(d->GetList());
+  while(TObject* obj = next()) {
+    if(!obj->InheritsFrom("TH1"))  continue;
+    registry_[dir + "/" + obj->GetName()] = dynamic_cast<TH1*>(obj);
+  }
+}
+
+Hist1DHandle Histogrammer::hist1D(const std::string& dir, const std::string& hname) const {
+  auto it = registry_.find(dir + "/" + hname);
+  if(it == registry_.end()) {
+    std::cerr << "**** hist1D: Histogram for <" << dir << "/" << hname << "> not registered!" << std::endl;
+    return Hist1DHandle();
+  }
+  return Hist1DHandle(it->second);
+}
+
+Hist2DHandle Histogrammer::hist2D(const std::string& dir, const std::string& hname) const {
+  auto it = registry_.find(dir + "/" + hname);
+  TH2* h = (it != registry_.end()) ? dynamic_cast<TH2*>(it->second) : nullptr;
+  if(!h)
+    std::cerr << "**** hist2D: <" << dir << "/" << hname << "> not registered or not a 2D Histogram" << std::endl;
+  return Hist2DHandle(h);
+}
+
+HistProfileHandle Histogrammer::histProfile(const std::string& dir, const std::string& hname) const {
+  auto it = registry_.find(dir + "/" + hname);
+  TProfile* h = (it != registry_.end()) ? dynamic_cast<TProfile*>(it->second) : nullptr;
+  if(!h)
+    std::cerr << "**** histProfile: <" << dir << "/" << hname << "> not registered or not a Profile Histogram" << std::endl;
+  return HistProfileHandle(h);
+}
+
+Histogrammer::ClusterHistos Histogrammer::clusterHistos(const std::string& det, const std::string& col) const {
+  ClusterHistos ch;
+  ch.ncluster = hist1D(det, "ncluster" + col);
+  ch.clusterWidth = hist1D(det, "clusterWidth" + col);
+  ch.clusterPos = hist1D(det, "clusterPos" + col);
+  ch.clusterWidthVsPosProf = histProfile(det, "clusterWidthVsPosProf" + col);
+  ch.clusterWidthVsPos2D = hist2D(det, "clusterWidthVsPos2D" + col);
+  return ch;
+}
+
+Histogrammer::DUTHistos Histogrammer::dutHistos(const std::string& det, const std::string& col) const {
+  DUTHistos dh;
+  dh.chsize = hist1D(det, "chsize" + col);
+  dh.hitmap = hist1D(det, "hitmap" + col);
+  dh.hitmapfull = hist2D(det, "hitmapfull");
+  dh.nhitvsnclus = hist2D(det, "nhitvsnclus" + col);
+  dh.nhitvsHitClusPosDiff = hist2D(det, "nhitvsHitClusPosDiff" + col);
+  dh.propertyVsTDC2D = hist2D(det, "propertyVsTDC2D" + col);
+  dh.clusters = clusterHistos(det, col);
+  return dh;
+}
+
+Histogrammer::EventHistos Histogrammer::eventHistos() const {
+  EventHistos eh;
+  eh.isPeriodic = hist1D("EventInfo", "isPeriodic");
+  eh.isGoodFlag = hist1D("EventInfo", "isGoodFlag");
+  eh.condData = hist1D("EventInfo", "condData");
+  eh.tdcPhase = hist1D("EventInfo", "tdcPhase");
+  return eh;
+}
+
+Histogrammer::TelescopeHistos Histogrammer::telescopeHistos() const {
+  TelescopeHistos th;
+  th.HtColumn = hist1D("TelescopeAnalysis", "HtColumn");
+  th.HtRow = hist1D("TelescopeAnalysis", "HtRow");
+  th.HtXPos = hist1D("TelescopeAnalysis", "HtXPos");
+  th.HtYPos = hist1D("TelescopeAnalysis", "HtYPos");
+  th.TkXPos = hist1D("TelescopeAnalysis", "TkXPos");
+  th.TkYPos = hist1D("TelescopeAnalysis", "TkYPos");
+  th.deltaXPos = hist1D("TelescopeAnalysis", "deltaXPos");
+  th.deltaXPos_fit = hist1D("TelescopeAnalysis", "deltaXPos_fit");
+  th.deltaXPos_trkfei4 = hist1D("TelescopeAnalysis", "deltaXPos_trkfei4");
+  th.deltaXPos_trkfei4M = hist1D("TelescopeAnalysis", "deltaXPos_trkfei4M");
+  th.deltaYPos = hist1D("TelescopeAnalysis", "deltaYPos");
+  th.deltaYPos_fit = hist1D("TelescopeAnalysis", "deltaYPos_fit");
+  th.deltaYPos_trkfei4 = hist1D("TelescopeAnalysis", "deltaYPos_trkfei4");
+  th.deltaYPos_trkfei4M = hist1D("TelescopeAnalysis", "deltaYPos_trkfei4M");
+  th.nTrack = hist1D("TelescopeAnalysis", "nTrack");
+  th.nhitsFei4 = hist1D("TelescopeAnalysis", "nhitsFei4");
+  th.tkXPosVsHtXPos = hist2D("TelescopeAnalysis", "tkXPosVsHtXPos");
+  th.tkYPosVsHtYPos = hist2D("TelescopeAnalysis", "tkYPosVsHtYPos");
+  return th;
+}
+
+void Histogrammer::addHistograms(const Histogrammer& replica) {
+  for(auto& h : registry_) {
+    auto it = replica.registry_.find(h.first);
+    if(it == replica.registry_.end()) {
+      std::cerr << "**** addHistograms: <" << h.first << "> not booked in replica!" << std::endl;
+      continue;
+    }
+    //an empty replica would only spoil the statistics of a histogram with a range set
+    if(it->second->GetEntries() == 0)  continue;
+    h.second->Add(it->second);
+  }
+}
+
+void Histogrammer::resetHistograms() {
+  for(auto& h : registry_)
+    h.second->Reset();
+}
+
+void Histogrammer::writeHistograms(const std::string& fname) {
+  TFile f(fname.c_str(), "RECREATE");
+  if(f.IsZombie()) {
+    std::cerr << "**** writeHistograms: file <" << fname << "> could not be opened!" << std::endl;
+    fout_->cd();
+    return;
+  }
+  for(auto& h : registry_) {
+    std::string dir = h.first.substr(0, h.first.rfind('/'));
+    if(!f.GetDirectory(dir.c_str()))  f.mkdir(dir.c_str());
+    f.cd(dir.c_str());
+    h.second->Write();
+  }
+  f.Close();
+  fout_->cd();
+  std::cout << "Histograms written to " << fname << std::endl;
+}
+
+void Histogrammer::fill2DHistofromVec( const std::vector<int>& vecC0, const std::vector<int>& vecC1, const Hist2DHandle& h) {
+  if(!h.isValid())  return;
+  for( unsigned int i = 0; i<vecC0.size(); i++ )
+    h.get()->Fill(vecC0[i], 0, 1.0);
+  for( unsigned int i = 0; i<vecC1.size(); i++ )
+    h.get()->Fill(1015-vecC1[i], 1, 1.0);
+}
+
+void Histogrammer::fillClusterHistograms( const ClusterHistos& ch, const std::vector<tbeam::cluster>& cvec) {
+  fillHist1D(ch.ncluster, cvec.size());
+  for( unsigned int i =0; i<cvec.size(); i++ ) {
+    fillHist1D(ch.clusterWidth, cvec[i].size);
+    fillHist1D(ch.clusterPos, cvec[i].x);
+    fillHistProfile(ch.clusterWidthVsPosProf, cvec[i].x, cvec[i].size);
+    fillHist2D(ch.clusterWidthVsPos2D, cvec[i].x, cvec[i].size);
+  }
+}
+
 void Histogrammer::closeFile() { 
   fout_->cd();
   fout_->Write();
@@ -271,6 +433,7 @@ void Histogrammer::fillClusterHistograms( const char* det, std::vector<tbeam::cl
 }
 
 Histogrammer::~Histogrammer() {
+  if(inMemory_)  isFileopen_ = false;
   if(isFileopen_)  {
     std::cout << "You forgot to close the output file!!!Closing it now" << std::endl;  
     closeFile();
@@ -0,0 +1,88 @@
+/*!
+        \file                PerfCounters.cc
+        \brief               Per-stage timing and cut-flow counters of the event processing
+*/
+#include "PerfCounters.h"
+#include "TDirectory.h"
+#include "TH1.h"
+#include <iomanip>
+
+PerfCounters::PerfCounters() :
+  enabled_(false)
+{
+  for(int s = 0; s < NStages; s++) {
+    ns_[s] = 0;
+    calls_[s] = 0;
+  }
+}
+
+unsigned int PerfCounters::counter(const std::string& name) {
+  for(unsigned int i = 0; i < names_.size(); i++)
+    if(names_[i] == name)  return i;
+  names_.push_back(name);
+  counts_.push_back(0);
+  return names_.size() - 1;
+}
+
+const char* PerfCounters::stageName(Stage s) {
+  static const char* names[NStages] = {"readEntry", "setDetChannelVectors", "channelMasking", "getExtrapolatedTracks",
+                                       "clusterMatching", "histogramFill", "closeFile"};
+  return names[s];
+}
+
+double PerfCounters::nsPerEvent(Stage s) const {
+  unsigned long n = nEvents();
+  return n ? static_cast<double>(ns_[s])/n : 0.;
+}
+
+void PerfCounters::add(const PerfCounters& o) {
+  for(int s = 0; s < NStages; s++) {
+    ns_[s] += o.ns_[s];
+    calls_[s] += o.calls_[s];
+  }
+  for(unsigned int i = 0; i < o.names_.size(); i++)
+    counts_[counter(o.names_[i])] += o.counts_[i];
+}
+
+void PerfCounters::reset() {
+  for(int s = 0; s < NStages; s++) {
+    ns_[s] = 0;
+    calls_[s] = 0;
+  }
+  for(auto& c : counts_)
+    c = 0;
+}
+
+void PerfCounters::print(std::ostream& out) const {
+  out << "----Stage timing(" << nEvents() << " events read)----\n"
+      << std::setw(24) << "stage" << std::setw(14) << "ns/event" << std::setw(12) << "calls"
+      << std::setw(12) << "total(ms)" << "\n" << std::fixed << std::setprecision(1);
+  for(int s = 0; s < NStages; s++) {
+    if(s == CloseFile && !calls_[s])  continue;
+    out << std::setw(24) << stageName(static_cast<Stage>(s)) << std::setw(14) << nsPerEvent(static_cast<Stage>(s))
+        << std::setw(12) << calls_[s] << std::setw(12) << ns_[s]*1e-6 << "\n";
+  }
+  if(!names_.empty())  out << "----Cut flow----\n";
+  for(unsigned int i = 0; i < names_.size(); i++)
+    out << std::setw(40) << names_[i] << std::setw(12) << counts_[i] << "\n";
+  out << std::flush;
+}
+
+void PerfCounters::write(TDirectory* d) const {
+  d->cd();
+  TH1D* hns = new TH1D("nsPerEvent", "Time per event read;;ns/event", NStages, -0.5, NStages - 0.5);
+  TH1D* hcalls = new TH1D("calls", "Calls per stage;;#calls", NStages, -0.5, NStages - 0.5);
+  for(int s = 0; s < NStages; s++) {
+    hns->GetXaxis()->SetBinLabel(s+1, stageName(static_cast<Stage>(s)));
+    hcalls->GetXaxis()->SetBinLabel(s+1, stageName(static_cast<Stage>(s)));
+    hns->SetBinContent(s+1, nsPerEvent(static_cast<Stage>(s)));
+    hcalls->SetBinContent(s+1, calls_[s]);
+  }
+  if(names_.empty())  return;
+  const int n = names_.size();
+  TH1D* hcf = new TH1D("cutFlow", "Cut flow;;#events", n, -0.5, n - 0.5);
+  for(int i = 0; i < n; i++) {
+    hcf->GetXaxis()->SetBinLabel(i+1, names_[i].c_str());
+    hcf->SetBinContent(i+1, counts_[i]);
+  }
+}
@@ -0,0 +1,145 @@
+/*!
+        \file                SkimAnalysis.cc
+        \brief               Pre-selection of the events used by the track based analyses,
+                             written to a slim analysisTree
+*/
+#include "TROOT.h"
+#include "TH1.h"
+#include "TFile.h"
+#include "TTree.h"
+#include <algorithm>
+#include <vector>
+
+#include "SkimAnalysis.h"
+
+SkimAnalysis::SkimAnalysis() :
+  BeamAnaBase::BeamAnaBase(),
+  hist_(nullptr),
+  nEntries_(0),
+  fiducialCut_(true),
+  skimTree_(nullptr),
+  fillFlat_(false),
+  flatEv_(new tbeam::dutFlatEvent())
+{
+}
+
+void SkimAnalysis::bookHistograms() {
+  hist_->hfile()->mkdir("Skim");
+  hist_->hfile()->cd("Skim");
+  TH1I* h = new TH1I("cutFlow", "Skim selection;;#Events", 5, -0.5, 4.5);
+  const char* labels[5] = {"read", "isGood", "nPixHits==1", "FEI4 matched track", "skimmed"};
+  for(int i = 0; i < 5; i++)
+    h->GetXaxis()->SetBinLabel(i+1, labels[i]);
+  hist_->registerHistograms("Skim");
+  cutFlow_ = hist_->hist1D("Skim","cutFlow");
+}
+
+void SkimAnalysis::beginJob() {
+  if(nRuns()) {
+    std::cerr << "runList is not supported by the skim, run it once per run!" << std::endl;
+    exit(1);
+  }
+  auto jmap = jobCardmap();
+  if(jmap.find("skimFiducial") != jmap.end())
+    fiducialCut_ = atoi(jmap["skimFiducial"].c_str()) > 0;
+  if(resfei4x() <= 0. || resfei4y() <= 0.) {
+    std::cerr << "The skim needs the FEI4 residual sigmas of the run (readAlignmentFromfile)!" << std::endl;
+    exit(1);
+  }
+  //the cloned tree shares the branch addresses, they must not move with a read-ahead slot
+  setReadAheadSlots(0);
+  BeamAnaBase::beginJob();
+  nEntries_ = analysisTree()->GetEntries();
+  hist_ = outFile();
+  setAddresses();
+  bookHistograms();
+  analysisTree()->LoadTree(0);
+
+  //the output tree goes next to the histograms, at the top of the output file.
+  //DUT is replaced by DUTFlat, which is copied as it is if the input has it
+  hist_->hfile()->cd();
+  fillFlat_ = !hasFlatDUT();
+  if(branchFound("DUT")) {
+    analysisTree()->SetBranchStatus("DUT*", 0);
+    if(hasFlatDUT())  analysisTree()->SetBranchStatus("DUTFlat*", 1);
+  }
+  skimTree_ = analysisTree()->CloneTree(0);
+  analysisTree()->SetBranchStatus("*", 1);
+  if(fillFlat_)  skimTree_->Branch("DUTFlat", &flatEv_);
+  std::cout << "Skim with skimFiducial=" << fiducialCut_ << std::endl;
+}
+
+bool SkimAnalysis::selectEvent() {
+  skimTk_.clear();
+  hist_->fillHist1D(cutFlow_, 0);
+  if(!isGoodEvent())  return false;
+  hist_->fillHist1D(cutFlow_, 1);
+  if(fei4Ev()->nPixHits != 1)  return false;
+  hist_->fillHist1D(cutFlow_, 2);
+  if(!doTelMatching() || !hasTelescope())  return false;
+  if(fiducialCut_)  getExtrapolatedTracks(skimTk_);
+  else  getFei4MatchedTracks(skimTk_);
+  if(nFei4MatchedTracks())  hist_->fillHist1D(cutFlow_, 3);
+  return !skimTk_.empty();
+}
+
+template<typename T>
+void SkimAnalysis::keepTracks(std::vector<T>* v) {
+  if(!v || v->size() <= keep_.back())  return;
+  //keep_ is sorted, so the copy can be done in place
+  for(unsigned int k = 0; k < keep_.size(); k++)
+    (*v)[k] = (*v)[keep_[k]];
+  v->resize(keep_.size());
+}
+
+void SkimAnalysis::eventLoop()
+{
+  cout << "#Events=" << nEntries_ << endl;
+  //the output tree is filled in entry order, so the loop is not run on workers
+  unsigned long int nSkim = 0;
+  for(Long64_t jentry=0; jentry<static_cast<Long64_t>(nEntries_); jentry++) {
+    clearEvent();
+    Long64_t ientry = readEntry(jentry);
+    if (ientry < 0) break;
+    if (jentry%1000 == 0) {
+      cout << " Events processed. " << std::setw(8) << jentry
+           << "  skimmed " << nSkim << endl;
+    }
+    if(!selectEvent())  continue;
+
+    //trkIndex is the position of the track in the telescope vectors
+    keep_.clear();
+    for(auto& tk : skimTk_)
+      keep_.push_back(tk.trkIndex);
+    std::sort(keep_.begin(), keep_.end());
+    tbeam::TelescopeEvent* tel = telEv();
+    keepTracks(tel->xPos);
+    keepTracks(tel->yPos);
+    keepTracks(tel->dxdz);
+    keepTracks(tel->dydz);
+    keepTracks(tel->trackNum);
+    keepTracks(tel->iden);
+    keepTracks(tel->chi2);
+    keepTracks(tel->ndof);
+
+    if(fillFlat_)  flatEv_->fill(*dutEv());
+    skimTree_->Fill();
+    hist_->fillHist1D(cutFlow_, 4);
+    nSkim++;
+  }
+  std::cout << "#Skimmed events=" << nSkim << " of " << nEntries_
+            << " (" << (nEntries_ ? 100.*nSkim/nEntries_ : 0.) << "%)" << std::endl;
+  if(cutFlow_.isValid())
+    std::cout << "#Events with 1 FEI4 hit=" << cutFlow_.get()->GetBinContent(3)
+              << " with a FEI4 matched track=" << cutFlow_.get()->GetBinContent(4) << std::endl;
+}
+
+void SkimAnalysis::endJob() {
+  BeamAnaBase::endJob();
+  closeOutput();
+}
+
+SkimAnalysis::~SkimAnalysis(){
+  delete hist_;
+  delete flatEv_;
+}
@@ -23,89 +23,52 @@
 using std::vector;
 using std::map;
 TelescopeAnalysis::TelescopeAnalysis() :
-  BeamAnaBase::BeamAnaBase()
+  BeamAnaBase::BeamAnaBase(),
+  singlePass_(false)
 {
 }
 void TelescopeAnalysis::bookHistograms() {
   hist_->bookTelescopeAnalysisHistograms();
+  //resolve handles for the event loop
+  tH_ = hist_->telescopeHistos();
+}
+
+//tracks and FEI4 hits only
+std::vector<std::string> TelescopeAnalysis::requiredBranches() const {
+  static const char* b[] = {
+    "TelescopeEvent.nTrackParams", "TelescopeEvent.xPos", "TelescopeEvent.yPos", "TelescopeEvent.dxdz",
+    "TelescopeEvent.dydz", "TelescopeEvent.chi2", "TelescopeEvent.ndof",
+    "Fei4Event.nPixHits", "Fei4Event.row", "Fei4Event.col"
+  };
+  return std::vector<std::string>(b, b + sizeof(b)/sizeof(b[0]));
 }
 
 void TelescopeAnalysis::beginJob() {
   BeamAnaBase::beginJob();
   nEntries_ = analysisTree()->GetEntries();
   hist_ = outFile();
+  if(jobCardmap().find("telescopeSinglePass") != jobCardmap().end())
+    singlePass_ = (atoi(jobCardmap().at("telescopeSinglePass").c_str()) > 0) ? true : false;
   setAddresses();
   bookHistograms();
 }
 
+void TelescopeAnalysis::beginRun() {
+  nEntries_ = analysisTree()->GetEntries();
+}
+
 void TelescopeAnalysis::eventLoop()
 {
-  Long64_t nbytes = 0, nb = 0;
   cout << "#Events=" << nEntries_ << endl;
 
-  for (Long64_t jentry=0; jentry<nEntries_;jentry++) {
-    clearEvent();
-    Long64_t ientry = analysisTree()->GetEntry(jentry);
-    if (ientry < 0) break;
-    if (jentry%1000 == 0) 
-      cout << " Events processed. " << std::setw(8) << jentry 
-	   << endl;
-    hist_->fillHist1D("TelescopeAnalysis","nhitsFei4", fei4Ev()->nPixHits);
-    hist_->fillHist1D("TelescopeAnalysis","nTrack", telEv()->nTrackParams);
-    
-    if(fei4Ev()->nPixHits > 2)    continue;
-    if (fei4Ev()->nPixHits==0) continue;
-    if(telEv()->xPos->empty())    continue;
-
-    std::vector<tbeam::Track>  tkNoOv;
-    Utility::removeTrackDuplicates(telEv(), tkNoOv);
-    //if(tkNoOv.size() != 1)   continue;
-    //if(tkNoOv.size() > 20)   continue;
-
-    for(unsigned int i = 0; i<tkNoOv.size(); i++) {
-      //std::cout << i<< std::endl;
-      double tkX = tkNoOv[i].xPos;//-1.*tkNoOv[i].xPos;
-      double tkY = tkNoOv[i].yPos;
-      hist_->fillHist1D("TelescopeAnalysis","TkXPos", tkX);
-      hist_->fillHist1D("TelescopeAnalysis","TkYPos", tkY);
-    }
-
-    for (unsigned int i = 0; i < fei4Ev()->nPixHits; i++) {   
-      hist_->fillHist1D("TelescopeAnalysis","HtColumn", fei4Ev()->col->at(i));
-      hist_->fillHist1D("TelescopeAnalysis","HtRow", fei4Ev()->row->at(i));
-      //double xval = -9.875 + (fei4Ev()->col->at(i)-1)*0.250;
-      //double yval = -8.375 + (fei4Ev()->row->at(i)-1)*0.05;
-      double xval = 8.375 - (fei4Ev()->row->at(i)-1)*0.05;
-      double yval = 9.875 - (fei4Ev()->col->at(i)-1)*0.250;
-      hist_->fillHist1D("TelescopeAnalysis","HtXPos", xval);
-      hist_->fillHist1D("TelescopeAnalysis","HtYPos", yval);
-    }
-
-    //get residuals
-    //now loop over tracks
-    double xmin = 999.9;
-    double ymin = 999.9;
-    double deltamin = 999.9;
-    for(unsigned int itk = 0; itk < tkNoOv.size(); itk++) {
-      double tkX = tkNoOv[itk].xPos;//-1.*tkNoOv[itk].xPos; 
-      double tkY = tkNoOv[itk].yPos; 
-      for (unsigned int i = 0; i < fei4Ev()->nPixHits; i++) {   
-        double xval = 8.375 - (fei4Ev()->row->at(i)-1)*0.05;
-        double yval = 9.875 - (fei4Ev()->col->at(i)-1)*0.250;
-        hist_->fillHist2D("TelescopeAnalysis","tkXPosVsHtXPos", xval, tkX);
-        hist_->fillHist2D("TelescopeAnalysis","tkYPosVsHtYPos", yval, tkY);
-        //if (std::fabs(xval - tkX) < std::fabs(xmin)) xmin = xval - tkX;
-        //if (std::fabs(yval - tkY) < std::fabs(ymin)) ymin = yval - tkY;
-        if (sqrt((xval - tkX)*(xval - tkX) + (yval - tkY)*(yval - tkY)) < deltamin){
-	  xmin = xval - tkX;
-	  ymin = yval - tkY;
-	  deltamin = sqrt(xmin*xmin + ymin*ymin);
-	}
-      }
-    }
-    hist_->fillHist1D("TelescopeAnalysis","deltaXPos", xmin);
-    hist_->fillHist1D("TelescopeAnalysis","deltaYPos", ymin);
-  }//event loop
+  ps_.pass = 0;
+  runEventLoop(nEntries_);
+  if(singlePass_)
+    std::cout << "Residual candidates: " << pairs_.size() << " events, "
+              << pairs_.memoryUsage()/1024 << " kB" << std::endl;
+  else if(useEventCache() && eventCache().size())
+    std::cout << "Event cache: " << eventCache().size() << " events, "
+              << eventCache().memoryUsage()/1024 << " kB" << std::endl;
 
   //Fit residual in Y direction//Perpendicular to strips in DUT
    TH1F* htmp = dynamic_cast<TH1F*>(hist_->GetHistoByName("TelescopeAnalysis","deltaYPos"));
@@ -146,40 +109,10 @@ void TelescopeAnalysis::eventLoop()
             << std::endl;
 
   //Recompute residuals, with offset from previous gaus+pol1 fit
-  for (Long64_t jentry=0; jentry<nEntries_;jentry++) {
-    clearEvent();
-    Long64_t ientry = analysisTree()->GetEntry(jentry);
-    if (ientry < 0) break;
-    if (jentry%1000 == 0)
-      cout << " Events processed. " << std::setw(8) << jentry
-           << endl;
-
-    if(fei4Ev()->nPixHits > 2)    continue;
-    if (fei4Ev()->nPixHits==0) continue;
-    if(telEv()->xPos->empty())    continue;
-
-    std::vector<tbeam::Track>  tkNoOv;
-    Utility::removeTrackDuplicates(telEv(), tkNoOv);
-    double xmin = 999.9;
-    double ymin = 999.9;
-    double deltamin = 999.9;
-    for(unsigned int itk = 0; itk < tkNoOv.size(); itk++) {
-      double tkX = tkNoOv[itk].xPos;//-1.*tkNoOv[itk].xPos;
-      double tkY = tkNoOv[itk].yPos;
-      for (unsigned int i = 0; i < fei4Ev()->nPixHits; i++) {
-        double xval = 8.375 - (fei4Ev()->row->at(i)-1)*0.05;
-        double yval = 9.875 - (fei4Ev()->col->at(i)-1)*0.250;
-        if (sqrt((xval - tkX - offset_x_tmp)*(xval - tkX - offset_x_tmp) + (yval - tkY - offset_y_tmp)*(yval - tkY - offset_y_tmp)) < deltamin){
-          xmin = xval - tkX - offset_x_tmp;
-          ymin = yval - tkY - offset_y_tmp;
-          deltamin = sqrt(xmin*xmin + ymin*ymin);
-        }
-
-      }
-    }
-    hist_->fillHist1D("TelescopeAnalysis","deltaXPos_fit", xmin);
-    hist_->fillHist1D("TelescopeAnalysis","deltaYPos_fit", ymin);
-  }//event loop
+  ps_.offsetXtmp = offset_x_tmp;
+  ps_.offsetYtmp = offset_y_tmp;
+  ps_.pass = 1;
+  runEventLoop(nEntries_);
 
   //Fit with Gaussian convoluted with StepFunc  To be Done
   float height = fPol1Gaus_y->GetParameter(0);
@@ -241,51 +174,182 @@ void TelescopeAnalysis::eventLoop()
 
   std::cout << "Total offset in x:" << offset_x_total << " ; in y :"<<offset_y_total<<endl;
  
-  for (Long64_t jentry=0; jentry<nEntries_;jentry++) {
+  ps_.offsetXtotal = offset_x_total;
+  ps_.offsetYtotal = offset_y_total;
+  ps_.resXtotal = res_x_total;
+  ps_.resYtotal = res_y_total;
+  ps_.pass = 2;
+  runEventLoop(nEntries_);
+
+  std::cout << "offsetFEI4X=" << offset_x_total << endl;
+  std::cout << "offsetFEI4Y="<<offset_y_total<<endl;
+  std::cout << "residualSigmaFEI4X=" <<res_x_total<<endl;
+  std::cout << "residualSigmaFEI4Y="<< res_y_total <<endl;
+}
+
+void TelescopeAnalysis::processEntries(Long64_t first, Long64_t last)
+{
+  if(singlePass_ && ps_.pass > 0 && pairs_.covers(first, last)) {
+    replayResiduals(first, last);
+    return;
+  }
+  //the passes after the first one run on the events kept in the cache by the first
+  if(ps_.pass > 0 && !singlePass_ && eventCache().covers(first, last)) {
+    for(Long64_t i = 0; i < eventCache().size(); i++) {
+      const EventCache::Event ev = eventCache().event(i);
+      if (i%1000 == 0)
+        cout << " Events processed. " << std::setw(8) << ev.entry
+             << endl;
+      if(ps_.pass == 1)  fillResidualsWithOffset(ev);
+      else  fillMatchedResiduals(ev);
+    }
+    return;
+  }
+  eventCache().clear(first);
+  if(singlePass_ && ps_.pass == 0)  pairs_.clear(first);
+  for (Long64_t jentry=first; jentry<last;jentry++) {
     clearEvent();
-    Long64_t ientry = analysisTree()->GetEntry(jentry);
+    Long64_t ientry = readEntry(jentry);
     if (ientry < 0) break;
+    //one event at a time if the later passes need no event cache, or in a later pass
+    if(!useEventCache() || singlePass_ || ps_.pass > 0)  eventCache().clear(jentry);
+    cacheEvent(false);
     if (jentry%1000 == 0) 
       cout << " Events processed. " << std::setw(8) << jentry 
 	   << endl;
-    if(fei4Ev()->nPixHits > 2)    continue;
-    //Remove track duplicates
-    std::vector<tbeam::Track>  tkNoOv;
-    Utility::removeTrackDuplicates(telEv(), tkNoOv);
+    const EventCache::Event ev = eventCache().last();
+    if(ps_.pass == 0) {
+      fillResiduals(ev);
+      if(!singlePass_)  continue;
+      if(ev.nPixHits > 2)  pairs_.skipEvent();
+      else  pairs_.addEvent(ev, (ev.nPixHits > 0 && ev.nRawTracks > 0) ? Fei4PairBuffer::Fitted : Fei4PairBuffer::Matched);
+    }
+    else if(ps_.pass == 1)  fillResidualsWithOffset(ev);
+    else  fillMatchedResiduals(ev);
+  }//event loop
+}
+
+void TelescopeAnalysis::fillResiduals(const EventCache::Event& ev)
+{
+  hist_->fillHist1D(tH_.nhitsFei4, ev.nPixHits);
+  hist_->fillHist1D(tH_.nTrack, ev.nTrackParams);
+  
+  if(ev.nPixHits > 2)    return;
+  if (ev.nPixHits==0) return;
+  if(ev.nRawTracks == 0)    return;
+
+  //tracks in the cache are already free of duplicates
+  for(unsigned int i = 0; i<ev.nTk; i++) {
+    double tkX = ev.tkX[i];
+    double tkY = ev.tkY[i];
+    hist_->fillHist1D(tH_.TkXPos, tkX);
+    hist_->fillHist1D(tH_.TkYPos, tkY);
+  }
+
+  for (unsigned int i = 0; i < ev.nFei4; i++) {   
+    hist_->fillHist1D(tH_.HtColumn, ev.col[i]);
+    hist_->fillHist1D(tH_.HtRow, ev.row[i]);
+    double xval = 8.375 - (ev.row[i]-1)*0.05;
+    double yval = 9.875 - (ev.col[i]-1)*0.250;
+    hist_->fillHist1D(tH_.HtXPos, xval);
+    hist_->fillHist1D(tH_.HtYPos, yval);
+  }
+
+  for(unsigned int itk = 0; itk < ev.nTk; itk++) {
+    for (unsigned int i = 0; i < ev.nFei4; i++) {   
+      hist_->fillHist2D(tH_.tkXPosVsHtXPos, Fei4HitIndex::xPos(ev.row[i]), ev.tkX[itk]);
+      hist_->fillHist2D(tH_.tkYPosVsHtYPos, Fei4HitIndex::yPos(ev.col[i]), ev.tkY[itk]);
+    }
+  }
+
+  //get residuals of the closest track-hit pair
+  double xmin = 999.9;
+  double ymin = 999.9;
+  closestTrackHit(ev, 0., 0., xmin, ymin);
+  hist_->fillHist1D(tH_.deltaXPos, xmin);
+  hist_->fillHist1D(tH_.deltaYPos, ymin);
+}
+
+void TelescopeAnalysis::fillResidualsWithOffset(const EventCache::Event& ev)
+{
+  if(ev.nPixHits > 2)    return;
+  if (ev.nPixHits==0) return;
+  if(ev.nRawTracks == 0)    return;
+
+  double xmin = 999.9;
+  double ymin = 999.9;
+  closestTrackHit(ev, ps_.offsetXtmp, ps_.offsetYtmp, xmin, ymin);
+  hist_->fillHist1D(tH_.deltaXPos_fit, xmin);
+  hist_->fillHist1D(tH_.deltaYPos_fit, ymin);
+}
+
+void TelescopeAnalysis::fillMatchedResiduals(const EventCache::Event& ev)
+{
+  if(ev.nPixHits > 2)    return;
 
-    //get residuals
+  //get residuals
+  double minresx = 999.;
+  double minresy = 999.;
+  closestTrackHit(ev, ps_.offsetXtotal, ps_.offsetYtotal, minresx, minresy);
+  hist_->fillHist1D(tH_.deltaXPos_trkfei4, minresx);
+  hist_->fillHist1D(tH_.deltaYPos_trkfei4, minresy);
+  if(std::fabs(minresx) < ps_.resXtotal &&
+    std::fabs(minresy) < ps_.resYtotal) {
+    hist_->fillHist1D(tH_.deltaXPos_trkfei4M, minresx);
+    hist_->fillHist1D(tH_.deltaYPos_trkfei4M, minresy);
+  }
+}
+
+void TelescopeAnalysis::replayResiduals(Long64_t first, Long64_t last)
+{
+  //same selection and histograms as fillResidualsWithOffset and fillMatchedResiduals
+  for (Long64_t jentry=first; jentry<last;jentry++) {
+    Fei4PairBuffer::Flag f = pairs_.flag(jentry);
+    if(f == Fei4PairBuffer::Skipped)  continue;
+    if(ps_.pass == 1) {
+      if(f != Fei4PairBuffer::Fitted)  continue;
+      double xmin = 999.9;
+      double ymin = 999.9;
+      pairs_.closest(jentry, ps_.offsetXtmp, ps_.offsetYtmp, xmin, ymin);
+      hist_->fillHist1D(tH_.deltaXPos_fit, xmin);
+      hist_->fillHist1D(tH_.deltaYPos_fit, ymin);
+      continue;
+    }
     double minresx = 999.;
     double minresy = 999.;
-    double mindelta = 999.;
-    for(unsigned int itk = 0; itk < tkNoOv.size(); itk++) {
-      double tkX = tkNoOv[itk].xPos;//-1.*tkNoOv[itk].xPos;//-1.*telEv()->xPos->at(itk);
-      double tkY = tkNoOv[itk].yPos;//telEv()->yPos->at(itk);
-      for (unsigned int i = 0; i < fei4Ev()->nPixHits; i++) {   
-        //default pitch and dimensions of fei4 plane
-        double xval = 8.375 - (fei4Ev()->row->at(i)-1)*0.05;
-        double yval = 9.875 - (fei4Ev()->col->at(i)-1)*0.250;
-        double xres = xval - tkX - offset_x_total;//fStepGaus_x->GetParameter(4);//fGausResiduals_x->GetParameter("Mean");
-        double yres = yval - tkY - offset_y_total;//fStepGaus_y->GetParameter(4);//fGausResiduals_y->GetParameter("Mean");
-        if (sqrt(xres*xres+yres*yres)<mindelta){
-	  mindelta = sqrt(xres*xres+yres*yres);
-	  minresx = xres;
-	  minresy = yres;
-        }
-      }
+    pairs_.closest(jentry, ps_.offsetXtotal, ps_.offsetYtotal, minresx, minresy);
+    hist_->fillHist1D(tH_.deltaXPos_trkfei4, minresx);
+    hist_->fillHist1D(tH_.deltaYPos_trkfei4, minresy);
+    if(std::fabs(minresx) < ps_.resXtotal &&
+      std::fabs(minresy) < ps_.resYtotal) {
+      hist_->fillHist1D(tH_.deltaXPos_trkfei4M, minresx);
+      hist_->fillHist1D(tH_.deltaYPos_trkfei4M, minresy);
     }
-    hist_->fillHist1D("TelescopeAnalysis","deltaXPos_trkfei4", minresx);
-    hist_->fillHist1D("TelescopeAnalysis","deltaYPos_trkfei4", minresy);
-      if(std::fabs(minresx) < res_x_total &&
-        std::fabs(minresy) < res_y_total) {
-        hist_->fillHist1D("TelescopeAnalysis","deltaXPos_trkfei4M", minresx);
-        hist_->fillHist1D("TelescopeAnalysis","deltaYPos_trkfei4M", minresy);
-      }
-  }//event loop
+  }
+}
 
-  std::cout << "offsetFEI4X=" << offset_x_total << endl;
-  std::cout << "offsetFEI4Y="<<offset_y_total<<endl;
-  std::cout << "residualSigmaFEI4X=" <<res_x_total<<endl;
-  std::cout << "residualSigmaFEI4Y="<< res_y_total <<endl;
+void TelescopeAnalysis::closestTrackHit(const EventCache::Event& ev, double xResMean, double yResMean,
+                                        double& xres, double& yres) {
+  //nearest hit of each track, the pair with the smallest distance wins; xres/yres are left as they are
+  //if no pair is within the 999.9 starting distance of the old loop
+  fei4Hits_.build(ev.row, ev.col, ev.nFei4);
+  double mindelta2 = 999.9*999.9;
+  for(unsigned int itk = 0; itk < ev.nTk; itk++) {
+    Fei4HitIndex::Match m = fei4Hits_.nearest(ev.tkX[itk], ev.tkY[itk], xResMean, yResMean);
+    if(m.hit >= 0 && m.dist2 < mindelta2) {
+      mindelta2 = m.dist2;
+      xres = m.xres;
+      yres = m.yres;
+    }
+  }
+}
+
+BeamAnaBase* TelescopeAnalysis::makeWorker() const {
+  return new TelescopeAnalysis();
+}
+
+void TelescopeAnalysis::syncWorker(BeamAnaBase& w) {
+  dynamic_cast<TelescopeAnalysis&>(w).ps_ = ps_;
 }
 
 void TelescopeAnalysis::clearEvent() {
@@ -294,7 +358,7 @@ void TelescopeAnalysis::clearEvent() {
 
 void TelescopeAnalysis::endJob() {
   BeamAnaBase::endJob();
-  hist_->closeFile();
+  closeOutput();
 }
 
 TelescopeAnalysis::~TelescopeAnalysis(){
@@ -0,0 +1,91 @@
+/*!
+        \file                TrackDuplicateFilter.cc
+        \brief               Sort based removal of the duplicated telescope tracks
+*/
+#include "TrackDuplicateFilter.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+  //same tolerance as Utility::removeTrackDuplicates
+  const double tolerance = 0.001;
+  //the sort key is the x cell of size tolerance in the upper 32 bits and the track index in the
+  //lower ones; positions beyond maxGridPos (or not finite) are kept off the grid
+  const double maxGridPos = 1e6;
+  const int64_t cellOffset = int64_t(1) << 30;
+  //below this many tracks the plain pairwise comparison is faster than the sort
+  const unsigned int maxPairwise = 16;
+
+  bool isClose(const double* x, const double* y, unsigned int i, unsigned int j) {
+    return std::fabs(y[i]-y[j]) < tolerance && std::fabs(x[i]-x[j]) < tolerance;
+  }
+}
+
+void TrackDuplicateFilter::Tracks::clear() {
+  index.clear();
+  x.clear();
+  y.clear();
+  dxdz.clear();
+  dydz.clear();
+  chi2.clear();
+  ndof.clear();
+}
+
+tbeam::Track TrackDuplicateFilter::Tracks::track(unsigned int i) const {
+  return tbeam::Track(index[i], x[i], y[i], dxdz[i], dydz[i], chi2[i], ndof[i]);
+}
+
+void TrackDuplicateFilter::run(const double* x, const double* y, unsigned int n, std::vector<unsigned int>& survivors) {
+  survivors.clear();
+  if(n <= maxPairwise) {
+    for(unsigned int i = 0; i < n; i++) {
+      unsigned int j = i+1;
+      while(j < n && !isClose(x, y, i, j))  j++;
+      if(j == n)  survivors.push_back(i);
+    }
+    return;
+  }
+  isDuplicate_.assign(n, 0);
+  keys_.clear();
+  outliers_.clear();
+  for(unsigned int i = 0; i < n; i++) {
+    if(std::fabs(x[i]) < maxGridPos && std::isfinite(y[i]))
+      keys_.push_back(static_cast<uint64_t>(static_cast<int64_t>(std::floor(x[i]/tolerance)) + cellOffset) << 32 | i);
+    else
+      outliers_.push_back(i);
+  }
+  std::sort(keys_.begin(), keys_.end());
+  //two tracks closer than the tolerance are at most one cell apart in x (two with the rounding of
+  //the division), so only the few following keys are compared; of a close pair the earlier track
+  //is the duplicate
+  const unsigned int nk = keys_.size();
+  for(unsigned int p = 0; p < nk; p++) {
+    const uint64_t lastCell = (keys_[p] >> 32) + 2;
+    const unsigned int ip = static_cast<uint32_t>(keys_[p]);
+    for(unsigned int q = p+1; q < nk && (keys_[q] >> 32) <= lastCell; q++) {
+      const unsigned int iq = static_cast<uint32_t>(keys_[q]);
+      if(isClose(x, y, ip, iq))  isDuplicate_[std::min(ip, iq)] = 1;
+    }
+  }
+  //the rare tracks off the grid are compared with all the others
+  for(auto o : outliers_)
+    for(unsigned int j = 0; j < n; j++)
+      if(j != o && isClose(x, y, o, j))  isDuplicate_[std::min(o, j)] = 1;
+  for(unsigned int i = 0; i < n; i++)
+    if(!isDuplicate_[i])  survivors.push_back(i);
+}
+
+void TrackDuplicateFilter::run(const tbeam::TelescopeEvent& tel, Tracks& out) {
+  out.clear();
+  const unsigned int n = tel.xPos->size();
+  run(tel.xPos->data(), tel.yPos->data(), n, survivors_);
+  for(auto i : survivors_) {
+    out.index.push_back(i);
+    out.x.push_back((*tel.xPos)[i]);
+    out.y.push_back((*tel.yPos)[i]);
+    out.dxdz.push_back((*tel.dxdz)[i]);
+    out.dydz.push_back((*tel.dydz)[i]);
+    out.chi2.push_back((*tel.chi2)[i]);
+    out.ndof.push_back((*tel.ndof)[i]);
+  }
+}
@@ -0,0 +1,196 @@
+/*!
+        \file                TreeIOStats.cc
+        \brief               Branch selection, TTreeCache set up and per-branch I/O accounting
+                             of the analysis tree
+*/
+#include "TreeIOStats.h"
+#include "TBranch.h"
+#include "TObjArray.h"
+#include "TTreePerfStats.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+TreeIOStats::TreeIOStats() :
+  tree_(nullptr),
+  timing_(false),
+  treeNumber_(-1),
+  perf_(nullptr),
+  diskBytes_(0),
+  readCalls_(0),
+  diskSeconds_(0.),
+  unzipSeconds_(0.)
+{
+}
+
+TreeIOStats::~TreeIOStats() {
+  delete perf_;
+}
+
+std::vector<std::string> TreeIOStats::enableBranches(TTree* t, const std::vector<std::string>& branches) {
+  std::vector<std::string> top;
+  if(branches.empty()) {
+    t->SetBranchStatus("*", 1);
+    TObjArray* all = t->GetListOfBranches();
+    for(int i = 0; i < all->GetEntriesFast(); i++)
+      top.push_back(all->At(i)->GetName());
+    return top;
+  }
+  t->SetBranchStatus("*", 0);
+  for(auto& e : branches) {
+    std::string::size_type dot = e.find('.');
+    std::string bname = e.substr(0, dot);
+    TBranch* b = t->GetBranch(bname.c_str());
+    if(!b)  continue;
+    if(dot == std::string::npos)  t->SetBranchStatus(bname.c_str(), 1);
+    else {
+      TBranch* sb = b->FindBranch(e.substr(dot+1).c_str());
+      if(sb)  t->SetBranchStatus(sb->GetName(), 1);
+      else {
+        std::cerr << "Branch " << e << " not found, all of " << bname << " is read!" << std::endl;
+        t->SetBranchStatus(bname.c_str(), 1);
+      }
+    }
+    if(std::find(top.begin(), top.end(), bname) == top.end())  top.push_back(bname);
+  }
+  return top;
+}
+
+Long64_t TreeIOStats::setTreeCache(TTree* t, const std::vector<std::string>& branches, double cacheMB) {
+  const Long64_t MB = 1024*1024;
+  Long64_t size = static_cast<Long64_t>(cacheMB*MB);
+  if(size <= 0) {
+    //compressed size of ~1000 entries of the branches read, within [1,64] MB
+    TTree* cur = t->GetTree() ? t->GetTree() : t;
+    double perEntry = 0.;
+    Long64_t n = std::max(cur->GetEntries(), 1LL);
+    for(auto& b : branches) {
+      TBranch* br = cur->GetBranch(b.c_str());
+      if(br)  perEntry += static_cast<double>(br->GetZipBytes("*"))/n;
+    }
+    size = std::min(std::max(static_cast<Long64_t>(1000*perEntry), MB), 64*MB);
+  }
+  t->SetCacheSize(size);
+  for(auto& b : branches)
+    t->AddBranchToCache(b.c_str(), true);
+  t->StopCacheLearningPhase();
+  return size;
+}
+
+TreeIOStats::BranchIO& TreeIOStats::branchIO(const std::string& name) {
+  for(auto& io : io_)
+    if(io.name == name)  return io;
+  BranchIO io;
+  io.name = name;
+  io.nEntries = 0;
+  io.bytes = 0;
+  io.zipBytes = 0;
+  io.seconds = 0.;
+  io_.push_back(io);
+  return io_.back();
+}
+
+void TreeIOStats::collectPerfStats() {
+  if(!perf_)  return;
+  diskBytes_ += perf_->GetBytesRead();
+  readCalls_ += perf_->GetReadCalls();
+  diskSeconds_ += perf_->GetDiskTime();
+  unzipSeconds_ += perf_->GetUnzipTime();
+  delete perf_;
+  perf_ = nullptr;
+}
+
+void TreeIOStats::setTree(TTree* t, const std::vector<std::string>& branches, bool timing) {
+  //the previous tree is usually deleted by now, only a tree set again is detached
+  if(t == tree_ && perf_)  t->SetPerfStats(nullptr);
+  collectPerfStats();
+  tree_ = t;
+  timing_ = timing;
+  treeNumber_ = -1;
+  names_ = branches;
+  branches_.assign(names_.size(), nullptr);
+  zipRatio_.assign(names_.size(), 1.);
+  slots_.clear();
+  for(auto& n : names_) {
+    branchIO(n);
+    for(unsigned int i = 0; i < io_.size(); i++)
+      if(io_[i].name == n)  slots_.push_back(i);
+  }
+  perf_ = new TTreePerfStats("analysisTreeIO", tree_);
+}
+
+Long64_t TreeIOStats::readEntry(Long64_t jentry) {
+  if(!timing_)  return tree_->GetEntry(jentry);
+  Long64_t local = tree_->LoadTree(jentry);
+  if(local < 0)  return -1;
+  //the branches change with the file of a TChain
+  if(tree_->GetTreeNumber() != treeNumber_) {
+    treeNumber_ = tree_->GetTreeNumber();
+    TTree* cur = tree_->GetTree();
+    for(unsigned int i = 0; i < names_.size(); i++) {
+      branches_[i] = cur->GetBranch(names_[i].c_str());
+      Long64_t tot = branches_[i] ? branches_[i]->GetTotBytes("*") : 0;
+      zipRatio_[i] = tot > 0 ? static_cast<double>(branches_[i]->GetZipBytes("*"))/tot : 1.;
+    }
+  }
+  Long64_t nb = 0;
+  for(unsigned int i = 0; i < branches_.size(); i++) {
+    if(!branches_[i])  continue;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    Int_t n = branches_[i]->GetEntry(local);
+    double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if(n < 0)  return -1;
+    BranchIO& io = io_[slots_[i]];
+    io.nEntries++;
+    io.bytes += n;
+    io.zipBytes += static_cast<Long64_t>(n*zipRatio_[i]);
+    io.seconds += dt;
+    nb += n;
+  }
+  return nb;
+}
+
+void TreeIOStats::add(const TreeIOStats& o) {
+  for(auto& oio : o.io_) {
+    BranchIO& io = branchIO(oio.name);
+    io.nEntries += oio.nEntries;
+    io.bytes += oio.bytes;
+    io.zipBytes += oio.zipBytes;
+    io.seconds += oio.seconds;
+  }
+  diskBytes_ += o.diskBytes_;
+  readCalls_ += o.readCalls_;
+  diskSeconds_ += o.diskSeconds_;
+  unzipSeconds_ += o.unzipSeconds_;
+  if(o.perf_) {
+    diskBytes_ += o.perf_->GetBytesRead();
+    readCalls_ += o.perf_->GetReadCalls();
+    diskSeconds_ += o.perf_->GetDiskTime();
+    unzipSeconds_ += o.perf_->GetUnzipTime();
+  }
+}
+
+void TreeIOStats::print(std::ostream& out) const {
+  const double MB = 1024.*1024.;
+  Long64_t bytes = diskBytes_;
+  Long64_t calls = readCalls_;
+  double disk = diskSeconds_;
+  double unzip = unzipSeconds_;
+  if(perf_) {
+    bytes += perf_->GetBytesRead();
+    calls += perf_->GetReadCalls();
+    disk += perf_->GetDiskTime();
+    unzip += perf_->GetUnzipTime();
+  }
+  out << "----analysisTree I/O----\n"
+      << std::fixed << std::setprecision(2)
+      << "Read from disk: " << bytes/MB << " MB in " << calls << " calls, disk time " << disk
+      << " s, decompression time " << unzip << " s\n";
+  if(io_.empty() || !timing_)  return;
+  out << std::setw(20) << "branch" << std::setw(12) << "entries" << std::setw(14) << "unpacked(MB)"
+      << std::setw(14) << "on disk(MB)" << std::setw(12) << "time(s)" << std::setw(10) << "MB/s" << "\n";
+  for(auto& io : io_)
+    out << std::setw(20) << io.name << std::setw(12) << io.nEntries << std::setw(14) << io.bytes/MB
+        << std::setw(14) << io.zipBytes/MB << std::setw(12) << io.seconds
+        << std::setw(10) << (io.seconds > 0. ? io.bytes/MB/io.seconds : 0.) << "\n";
+}
@@ -38,35 +38,27 @@ namespace Utility {
     }
   }
 
-  void getChannelMaskedHits( std::vector<int>& vec, const std::vector<int>& mch ) {
-    std::vector<int> vtemp = vec;
-    vec.clear();
-    for(auto& ch : vtemp) {
-      //std::cout << ch;
-      if( std::find(mch.begin(), mch.end(), ch) != mch.end() )   continue;
-      vec.push_back(ch);
+  void getChannelMaskedHits( std::vector<int>& vec, const ChannelMask& mch ) {
+    vec.erase(std::remove_if(vec.begin(), vec.end(), [&mch](int ch) { return isMasked(mch, ch); }), vec.end());
+  }
 
+  //the event owns the objects, so the masked ones are deleted here; the order is kept
+  template<typename T>
+  void dropMaskedObjects( std::vector<T*>& vec, const ChannelMask& mch ) {
+    unsigned int n = 0;
+    for(auto p : vec) {
+      if(isMasked(mch, p->x))  delete p;
+      else vec[n++] = p;
     }
+    vec.resize(n);
   }
 
-  void getChannelMaskedClusters( std::vector<tbeam::cluster*>& vec, const std::vector<int>& mch ) {
-    std::vector<tbeam::cluster*> vtemp = vec;
-    vec.clear();
-    for(auto& clus : vtemp) {
-      //std::cout << ch;
-      if( std::find(mch.begin(), mch.end(), clus->x) != mch.end() )   continue;
-      vec.push_back(clus);
-    }
+  void getChannelMaskedClusters( std::vector<tbeam::cluster*>& vec, const ChannelMask& mch ) {
+    dropMaskedObjects(vec, mch);
   }
 
-  void getChannelMaskedStubs( std::vector<tbeam::stub*>& vec, const std::vector<int>& mch ) {
-    std::vector<tbeam::stub*> vtemp = vec;
-    vec.clear();
-    for(auto& stub : vtemp) {
-      //std::cout << ch;
-      if( std::find(mch.begin(), mch.end(), stub->x) != mch.end() )   continue;
-      vec.push_back(stub);
-    }
+  void getChannelMaskedStubs( std::vector<tbeam::stub*>& vec, const ChannelMask& mch ) {
+    dropMaskedObjects(vec, mch);
   }
 
   void fill2DHistofromVec( const std::vector<int>& vecC0, const std::vector<int>& vecC1,const char* h) {
@@ -189,60 +181,63 @@ namespace Utility {
   // ---------------------------------------------
 
   void removeTrackDuplicates(const tbeam::TelescopeEvent *telEv, std::vector<tbeam::Track>& tkNoOverlap) {
-    //Loop over original track collection and compare all track pairs to check for duplicates
-    for(unsigned int i = 0; i<telEv->xPos->size(); i++) {
-      double tkX = telEv->xPos->at(i);
-      double tkY = telEv->yPos->at(i);
-      bool isduplicate = false;
-      for (unsigned int j = i+1; j<telEv->xPos->size(); j++) {
-        double tkX_j = telEv->xPos->at(j);
-        double tkY_j = telEv->yPos->at(j);
-        //if (fabs(tkY-tkY_j)<0.015*4 && fabs(tkX-tkX_j)<0.072*4) isduplicate = true;
-        //if (fabs(tkY-tkY_j)<0.015 && fabs(tkX-tkX_j)<0.072) isduplicate = true;
-        if (fabs(tkY-tkY_j)<0.001 && fabs(tkX-tkX_j)<0.001) isduplicate = true;
-      }
-      if (!isduplicate) {
-        tbeam::Track t(i,tkX,tkY,telEv->dxdz->at(i),telEv->dydz->at(i),telEv->chi2->at(i),telEv->ndof->at(i));  
-        tkNoOverlap.push_back(t);
-      }      
+    //A track is a duplicate if a later one is within 0.001 in x and y, see TrackDuplicateFilter
+    static thread_local TrackDuplicateFilter filter;
+    static thread_local std::vector<unsigned int> survivors;
+    filter.run(telEv->xPos->data(), telEv->yPos->data(), telEv->xPos->size(), survivors);
+    for(auto i : survivors) {
+      tbeam::Track t(i,telEv->xPos->at(i),telEv->yPos->at(i),telEv->dxdz->at(i),telEv->dydz->at(i),telEv->chi2->at(i),telEv->ndof->at(i));  
+      tkNoOverlap.push_back(t);
     }
   }
 
   void cutTrackFei4Residuals(const tbeam::FeIFourEvent* fei4ev ,const std::vector<tbeam::Track>& tkNoOverlap, std::vector<tbeam::Track>& selectedTk, 
                              const double xResMean, const double yResMean, const double xResPitch, const double yResPitch, bool doClosestTrack) {
-   
-    double mindelta = 999.;
+    Fei4HitIndex fei4Hits;
+    fei4Hits.build(*fei4ev->row, *fei4ev->col);
+    std::vector<double> xTk(tkNoOverlap.size()), yTk(tkNoOverlap.size());
+    for(unsigned int itk = 0; itk < tkNoOverlap.size(); itk++) {
+      xTk[itk] = tkNoOverlap[itk].xPos;
+      yTk[itk] = tkNoOverlap[itk].yPos;
+    }
+    std::vector<unsigned int> selected;
+    cutTrackFei4Residuals(fei4Hits, xTk.data(), yTk.data(), xTk.size(), selected, xResMean, yResMean, xResPitch, yResPitch, doClosestTrack);
+    for(auto itk : selected)
+      selectedTk.push_back(tkNoOverlap[itk]);
+  }
+
+  void cutTrackFei4Residuals(const int* rowFei4, const int* colFei4, unsigned int nFei4Hits, const double* xTk, const double* yTk, unsigned int nTk,
+                             std::vector<unsigned int>& selectedTk, const double xResMean, const double yResMean, const double xResPitch, const double yResPitch, bool doClosestTrack) {
+    Fei4HitIndex fei4Hits;
+    fei4Hits.build(rowFei4, colFei4, nFei4Hits);
+    cutTrackFei4Residuals(fei4Hits, xTk, yTk, nTk, selectedTk, xResMean, yResMean, xResPitch, yResPitch, doClosestTrack);
+  }
+
+  void cutTrackFei4Residuals(const Fei4HitIndex& fei4Hits, const double* xTk, const double* yTk, unsigned int nTk,
+                             std::vector<unsigned int>& selectedTk, const double xResMean, const double yResMean, const double xResPitch, const double yResPitch, bool doClosestTrack) {
+    //squared distances, 999. is the starting distance of the original loop
+    double mindelta2 = 999.*999.;
     double minresx = 999.;
     double minresy = 999.;
     int itkClosest = -1;
 
-    for(unsigned int itk = 0; itk < tkNoOverlap.size(); itk++) {
-      const tbeam::Track tTemp(tkNoOverlap.at(itk));
-      double tkX = tTemp.xPos;
-      double tkY = tTemp.yPos;
+    for(unsigned int itk = 0; itk < nTk; itk++) {
       if (!doClosestTrack){
         minresx = 999.;
         minresy = 999.;
-	mindelta = 999.;
+        mindelta2 = 999.*999.;
       }
-      for (unsigned int i = 0; i < fei4ev->col->size(); i++) {
-        double xval = 8.375 - (fei4ev->row->at(i)-1)*0.05;
-        double yval = 9.875 - (fei4ev->col->at(i)-1)*0.250;
-        double xres = xval - tkX - xResMean;
-        double yres = yval - tkY - yResMean;
-        if (sqrt(xres*xres+yres*yres)<mindelta){
-	  mindelta = sqrt(xres*xres+yres*yres);
-	  minresx = xres;
-	  minresy = yres;
-	  itkClosest = itk;
-	}
+      Fei4HitIndex::Match m = fei4Hits.nearest(xTk[itk], yTk[itk], xResMean, yResMean);
+      if (m.hit >= 0 && m.dist2 < mindelta2){
+        mindelta2 = m.dist2;
+        minresx = m.xres;
+        minresy = m.yres;
+        itkClosest = itk;
       }
-      if (!doClosestTrack && (std::fabs(minresx) < xResPitch) && (std::fabs(minresy) < yResPitch)) selectedTk.push_back(tTemp);
-    }
-    if (doClosestTrack && (std::fabs(minresx) < xResPitch) && (std::fabs(minresy) < yResPitch) && itkClosest!=-1){
-      const tbeam::Track tClosest(tkNoOverlap.at(itkClosest));
-      selectedTk.push_back(tClosest);
+      if (!doClosestTrack && (std::fabs(minresx) < xResPitch) && (std::fabs(minresy) < yResPitch)) selectedTk.push_back(itk);
     }
+    if (doClosestTrack && (std::fabs(minresx) < xResPitch) && (std::fabs(minresy) < yResPitch) && itkClosest!=-1)
+      selectedTk.push_back(itkClosest);
   }
 
   double extrapolateTrackAtDUTwithAngles(const tbeam::Track& track, double FEI4_z, double offset, double zDUT, double theta){
@@ -270,4 +265,30 @@ namespace Utility {
     xTkAtDUT.second = xTkAtDUT_d1;
     return xTkAtDUT;
   }
+
+  //Same formula as above on n tracks. The loops have no branches and the arrays do not alias,
+  //so they are vectorized when the file is built with SIMDFLAGS (see Makefile)
+  void extrapolateTracksAtDUTwithAngles(const double* __restrict__ xPos, const double* __restrict__ dxdz, unsigned int nTk,
+                                        double FEI4_z, double offset, double zDUT, double theta, double* __restrict__ xTkAtDUT){
+    const double dz = zDUT - FEI4_z;
+    const double c = cos(theta);
+    const double t = tan(theta);
+    for(unsigned int i = 0; i < nTk; i++)
+      xTkAtDUT[i] = (xPos[i] + dz*dxdz[i] + offset)/(c*(1. - dxdz[i]*t));
+  }
+
+  void extrapolateTracksAtDUTwithAngles(const double* __restrict__ xPos, const double* __restrict__ dxdz, unsigned int nTk,
+                                        double FEI4_z, double offset_d0, double zDUT_d0, double offset_d1, double zDUT_d1, double theta,
+                                        double* __restrict__ xTkAtDUT_d0, double* __restrict__ xTkAtDUT_d1){
+    const double dz0 = zDUT_d0 - FEI4_z;
+    const double dz1 = zDUT_d1 - FEI4_z;
+    const double c = cos(theta);
+    const double t = tan(theta);
+    for(unsigned int i = 0; i < nTk; i++) {
+      //the projection factor is shared by the two planes
+      const double inv = 1./(c*(1. - dxdz[i]*t));
+      xTkAtDUT_d0[i] = (xPos[i] + dz0*dxdz[i] + offset_d0)*inv;
+      xTkAtDUT_d1[i] = (xPos[i] + dz1*dxdz[i] + offset_d1)*inv;
+    }
+  }
 }
@@ -0,0 +1,120 @@
+/*!
+        \file                ZScanAccumulator.cc
+        \brief               Residual peaks of the DUT z scan from flat per-event columns
+*/
+#include "ZScanAccumulator.h"
+#include <cmath>
+#include <algorithm>
+
+namespace {
+  //coarse binning of the mode search, first window as the range of the old Pol1+Gaus fit
+  const double histMin = -10.;
+  const double histMax = 10.;
+  const double binWidth = 0.02;
+  const double firstWindow = 0.2;
+  const unsigned int minCore = 5;
+}
+
+ZScanAccumulator::ZScanAccumulator() :
+  fei4Z_(0.),
+  zMin_(0.),
+  zStep_(1.),
+  nSteps_(0)
+{
+}
+
+void ZScanAccumulator::setScan(double fei4Z, double zMin, double zStep, int nSteps) {
+  fei4Z_ = fei4Z;
+  zMin_ = zMin;
+  zStep_ = zStep;
+  nSteps_ = nSteps;
+  clear();
+}
+
+void ZScanAccumulator::clear() {
+  res0_.clear();
+  dxdz_.clear();
+  steps_.clear();
+}
+
+void ZScanAccumulator::add(double xDUT, double xTk, double dxdz) {
+  res0_.push_back(xDUT - (xTk + (zMin_ - fei4Z_)*dxdz));
+  dxdz_.push_back(dxdz);
+}
+
+void ZScanAccumulator::residuals(double z, double offset, std::vector<double>& res) const {
+  const unsigned int n = res0_.size();
+  res.resize(n);
+  const double dz = z - zMin_;
+  const double* __restrict__ r0 = res0_.data();
+  const double* __restrict__ s = dxdz_.data();
+  double* __restrict__ r = res.data();
+  for(unsigned int i = 0; i < n; i++)
+    r[i] = r0[i] - dz*s[i] - offset;
+}
+
+AlignmentChi2::Peak ZScanAccumulator::findPeak(const std::vector<double>& res) const {
+  AlignmentChi2::Peak p{0., 0., 0, false};
+  const unsigned int nbins = static_cast<unsigned int>((histMax - histMin)/binWidth);
+  bins_.assign(nbins, 0);
+  for(auto r : res) {
+    if(r < histMin || r >= histMax)  continue;
+    bins_[static_cast<unsigned int>((r - histMin)/binWidth)]++;
+  }
+  unsigned int imax = std::max_element(bins_.begin(), bins_.end()) - bins_.begin();
+  if(bins_[imax] == 0)  return p;
+  double center = histMin + (imax + 0.5)*binWidth;
+  double window = firstWindow;
+  double sigma = 0.;
+  unsigned int n = 0;
+  //mean and rms in a window around the mode, the window shrinks to 3 sigma
+  for(int iter = 0; iter < 5; iter++) {
+    double sum = 0., sum2 = 0.;
+    n = 0;
+    for(auto r : res) {
+      double d = r - center;
+      if(std::fabs(d) < window) {
+        sum += d;
+        sum2 += d*d;
+        n++;
+      }
+    }
+    if(n < minCore)  return p;
+    double mean = sum/n;
+    sigma = std::sqrt(std::max(sum2/n - mean*mean, 0.));
+    center += mean;
+    if(std::fabs(mean) < 1e-6 || !(sigma > 0.))  break;
+    window = std::min(std::max(3.*sigma, binWidth), firstWindow);
+  }
+  if(!(sigma > 0.))  return p;
+  p.center = center;
+  p.sigma = sigma;
+  p.nCore = n;
+  p.valid = true;
+  return p;
+}
+
+const std::vector<ZScanAccumulator::Step>& ZScanAccumulator::scan() {
+  steps_.resize(nSteps_);
+  for(int iz = 0; iz < nSteps_; iz++) {
+    Step& st = steps_[iz];
+    st.z = z(iz);
+    residuals(st.z, 0., res_);
+    st.peak = findPeak(res_);
+    st.offsetErr = st.peak.valid ? st.peak.sigma/std::sqrt(double(st.peak.nCore)) : 0.;
+  }
+  return steps_;
+}
+
+double ZScanAccumulator::chi2(double z, double offset, double window, double resolution, unsigned int& nWindow) const {
+  residuals(z, offset, res_);
+  double chi2 = 0.;
+  nWindow = 0;
+  for(auto r : res_) {
+    if(std::fabs(r) < window) {
+      chi2 += (r/resolution)*(r/resolution);
+      nWindow++;
+    }
+  }
+  return chi2;
+}
@@ -0,0 +1,83 @@
+/*!
+        \file                alignmentDBTool.cc
+        \brief               Import of the text alignment file into the alignment DB, listing and lookup of its entries
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include "argvparser.h"
+#include "AlignmentDB.h"
+#include "AlignmentFile.h"
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using namespace CommandLineProcessing;
+
+int main(int argc, char** argv) {
+  ArgvParser cmd;
+  cmd.setIntroductoryDescription( "Alignment DB: import of text alignment files, listing and lookup by run and version" );
+  cmd.setHelpOption( "h", "help", "Print this help page" );
+  cmd.addErrorCode( 0, "Success" );
+  cmd.addErrorCode( 1, "Error" );
+  cmd.defineOption( "db", "Alignment DB file", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "import", "Text alignment file added to the DB, the lines of a run become new versions in their order", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "list", "List all the entries of the DB", ArgvParser::NoOptionAttribute);
+  cmd.defineOption( "run", "Print the alignment line of a run", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "version", "Version for --run. Default=latest", ArgvParser::OptionRequiresValue);
+
+  int result = cmd.parse( argc, argv );
+  if (result != ArgvParser::NoParserError)
+  {
+    cout << cmd.parseErrorDescription(result);
+    exit(1);
+  }
+  if( !cmd.foundOption( "db" ) ) {
+    cerr << "Error, no alignment DB given. Quitting" << endl;
+    exit(1);
+  }
+  std::string dbFile = cmd.optionValue( "db" );
+
+  if( cmd.foundOption( "import" ) ) {
+    int lockFd = AlignmentFile::lock(dbFile);
+    if(lockFd < 0)  return 1;
+    AlignmentDB db;
+    std::ifstream test(dbFile.c_str());
+    bool ok = !test || db.read(dbFile);
+    test.close();
+    int n = ok ? db.importText(cmd.optionValue( "import" )) : 0;
+    if(ok)  ok = db.write(dbFile);
+    AlignmentFile::unlock(lockFd);
+    if(!ok)  return 1;
+    cout << n << " lines of " << cmd.optionValue( "import" ) << " imported, " << db.size() << " entries in " << dbFile << endl;
+  }
+
+  if( cmd.foundOption( "list" ) ) {
+    AlignmentDB db;
+    if(!db.read(dbFile))  return 1;
+    for(const auto& e : db.entries()) {
+      tbeam::alignmentPars al;
+      AlignmentDB::toPars(e, al);
+      std::time_t t = static_cast<std::time_t>(e.time);
+      char date[32];
+      std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", std::localtime(&t));
+      cout << "version=" << e.version << " " << date << " " << AlignmentFile::line(e.run, al) << endl;
+    }
+  }
+
+  if( cmd.foundOption( "run" ) ) {
+    int run = atoi(cmd.optionValue( "run" ).c_str());
+    int version = ( cmd.foundOption( "version" ) ) ? atoi(cmd.optionValue( "version" ).c_str()) : AlignmentDB::kLatest;
+    tbeam::alignmentPars al;
+    int found = 0;
+    if(!AlignmentDB::lookup(dbFile, run, version, al, &found)) {
+      cerr << "Run " << run << " not found in " << dbFile << endl;
+      return 1;
+    }
+    cout << "version=" << found << " " << AlignmentFile::line(run, al) << endl;
+  }
+  return 0;
+}
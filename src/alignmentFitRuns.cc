@@ -0,0 +1,201 @@
+/*!
+        \file                alignmentFitRuns.cc
+        \brief               DUT alignment fits of many runs from their alignment samples, in parallel
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <limits>
+#include <glob.h>
+#include "RVersion.h"
+#include "TROOT.h"
+#include "TThread.h"
+#include "TMath.h"
+#include "argvparser.h"
+#include "AlignmentSample.h"
+#include "AlignmentFitter.h"
+#include "GlobalAlignmentFitter.h"
+#include "AlignmentFile.h"
+#include "AlignmentDB.h"
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using namespace CommandLineProcessing;
+
+namespace {
+  //comma separated list of files or glob patterns
+  std::vector<std::string> expandFiles(const std::string& list) {
+    std::vector<std::string> files;
+    std::stringstream ss(list);
+    std::string pattern;
+    while(std::getline(ss, pattern, ',')) {
+      if(pattern.empty())  continue;
+      glob_t g;
+      if(glob(pattern.c_str(), 0, nullptr, &g) == 0) {
+        for(size_t i = 0; i < g.gl_pathc; i++)  files.push_back(g.gl_pathv[i]);
+      } else cerr << "No file matches " << pattern << endl;
+      globfree(&g);
+    }
+    return files;
+  }
+}
+
+int main(int argc, char** argv) {
+  ArgvParser cmd;
+  cmd.setIntroductoryDescription( "DUT alignment of many runs from the samples written by alignmentReco(alignmentSampleFile=)" );
+  cmd.setHelpOption( "h", "help", "Print this help page" );
+  cmd.addErrorCode( 0, "Success" );
+  cmd.addErrorCode( 1, "Error" );
+  cmd.defineOption( "samples", "Alignment sample files, comma separated list of files or glob patterns", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "output", "Alignment file where the lines of the fitted runs are replaced", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "db", "Alignment DB where the results are added as new versions of the runs", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "nThreads", "Number of runs fitted in parallel. Default=number of cores", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "gridScan", "Start values from the grid scan of the fast chi2, as alignmentGridScan=1", ArgvParser::NoOptionAttribute);
+  cmd.defineOption( "global", "One fit of all the runs with zD0-fei4Z and deltaZ shared, offset_d0 and theta per run", ArgvParser::NoOptionAttribute);
+  cmd.defineOption( "runRange", "Only the samples of the runs <first>:<last>", ArgvParser::OptionRequiresValue);
+
+  int result = cmd.parse( argc, argv );
+  if (result != ArgvParser::NoParserError)
+  {
+    cout << cmd.parseErrorDescription(result);
+    exit(1);
+  }
+  if( !cmd.foundOption( "samples" ) || !cmd.foundOption( "output" ) ) {
+    cerr << "Error, --samples and --output are required. Quitting" << endl;
+    exit(1);
+  }
+  std::vector<std::string> files = expandFiles(cmd.optionValue( "samples" ));
+  if( files.empty() ) {
+    cerr << "Error, no alignment samples found. Quitting" << endl;
+    exit(1);
+  }
+  std::string output = cmd.optionValue( "output" );
+  int nThreads = ( cmd.foundOption( "nThreads" ) ) ? atoi(cmd.optionValue( "nThreads" ).c_str()) : std::thread::hardware_concurrency();
+  if(nThreads < 1)  nThreads = 1;
+  if(nThreads > int(files.size()))  nThreads = files.size();
+  bool gridScan = cmd.foundOption( "gridScan" );
+  bool global = cmd.foundOption( "global" );
+  int firstRun = 0, lastRun = std::numeric_limits<int>::max();
+  if( cmd.foundOption( "runRange" ) ) {
+    std::string range = cmd.optionValue( "runRange" );
+    std::string::size_type c = range.find(':');
+    if(c == std::string::npos) {
+      cerr << "Error, --runRange is <first>:<last>. Quitting" << endl;
+      exit(1);
+    }
+    firstRun = atoi(range.substr(0, c).c_str());
+    lastRun = atoi(range.substr(c+1).c_str());
+  }
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,6,0)
+  ROOT::EnableThreadSafety();
+#else
+  TThread::Initialize();
+#endif
+
+  std::vector<AlignmentFitter::Result> results(files.size());
+  std::vector<std::string> runLines(files.size());
+  std::vector<tbeam::alignmentPars> runPars(files.size());
+  //outside the run range
+  std::vector<char> skipped(files.size(), 0);
+  std::mutex printLock;
+  auto printResult = [&](const AlignmentFitter::Result& r) {
+    std::lock_guard<std::mutex> lock(printLock);
+    cout << "Run=" << r.run << " offset_d0=" << r.offsetD0 << " zDUT_d0=" << r.zD0 << " deltaZ=" << r.deltaZ
+         << " theta=" << r.theta*180./TMath::Pi() << " chi2=" << r.chi2 << " status=" << r.status
+         << " calls=" << r.nCalls << " time=" << std::setprecision(3) << r.time << "s" << std::setprecision(6) << endl;
+  };
+  auto t0 = std::chrono::steady_clock::now();
+  if(global) {
+    //the flat buffers of all the runs are kept for the whole fit, the per-run chi2s go on nThreads
+    GlobalAlignmentFitter fitter(nThreads, gridScan);
+    std::vector<unsigned int> index;
+    for(unsigned int i = 0; i < files.size(); i++) {
+      AlignmentSample sample;
+      if(!sample.read(files[i]))  continue;
+      if(sample.run < firstRun || sample.run > lastRun) {
+        skipped[i] = 1;
+        continue;
+      }
+      fitter.addRun(sample);
+      index.push_back(i);
+    }
+    if(fitter.nRuns() > 0) {
+      GlobalAlignmentFitter::Result g = fitter.fit();
+      cout << "Global fit of " << fitter.nRuns() << " runs: zD0-fei4Z=" << g.zFromFEI4 << " deltaZ=" << g.deltaZ
+           << " chi2=" << g.chi2 << " status=" << g.status << " calls=" << g.nCalls << " run chi2 evaluations=" << g.nRunEvals
+           << " time=" << std::setprecision(3) << g.time << "s" << std::setprecision(6) << endl;
+      for(unsigned int k = 0; k < index.size(); k++) {
+        unsigned int i = index[k];
+        results[i] = g.runs[k];
+        runPars[i] = fitter.parameters(k, g);
+        runLines[i] = AlignmentFile::line(results[i].run, runPars[i]);
+        printResult(results[i]);
+      }
+    }
+  } else {
+    //one fitter per thread, the runs are taken one by one from a shared index
+    std::atomic<unsigned int> next(0);
+    auto work = [&]() {
+      AlignmentFitter fitter(gridScan);
+      for(unsigned int i = next++; i < files.size(); i = next++) {
+        //the tracks of a run are only kept while it is fitted
+        AlignmentSample sample;
+        if(!sample.read(files[i]))  continue;
+        if(sample.run < firstRun || sample.run > lastRun) {
+          skipped[i] = 1;
+          continue;
+        }
+        results[i] = fitter.fit(sample);
+        runPars[i] = AlignmentFitter::parameters(sample, results[i]);
+        runLines[i] = AlignmentFile::line(results[i].run, runPars[i]);
+        printResult(results[i]);
+      }
+    };
+    std::vector<std::thread> threads;
+    for(int t = 0; t < nThreads; t++)  threads.push_back(std::thread(work));
+    for(auto& t : threads)  t.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  std::map<int, std::string> lines;
+  std::map<int, tbeam::alignmentPars> pars;
+  int nFailed = 0;
+  for(unsigned int i = 0; i < files.size(); i++) {
+    if(skipped[i])  continue;
+    if(runLines[i].empty()) {
+      nFailed++;
+      continue;
+    }
+    //written as alignmentReco does, whatever the status
+    if(results[i].status != 0)
+      cerr << "Run " << results[i].run << ": fit status " << results[i].status << endl;
+    if(lines.find(results[i].run) != lines.end())
+      cerr << "Run " << results[i].run << " appears twice, the sample " << files[i] << " is used" << endl;
+    lines[results[i].run] = runLines[i];
+    pars[results[i].run] = runPars[i];
+  }
+  cout << lines.size() << " runs fitted in " << seconds << " s on " << nThreads << " threads, "
+       << nFailed << " failed" << endl;
+  if(!lines.empty() && !AlignmentFile::update(output, lines)) {
+    cerr << "Error, " << output << " could not be written" << endl;
+    return 1;
+  }
+  if(cmd.foundOption( "db" ) && !pars.empty()) {
+    //one update of the DB for all the runs
+    std::string dbFile = cmd.optionValue( "db" );
+    if(!AlignmentDB::append(dbFile, pars))  return 1;
+    cout << pars.size() << " runs added to " << dbFile << endl;
+  }
+  return nFailed ? 1 : 0;
+}
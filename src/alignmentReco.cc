@@ -24,7 +24,10 @@ int main( int argc,char* argv[] ){
   r.readJob(jobfile);
   r.beginJob();
   std::cout << "Event Loop start" << std::endl;
-  r.eventLoop();
+  //with a runList in the job card the loop is repeated for every run
+  do {
+    r.eventLoop();
+  } while(r.nextRun());
   r.endJob();
   timer.Stop();
   cout << "Realtime/CpuTime = " << timer.RealTime() << "/" << timer.CpuTime() << endl;
@@ -0,0 +1,286 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "argvparser.h"
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using namespace CommandLineProcessing;
+
+//Batch driver: runs the telescope, alignment and baseline steps of many runs on a
+//local pool of processes. The steps of one run are chained (telescope, then
+//alignment, then baseline), different runs go in parallel.
+namespace {
+  enum Stage { kTelescope = 0, kAlignment, kBaseline, kNStages };
+  const char* stageName[kNStages] = {"telescope", "alignment", "baseline"};
+  const char* stageExe[kNStages] = {"telescopeAna", "alignmentReco", "baselineReco"};
+  enum Status { kPending = 0, kRunning, kDone, kFailed, kSkipped };
+
+  typedef std::chrono::steady_clock Clock;
+
+  struct BatchJob {
+    int run;
+    int stage;
+    std::string jobCard;
+    std::string logFile;
+    int status;
+    pid_t pid;
+    Clock::time_point start;
+    double seconds;
+    long nEvents;
+  };
+
+  int stageFromName(const std::string& s) {
+    for(int i = 0; i < kNStages; i++)
+      if(s.find(stageName[i]) != std::string::npos)  return i;
+    return -1;
+  }
+
+  //reads Run= and the optional analysis= key of a job card
+  bool readJobCard(const std::string& card, int& run, int& stage) {
+    std::ifstream f(card.c_str());
+    if(!f)  return false;
+    std::string line;
+    while(std::getline(f,line)) {
+      if (line.substr(0,1) == "#" || line.substr(0,2) == "//") continue;
+      std::string::size_type eq = line.find('=');
+      if(eq == std::string::npos)  continue;
+      std::string key = line.substr(0, eq);
+      std::string value = line.substr(eq+1);
+      if(key == "Run")  run = atoi(value.c_str());
+      else if(key == "analysis")  stage = stageFromName(value);
+    }
+    return true;
+  }
+
+  void addJob(std::vector<BatchJob>& jobs, int run, int stage, const std::string& card) {
+    BatchJob j;
+    j.run = run;
+    j.stage = stage;
+    j.jobCard = card;
+    //one log per run and step, a job card may be shared by several steps or runs
+    j.logFile = card + "_Run" + std::to_string(run) + "." + stageName[stage] + ".log";
+    j.status = kPending;
+    j.pid = -1;
+    j.seconds = 0.;
+    j.nEvents = 0;
+    jobs.push_back(j);
+  }
+
+  //job cards of a directory; the step is taken from analysis= or else from the file name
+  void readJobDirectory(const std::string& dir, std::vector<BatchJob>& jobs) {
+    DIR* d = opendir(dir.c_str());
+    if(!d) {
+      cerr << "Directory " << dir << " could not be opened!" << endl;
+      return;
+    }
+    std::vector<std::string> cards;
+    while(struct dirent* e = readdir(d)) {
+      std::string n = e->d_name;
+      if(n.size() > 4 && n.compare(n.size() - 4, 4, ".job") == 0)  cards.push_back(dir + "/" + n);
+    }
+    closedir(d);
+    std::sort(cards.begin(), cards.end());
+    for(auto& c : cards) {
+      int run = -1;
+      int stage = -1;
+      readJobCard(c, run, stage);
+      if(stage < 0)  stage = stageFromName(c.substr(c.rfind('/')+1));
+      if(run < 0 || stage < 0) {
+        cerr << "Job card " << c << " has no Run or no analysis step, skipped!" << endl;
+        continue;
+      }
+      addJob(jobs, run, stage, c);
+    }
+  }
+
+  //manifest lines: <Run> <telescope|alignment|baseline> <jobcard>
+  void readManifest(const std::string& mfile, std::vector<BatchJob>& jobs) {
+    std::ifstream f(mfile.c_str());
+    if(!f) {
+      cerr << "Manifest " << mfile << " could not be opened!" << endl;
+      return;
+    }
+    std::string line;
+    while(std::getline(f,line)) {
+      if (line.empty() || line.substr(0,1) == "#" || line.substr(0,2) == "//") continue;
+      std::istringstream is(line);
+      int run;
+      std::string step, card;
+      if(!(is >> run >> step >> card) || stageFromName(step) < 0) {
+        cerr << "Manifest line <" << line << "> not understood, skipped!" << endl;
+        continue;
+      }
+      addJob(jobs, run, stageFromName(step), card);
+    }
+  }
+
+  //a job can start once the earlier steps of its run are done
+  int dependencyStatus(const std::vector<BatchJob>& jobs, const BatchJob& j) {
+    for(auto& o : jobs) {
+      if(o.run != j.run || o.stage >= j.stage)  continue;
+      if(o.status == kFailed || o.status == kSkipped)  return kFailed;
+      if(o.status != kDone)  return kPending;
+    }
+    return kDone;
+  }
+
+  pid_t launch(const std::string& binDir, BatchJob& j) {
+    pid_t pid = fork();
+    if(pid == 0) {
+      int fd = open(j.logFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if(fd >= 0) {
+        dup2(fd, 1);
+        dup2(fd, 2);
+        close(fd);
+      }
+      std::string exe = binDir + "/" + stageExe[j.stage];
+      execl(exe.c_str(), exe.c_str(), j.jobCard.c_str(), (char*)nullptr);
+      _exit(127);
+    }
+    return pid;
+  }
+
+  long eventsFromLog(const std::string& log) {
+    std::ifstream f(log.c_str());
+    std::string line;
+    while(std::getline(f,line)) {
+      std::string::size_type p = line.find("#Events=");
+      if(p != std::string::npos)  return atol(line.c_str() + p + 8);
+    }
+    return 0;
+  }
+}
+
+int main( int argc,char* argv[] ){
+
+  ArgvParser cmd;
+  cmd.setIntroductoryDescription( "Batch reprocessing of test beam runs on a local process pool" );
+  cmd.setHelpOption( "h", "help", "Print this help page" );
+  cmd.addErrorCode( 0, "Success" );
+  cmd.addErrorCode( 1, "Error" );
+  cmd.defineOption( "jobDir", "Directory with the job cards(*.job)", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "manifest", "Campaign manifest, lines of <Run> <telescope|alignment|baseline> <jobcard>", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "nProc", "Number of parallel processes. Default=number of cores", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "binDir", "Directory of the executables. Default=.", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "summary", "File where the summary is written. Default=batchSummary.txt", ArgvParser::OptionRequiresValue);
+
+  int result = cmd.parse( argc, argv );
+  if (result != ArgvParser::NoParserError)
+  {
+    cout << cmd.parseErrorDescription(result);
+    exit(1);
+  }
+
+  std::vector<BatchJob> jobs;
+  if( cmd.foundOption( "jobDir" ) )  readJobDirectory(cmd.optionValue( "jobDir" ), jobs);
+  if( cmd.foundOption( "manifest" ) )  readManifest(cmd.optionValue( "manifest" ), jobs);
+  if( jobs.empty() ) {
+    std::cerr << "Error, no jobs found. Quitting" << std::endl;
+    exit( 1 );
+  }
+  int nProc = ( cmd.foundOption( "nProc" ) ) ? atoi(cmd.optionValue( "nProc" ).c_str()) : std::thread::hardware_concurrency();
+  if(nProc < 1)  nProc = 1;
+  std::string binDir = ( cmd.foundOption( "binDir" ) ) ? cmd.optionValue( "binDir" ) : ".";
+  std::string summaryFile = ( cmd.foundOption( "summary" ) ) ? cmd.optionValue( "summary" ) : "batchSummary.txt";
+
+  //keep the order run by run and step by step
+  std::stable_sort(jobs.begin(), jobs.end(), [](const BatchJob& a, const BatchJob& b) {
+    return a.run != b.run ? a.run < b.run : a.stage < b.stage;
+  });
+  cout << jobs.size() << " jobs on " << nProc << " processes" << endl;
+
+  Clock::time_point tStart = Clock::now();
+  int nRunning = 0;
+  unsigned int nFinished = 0;
+  while(nFinished < jobs.size()) {
+    //start what is ready
+    for(auto& j : jobs) {
+      if(nRunning >= nProc)  break;
+      if(j.status != kPending)  continue;
+      int dep = dependencyStatus(jobs, j);
+      if(dep == kPending)  continue;
+      if(dep == kFailed) {
+        j.status = kSkipped;
+        nFinished++;
+        cout << "[" << nFinished << "/" << jobs.size() << "] Run " << j.run << " " << stageName[j.stage]
+             << " skipped, an earlier step failed" << endl;
+        continue;
+      }
+      j.pid = launch(binDir, j);
+      if(j.pid < 0) {
+        cerr << "fork failed for " << j.jobCard << endl;
+        j.status = kFailed;
+        nFinished++;
+        continue;
+      }
+      j.status = kRunning;
+      j.start = Clock::now();
+      nRunning++;
+    }
+    if(nRunning == 0)  continue;
+    //wait for one to finish
+    int wstatus = 0;
+    pid_t pid = waitpid(-1, &wstatus, 0);
+    if(pid < 0)  break;
+    for(auto& j : jobs) {
+      if(j.pid != pid || j.status != kRunning)  continue;
+      j.seconds = std::chrono::duration<double>(Clock::now() - j.start).count();
+      j.status = (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0) ? kDone : kFailed;
+      j.nEvents = eventsFromLog(j.logFile);
+      nRunning--;
+      nFinished++;
+      double elapsed = std::chrono::duration<double>(Clock::now() - tStart).count();
+      cout << "[" << nFinished << "/" << jobs.size() << "] Run " << j.run << " " << stageName[j.stage]
+           << (j.status == kDone ? " done" : " FAILED") << " in " << std::fixed << std::setprecision(1) << j.seconds << " s"
+           << ", " << j.nEvents << " events, elapsed " << elapsed << " s" << endl;
+      break;
+    }
+  }
+
+  //summary
+  double wall = std::chrono::duration<double>(Clock::now() - tStart).count();
+  std::ostringstream sum;
+  sum << "Batch summary: " << jobs.size() << " jobs, " << nProc << " processes, wall time " << std::fixed << std::setprecision(1) << wall << " s\n";
+  sum << std::setw(10) << "step" << std::setw(8) << "done" << std::setw(8) << "failed" << std::setw(8) << "skipped"
+      << std::setw(12) << "time(s)" << std::setw(12) << "events" << std::setw(12) << "events/s\n";
+  double busy = 0.;
+  for(int s = 0; s < kNStages; s++) {
+    int n[kSkipped+1] = {0, 0, 0, 0, 0};
+    double t = 0.;
+    long ev = 0;
+    for(auto& j : jobs) {
+      if(j.stage != s)  continue;
+      n[j.status]++;
+      t += j.seconds;
+      ev += j.nEvents;
+    }
+    busy += t;
+    sum << std::setw(10) << stageName[s] << std::setw(8) << n[kDone] << std::setw(8) << n[kFailed] << std::setw(8) << n[kSkipped]
+        << std::setw(12) << t << std::setw(12) << ev << std::setw(11) << (t > 0. ? ev/t : 0.) << "\n";
+  }
+  sum << "Pool occupancy: " << (wall > 0. ? 100.*busy/(wall*nProc) : 0.) << "%\n";
+  for(auto& j : jobs)
+    if(j.status == kFailed)  sum << "Failed: Run " << j.run << " " << stageName[j.stage] << " " << j.jobCard << " (log " << j.logFile << ")\n";
+  cout << sum.str();
+  std::ofstream sf(summaryFile.c_str());
+  if(sf)  sf << sum.str();
+  else  cerr << "Summary file " << summaryFile << " could not be opened!" << endl;
+
+  for(auto& j : jobs)
+    if(j.status != kDone)  return 1;
+  return 0;
+}
@@ -0,0 +1,290 @@
+/*!
+        \file                beamBench.cc
+        \brief               Throughput benchmark of the analyses on synthetic runs of 1e4 to 1e7
+                             events, with a check of the fitted alignment against the truth
+*/
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "argvparser.h"
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using namespace CommandLineProcessing;
+
+//For every size: eventGenerator writes a run with a known alignment and channel mask,
+//then each analysis step runs on it as a separate process. The wall time, events/s and
+//peak RSS of every process are recorded, and the alignment written by alignmentReco is
+//compared with the truth.
+namespace {
+  typedef std::chrono::steady_clock Clock;
+
+  struct StepResult {
+    long nEvents;
+    std::string step;
+    bool ok;
+    double seconds;
+    double rssMB;
+  };
+
+  struct AlignCheck {
+    long nEvents;
+    std::string par;
+    double truth;
+    double fitted;
+    double tol;
+    bool ok;
+  };
+
+  void tokenize(const std::string& s, std::vector<std::string>& tokens, char sep) {
+    std::istringstream is(s);
+    std::string t;
+    while(std::getline(is, t, sep))
+      if(!t.empty())  tokens.push_back(t);
+  }
+
+  //runs exe with args, output to log; returns false if it could not run or did not exit with 0
+  bool runProcess(const std::vector<std::string>& args, const std::string& logFile, StepResult& r) {
+    Clock::time_point t0 = Clock::now();
+    pid_t pid = fork();
+    if(pid == 0) {
+      int fd = open(logFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if(fd >= 0) {
+        dup2(fd, 1);
+        dup2(fd, 2);
+        close(fd);
+      }
+      std::vector<char*> argv;
+      for(auto& a : args)  argv.push_back(const_cast<char*>(a.c_str()));
+      argv.push_back(nullptr);
+      execv(argv[0], argv.data());
+      _exit(127);
+    }
+    if(pid < 0)  return false;
+    int status = 0;
+    struct rusage ru;
+    if(wait4(pid, &status, 0, &ru) < 0)  return false;
+    r.seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+    r.rssMB = ru.ru_maxrss/1024.;//kB on Linux
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+
+  //key=value pairs of the line of run in an alignment file
+  bool readAlignment(const std::string& fname, int run, std::map<std::string,double>& pars) {
+    std::ifstream f(fname.c_str());
+    std::string line;
+    while(std::getline(f, line)) {
+      std::vector<std::string> tokens;
+      tokenize(line, tokens, ':');
+      if(tokens.empty() || tokens[0] != "Run=" + std::to_string(run))  continue;
+      pars.clear();
+      for(auto& t : tokens) {
+        std::string::size_type eq = t.find('=');
+        if(eq != std::string::npos)  pars[t.substr(0, eq)] = atof(t.substr(eq+1).c_str());
+      }
+    }
+    return !pars.empty();
+  }
+
+  //FEI4 matching counts printed by skimReco
+  bool readFei4Matching(const std::string& log, double& nHit, double& nMatched) {
+    std::ifstream f(log.c_str());
+    std::string line;
+    const std::string key = "#Events with 1 FEI4 hit=";
+    const std::string keyMatched = " with a FEI4 matched track=";
+    while(std::getline(f, line)) {
+      std::string::size_type p = line.find(key);
+      std::string::size_type pm = line.find(keyMatched);
+      if(p == std::string::npos || pm == std::string::npos)  continue;
+      nHit = atof(line.c_str() + p + key.size());
+      nMatched = atof(line.c_str() + pm + keyMatched.size());
+      return true;
+    }
+    return false;
+  }
+
+  bool writeJobCard(const std::string& card, int run, const std::string& inFile, const std::string& outFile,
+                    bool readAlignmentFromfile, const std::string& alignFile, const std::string& maskFile, int nThreads) {
+    std::ofstream f(card.c_str());
+    if(!f)  return false;
+    //no empty lines, readJob expects key=value on every line
+    f << "#written by beamBench" << "\n"
+      << "Run=" << run << "\n"
+      << "inputFile=" << inFile << "\n"
+      << "outputFile=" << outFile << "\n"
+      << "fei4Z=724" << "\n"
+      << "readAlignmentFromfile=" << readAlignmentFromfile << "\n"
+      << "alignmentOutputFile=" << alignFile << "\n"
+      << "isProductionmode=0" << "\n"
+      << "doTelescopeMatching=1" << "\n"
+      << "doChannelMasking=1" << "\n"
+      << "channelMaskFile=" << maskFile << "\n"
+      << "residualSigmaDUT=0.026" << "\n"
+      << "nStrips=254" << "\n"
+      << "pitchDUT=0.09" << "\n"
+      << "nThreads=" << nThreads << endl;
+    return true;
+  }
+}
+
+int main( int argc,char* argv[] ){
+
+  ArgvParser cmd;
+  cmd.setIntroductoryDescription( "Throughput benchmark of the analyses on synthetic runs" );
+  cmd.setHelpOption( "h", "help", "Print this help page" );
+  cmd.addErrorCode( 0, "Success" );
+  cmd.addErrorCode( 1, "Error" );
+  cmd.defineOption( "sizes", "Comma separated numbers of events. Default=1e4,1e5,1e6,1e7", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "steps", "Comma separated steps out of alignment,baseline,telescope,deltaCluster,skim. Default=all", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "workDir", "Directory of the generated runs, job cards and logs. Default=bench", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "binDir", "Directory of the executables. Default=.", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "nThreads", "nThreads of the job cards. Default=1", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "seed", "Seed of the generator. Default=1", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "keep", "Keep the generated trees and the outputs. Default=removed after each size", ArgvParser::NoOptionAttribute);
+  cmd.defineOption( "tolOffset", "Tolerance on the fitted x offsets(mm). Default=0.02", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "tolZ", "Tolerance on the fitted zD0(mm). Default=10", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "tolDeltaZ", "Tolerance on the fitted deltaZ(mm). Default=0.3", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "tolAngle", "Tolerance on the fitted angle(deg). Default=0.5", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "minMatchFraction", "Minimum fraction of the skim events with 1 FEI4 hit that have a FEI4 matched track. Default=0.98", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "summary", "File where the summary is written. Default=benchSummary.txt", ArgvParser::OptionRequiresValue);
+
+  int result = cmd.parse( argc, argv );
+  if (result != ArgvParser::NoParserError)
+  {
+    cout << cmd.parseErrorDescription(result);
+    exit(1);
+  }
+
+  std::vector<std::string> sizeTokens, steps;
+  tokenize(( cmd.foundOption( "sizes" ) ) ? cmd.optionValue( "sizes" ) : "1e4,1e5,1e6,1e7", sizeTokens, ',');
+  tokenize(( cmd.foundOption( "steps" ) ) ? cmd.optionValue( "steps" ) : "alignment,baseline,telescope,deltaCluster,skim", steps, ',');
+  std::string workDir = ( cmd.foundOption( "workDir" ) ) ? cmd.optionValue( "workDir" ) : "bench";
+  std::string binDir = ( cmd.foundOption( "binDir" ) ) ? cmd.optionValue( "binDir" ) : ".";
+  int nThreads = ( cmd.foundOption( "nThreads" ) ) ? atoi(cmd.optionValue( "nThreads" ).c_str()) : 1;
+  std::string seed = ( cmd.foundOption( "seed" ) ) ? cmd.optionValue( "seed" ) : "1";
+  bool keep = cmd.foundOption( "keep" );
+  std::string summaryFile = ( cmd.foundOption( "summary" ) ) ? cmd.optionValue( "summary" ) : "benchSummary.txt";
+  std::map<std::string,double> tol;
+  tol["offsetFEI4X"] = tol["offsetFEI4Y"] = tol["offsetD0"] = ( cmd.foundOption( "tolOffset" ) ) ? atof(cmd.optionValue( "tolOffset" ).c_str()) : 0.02;
+  tol["zD0"] = ( cmd.foundOption( "tolZ" ) ) ? atof(cmd.optionValue( "tolZ" ).c_str()) : 10.;
+  tol["deltaZ"] = ( cmd.foundOption( "tolDeltaZ" ) ) ? atof(cmd.optionValue( "tolDeltaZ" ).c_str()) : 0.3;
+  tol["angle"] = ( cmd.foundOption( "tolAngle" ) ) ? atof(cmd.optionValue( "tolAngle" ).c_str()) : 0.5;
+  double minMatchFraction = ( cmd.foundOption( "minMatchFraction" ) ) ? atof(cmd.optionValue( "minMatchFraction" ).c_str()) : 0.98;
+  mkdir(workDir.c_str(), 0755);
+
+  std::vector<StepResult> results;
+  std::vector<AlignCheck> checks;
+  for(unsigned int is = 0; is < sizeTokens.size(); is++) {
+    long nEvents = static_cast<long>(atof(sizeTokens[is].c_str()));
+    const int run = 9000 + is;
+    const std::string tag = workDir + "/bench_" + std::to_string(nEvents);
+    const std::string tree = tag + ".root";
+    const std::string truthFile = tag + "_truthAlignment.txt";
+    const std::string maskFile = tag + "_channelMask.txt";
+    const std::string alignFile = tag + "_alignment.txt";
+    std::vector<std::string> outputs(1, tree);
+
+    StepResult gen{nEvents, "generate", false, 0., 0.};
+    gen.ok = runProcess({binDir + "/eventGenerator", "--oFile", tree, "--nEvents", std::to_string(nEvents),
+                         "--run", std::to_string(run), "--seed", seed, "--alignFile", truthFile, "--maskFile", maskFile},
+                        tag + "_generate.log", gen);
+    results.push_back(gen);
+    cout << "Generated " << nEvents << " events in " << gen.seconds << " s" << (gen.ok ? "" : " FAILED") << endl;
+    if(!gen.ok)  continue;
+
+    for(auto& step : steps) {
+      StepResult r{nEvents, step, false, 0., 0.};
+      const std::string card = tag + "_" + step + ".job";
+      const std::string out = tag + "_" + step + "_out.root";
+      outputs.push_back(out);
+      std::vector<std::string> args;
+      //the fit starts from nothing, the other steps read the truth alignment
+      bool fit = step == "alignment";
+      if(step == "alignment")  args.push_back(binDir + "/alignmentReco");
+      else if(step == "baseline")  args.push_back(binDir + "/baselineReco");
+      else if(step == "telescope")  args.push_back(binDir + "/telescopeAna");
+      else if(step == "skim")  args.push_back(binDir + "/skimReco");
+      else if(step == "deltaCluster") {
+        args = {binDir + "/deltaClusAnalysis", "--iFile", tree, "--oFile", out, "--nThreads", std::to_string(nThreads)};
+      } else {
+        cerr << "Unknown step " << step << ", skipped!" << endl;
+        continue;
+      }
+      if(args.size() == 1) {
+        if(!writeJobCard(card, run, tree, out, !fit, fit ? alignFile : truthFile, maskFile, nThreads)) {
+          cerr << "Job card " << card << " could not be written!" << endl;
+          continue;
+        }
+        args.push_back(card);
+      }
+      r.ok = runProcess(args, tag + "_" + step + ".log", r);
+      results.push_back(r);
+      cout << std::setw(10) << nEvents << std::setw(14) << step << std::setw(10) << std::fixed << std::setprecision(2)
+           << r.seconds << " s" << std::setw(12) << std::setprecision(0) << nEvents/std::max(r.seconds, 1e-9)
+           << " ev/s" << std::setw(10) << std::setprecision(1) << r.rssMB << " MB" << (r.ok ? "" : "  FAILED") << endl;
+      if(step == "skim" && r.ok) {
+        //every FEI4 hit of the generator comes from a track, so with the truth alignment all of them match
+        double nHit = 0., nMatched = 0.;
+        AlignCheck c{nEvents, "FEI4 match", 1., 0., 1. - minMatchFraction, false};
+        if(readFei4Matching(tag + "_skim.log", nHit, nMatched) && nHit > 0.) {
+          c.fitted = nMatched/nHit;
+          c.ok = c.fitted >= minMatchFraction;
+        } else cerr << "FEI4 matching counts not found in " << tag << "_skim.log" << endl;
+        checks.push_back(c);
+      }
+      if(!fit || !r.ok)  continue;
+
+      std::map<std::string,double> truth, fitted;
+      if(!readAlignment(truthFile, run, truth) || !readAlignment(alignFile, run, fitted)) {
+        cerr << "Alignment of run " << run << " not found in " << truthFile << " or " << alignFile << endl;
+        checks.push_back(AlignCheck{nEvents, "all", 0., 0., 0., false});
+        continue;
+      }
+      for(auto& t : tol) {
+        AlignCheck c{nEvents, t.first, truth[t.first], fitted[t.first], t.second, false};
+        c.ok = fitted.count(t.first) && std::fabs(c.fitted - c.truth) <= c.tol;
+        checks.push_back(c);
+      }
+    }
+    if(!keep)
+      for(auto& o : outputs)  unlink(o.c_str());
+  }
+
+  //summary
+  bool allOk = true;
+  std::ostringstream os;
+  os << std::setw(10) << "nEvents" << std::setw(14) << "step" << std::setw(12) << "time(s)"
+     << std::setw(14) << "events/s" << std::setw(14) << "peakRSS(MB)" << std::setw(8) << "status" << "\n";
+  for(auto& r : results) {
+    allOk = allOk && r.ok;
+    os << std::setw(10) << r.nEvents << std::setw(14) << r.step << std::setw(12) << std::fixed << std::setprecision(2) << r.seconds
+       << std::setw(14) << std::setprecision(0) << r.nEvents/std::max(r.seconds, 1e-9)
+       << std::setw(14) << std::setprecision(1) << r.rssMB << std::setw(8) << (r.ok ? "ok" : "FAILED") << "\n";
+  }
+  if(!checks.empty())
+    os << "\n" << std::setw(10) << "nEvents" << std::setw(14) << "parameter" << std::setw(12) << "truth"
+       << std::setw(12) << "fitted" << std::setw(12) << "tolerance" << std::setw(8) << "status" << "\n";
+  for(auto& c : checks) {
+    allOk = allOk && c.ok;
+    os << std::setw(10) << c.nEvents << std::setw(14) << c.par << std::setprecision(4) << std::setw(12) << c.truth
+       << std::setw(12) << c.fitted << std::setw(12) << c.tol << std::setw(8) << (c.ok ? "ok" : "FAILED") << "\n";
+  }
+  cout << "\n" << os.str() << endl;
+  std::ofstream sf(summaryFile.c_str());
+  if(sf)  sf << os.str();
+  else  cerr << "Summary file " << summaryFile << " could not be written!" << endl;
+  return allOk ? 0 : 1;
+}
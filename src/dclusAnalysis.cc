@@ -23,6 +23,7 @@ int main( int argc,char* argv[] ){
   cmd.defineOption( "oFile", "Output file name", ArgvParser::OptionRequiresValue);  
   cmd.defineOption( "telM", "Do telescope matching. Default=false", ArgvParser::NoOptionAttribute);  
   cmd.defineOption( "chMaskF", "Channel Mask file;Ch masking off by default", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "nThreads", "Number of event loop threads. Default=1", ArgvParser::OptionRequiresValue);
 
   int result = cmd.parse( argc, argv );
   if (result != ArgvParser::NoParserError)
@@ -47,6 +48,7 @@ int main( int argc,char* argv[] ){
   bool telmatch = ( cmd.foundOption( "telM" ) ) ? true : false;
   bool dochMask = ( cmd.foundOption( "chMaskF" ) ) ? true : false;
   std::string cMaskFilename = ( cmd.foundOption( "chMaskF" ) ) ? cmd.optionValue( "chMaskF" ) : "";
+  int nThreads = ( cmd.foundOption( "nThreads" ) ) ? atoi(cmd.optionValue( "nThreads" ).c_str()) : 1;
 
   //Let's roll
   TStopwatch timer;
@@ -54,6 +56,7 @@ int main( int argc,char* argv[] ){
   DeltaClusterAnalysis r(inFilename,outFilename);
   //r.setTelMatching(telmatch);
   //r.setChannelMasking(dochMask, cMaskFilename);
+  r.setNumberOfThreads(nThreads);
   std::cout << "Event Loop start" << std::endl;
   r.eventLoop();
   r.endJob();
@@ -0,0 +1,423 @@
+/*!
+        \file                eventGenerator.cc
+        \brief               Writes synthetic test beam events in the analysisTree format, with the
+                             truth alignment and the channel mask used, for tests and benchmarks
+*/
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <random>
+#include "TROOT.h"
+#include "TFile.h"
+#include "TTree.h"
+#include "TStopwatch.h"
+#include "DataFormats.h"
+#include "argvparser.h"
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using namespace CommandLineProcessing;
+
+namespace {
+  //FEI4 pixel centres, as in Fei4HitIndex
+  const double fei4X0 = 8.375;
+  const double fei4Y0 = 9.875;
+  const double fei4PitchX = 0.05;
+  const double fei4PitchY = 0.250;
+  const int fei4NRows = 336;
+  const int fei4NCols = 80;
+  //DUT channels per column, column 1 starts at 1016
+  const int nChColumn = 1016;
+
+  struct GenConfig {
+    unsigned int run;
+    //beam profile in the telescope frame(mm) and track slopes
+    double beamX, beamY, beamSigmaX, beamSigmaY, slopeSigma;
+    //mean number of telescope tracks per event(>=1, the trigger track is always there)
+    double meanTracks;
+    double dupFraction;
+    double trackRes;
+    //DUT
+    int nStrips;
+    double pitch;
+    double dutRes;
+    double dutEff;
+    double noise;//occupancy per channel
+    int nMasked;
+    double hotOccupancy;
+    int stubWindow;//strips
+    double badFraction;
+    //truth alignment
+    double fei4Z, zD0, offsetD0, deltaZ, angle, offsetFEI4X, offsetFEI4Y;
+  };
+
+  //objects pointed to by the dutEvent, reused from event to event
+  struct DutObjects {
+    std::deque<tbeam::cluster> clusters;
+    std::deque<tbeam::stub> stubs;
+    unsigned int nCls;
+    unsigned int nStubs;
+    tbeam::cluster* newCluster() {
+      if(nCls == clusters.size())  clusters.emplace_back();
+      return &clusters[nCls++];
+    }
+    tbeam::stub* newStub() {
+      if(nStubs == stubs.size())  stubs.emplace_back();
+      return &stubs[nStubs++];
+    }
+  };
+
+  //strip hit by the track on a DUT plane, same geometry as Utility::extrapolateTrackAtDUTwithAngles
+  double stripPosition(const GenConfig& c, double x, double dxdz, double offset, double zDUT) {
+    const double theta = TMath::Pi()*c.angle/180.;
+    double u = x + (zDUT - c.fei4Z)*dxdz;
+    u = (u + offset)/(cos(theta)*(1. - dxdz*tan(theta)));
+    return u/c.pitch + c.nStrips/2.;
+  }
+
+  //hot channels of a plane, inside column 0 and away from the edges of the CBCs
+  std::vector<int> hotChannels(std::mt19937& rng, const GenConfig& c) {
+    std::vector<int> hot;
+    std::uniform_int_distribution<int> ch(3, c.nStrips - 4);
+    while(static_cast<int>(hot.size()) < c.nMasked) {
+      int h = ch(rng);
+      if(std::find(hot.begin(), hot.end(), h) == hot.end())  hot.push_back(h);
+    }
+    std::sort(hot.begin(), hot.end());
+    return hot;
+  }
+
+  //channels to clusters of adjacent channels, column by column
+  void makeClusters(const std::vector<int>& ch, DutObjects& obj, std::vector<tbeam::cluster*>& cls) {
+    cls.clear();
+    for(unsigned int i = 0; i < ch.size(); ) {
+      unsigned int j = i;
+      while(j + 1 < ch.size() && ch[j+1] == ch[j] + 1 && ch[j+1] != nChColumn)  j++;
+      tbeam::cluster* c = obj.newCluster();
+      c->x = (ch[i] + ch[j])/2;
+      c->fx = 0.5*(ch[i] + ch[j]);
+      c->size = j - i + 1;
+      cls.push_back(c);
+      i = j + 1;
+    }
+  }
+
+  //stubs seeded on det1 with the closest det0 cluster within the window
+  void makeStubs(const GenConfig& c, const std::vector<tbeam::cluster*>& cls0, const std::vector<tbeam::cluster*>& cls1,
+                 DutObjects& obj, tbeam::dutEvent& ev) {
+    ev.stubs.clear();
+    ev.stubWord = 0;
+    ev.stubWordReco = 0;
+    for(auto s : cls1) {
+      tbeam::cluster* best = nullptr;
+      for(auto m : cls0) {
+        if((s->x >= nChColumn) != (m->x >= nChColumn))  continue;
+        int d = static_cast<int>(m->x) - static_cast<int>(s->x);
+        if(std::abs(d) > c.stubWindow)  continue;
+        if(!best || std::abs(d) < std::abs(static_cast<int>(best->x) - static_cast<int>(s->x)))  best = m;
+      }
+      if(!best)  continue;
+      tbeam::stub* st = obj.newStub();
+      *st->seeding = *s;
+      *st->matched = *best;
+      st->x = s->x;
+      st->fx = std::round(2.*s->fx)/2.;
+      st->direction = static_cast<int>(best->x) - static_cast<int>(s->x);
+      ev.stubs.push_back(st);
+      //one bit per CBC of 127 strips, bits 8-15 for column 1
+      int col = s->x >= nChColumn ? 1 : 0;
+      int cbc = 8*col + std::min((s->x - col*nChColumn)/127, 7);
+      ev.stubWordReco |= 1u << cbc;
+    }
+    ev.stubWord = ev.stubWordReco;
+  }
+
+  bool writeTruthAlignment(const std::string& fname, const GenConfig& c) {
+    std::ofstream f(fname.c_str());
+    if(!f)  return false;
+    //residualSigmaFEI4 is the track-FEI4 match window of Utility::cutTrackFei4Residuals,
+    //half a pixel plus twice the track resolution as TelescopeAnalysis writes it
+    const double sx = 0.5*fei4PitchX + 2.*c.trackRes;
+    const double sy = 0.5*fei4PitchY + 2.*c.trackRes;
+    f << "Run=" << c.run
+      << ":offsetFEI4X=" << c.offsetFEI4X
+      << ":offsetFEI4Y=" << c.offsetFEI4Y
+      << ":residualSigmaFEI4X=" << sx
+      << ":residualSigmaFEI4Y=" << sy
+      << ":zD0=" << c.zD0
+      << ":offsetD0=" << c.offsetD0
+      << ":deltaZ=" << c.deltaZ
+      << ":angle=" << c.angle << endl;
+    return true;
+  }
+
+  //format of BeamAnaBase::readChannelMaskData: <cbc>:<ch>,<ch>... with odd channels on det0
+  bool writeChannelMask(const std::string& fname, const std::vector<int> hot[2]) {
+    std::ofstream f(fname.c_str());
+    if(!f)  return false;
+    f << "#hot channels of eventGenerator" << endl;
+    for(int cbc = 0; cbc < 8; cbc++) {
+      std::vector<int> chs;
+      for(int d = 0; d < 2; d++)
+        for(auto h : hot[d])
+          if(h/127 == cbc)  chs.push_back(2*(h%127) + (d == 0 ? 1 : 0));
+      if(chs.empty())  continue;
+      f << cbc << ":";
+      for(unsigned int i = 0; i < chs.size(); i++)
+        f << (i ? "," : "") << chs[i];
+      f << endl;
+    }
+    return true;
+  }
+
+  double optionValue(ArgvParser& cmd, const char* name, double def) {
+    return cmd.foundOption(name) ? atof(cmd.optionValue(name).c_str()) : def;
+  }
+}
+
+int main( int argc,char* argv[] ){
+
+  ArgvParser cmd;
+  cmd.setIntroductoryDescription( "Synthetic test beam events in the analysisTree format" );
+  cmd.setHelpOption( "h", "help", "Print this help page" );
+  cmd.addErrorCode( 0, "Success" );
+  cmd.addErrorCode( 1, "Error" );
+  cmd.defineOption( "oFile", "Output file name", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "nEvents", "Number of events, 1e6 is accepted. Default=10000", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "run", "Run number. Default=1", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "seed", "Random seed. Default=1", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "alignFile", "File where the truth alignment is written(alignment file format). Default=truthAlignment.txt", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "maskFile", "File where the masked channels are written(channel mask format). Default=truthChannelMask.txt", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "beamX", "Beam centre along x in the telescope frame(mm). Default=centre of the FEI4", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "beamY", "Beam centre along y in the telescope frame(mm). Default=centre of the FEI4", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "beamSigmaX", "Beam width along x(mm). Default=4", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "beamSigmaY", "Beam width along y(mm). Default=4", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "slopeSigma", "Spread of the track slopes. Default=2e-3", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "meanTracks", "Mean number of telescope tracks per event(>=1). Default=1.5", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "dupFraction", "Fraction of tracks duplicated by the telescope. Default=0.05", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "angle", "DUT angle(deg). Default=-10", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "noise", "Noise occupancy per DUT channel. Default=1e-4", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "nMasked", "Hot channels per DUT plane, written to maskFile. Default=4", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "dutEff", "DUT hit efficiency. Default=0.99", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "fei4Z", "Truth FEI4 z(mm). Default=724", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "zD0", "Truth z of DUT plane 0(mm). Default=435", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "offsetD0", "Truth x offset of DUT plane 0(mm). Default=-0.75", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "deltaZ", "Truth distance of the DUT planes(mm). Default=2.7", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "offsetFEI4X", "Truth FEI4 x offset(mm). Default=-3.7", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "offsetFEI4Y", "Truth FEI4 y offset(mm). Default=-0.7", ArgvParser::OptionRequiresValue);
+
+  int result = cmd.parse( argc, argv );
+  if (result != ArgvParser::NoParserError)
+  {
+    cout << cmd.parseErrorDescription(result);
+    exit(1);
+  }
+
+  std::string outFilename = ( cmd.foundOption( "oFile" ) ) ? cmd.optionValue( "oFile" ) : "";
+  if ( outFilename.empty() ) {
+    std::cerr << "Error, no output filename provided. Quitting" << std::endl;
+    exit( 1 );
+  }
+  Long64_t nEvents = static_cast<Long64_t>(optionValue(cmd, "nEvents", 1e4));
+  unsigned int seed = static_cast<unsigned int>(optionValue(cmd, "seed", 1));
+  std::string alignFilename = ( cmd.foundOption( "alignFile" ) ) ? cmd.optionValue( "alignFile" ) : "truthAlignment.txt";
+  std::string maskFilename = ( cmd.foundOption( "maskFile" ) ) ? cmd.optionValue( "maskFile" ) : "truthChannelMask.txt";
+
+  GenConfig c;
+  c.run = static_cast<unsigned int>(optionValue(cmd, "run", 1));
+  c.beamSigmaX = optionValue(cmd, "beamSigmaX", 4.);
+  c.beamSigmaY = optionValue(cmd, "beamSigmaY", 4.);
+  c.slopeSigma = optionValue(cmd, "slopeSigma", 2e-3);
+  c.meanTracks = std::max(optionValue(cmd, "meanTracks", 1.5), 1.);
+  c.dupFraction = optionValue(cmd, "dupFraction", 0.05);
+  c.trackRes = 0.005;
+  c.nStrips = 254;
+  c.pitch = 0.09;
+  c.dutRes = 0.01;
+  c.dutEff = optionValue(cmd, "dutEff", 0.99);
+  c.noise = optionValue(cmd, "noise", 1e-4);
+  c.nMasked = static_cast<int>(optionValue(cmd, "nMasked", 4));
+  c.hotOccupancy = 0.3;
+  c.stubWindow = 7;
+  c.badFraction = 0.01;
+  c.fei4Z = optionValue(cmd, "fei4Z", 724.);
+  c.zD0 = optionValue(cmd, "zD0", 435.);
+  c.offsetD0 = optionValue(cmd, "offsetD0", -0.75);
+  c.deltaZ = optionValue(cmd, "deltaZ", 2.7);
+  c.angle = optionValue(cmd, "angle", -10.);
+  c.offsetFEI4X = optionValue(cmd, "offsetFEI4X", -3.7);
+  c.offsetFEI4Y = optionValue(cmd, "offsetFEI4Y", -0.7);
+  c.beamX = optionValue(cmd, "beamX", -c.offsetFEI4X);
+  c.beamY = optionValue(cmd, "beamY", -c.offsetFEI4Y);
+
+  std::mt19937 rng(seed);
+  std::normal_distribution<double> gaus(0., 1.);
+  std::uniform_real_distribution<double> flat(0., 1.);
+  std::poisson_distribution<int> extraTracks(c.meanTracks - 1.);
+  std::poisson_distribution<int> noiseHits(c.noise*2*nChColumn);
+  std::uniform_int_distribution<int> noiseCh(0, 2*nChColumn - 1);
+  std::uniform_int_distribution<int> tdc(0, 15);
+
+  std::vector<int> hot[2] = {hotChannels(rng, c), hotChannels(rng, c)};
+  if(!writeTruthAlignment(alignFilename, c) || !writeChannelMask(maskFilename, hot)) {
+    std::cerr << "Truth files " << alignFilename << ", " << maskFilename << " could not be written!" << std::endl;
+    exit( 1 );
+  }
+
+  TStopwatch timer;
+  timer.Start();
+  TFile* fout = TFile::Open(outFilename.c_str(), "RECREATE");
+  if(!fout) {
+    std::cerr << "File " << outFilename << " could not be opened!!" << std::endl;
+    exit( 1 );
+  }
+  TTree* tree = new TTree("analysisTree", "synthetic test beam events");
+  tbeam::dutEvent* dutEv = new tbeam::dutEvent();
+  tbeam::condEvent* condEv = new tbeam::condEvent();
+  tbeam::TelescopeEvent* telEv = new tbeam::TelescopeEvent();
+  tbeam::FeIFourEvent* fei4Ev = new tbeam::FeIFourEvent();
+  bool periodic = true;
+  bool good = true;
+  tree->Branch("DUT", &dutEv);
+  tree->Branch("Condition", &condEv);
+  tree->Branch("TelescopeEvent", &telEv);
+  tree->Branch("Fei4Event", &fei4Ev);
+  tree->Branch("periodicityFlag", &periodic, "periodicityFlag/O");
+  tree->Branch("goodEventFlag", &good, "goodEventFlag/O");
+
+  //run conditions: stub window 7, no offsets, cluster width 3
+  condEv->run = c.run;
+  condEv->HVsettings = 250;
+  condEv->DUTangle = static_cast<unsigned int>(std::fabs(c.angle));
+  condEv->window = c.stubWindow << 4;
+  condEv->cwd = 3 << 6;
+  condEv->vcth = 120;
+  condEv->condData = 0;
+
+  DutObjects obj;
+  std::vector<int> ch[2];
+  std::vector<tbeam::cluster*> cls[2];
+  const double z[2] = {c.zD0, c.zD0 + c.deltaZ*cos(TMath::Pi()*c.angle/180.)};
+  const double off[2] = {c.offsetD0, c.offsetD0 + sin(TMath::Pi()*c.angle/180.)*c.deltaZ};
+  cout << "#Events=" << nEvents << endl;
+  for(Long64_t jentry = 0; jentry < nEvents; jentry++) {
+    if (jentry%100000 == 0)
+      cout << " Events generated. " << std::setw(9) << jentry << endl;
+    condEv->event = jentry;
+    condEv->time = 25*jentry;
+    condEv->unixtime = 1463000000 + jentry/1000;
+    condEv->tdcPhase = tdc(rng);
+    good = flat(rng) >= c.badFraction;
+
+    //telescope: the trigger track, extra tracks over the telescope acceptance and duplicates
+    telEv->xPos->clear();
+    telEv->yPos->clear();
+    telEv->dxdz->clear();
+    telEv->dydz->clear();
+    telEv->trackNum->clear();
+    telEv->iden->clear();
+    telEv->chi2->clear();
+    telEv->ndof->clear();
+    int nTk = 1 + extraTracks(rng);
+    for(int i = 0; i < nTk; i++) {
+      double x = i == 0 ? c.beamX + c.beamSigmaX*gaus(rng) : -10. + 20.*flat(rng);
+      double y = i == 0 ? c.beamY + c.beamSigmaY*gaus(rng) : -12. + 24.*flat(rng);
+      telEv->xPos->push_back(x);
+      telEv->yPos->push_back(y);
+      telEv->dxdz->push_back(c.slopeSigma*gaus(rng));
+      telEv->dydz->push_back(c.slopeSigma*gaus(rng));
+      telEv->chi2->push_back(-8.*std::log(1. - flat(rng)));
+      telEv->ndof->push_back(8.);
+      if(flat(rng) < c.dupFraction) {
+        telEv->xPos->push_back(x + 2e-4*(flat(rng) - 0.5));
+        telEv->yPos->push_back(y + 2e-4*(flat(rng) - 0.5));
+        telEv->dxdz->push_back(telEv->dxdz->back());
+        telEv->dydz->push_back(telEv->dydz->back());
+        telEv->chi2->push_back(telEv->chi2->back() + 1.);
+        telEv->ndof->push_back(8.);
+      }
+    }
+    for(unsigned int i = 0; i < telEv->xPos->size(); i++) {
+      telEv->trackNum->push_back(i);
+      telEv->iden->push_back(0);
+    }
+    telEv->nTrackParams = telEv->xPos->size();
+    telEv->euEvt = jentry;
+
+    //FEI4: one pixel per track inside the chip, duplicates give no extra hit
+    fei4Ev->col->clear();
+    fei4Ev->row->clear();
+    fei4Ev->tot->clear();
+    fei4Ev->lv1->clear();
+    fei4Ev->iden->clear();
+    fei4Ev->hitTime->clear();
+    fei4Ev->frameTime->clear();
+    //DUT hits of the tracks on both planes, column 0
+    ch[0].clear();
+    ch[1].clear();
+    for(unsigned int i = 0; i < telEv->xPos->size(); i++) {
+      if(i > 0 && std::fabs(telEv->xPos->at(i) - telEv->xPos->at(i-1)) < 1e-3)  continue;
+      const double x = telEv->xPos->at(i);
+      const double y = telEv->yPos->at(i);
+      const double dxdz = telEv->dxdz->at(i);
+      int row = static_cast<int>(std::floor((fei4X0 - (x + c.offsetFEI4X + c.trackRes*gaus(rng)))/fei4PitchX + 0.5)) + 1;
+      int col = static_cast<int>(std::floor((fei4Y0 - (y + c.offsetFEI4Y + c.trackRes*gaus(rng)))/fei4PitchY + 0.5)) + 1;
+      if(row >= 1 && row <= fei4NRows && col >= 1 && col <= fei4NCols) {
+        fei4Ev->row->push_back(row);
+        fei4Ev->col->push_back(col);
+        fei4Ev->tot->push_back(1 + rng()%14);
+        fei4Ev->lv1->push_back(rng()%16);
+        fei4Ev->iden->push_back(0);
+        fei4Ev->hitTime->push_back(0);
+        fei4Ev->frameTime->push_back(0.);
+      }
+      for(int d = 0; d < 2; d++) {
+        if(flat(rng) >= c.dutEff)  continue;
+        double s = stripPosition(c, x, dxdz, off[d], z[d]) + c.dutRes/c.pitch*gaus(rng);
+        int strip = static_cast<int>(std::floor(s + 0.5));
+        if(strip < 0 || strip >= c.nStrips)  continue;
+        ch[d].push_back(strip);
+        //charge sharing close to the strip edge
+        double frac = s - strip;
+        if(std::fabs(frac) > 0.4 && strip + (frac > 0 ? 1 : -1) >= 0 && strip + (frac > 0 ? 1 : -1) < c.nStrips)
+          ch[d].push_back(strip + (frac > 0 ? 1 : -1));
+      }
+    }
+    fei4Ev->nPixHits = fei4Ev->row->size();
+    fei4Ev->euEvt = jentry;
+
+    //noise over both columns and the hot channels
+    for(int d = 0; d < 2; d++) {
+      int n = noiseHits(rng);
+      for(int i = 0; i < n; i++)  ch[d].push_back(noiseCh(rng));
+      for(auto h : hot[d])
+        if(flat(rng) < c.hotOccupancy)  ch[d].push_back(h);
+      std::sort(ch[d].begin(), ch[d].end());
+      ch[d].erase(std::unique(ch[d].begin(), ch[d].end()), ch[d].end());
+    }
+    obj.nCls = 0;
+    obj.nStubs = 0;
+    makeClusters(ch[0], obj, cls[0]);
+    makeClusters(ch[1], obj, cls[1]);
+    dutEv->dut_channel["det0"] = ch[0];
+    dutEv->dut_channel["det1"] = ch[1];
+    dutEv->clusters["det0"] = cls[0];
+    dutEv->clusters["det1"] = cls[1];
+    makeStubs(c, cls[0], cls[1], obj, *dutEv);
+    tree->Fill();
+  }
+  fout->cd();
+  tree->Write();
+  fout->Close();
+  timer.Stop();
+  cout << "Truth alignment: " << alignFilename << ", channel mask: " << maskFilename << endl;
+  cout << "Realtime/CpuTime = " << timer.RealTime() << "/" << timer.CpuTime() << endl;
+  return 0;
+}
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <iomanip>
+#include "TROOT.h"
+#include "TFile.h"
+#include "TTree.h"
+#include "TStopwatch.h"
+#include "DataFormats.h"
+#include "argvparser.h"
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using namespace CommandLineProcessing;
+
+//Copies analysisTree replacing the DUT branch (tbeam::dutEvent) by the flat
+//DUTFlat branch (tbeam::dutFlatEvent). All the other branches are kept as they are.
+int main( int argc,char* argv[] ){
+
+  ArgvParser cmd;
+  cmd.setIntroductoryDescription( "Convert the DUT content of an analysis tree to the flat format" );
+  cmd.setHelpOption( "h", "help", "Print this help page" );
+  cmd.addErrorCode( 0, "Success" );
+  cmd.addErrorCode( 1, "Error" );
+  cmd.defineOption( "iFile", "Input Tree name", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "oFile", "Output file name", ArgvParser::OptionRequiresValue);
+
+  int result = cmd.parse( argc, argv );
+  if (result != ArgvParser::NoParserError)
+  {
+    cout << cmd.parseErrorDescription(result);
+    exit(1);
+  }
+
+  std::string inFilename = ( cmd.foundOption( "iFile" ) ) ? cmd.optionValue( "iFile" ) : "";
+  if ( inFilename.empty() ) {
+    std::cerr << "Error, no input file provided. Quitting" << std::endl;
+    exit( 1 );
+  }
+
+  std::string outFilename = ( cmd.foundOption( "oFile" ) ) ? cmd.optionValue( "oFile" ) : "";
+  if ( outFilename.empty() ) {
+    std::cerr << "Error, no output filename provided. Quitting" << std::endl;
+    exit( 1 );
+  }
+
+  TStopwatch timer;
+  timer.Start();
+  TFile* fin = TFile::Open(inFilename.c_str());
+  if(!fin) {
+    std::cerr << "File " << inFilename << " could not be opened!!" << std::endl;
+    exit( 1 );
+  }
+  TTree* tin = dynamic_cast<TTree*>(fin->Get("analysisTree"));
+  if(!tin || !tin->GetBranch("DUT")) {
+    std::cerr << "No analysisTree with a DUT branch in " << inFilename << std::endl;
+    exit( 1 );
+  }
+  tbeam::dutEvent* dutEv = new tbeam::dutEvent();
+  tin->SetBranchAddress("DUT", &dutEv);
+
+  TFile* fout = TFile::Open(outFilename.c_str(), "RECREATE");
+  if(!fout) {
+    std::cerr << "File " << outFilename << " could not be opened!!" << std::endl;
+    exit( 1 );
+  }
+  //clone all the branches but DUT, which is read separately
+  tin->SetBranchStatus("DUT*", 0);
+  TTree* tout = tin->CloneTree(0);
+  tin->SetBranchStatus("DUT*", 1);
+  tbeam::dutFlatEvent* flatEv = new tbeam::dutFlatEvent();
+  tout->Branch("DUTFlat", &flatEv);
+
+  Long64_t nEntries = tin->GetEntries();
+  cout << "#Events=" << nEntries << endl;
+  for(Long64_t jentry = 0; jentry < nEntries; jentry++) {
+    if(tin->GetEntry(jentry) < 0)  break;
+    if (jentry%1000 == 0)
+      cout << " Events processed. " << std::setw(8) << jentry << endl;
+    flatEv->fill(*dutEv);
+    tout->Fill();
+  }
+  fout->cd();
+  tout->Write();
+  fout->Close();
+  fin->Close();
+  timer.Stop();
+  cout << "Realtime/CpuTime = " << timer.RealTime() << "/" << timer.CpuTime() << endl;
+  return 0;
+}
@@ -0,0 +1,169 @@
+/*!
+        \file                trackDuplicateBench.cc
+        \brief               Checks and times the telescope track duplicate removal on synthetic
+                             events with 1 to 200 tracks
+*/
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include "DataFormats.h"
+#include "Utility.h"
+#include "TrackDuplicateFilter.h"
+#include "argvparser.h"
+using std::cout;
+using std::cerr;
+using std::endl;
+
+using namespace CommandLineProcessing;
+
+namespace {
+  typedef std::chrono::steady_clock Clock;
+
+  //the pairwise loop Utility::removeTrackDuplicates had before the grid, kept as the reference
+  void removeTrackDuplicatesPairwise(const tbeam::TelescopeEvent *telEv, std::vector<tbeam::Track>& tkNoOverlap) {
+    for(unsigned int i = 0; i<telEv->xPos->size(); i++) {
+      double tkX = telEv->xPos->at(i);
+      double tkY = telEv->yPos->at(i);
+      bool isduplicate = false;
+      for (unsigned int j = i+1; j<telEv->xPos->size(); j++) {
+        double tkX_j = telEv->xPos->at(j);
+        double tkY_j = telEv->yPos->at(j);
+        if (fabs(tkY-tkY_j)<0.001 && fabs(tkX-tkX_j)<0.001) isduplicate = true;
+      }
+      if (!isduplicate) {
+        tbeam::Track t(i,tkX,tkY,telEv->dxdz->at(i),telEv->dydz->at(i),telEv->chi2->at(i),telEv->ndof->at(i));  
+        tkNoOverlap.push_back(t);
+      }      
+    }
+  }
+
+  //tracks over the telescope acceptance; a fraction are copies of an earlier track shifted by
+  //less or a bit more than the tolerance, or sitting on the cell boundaries of the grid
+  void generateEvent(std::mt19937& rng, unsigned int nTk, double dupFraction, tbeam::TelescopeEvent& ev) {
+    std::uniform_real_distribution<double> posX(-10., 10.), posY(-12., 12.), slope(-3e-3, 3e-3), flat(0., 1.);
+    std::uniform_real_distribution<double> shift(-0.0015, 0.0015);
+    ev.xPos->clear();
+    ev.yPos->clear();
+    ev.dxdz->clear();
+    ev.dydz->clear();
+    ev.chi2->clear();
+    ev.ndof->clear();
+    for(unsigned int i = 0; i < nTk; i++) {
+      double x = posX(rng), y = posY(rng);
+      double r = flat(rng);
+      if(i > 0 && r < dupFraction) {
+        unsigned int j = rng() % i;
+        x = ev.xPos->at(j) + (flat(rng) < 0.3 ? 0. : shift(rng));
+        y = ev.yPos->at(j) + (flat(rng) < 0.3 ? 0. : shift(rng));
+      } else if(r < dupFraction + 0.05) {
+        x = std::round(x/0.002)*0.002;
+        y = std::round(y/0.002)*0.002 - 0.0005;
+      }
+      ev.xPos->push_back(x);
+      ev.yPos->push_back(y);
+      ev.dxdz->push_back(slope(rng));
+      ev.dydz->push_back(slope(rng));
+      ev.chi2->push_back(10.*flat(rng));
+      ev.ndof->push_back(8.);
+    }
+    ev.nTrackParams = nTk;
+  }
+
+  bool sameTracks(const std::vector<tbeam::Track>& a, const std::vector<tbeam::Track>& b) {
+    if(a.size() != b.size())  return false;
+    for(unsigned int i = 0; i < a.size(); i++)
+      if(a[i].trkIndex != b[i].trkIndex || a[i].xPos != b[i].xPos || a[i].yPos != b[i].yPos ||
+         a[i].dxdz != b[i].dxdz || a[i].dydz != b[i].dydz || a[i].chi2 != b[i].chi2 || a[i].ndof != b[i].ndof)  return false;
+    return true;
+  }
+
+  bool sameTracks(const std::vector<tbeam::Track>& a, const TrackDuplicateFilter::Tracks& b) {
+    if(a.size() != b.size())  return false;
+    for(unsigned int i = 0; i < a.size(); i++)
+      if(a[i].trkIndex != b.index[i] || a[i].xPos != b.x[i] || a[i].yPos != b.y[i] ||
+         a[i].dxdz != b.dxdz[i] || a[i].dydz != b.dydz[i] || a[i].chi2 != b.chi2[i] || a[i].ndof != b.ndof[i])  return false;
+    return true;
+  }
+}
+
+int main( int argc,char* argv[] ){
+
+  ArgvParser cmd;
+  cmd.setIntroductoryDescription( "Benchmark of the telescope track duplicate removal" );
+  cmd.setHelpOption( "h", "help", "Print this help page" );
+  cmd.addErrorCode( 0, "Success" );
+  cmd.addErrorCode( 1, "Error" );
+  cmd.defineOption( "nEvents", "Events generated per track multiplicity. Default=2000", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "dupFraction", "Fraction of tracks copied from an earlier one. Default=0.2", ArgvParser::OptionRequiresValue);
+  cmd.defineOption( "seed", "Random seed. Default=1", ArgvParser::OptionRequiresValue);
+
+  int result = cmd.parse( argc, argv );
+  if (result != ArgvParser::NoParserError)
+  {
+    cout << cmd.parseErrorDescription(result);
+    exit(1);
+  }
+  unsigned int nEvents = ( cmd.foundOption( "nEvents" ) ) ? atoi(cmd.optionValue( "nEvents" ).c_str()) : 2000;
+  double dupFraction = ( cmd.foundOption( "dupFraction" ) ) ? atof(cmd.optionValue( "dupFraction" ).c_str()) : 0.2;
+  unsigned int seed = ( cmd.foundOption( "seed" ) ) ? atoi(cmd.optionValue( "seed" ).c_str()) : 1;
+
+  const unsigned int nTkList[] = {1, 2, 5, 10, 20, 50, 100, 150, 200};
+  std::mt19937 rng(seed);
+  std::vector<tbeam::TelescopeEvent> events(nEvents);
+  std::vector<tbeam::Track> ref, tk;
+  TrackDuplicateFilter filter;
+  TrackDuplicateFilter::Tracks cols;
+  unsigned long nMismatch = 0;
+
+  cout << std::setw(8) << "nTracks" << std::setw(16) << "pairwise(ns)" << std::setw(16) << "sorted(ns)"
+       << std::setw(16) << "sorted SoA(ns)" << std::setw(12) << "speedup" << endl;
+  for(auto nTk : nTkList) {
+    for(auto& ev : events)  generateEvent(rng, nTk, dupFraction, ev);
+    //correctness first
+    for(auto& ev : events) {
+      ref.clear();
+      tk.clear();
+      removeTrackDuplicatesPairwise(&ev, ref);
+      Utility::removeTrackDuplicates(&ev, tk);
+      filter.run(ev, cols);
+      if(!sameTracks(ref, tk) || !sameTracks(ref, cols))  nMismatch++;
+    }
+    //then timing, ns per event
+    unsigned long nKept = 0;
+    Clock::time_point t0 = Clock::now();
+    for(auto& ev : events) {
+      ref.clear();
+      removeTrackDuplicatesPairwise(&ev, ref);
+      nKept += ref.size();
+    }
+    Clock::time_point t1 = Clock::now();
+    for(auto& ev : events) {
+      tk.clear();
+      Utility::removeTrackDuplicates(&ev, tk);
+      nKept += tk.size();
+    }
+    Clock::time_point t2 = Clock::now();
+    for(auto& ev : events) {
+      filter.run(ev, cols);
+      nKept += cols.size();
+    }
+    Clock::time_point t3 = Clock::now();
+    double tRef = std::chrono::duration<double, std::nano>(t1 - t0).count()/nEvents;
+    double tGrid = std::chrono::duration<double, std::nano>(t2 - t1).count()/nEvents;
+    double tSoA = std::chrono::duration<double, std::nano>(t3 - t2).count()/nEvents;
+    cout << std::setw(8) << nTk << std::fixed << std::setprecision(0) << std::setw(16) << tRef << std::setw(16) << tGrid
+         << std::setw(16) << tSoA << std::setprecision(2) << std::setw(12) << (tSoA > 0. ? tRef/tSoA : 0.)
+         << "  (kept " << nKept/3 << ")" << endl;
+  }
+  if(nMismatch) {
+    cerr << nMismatch << " events with a different output than the pairwise loop!" << endl;
+    return 1;
+  }
+  cout << "All outputs identical to the pairwise loop" << endl;
+  return 0;
+}